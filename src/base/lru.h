@@ -25,6 +25,56 @@
 #include "pth.h"
 
 
+/* Usage statistics of a cache. The counters are cumulative; the difference
+ * of two snapshots gives the statistics of the time between them. */
+class cache_stats
+{
+public:
+    unsigned long long hits;            // requested elements that were available
+    unsigned long long misses;          // requested elements that were not available
+    unsigned long long inserts;         // new elements
+    unsigned long long evictions;       // elements removed to meet the size limit
+    unsigned long long evicted_size;    // size of these elements, in cache size units
+
+    cache_stats() : hits(0), misses(0), inserts(0), evictions(0), evicted_size(0)
+    {
+    }
+
+    cache_stats operator-(const cache_stats& s) const
+    {
+        cache_stats r;
+        r.hits = hits - s.hits;
+        r.misses = misses - s.misses;
+        r.inserts = inserts - s.inserts;
+        r.evictions = evictions - s.evictions;
+        r.evicted_size = evicted_size - s.evicted_size;
+        return r;
+    }
+
+    cache_stats& operator+=(const cache_stats& s)
+    {
+        hits += s.hits;
+        misses += s.misses;
+        inserts += s.inserts;
+        evictions += s.evictions;
+        evicted_size += s.evicted_size;
+        return *this;
+    }
+
+    float hit_ratio() const
+    {
+        return (hits + misses > 0 ? static_cast<float>(hits) / (hits + misses) : 0.0f);
+    }
+};
+
+/* Types of cache accesses, reported to lru_cache::observe_access(). */
+enum cache_access
+{
+    cache_access_hit,           // get() found the element
+    cache_access_miss,          // get() did not find the element
+    cache_access_put            // put() inserted or replaced the element
+};
+
 template<typename ELEMENT_TYPE, typename KEY_TYPE, bool AUTO_SHRINK = true>
 class lru_cache
 {
@@ -50,6 +100,7 @@ private:
     unsigned long long _timestamp;                              // current timestamp (assumed to not wrap around)
     std::map<KEY_TYPE, value> _element_map;                     // cache elements
     std::map<unsigned long long, KEY_TYPE> _timestamp_map;      // cache timestamps
+    cache_stats _stats;                                         // usage statistics
 
     mutex _mutex;                                               // Mutex for locked access
 
@@ -60,8 +111,10 @@ private:
         typename std::map<KEY_TYPE, value>::iterator element_it = _element_map.find(timestamp_it->second);
         assert(element_it != _element_map.end());
         delete element_it->second.element;
-        _size -= element_it->second.size;
-        _size -= _overhead_size;
+        size_t element_size = (element_it->second.size == 0 ? 1 : element_it->second.size + _overhead_size);
+        _size -= element_size;
+        atomic::inc_and_fetch(&_stats.evictions);
+        atomic::add_and_fetch(&_stats.evicted_size, static_cast<unsigned long long>(element_size));
         _element_map.erase(element_it);
         _timestamp_map.erase(timestamp_it);
     }
@@ -75,9 +128,16 @@ protected:
         return false;
     }
 
+    // Implement this if you want to observe all accesses to the cache, e.g. for tracing.
+    // It is called with the cache in the state before the access.
+    virtual void observe_access(const KEY_TYPE& /* key */, enum cache_access /* access */, size_t /* size */)
+    {
+    }
+
 public:
-    lru_cache(size_t max_size) :
-        _max_size(max_size), _size(0), _timestamp(0)
+    // The optional name identifies the cache in mutex contention profiles.
+    lru_cache(size_t max_size, const char* name = NULL) :
+        _max_size(max_size), _size(0), _timestamp(0), _mutex(name)
     {
     }
 
@@ -90,12 +150,16 @@ public:
     {
         typename std::map<KEY_TYPE, value>::iterator element_it = _element_map.find(key);
         if (element_it == _element_map.end()) {
+            atomic::inc_and_fetch(&_stats.misses);
+            observe_access(key, cache_access_miss, 0);
             ELEMENT_TYPE* element = NULL;
             size_t element_size;
             if (fetch_element(key, &element, &element_size))
                 put(key, element, element_size);
             return element;
         } else {
+            atomic::inc_and_fetch(&_stats.hits);
+            observe_access(key, cache_access_hit, element_it->second.size);
             unsigned long long old_timestamp = element_it->second.timestamp;
             unsigned long long new_timestamp = atomic::inc_and_fetch(&_timestamp);
             typename std::map<unsigned long long, KEY_TYPE>::iterator timestamp_it = _timestamp_map.find(old_timestamp);
@@ -107,10 +171,12 @@ public:
         }
     }
 
-    const ELEMENT_TYPE* locked_get(const KEY_TYPE& key)
+    // The locked_* variants take the mutex. Their file and line arguments
+    // identify the caller for lock contention profiling (see mutex::lock()).
+    const ELEMENT_TYPE* locked_get(const KEY_TYPE& key, const char* file = PTH_CALLER_FILE, int line = PTH_CALLER_LINE)
     {
         const ELEMENT_TYPE* element;
-        _mutex.lock();
+        _mutex.lock(file, line);
         try {
             element = get(key);
         }
@@ -124,11 +190,13 @@ public:
 
     void put(const KEY_TYPE& key, const ELEMENT_TYPE* element, size_t size = 0)
     {
+        observe_access(key, cache_access_put, size);
         unsigned long long new_timestamp = atomic::inc_and_fetch(&_timestamp);
         typename std::map<KEY_TYPE, value>::iterator element_it = _element_map.find(key);
         if (element_it == _element_map.end()) {
             _element_map.insert(std::pair<KEY_TYPE, value>(key, value(new_timestamp, size, element)));
             _timestamp_map.insert(std::pair<unsigned long long, KEY_TYPE>(new_timestamp, key));
+            atomic::inc_and_fetch(&_stats.inserts);
             if (size == 0) {
                 // Count number of elements
                 _size += 1;
@@ -150,9 +218,9 @@ public:
         }
     }
 
-    void locked_put(const KEY_TYPE& key, const ELEMENT_TYPE* element, size_t size = 0)
+    void locked_put(const KEY_TYPE& key, const ELEMENT_TYPE* element, size_t size = 0, const char* file = PTH_CALLER_FILE, int line = PTH_CALLER_LINE)
     {
-        _mutex.lock();
+        _mutex.lock(file, line);
         try {
             put(key, element, size);
         }
@@ -173,9 +241,9 @@ public:
         _size = 0;
     }
 
-    void locked_clear()
+    void locked_clear(const char* file = PTH_CALLER_FILE, int line = PTH_CALLER_LINE)
     {
-        _mutex.lock();
+        _mutex.lock(file, line);
         try {
             clear();
         }
@@ -186,6 +254,22 @@ public:
         _mutex.unlock();
     }
 
+    size_t size() const
+    {
+        return _size;
+    }
+
+    size_t max_size() const
+    {
+        return _max_size;
+    }
+
+    // Get a snapshot of the usage statistics.
+    cache_stats stats() const
+    {
+        return _stats;
+    }
+
     void set_max_size(size_t max_size)
     {
         _max_size = max_size;
@@ -193,9 +277,9 @@ public:
             shrink();
     }
 
-    void locked_set_max_size(size_t max_size)
+    void locked_set_max_size(size_t max_size, const char* file = PTH_CALLER_FILE, int line = PTH_CALLER_LINE)
     {
-        _mutex.lock();
+        _mutex.lock(file, line);
         try {
             set_max_size(max_size);
         }
@@ -213,9 +297,9 @@ public:
         }
     }
 
-    void locked_shrink()
+    void locked_shrink(const char* file = PTH_CALLER_FILE, int line = PTH_CALLER_LINE)
     {
-        _mutex.lock();
+        _mutex.lock(file, line);
         try {
             shrink();
         }
@@ -240,10 +324,10 @@ public:
         return true;
     }
 
-    bool locked_check()
+    bool locked_check(const char* file = PTH_CALLER_FILE, int line = PTH_CALLER_LINE)
     {
         bool r;
-        _mutex.lock();
+        _mutex.lock(file, line);
         try {
             r = check();
         }
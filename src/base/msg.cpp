@@ -21,16 +21,23 @@
 #include <limits>
 #include <cstdlib>
 #include <cstdio>
+#include <cstring>
+#include <cstddef>
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+#include <pthread.h>
 
 #include "dbg.h"
 #include "str.h"
+#include "pth.h"
 #include "msg.h"
 
 
 namespace msg
 {
     static FILE *_file = stderr;
-    static level_t _level = WRN;
+    level_t _level = WRN;
     static int _columns = 80;
     static std::string _program_name("");
     static std::string _category_name("");
@@ -107,6 +114,8 @@ namespace msg
 
     /* Print messages */
 
+    static void vmsg(int indent, level_t level, bool txt, const char *format, va_list args);
+
     static std::string prefix(level_t level)
     {
         static const char *_level_prefixes[] = { "[dbg] ", "[inf] ", "[wrn] ", "[err] ", "" };
@@ -129,13 +138,8 @@ namespace msg
         }
     }
 
-    void msg(int indent, level_t level, const std::string &s)
+    static void write(int indent, level_t level, const std::string &s)
     {
-        if (level < _level)
-        {
-            return;
-        }
-
         std::string out = prefix(level) + std::string(indent, ' ') + s.c_str() + '\n';
         std::fputs(out.c_str(), _file);
     }
@@ -147,21 +151,14 @@ namespace msg
             return;
         }
 
-        std::string s;
         va_list args;
         va_start(args, format);
-        s = str::vasprintf(format, args);
+        vmsg(indent, level, false, format, args);
         va_end(args);
-        msg(indent, level, s);
     }
 
-    void msg_txt(int indent, level_t level, const std::string &s)
+    static void write_txt(int indent, level_t level, const std::string &s)
     {
-        if (level < _level)
-        {
-            return;
-        }
-
         std::wstring pfx = str::to_wstr(prefix(level) + std::string(indent, ' '));
         size_t pfx_dw = str::display_width(pfx);
         std::wstring text = str::to_wstr(s);
@@ -230,6 +227,538 @@ namespace msg
         std::fprintf(_file, "%ls", &(out[0]));
     }
 
+    /* Asynchronous output */
+
+    // The kinds of arguments that can be captured
+    enum async_arg_kind
+    {
+        ak_none,        // "%%"
+        ak_int,
+        ak_long,
+        ak_llong,
+        ak_size,
+        ak_intmax,
+        ak_ptrdiff,
+        ak_double,
+        ak_ptr,
+        ak_str          // stored in the strings area of the record
+    };
+
+    static const int _async_max_args = 16;
+    static const size_t _async_record_size = 512;
+    static const unsigned long _async_ring_size = 512;
+
+    struct async_record_header
+    {
+        unsigned long long seq;         // global sequence number
+        const char *format;
+        int indent;
+        unsigned char level;
+        bool txt;
+        unsigned char args;
+        unsigned char kinds[_async_max_args];
+        union
+        {
+            long long i;
+            double d;
+            const void *p;
+            size_t offset;
+        } values[_async_max_args];
+    };
+
+    struct async_record
+    {
+        struct async_record_header h;
+        char strings[_async_record_size - sizeof(struct async_record_header)];
+    };
+
+    // A single-producer single-consumer ring buffer. Only the owning thread
+    // advances head, and only the output thread advances tail.
+    struct async_ring
+    {
+        volatile unsigned long head;
+        volatile unsigned long tail;
+        volatile bool orphaned;         // the owning thread has exited
+        struct async_record records[_async_ring_size];
+    };
+
+    class async_writer : public thread
+    {
+    public:
+        volatile bool stop_request;
+        async_writer() : stop_request(false) {}
+        void run();
+    };
+
+    static volatile bool _async_active = false;
+    static pthread_key_t _async_key;
+    static bool _async_key_created = false;
+    static pthread_mutex_t _async_rings_mutex = PTHREAD_MUTEX_INITIALIZER;
+    static std::vector<struct async_ring *> _async_rings;
+    static async_writer *_async_writer = NULL;
+    // The output thread sleeps on _async_wake_cond while there is nothing to
+    // print; flush() sleeps on _async_done_cond until its messages are printed.
+    static pthread_mutex_t _async_wake_mutex = PTHREAD_MUTEX_INITIALIZER;
+    static pthread_cond_t _async_wake_cond = PTHREAD_COND_INITIALIZER;
+    static pthread_cond_t _async_done_cond = PTHREAD_COND_INITIALIZER;
+    static volatile bool _async_writer_idle = false;
+    static unsigned long long _async_seq = 0;           // messages captured
+    static unsigned long long _async_done = 0;          // messages printed
+    static unsigned long long _async_dropped = 0;
+
+    static void async_ring_orphan(void *p)
+    {
+        static_cast<struct async_ring *>(p)->orphaned = true;
+    }
+
+    static struct async_ring *async_this_ring()
+    {
+        struct async_ring *r = static_cast<struct async_ring *>(pthread_getspecific(_async_key));
+        if (!r)
+        {
+            r = new struct async_ring;
+            r->head = 0;
+            r->tail = 0;
+            r->orphaned = false;
+            pthread_mutex_lock(&_async_rings_mutex);
+            _async_rings.push_back(r);
+            pthread_mutex_unlock(&_async_rings_mutex);
+            pthread_setspecific(_async_key, r);
+        }
+        return r;
+    }
+
+    // Parse the conversion specification that starts at f (which points to
+    // a '%'). Return a pointer to the character following it, or NULL if it
+    // is not supported.
+    static const char *parse_conversion(const char *f, enum async_arg_kind *kind)
+    {
+        const char *p = f + 1;
+        if (*p == '%')
+        {
+            *kind = ak_none;
+            return p + 1;
+        }
+        while (*p && std::strchr("-+ #0'", *p))
+            p++;
+        if (*p == '*')
+            return NULL;
+        while (*p >= '0' && *p <= '9')
+            p++;
+        if (*p == '.')
+        {
+            p++;
+            if (*p == '*')
+                return NULL;
+            while (*p >= '0' && *p <= '9')
+                p++;
+        }
+        enum async_arg_kind int_kind = ak_int;
+        bool long_mod = false;
+        if (p[0] == 'h')
+        {
+            p += (p[1] == 'h' ? 2 : 1);
+        }
+        else if (p[0] == 'l' && p[1] == 'l')
+        {
+            int_kind = ak_llong;
+            p += 2;
+        }
+        else if (p[0] == 'l')
+        {
+            int_kind = ak_long;
+            long_mod = true;
+            p++;
+        }
+        else if (p[0] == 'q')
+        {
+            int_kind = ak_llong;
+            p++;
+        }
+        else if (p[0] == 'z')
+        {
+            int_kind = ak_size;
+            p++;
+        }
+        else if (p[0] == 'j')
+        {
+            int_kind = ak_intmax;
+            p++;
+        }
+        else if (p[0] == 't')
+        {
+            int_kind = ak_ptrdiff;
+            p++;
+        }
+        else if (p[0] == 'L')
+        {
+            return NULL;
+        }
+        if (*p == '\0')
+            return NULL;
+        if (std::strchr("diouxX", *p))
+            *kind = int_kind;
+        else if (*p == 'c' && !long_mod)
+            *kind = ak_int;
+        else if (std::strchr("eEfFgGaA", *p))
+            *kind = ak_double;
+        else if (*p == 's' && !long_mod)
+            *kind = ak_str;
+        else if (*p == 'p')
+            *kind = ak_ptr;
+        else
+            return NULL;
+        return p + 1;
+    }
+
+    // Capture a message into the ring buffer of the calling thread. Return
+    // false if it cannot be captured; in this case, args is in an undefined
+    // state.
+    static bool async_capture(int indent, level_t level, bool txt, const char *format, va_list args)
+    {
+        struct async_ring *r = async_this_ring();
+        if (r->head - r->tail >= _async_ring_size)
+        {
+            atomic::inc_and_fetch(&_async_dropped);
+            return true;
+        }
+        struct async_record &rec = r->records[r->head % _async_ring_size];
+        size_t strings_size = 0;
+        int n = 0;
+        for (const char *f = std::strchr(format, '%'); f; f = std::strchr(f, '%'))
+        {
+            enum async_arg_kind kind;
+            f = parse_conversion(f, &kind);
+            if (!f)
+                return false;
+            if (kind == ak_none)
+                continue;
+            if (n == _async_max_args)
+                return false;
+            rec.h.kinds[n] = kind;
+            switch (kind)
+            {
+            case ak_int:
+                rec.h.values[n].i = va_arg(args, int);
+                break;
+            case ak_long:
+                rec.h.values[n].i = va_arg(args, long);
+                break;
+            case ak_llong:
+                rec.h.values[n].i = va_arg(args, long long);
+                break;
+            case ak_size:
+                rec.h.values[n].i = va_arg(args, size_t);
+                break;
+            case ak_intmax:
+                rec.h.values[n].i = va_arg(args, intmax_t);
+                break;
+            case ak_ptrdiff:
+                rec.h.values[n].i = va_arg(args, ptrdiff_t);
+                break;
+            case ak_double:
+                rec.h.values[n].d = va_arg(args, double);
+                break;
+            case ak_ptr:
+                rec.h.values[n].p = va_arg(args, void *);
+                break;
+            case ak_str:
+                {
+                    const char *str = va_arg(args, const char *);
+                    if (!str)
+                        str = "(null)";
+                    size_t len = std::strlen(str) + 1;
+                    if (strings_size + len > sizeof(rec.strings))
+                        return false;
+                    std::memcpy(rec.strings + strings_size, str, len);
+                    rec.h.values[n].offset = strings_size;
+                    strings_size += len;
+                }
+                break;
+            case ak_none:
+                break;
+            }
+            n++;
+        }
+        rec.h.format = format;
+        rec.h.indent = indent;
+        rec.h.level = level;
+        rec.h.txt = txt;
+        rec.h.args = n;
+        rec.h.seq = atomic::inc_and_fetch(&_async_seq);
+        __sync_synchronize();
+        r->head = r->head + 1;
+        // Wake the output thread if it sleeps. It sets the idle flag before it
+        // checks for pending messages, so either it sees this message or we
+        // see the flag.
+        __sync_synchronize();
+        if (_async_writer_idle)
+        {
+            pthread_mutex_lock(&_async_wake_mutex);
+            pthread_cond_signal(&_async_wake_cond);
+            pthread_mutex_unlock(&_async_wake_mutex);
+        }
+        return true;
+    }
+
+    static std::string async_format(const struct async_record &rec)
+    {
+        std::string s;
+        const char *f = rec.h.format;
+        int n = 0;
+        while (*f)
+        {
+            const char *c = std::strchr(f, '%');
+            if (!c)
+            {
+                s.append(f);
+                break;
+            }
+            s.append(f, c - f);
+            enum async_arg_kind kind;
+            f = parse_conversion(c, &kind);
+            std::string spec(c, f - c);
+            switch (kind)
+            {
+            case ak_none:
+                s += '%';
+                break;
+            case ak_int:
+                s += str::asprintf(spec.c_str(), static_cast<int>(rec.h.values[n].i));
+                break;
+            case ak_long:
+                s += str::asprintf(spec.c_str(), static_cast<long>(rec.h.values[n].i));
+                break;
+            case ak_llong:
+                s += str::asprintf(spec.c_str(), rec.h.values[n].i);
+                break;
+            case ak_size:
+                s += str::asprintf(spec.c_str(), static_cast<size_t>(rec.h.values[n].i));
+                break;
+            case ak_intmax:
+                s += str::asprintf(spec.c_str(), static_cast<intmax_t>(rec.h.values[n].i));
+                break;
+            case ak_ptrdiff:
+                s += str::asprintf(spec.c_str(), static_cast<ptrdiff_t>(rec.h.values[n].i));
+                break;
+            case ak_double:
+                s += str::asprintf(spec.c_str(), rec.h.values[n].d);
+                break;
+            case ak_ptr:
+                s += str::asprintf(spec.c_str(), rec.h.values[n].p);
+                break;
+            case ak_str:
+                s += str::asprintf(spec.c_str(), rec.strings + rec.h.values[n].offset);
+                break;
+            }
+            if (kind != ak_none)
+                n++;
+        }
+        return s;
+    }
+
+    struct async_message
+    {
+        unsigned long long seq;
+        int indent;
+        level_t level;
+        bool txt;
+        std::string text;
+
+        bool operator<(const async_message &m) const
+        {
+            return seq < m.seq;
+        }
+    };
+
+    void async_writer::run()
+    {
+        std::vector<struct async_message> messages;
+        unsigned long long reported_dropped = 0;
+        for (;;)
+        {
+            // Take all pending messages from all rings. Messages of different
+            // threads are ordered by their sequence number.
+            messages.clear();
+            pthread_mutex_lock(&_async_rings_mutex);
+            for (size_t i = 0; i < _async_rings.size(); i++)
+            {
+                struct async_ring *r = _async_rings[i];
+                unsigned long head = r->head;
+                __sync_synchronize();
+                while (r->tail != head)
+                {
+                    const struct async_record &rec = r->records[r->tail % _async_ring_size];
+                    struct async_message m;
+                    m.seq = rec.h.seq;
+                    m.indent = rec.h.indent;
+                    m.level = static_cast<level_t>(rec.h.level);
+                    m.txt = rec.h.txt;
+                    m.text = async_format(rec);
+                    messages.push_back(m);
+                    __sync_synchronize();
+                    r->tail = r->tail + 1;
+                }
+                if (r->orphaned && r->tail == r->head)
+                {
+                    delete r;
+                    _async_rings.erase(_async_rings.begin() + i);
+                    i--;
+                }
+            }
+            pthread_mutex_unlock(&_async_rings_mutex);
+            std::sort(messages.begin(), messages.end());
+            for (size_t i = 0; i < messages.size(); i++)
+            {
+                if (messages[i].txt)
+                    write_txt(messages[i].indent, messages[i].level, messages[i].text);
+                else
+                    write(messages[i].indent, messages[i].level, messages[i].text);
+                atomic::inc_and_fetch(&_async_done);
+            }
+            if (_async_dropped != reported_dropped)
+            {
+                write(0, WRN, str::asprintf("%llu messages dropped because the log buffer was full",
+                            _async_dropped - reported_dropped));
+                reported_dropped = _async_dropped;
+            }
+            if (!messages.empty())
+            {
+                pthread_mutex_lock(&_async_wake_mutex);
+                pthread_cond_broadcast(&_async_done_cond);
+                pthread_mutex_unlock(&_async_wake_mutex);
+            }
+            else
+            {
+                if (stop_request)
+                    break;
+                pthread_mutex_lock(&_async_wake_mutex);
+                _async_writer_idle = true;
+                __sync_synchronize();
+                if (_async_done == _async_seq && !stop_request)
+                    pthread_cond_wait(&_async_wake_cond, &_async_wake_mutex);
+                _async_writer_idle = false;
+                pthread_mutex_unlock(&_async_wake_mutex);
+            }
+        }
+    }
+
+    void start_async()
+    {
+        if (_async_active)
+            return;
+        if (!_async_key_created)
+        {
+            if (pthread_key_create(&_async_key, async_ring_orphan) != 0)
+                return;
+            _async_key_created = true;
+        }
+        _async_writer = new async_writer;
+        _async_writer->start();
+        _async_active = true;
+    }
+
+    void stop_async()
+    {
+        if (!_async_active)
+            return;
+        flush();
+        _async_active = false;
+        pthread_mutex_lock(&_async_wake_mutex);
+        _async_writer->stop_request = true;
+        pthread_cond_signal(&_async_wake_cond);
+        pthread_mutex_unlock(&_async_wake_mutex);
+        _async_writer->wait();
+        delete _async_writer;
+        _async_writer = NULL;
+    }
+
+    bool async()
+    {
+        return _async_active;
+    }
+
+    void flush()
+    {
+        if (!_async_active)
+            return;
+        unsigned long long seq = _async_seq;
+        pthread_mutex_lock(&_async_wake_mutex);
+        while (_async_done < seq)
+            pthread_cond_wait(&_async_done_cond, &_async_wake_mutex);
+        pthread_mutex_unlock(&_async_wake_mutex);
+    }
+
+    static void vmsg(int indent, level_t level, bool txt, const char *format, va_list args)
+    {
+        if (level < _level)
+        {
+            return;
+        }
+
+        if (_async_active && level < WRN)
+        {
+            va_list args_copy;
+            va_copy(args_copy, args);
+            bool captured = async_capture(indent, level, txt, format, args_copy);
+            va_end(args_copy);
+            if (captured)
+            {
+                return;
+            }
+        }
+        std::string s = str::vasprintf(format, args);
+        if (txt)
+            msg_txt(indent, level, s);
+        else
+            msg(indent, level, s);
+    }
+
+    static bool async_capture_string(int indent, level_t level, bool txt, const char *format, ...)
+    {
+        va_list args;
+        va_start(args, format);
+        bool captured = async_capture(indent, level, txt, format, args);
+        va_end(args);
+        return captured;
+    }
+
+    void msg(int indent, level_t level, const std::string &s)
+    {
+        if (level < _level)
+        {
+            return;
+        }
+
+        if (_async_active)
+        {
+            if (level < WRN && async_capture_string(indent, level, false, "%s", s.c_str()))
+            {
+                return;
+            }
+            flush();
+        }
+        write(indent, level, s);
+    }
+
+    void msg_txt(int indent, level_t level, const std::string &s)
+    {
+        if (level < _level)
+        {
+            return;
+        }
+
+        if (_async_active)
+        {
+            if (level < WRN && async_capture_string(indent, level, true, "%s", s.c_str()))
+            {
+                return;
+            }
+            flush();
+        }
+        write_txt(indent, level, s);
+    }
+
     void msg_txt(int indent, level_t level, const char *format, ...)
     {
         if (level < _level)
@@ -237,12 +766,10 @@ namespace msg
             return;
         }
 
-        std::string s;
         va_list args;
         va_start(args, format);
-        s = str::vasprintf(format, args);
+        vmsg(indent, level, true, format, args);
         va_end(args);
-        msg_txt(indent, level, s);
     }
 
     void msg(level_t level, const std::string &s)
@@ -262,12 +789,10 @@ namespace msg
             return;
         }
 
-        std::string s;
         va_list args;
         va_start(args, format);
-        s = str::vasprintf(format, args);
+        vmsg(0, level, false, format, args);
         va_end(args);
-        msg(0, level, s);
     }
 
     void msg_txt(level_t level, const std::string &s)
@@ -287,12 +812,10 @@ namespace msg
             return;
         }
 
-        std::string s;
         va_list args;
         va_start(args, format);
-        s = str::vasprintf(format, args);
+        vmsg(0, level, true, format, args);
         va_end(args);
-        msg_txt(0, level, s);
     }
 
 #ifndef NDEBUG
@@ -313,12 +836,10 @@ namespace msg
             return;
         }
 
-        std::string s;
         va_list args;
         va_start(args, format);
-        s = str::vasprintf(format, args);
+        vmsg(indent, DBG, false, format, args);
         va_end(args);
-        msg(indent, DBG, s);
     }
 
     void dbg_txt(int indent, const std::string &s)
@@ -338,12 +859,10 @@ namespace msg
             return;
         }
 
-        std::string s;
         va_list args;
         va_start(args, format);
-        s = str::vasprintf(format, args);
+        vmsg(indent, DBG, true, format, args);
         va_end(args);
-        msg_txt(indent, DBG, s);
     }
 
     void dbg(const std::string &s)
@@ -363,12 +882,10 @@ namespace msg
             return;
         }
 
-        std::string s;
         va_list args;
         va_start(args, format);
-        s = str::vasprintf(format, args);
+        vmsg(0, DBG, false, format, args);
         va_end(args);
-        msg(0, DBG, s);
     }
 
     void dbg_txt(const std::string &s)
@@ -388,12 +905,10 @@ namespace msg
             return;
         }
 
-        std::string s;
         va_list args;
         va_start(args, format);
-        s = str::vasprintf(format, args);
+        vmsg(0, DBG, true, format, args);
         va_end(args);
-        msg_txt(0, DBG, s);
     }
 #endif
 
@@ -414,12 +929,10 @@ namespace msg
             return;
         }
 
-        std::string s;
         va_list args;
         va_start(args, format);
-        s = str::vasprintf(format, args);
+        vmsg(indent, INF, false, format, args);
         va_end(args);
-        msg(indent, INF, s);
     }
 
     void inf_txt(int indent, const std::string &s)
@@ -439,12 +952,10 @@ namespace msg
             return;
         }
 
-        std::string s;
         va_list args;
         va_start(args, format);
-        s = str::vasprintf(format, args);
+        vmsg(indent, INF, true, format, args);
         va_end(args);
-        msg_txt(indent, INF, s);
     }
 
     void inf(const std::string &s)
@@ -464,12 +975,10 @@ namespace msg
             return;
         }
 
-        std::string s;
         va_list args;
         va_start(args, format);
-        s = str::vasprintf(format, args);
+        vmsg(0, INF, false, format, args);
         va_end(args);
-        msg(0, INF, s);
     }
 
     void inf_txt(const std::string &s)
@@ -489,12 +998,10 @@ namespace msg
             return;
         }
 
-        std::string s;
         va_list args;
         va_start(args, format);
-        s = str::vasprintf(format, args);
+        vmsg(0, INF, true, format, args);
         va_end(args);
-        msg_txt(0, INF, s);
     }
 
     void wrn(int indent, const std::string &s)
@@ -514,12 +1021,10 @@ namespace msg
             return;
         }
 
-        std::string s;
         va_list args;
         va_start(args, format);
-        s = str::vasprintf(format, args);
+        vmsg(indent, WRN, false, format, args);
         va_end(args);
-        msg(indent, WRN, s);
     }
 
     void wrn_txt(int indent, const std::string &s)
@@ -539,12 +1044,10 @@ namespace msg
             return;
         }
 
-        std::string s;
         va_list args;
         va_start(args, format);
-        s = str::vasprintf(format, args);
+        vmsg(indent, WRN, true, format, args);
         va_end(args);
-        msg_txt(indent, WRN, s);
     }
 
     void wrn(const std::string &s)
@@ -564,12 +1067,10 @@ namespace msg
             return;
         }
 
-        std::string s;
         va_list args;
         va_start(args, format);
-        s = str::vasprintf(format, args);
+        vmsg(0, WRN, false, format, args);
         va_end(args);
-        msg(0, WRN, s);
     }
 
     void wrn_txt(const std::string &s)
@@ -589,12 +1090,10 @@ namespace msg
             return;
         }
 
-        std::string s;
         va_list args;
         va_start(args, format);
-        s = str::vasprintf(format, args);
+        vmsg(0, WRN, true, format, args);
         va_end(args);
-        msg_txt(0, WRN, s);
     }
 
     void err(int indent, const std::string &s)
@@ -614,12 +1113,10 @@ namespace msg
             return;
         }
 
-        std::string s;
         va_list args;
         va_start(args, format);
-        s = str::vasprintf(format, args);
+        vmsg(indent, ERR, false, format, args);
         va_end(args);
-        msg(indent, ERR, s);
     }
 
     void err_txt(int indent, const std::string &s)
@@ -639,12 +1136,10 @@ namespace msg
             return;
         }
 
-        std::string s;
         va_list args;
         va_start(args, format);
-        s = str::vasprintf(format, args);
+        vmsg(indent, ERR, true, format, args);
         va_end(args);
-        msg_txt(indent, ERR, s);
     }
 
     void err(const std::string &s)
@@ -664,12 +1159,10 @@ namespace msg
             return;
         }
 
-        std::string s;
         va_list args;
         va_start(args, format);
-        s = str::vasprintf(format, args);
+        vmsg(0, ERR, false, format, args);
         va_end(args);
-        msg(0, ERR, s);
     }
 
     void err_txt(const std::string &s)
@@ -689,12 +1182,10 @@ namespace msg
             return;
         }
 
-        std::string s;
         va_list args;
         va_start(args, format);
-        s = str::vasprintf(format, args);
+        vmsg(0, ERR, true, format, args);
         va_end(args);
-        msg_txt(0, ERR, s);
     }
 
     void req(int indent, const std::string &s)
@@ -704,12 +1195,10 @@ namespace msg
 
     void req(int indent, const char *format, ...)
     {
-        std::string s;
         va_list args;
         va_start(args, format);
-        s = str::vasprintf(format, args);
+        vmsg(indent, REQ, false, format, args);
         va_end(args);
-        msg(indent, REQ, s);
     }
 
     void req_txt(int indent, const std::string &s)
@@ -719,12 +1208,10 @@ namespace msg
 
     void req_txt(int indent, const char *format, ...)
     {
-        std::string s;
         va_list args;
         va_start(args, format);
-        s = str::vasprintf(format, args);
+        vmsg(indent, REQ, true, format, args);
         va_end(args);
-        msg_txt(indent, REQ, s);
     }
 
     void req(const std::string &s)
@@ -734,12 +1221,10 @@ namespace msg
 
     void req(const char *format, ...)
     {
-        std::string s;
         va_list args;
         va_start(args, format);
-        s = str::vasprintf(format, args);
+        vmsg(0, REQ, false, format, args);
         va_end(args);
-        msg(0, REQ, s);
     }
 
     void req_txt(const std::string &s)
@@ -749,11 +1234,9 @@ namespace msg
 
     void req_txt(const char *format, ...)
     {
-        std::string s;
         va_list args;
         va_start(args, format);
-        s = str::vasprintf(format, args);
+        vmsg(0, REQ, true, format, args);
         va_end(args);
-        msg_txt(0, REQ, s);
     }
 }
@@ -62,6 +62,35 @@ namespace msg
     std::string category_name();
     void set_category_name(const std::string &n);
 
+    /* Check whether messages of the given level are printed. Use this (or the
+     * MSG_DBG and MSG_INF macros below) to avoid computing the arguments of
+     * messages that would be discarded anyway. */
+    extern level_t _level;
+    inline bool enabled(level_t l)
+    {
+        return l >= _level;
+    }
+
+    /* Asynchronous output
+     *
+     * While active, messages of levels DBG and INF are not formatted by the
+     * calling thread. Instead, the format and the arguments are copied in
+     * binary form into a ring buffer of the calling thread, and a background
+     * thread formats and prints them. Messages of level WRN and above are
+     * printed immediately, after all pending messages.
+     *
+     * The format strings must stay valid, which is the case for string
+     * literals and gettext translations. Messages that do not fit into a ring
+     * buffer record, or whose format uses unsupported conversions ('*' width
+     * or precision, long double, wide characters), are printed immediately.
+     * When the ring buffer of a thread is full, its messages are dropped and
+     * counted. */
+    void start_async();
+    void stop_async();
+    bool async();
+    /* Wait until all pending messages are printed. */
+    void flush();
+
     /* Print messages */
 
     void msg(int indent, level_t level, const std::string &s);
@@ -139,4 +168,11 @@ namespace msg
     void req_txt(const char *format, ...) MSG_AFP(1, 2);
 }
 
+/* Print debug or info messages only if they are enabled, without evaluating
+ * the arguments otherwise. With NDEBUG, set_level() never enables debug
+ * messages, so MSG_DBG costs a single comparison. */
+
+#define MSG_DBG(...) do { if (msg::enabled(msg::DBG)) msg::dbg(__VA_ARGS__); } while (0)
+#define MSG_INF(...) do { if (msg::enabled(msg::INF)) msg::inf(__VA_ARGS__); } while (0)
+
 #endif
@@ -20,18 +20,219 @@
 
 #include <cerrno>
 #include <cstring>
+#include <map>
+#include <functional>
+#include <algorithm>
 #include <pthread.h>
 #include <sched.h>
 
 #include "gettext.h"
 #define _(string) gettext(string)
 
+#include "str.h"
+#include "tmr.h"
 #include "pth.h"
 
 
+namespace mutex_profiler
+{
+    class wait_stats
+    {
+    public:
+        unsigned long long count;
+        long long total;        // microseconds
+        long long max;          // microseconds
+
+        wait_stats() : count(0), total(0), max(0)
+        {
+        }
+
+        void add(long long wait)
+        {
+            count++;
+            total += wait;
+            max = std::max(max, wait);
+        }
+
+        void add(const wait_stats& s)
+        {
+            count += s.count;
+            total += s.total;
+            max = std::max(max, s.max);
+        }
+    };
+
+    // A call site as recorded. The strings are compared by address, which is
+    // cheap; sites with equal strings are merged when a report is made.
+    class site
+    {
+    public:
+        const char* name;
+        const char* file;
+        int line;
+
+        site(const char* n, const char* f, int l) : name(n), file(f), line(l)
+        {
+        }
+
+        bool operator<(const site& s) const
+        {
+            std::less<const char*> lt;
+            return lt(name, s.name) || (name == s.name && (lt(file, s.file) || (file == s.file && line < s.line)));
+        }
+    };
+
+    // Each thread accumulates its statistics separately, so that recording
+    // does not contend on a common lock. The lock of a thread_stats object is
+    // only contended by start() and report(). When a thread exits, its
+    // statistics are merged into the retired statistics.
+    class thread_stats
+    {
+    public:
+        pthread_mutex_t mutex;
+        std::map<site, wait_stats> sites;
+        unsigned long long uncontended;     // changed only with atomic operations
+    };
+
+    bool _active = false;
+    // These are plain pthread mutexes: the mutex class itself reports to the profiler.
+    static pthread_mutex_t _mutex = PTHREAD_MUTEX_INITIALIZER;  // protects the following three
+    static std::vector<thread_stats*> _threads;
+    static std::map<site, wait_stats> _retired_sites;
+    static unsigned long long _retired_uncontended = 0;
+    static pthread_key_t _key;
+    static pthread_once_t _key_once = PTHREAD_ONCE_INIT;
+
+    static void retire_thread_stats(void* p)
+    {
+        thread_stats* t = static_cast<thread_stats*>(p);
+        pthread_mutex_lock(&_mutex);
+        pthread_mutex_lock(&(t->mutex));
+        for (std::map<site, wait_stats>::const_iterator it = t->sites.begin(); it != t->sites.end(); it++)
+            _retired_sites[it->first].add(it->second);
+        _retired_uncontended += t->uncontended;
+        pthread_mutex_unlock(&(t->mutex));
+        _threads.erase(std::find(_threads.begin(), _threads.end(), t));
+        pthread_mutex_unlock(&_mutex);
+        pthread_mutex_destroy(&(t->mutex));
+        delete t;
+    }
+
+    static void create_key()
+    {
+        (void)pthread_key_create(&_key, retire_thread_stats);
+    }
+
+    static thread_stats* this_thread_stats()
+    {
+        pthread_once(&_key_once, create_key);
+        thread_stats* t = static_cast<thread_stats*>(pthread_getspecific(_key));
+        if (!t) {
+            t = new thread_stats;
+            pthread_mutex_init(&(t->mutex), NULL);
+            t->uncontended = 0;
+            pthread_mutex_lock(&_mutex);
+            _threads.push_back(t);
+            pthread_mutex_unlock(&_mutex);
+            pthread_setspecific(_key, t);
+        }
+        return t;
+    }
+
+    static bool compare_total(const std::pair<std::string, wait_stats>& a, const std::pair<std::string, wait_stats>& b)
+    {
+        return a.second.total > b.second.total;
+    }
+}
+
+void mutex_profiler::start()
+{
+    pthread_mutex_lock(&_mutex);
+    for (size_t i = 0; i < _threads.size(); i++) {
+        pthread_mutex_lock(&(_threads[i]->mutex));
+        _threads[i]->sites.clear();
+        atomic::fetch_and_and(&(_threads[i]->uncontended), 0ULL);
+        pthread_mutex_unlock(&(_threads[i]->mutex));
+    }
+    _retired_sites.clear();
+    _retired_uncontended = 0;
+    _active = true;
+    pthread_mutex_unlock(&_mutex);
+}
+
+void mutex_profiler::stop()
+{
+    _active = false;
+}
+
+void mutex_profiler::record(const char* name, const char* file, int line, long long wait_usecs)
+{
+    thread_stats* t = this_thread_stats();
+    pthread_mutex_lock(&(t->mutex));
+    t->sites[site(name, file, line)].add(wait_usecs);
+    pthread_mutex_unlock(&(t->mutex));
+}
+
+void mutex_profiler::record_uncontended()
+{
+    atomic::inc_and_fetch(&(this_thread_stats()->uncontended));
+}
+
+std::string mutex_profiler::report()
+{
+    // Collect the statistics of all threads
+    pthread_mutex_lock(&_mutex);
+    std::map<site, wait_stats> sites = _retired_sites;
+    unsigned long long uncontended = _retired_uncontended;
+    for (size_t i = 0; i < _threads.size(); i++) {
+        thread_stats* t = _threads[i];
+        pthread_mutex_lock(&(t->mutex));
+        for (std::map<site, wait_stats>::const_iterator it = t->sites.begin(); it != t->sites.end(); it++)
+            sites[it->first].add(it->second);
+        pthread_mutex_unlock(&(t->mutex));
+        uncontended += atomic::fetch_and_add(&(t->uncontended), 0ULL);
+    }
+    pthread_mutex_unlock(&_mutex);
+
+    // Merge sites by their strings
+    std::map<std::string, wait_stats> mutexes;
+    std::map<std::string, wait_stats> site_names;
+    unsigned long long contended = 0;
+    for (std::map<site, wait_stats>::const_iterator it = sites.begin(); it != sites.end(); it++) {
+        std::string name = (it->first.name ? it->first.name : "unnamed");
+        std::string where = "unknown";
+        if (it->first.file) {
+            // Strip the directory
+            const char* base = std::strrchr(it->first.file, '/');
+            where = std::string(base ? base + 1 : it->first.file) + ':' + str::from(it->first.line);
+        }
+        mutexes[name].add(it->second);
+        site_names[name + " at " + where].add(it->second);
+        contended += it->second.count;
+    }
+    std::vector<std::pair<std::string, wait_stats> > mutex_list(mutexes.begin(), mutexes.end());
+    std::vector<std::pair<std::string, wait_stats> > site_list(site_names.begin(), site_names.end());
+    std::sort(mutex_list.begin(), mutex_list.end(), compare_total);
+    std::sort(site_list.begin(), site_list.end(), compare_total);
+
+    std::string r = str::asprintf("Lock contention: %llu of %llu acquisitions had to wait (%.2f%%)\n",
+            contended, contended + uncontended,
+            contended + uncontended > 0 ? 100.0 * contended / (contended + uncontended) : 0.0);
+    for (int i = 0; i < 2; i++) {
+        const std::vector<std::pair<std::string, wait_stats> >& list = (i == 0 ? mutex_list : site_list);
+        r += str::asprintf("%-48s %10s %12s %10s\n", i == 0 ? "Mutex" : "Call site", "Waits", "Total ms", "Max ms");
+        for (size_t j = 0; j < list.size(); j++) {
+            r += str::asprintf("%-48s %10llu %12.3f %10.3f\n", list[j].first.c_str(),
+                    list[j].second.count, list[j].second.total / 1e3, list[j].second.max / 1e3);
+        }
+    }
+    return r;
+}
+
+
 const pthread_mutex_t mutex::_mutex_initializer = PTHREAD_MUTEX_INITIALIZER;
 
-mutex::mutex() : _mutex(_mutex_initializer)
+mutex::mutex(const char* name) : _mutex(_mutex_initializer), _name(name)
 {
     int e = pthread_mutex_init(&_mutex, NULL);
     if (e != 0)
@@ -39,7 +240,7 @@ mutex::mutex() : _mutex(_mutex_initializer)
                 + "pthread_mutex_init(): " + std::strerror(e), e);
 }
 
-mutex::mutex(const mutex&) : _mutex(_mutex_initializer)
+mutex::mutex(const mutex& m) : _mutex(_mutex_initializer), _name(m._name)
 {
     // You cannot have multiple copies of the same mutex.
     // Instead, we create a new one. This allows easier use of mutexes in STL containers.
@@ -54,14 +255,32 @@ mutex::~mutex()
     (void)pthread_mutex_destroy(&_mutex);
 }
 
-void mutex::lock()
+void mutex::lock(const char* file, int line)
 {
+    if (__builtin_expect(mutex_profiler::_active, false)) {
+        profiled_lock(file, line);
+        return;
+    }
     int e = pthread_mutex_lock(&_mutex);
     if (e != 0)
         throw exc(std::string(_("System function failed: "))
                 + "pthread_mutex_lock(): " + std::strerror(e), e);
 }
 
+void mutex::profiled_lock(const char* file, int line)
+{
+    if (pthread_mutex_trylock(&_mutex) == 0) {
+        mutex_profiler::record_uncontended();
+        return;
+    }
+    long long t0 = timer::get(timer::monotonic);
+    int e = pthread_mutex_lock(&_mutex);
+    if (e != 0)
+        throw exc(std::string(_("System function failed: "))
+                + "pthread_mutex_lock(): " + std::strerror(e), e);
+    mutex_profiler::record(_name, file, line, timer::get(timer::monotonic) - t0);
+}
+
 bool mutex::trylock()
 {
     return (pthread_mutex_trylock(&_mutex) == 0);
@@ -109,6 +328,21 @@ void condition::wait(mutex& m)
                 + "pthread_cond_wait(): " + std::strerror(e), e);
 }
 
+bool condition::wait(mutex& m, long long timeout_usecs)
+{
+    long long t = timer::get(timer::realtime) + timeout_usecs;
+    struct timespec abstime;
+    abstime.tv_sec = t / 1000000;
+    abstime.tv_nsec = (t % 1000000) * 1000;
+    int e = pthread_cond_timedwait(&_cond, &m._mutex, &abstime);
+    if (e == ETIMEDOUT)
+        return false;
+    if (e != 0)
+        throw exc(std::string(_("System function failed: "))
+                + "pthread_cond_timedwait(): " + std::strerror(e), e);
+    return true;
+}
+
 void condition::wake_one()
 {
     int e = pthread_cond_signal(&_cond);
@@ -134,7 +368,8 @@ thread::thread() :
     __joinable(false),
     __running(false),
     __wait_mutex(),
-    __exception()
+    __exception(),
+    __notifier(NULL)
 {
 }
 
@@ -143,7 +378,8 @@ thread::thread(const thread&) :
     __joinable(false),
     __running(false),
     __wait_mutex(),
-    __exception()
+    __exception(),
+    __notifier(NULL)
 {
     // The thread state cannot be copied; a new state is created instead.
 }
@@ -172,7 +408,11 @@ void* thread::__run(void* p)
         t->__running = false;
         throw;
     }
+    // The thread object may be destroyed as soon as it is not running anymore
+    notifier* n = t->__notifier;
     t->__running = false;
+    if (n)
+        n->notify();
     return NULL;
 }
 
@@ -249,9 +489,108 @@ void thread::cancel()
 }
 
 
-thread_group::thread_group(unsigned char size) : __max_size(size)
+thread_group_stats::thread_group_stats() :
+    started(0), rejected(0), completed(0), in_flight(0)
+{
+    for (int i = 0; i < latency_buckets; i++)
+        latency_histogram[i] = 0;
+}
+
+thread_group_stats thread_group_stats::operator-(const thread_group_stats& s) const
+{
+    thread_group_stats r;
+    r.started = started - s.started;
+    r.rejected = rejected - s.rejected;
+    r.completed = completed - s.completed;
+    r.in_flight = in_flight;
+    for (int i = 0; i < latency_buckets; i++)
+        r.latency_histogram[i] = latency_histogram[i] - s.latency_histogram[i];
+    return r;
+}
+
+thread_group_stats& thread_group_stats::operator+=(const thread_group_stats& s)
+{
+    started += s.started;
+    rejected += s.rejected;
+    completed += s.completed;
+    in_flight = s.in_flight;
+    for (int i = 0; i < latency_buckets; i++)
+        latency_histogram[i] += s.latency_histogram[i];
+    return *this;
+}
+
+void thread_group_stats::add_latency(long long usecs)
+{
+    int bucket = 0;
+    long long msecs = usecs / 1000;
+    while (msecs > 0 && bucket < latency_buckets - 1) {
+        bucket++;
+        msecs >>= 1;
+    }
+    latency_histogram[bucket]++;
+}
+
+float thread_group_stats::latency_percentile(float p) const
+{
+    unsigned long long n = 0;
+    for (int i = 0; i < latency_buckets; i++)
+        n += latency_histogram[i];
+    if (n == 0)
+        return 0.0f;
+    unsigned long long rank = static_cast<unsigned long long>(p * n + 0.5f);
+    if (rank < 1)
+        rank = 1;
+    unsigned long long sum = 0;
+    int bucket = 0;
+    for (; bucket < latency_buckets - 1; bucket++) {
+        sum += latency_histogram[bucket];
+        if (sum >= rank)
+            break;
+    }
+    return static_cast<float>(1 << bucket);
+}
+
+
+notifier::notifier() : _count(0)
+{
+}
+
+unsigned long long notifier::count()
+{
+    _mutex.lock();
+    unsigned long long c = _count;
+    _mutex.unlock();
+    return c;
+}
+
+void notifier::notify()
+{
+    _mutex.lock();
+    _count++;
+    _cond.wake_all();
+    _mutex.unlock();
+}
+
+bool notifier::wait(unsigned long long count, long long timeout_usecs)
+{
+    long long deadline = timer::get(timer::monotonic) + timeout_usecs;
+    bool r = true;
+    _mutex.lock();
+    while (_count <= count) {
+        long long remaining = deadline - timer::get(timer::monotonic);
+        if (remaining <= 0 || !_cond.wait(_mutex, remaining)) {
+            r = (_count > count);
+            break;
+        }
+    }
+    _mutex.unlock();
+    return r;
+}
+
+thread_group::thread_group(unsigned char size) : __max_size(size), __stats_mutex("thread group stats")
 {
     __active_threads.reserve(__max_size);
+    __start_times.reserve(__max_size);
     __finished_threads.reserve(__max_size);
 }
 
@@ -269,24 +608,56 @@ thread_group::~thread_group()
 bool thread_group::start(thread* t, int priority)
 {
     if (__active_threads.size() < __max_size) {
+        t->set_notifier(&completions());
         t->start(priority);
         __active_threads.push_back(t);
+        __start_times.push_back(timer::get(timer::monotonic));
+        __stats_mutex.lock();
+        __stats.started++;
+        __stats.in_flight++;
+        __stats_mutex.unlock();
         return true;
     } else {
+        __stats_mutex.lock();
+        __stats.rejected++;
+        __stats_mutex.unlock();
         return false;
     }
 }
 
+thread_group_stats thread_group::stats() const
+{
+    __stats_mutex.lock();
+    thread_group_stats s = __stats;
+    __stats_mutex.unlock();
+    return s;
+}
+
+notifier& thread_group::completions()
+{
+    static notifier n;
+    return n;
+}
+
 thread* thread_group::get_next_finished_thread()
 {
     if (__finished_threads.size() == 0) {
-        std::vector<thread*>::iterator it = __active_threads.begin();
-        while (it != __active_threads.end()) {
-            if (!(*it)->running()) {
-                __finished_threads.push_back(*it);
-                it = __active_threads.erase(it);
+        long long now = -1;
+        size_t i = 0;
+        while (i < __active_threads.size()) {
+            if (!__active_threads[i]->running()) {
+                if (now < 0)
+                    now = timer::get(timer::monotonic);
+                __stats_mutex.lock();
+                __stats.completed++;
+                __stats.in_flight--;
+                __stats.add_latency(now - __start_times[i]);
+                __stats_mutex.unlock();
+                __finished_threads.push_back(__active_threads[i]);
+                __active_threads.erase(__active_threads.begin() + i);
+                __start_times.erase(__start_times.begin() + i);
             } else {
-                it++;
+                i++;
             }
         }
     }
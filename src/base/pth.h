@@ -19,6 +19,7 @@
 #ifndef PTH_H
 #define PTH_H
 
+#include <string>
 #include <vector>
 #include <pthread.h>
 
@@ -72,6 +73,58 @@ namespace atomic
     template<typename T> T inc_and_fetch(T* ptr) { return add_and_fetch(ptr, static_cast<T>(1)); }
     template<typename T> T fetch_and_dec(T* ptr) { return fetch_and_sub(ptr, static_cast<T>(1)); }
     template<typename T> T dec_and_fetch(T* ptr) { return sub_and_fetch(ptr, static_cast<T>(1)); }
+
+    /* Full memory barrier: no memory access is moved across it, neither by
+     * the compiler nor by the processor. */
+    inline void barrier() { __sync_synchronize(); }
+}
+
+
+/*
+ * Mutex contention profiling
+ *
+ * While the profiler is active, mutex::lock() first tries to get the lock
+ * without waiting. If that fails, it measures the time spent waiting, and
+ * the profiler aggregates count, total and maximum wait time per mutex name
+ * and per call site. Each thread accumulates its own statistics; they are
+ * merged when a report is made. When the profiler is inactive, the only cost
+ * is one predictable branch per lock.
+ *
+ * Call sites are determined with GCC builtins; other compilers only get
+ * per-mutex statistics.
+ */
+
+#if defined(__GNUC__) && !defined(__clang__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 8))
+# define PTH_CALLER_FILE __builtin_FILE()
+# define PTH_CALLER_LINE __builtin_LINE()
+#else
+# define PTH_CALLER_FILE NULL
+# define PTH_CALLER_LINE 0
+#endif
+
+namespace mutex_profiler
+{
+    extern bool _active;
+
+    /* Start profiling. This resets all statistics. */
+    void start();
+    /* Stop profiling. The statistics are kept until the next start(). */
+    void stop();
+    /* Check whether profiling is active. */
+    inline bool active()
+    {
+        return _active;
+    }
+
+    /* Record a wait for a lock. This is also useful for locks that are not
+     * implemented with the mutex class, such as busy loops. The strings must
+     * stay valid until the next start(). */
+    void record(const char* name, const char* file, int line, long long wait_usecs);
+    /* Record an acquisition that did not have to wait. */
+    void record_uncontended();
+
+    /* Get a human readable report of the statistics. */
+    std::string report();
 }
 
 
@@ -84,15 +137,25 @@ class mutex
 private:
     static const pthread_mutex_t _mutex_initializer;
     pthread_mutex_t _mutex;
+    const char* _name;
+
+    void profiled_lock(const char* file, int line);
 
 public:
     // Constructor / Destructor
-    mutex();
+    mutex(const char* name = NULL);
     mutex(const mutex& m);
     ~mutex();
 
-    // Lock the mutex.
-    void lock();
+    // Set the name of this mutex for contention profiling. The string must stay valid.
+    void set_name(const char* name)
+    {
+        _name = name;
+    }
+
+    // Lock the mutex. The arguments identify the call site for contention profiling;
+    // leave them at their defaults.
+    void lock(const char* file = PTH_CALLER_FILE, int line = PTH_CALLER_LINE);
     // Try to lock the mutex. Return true on success, false otherwise.
     bool trylock();
     // Unlock the mutex
@@ -120,6 +183,9 @@ public:
 
     // Wait for the condition. The calling thread must have the mutex locked.
     void wait(mutex& m);
+    // Wait for the condition, but at most the given number of microseconds.
+    // Return false if the timeout expired.
+    bool wait(mutex& m, long long timeout_usecs);
     // Wake one thread that waits on the condition.
     void wake_one();
     // Wake all threads that wait on the condition.
@@ -127,6 +193,34 @@ public:
 };
 
 
+/*
+ * Notifier
+ *
+ * Counts events and lets threads wait for new events. To avoid missing
+ * events, get the count before checking the state that the events change,
+ * and then wait for events after that count.
+ */
+
+class notifier
+{
+private:
+    mutex _mutex;
+    condition _cond;
+    unsigned long long _count;
+
+public:
+    notifier();
+
+    // Get the number of events so far.
+    unsigned long long count();
+    // Signal an event and wake all waiting threads.
+    void notify();
+    // Wait until the number of events exceeds the given count, but at most
+    // the given number of microseconds. Return false if the timeout expired.
+    bool wait(unsigned long long count, long long timeout_usecs);
+};
+
+
 /*
  * Thread
  *
@@ -141,6 +235,7 @@ private:
     bool __running;
     mutex __wait_mutex;
     exc __exception;
+    notifier* __notifier;
 
     static void* __run(void* p);
 
@@ -161,6 +256,13 @@ public:
     // running, this function does nothing.
     void start(int priority = thread::priority_default);
 
+    // Notify the given notifier whenever run() finishes. The notifier must
+    // outlive the thread.
+    void set_notifier(notifier* n)
+    {
+        __notifier = n;
+    }
+
     // Returns whether this thread is currently running.
     bool running()
     {
@@ -191,6 +293,42 @@ public:
 };
 
 
+/*
+ * Thread group statistics.
+ *
+ * The counters are cumulative; the difference of two snapshots gives the
+ * statistics of the time between them. The latency of a thread is the time
+ * from its start until the thread group notices that it finished.
+ */
+
+class thread_group_stats
+{
+public:
+    // Latency histogram: bucket 0 counts latencies below 1 ms, bucket i > 0
+    // counts latencies in [2^(i-1), 2^i) ms, and the last bucket counts all
+    // longer latencies.
+    static const int latency_buckets = 16;
+
+    unsigned long long started;         // threads started
+    unsigned long long rejected;        // threads not started because the group was full
+    unsigned long long completed;       // threads finished
+    int in_flight;                      // threads currently running (not cumulative)
+    unsigned long long latency_histogram[latency_buckets];
+
+    thread_group_stats();
+
+    thread_group_stats operator-(const thread_group_stats& s) const;
+    // Add the counters of s; in_flight is set to that of s.
+    thread_group_stats& operator+=(const thread_group_stats& s);
+
+    // Add a latency in microseconds to the histogram.
+    void add_latency(long long usecs);
+    // Get an upper bound of the latency percentile p (in [0,1]) in milliseconds,
+    // or 0 if no thread completed.
+    float latency_percentile(float p) const;
+};
+
+
 /*
  * Thread group.
  *
@@ -207,7 +345,10 @@ class thread_group
 private:
     unsigned char __max_size;
     std::vector<thread*> __active_threads;
+    std::vector<long long> __start_times;
     std::vector<thread*> __finished_threads;
+    thread_group_stats __stats;
+    mutable mutex __stats_mutex;        // stats() may be called from other threads
 
 public:
     thread_group(unsigned char size);
@@ -221,6 +362,13 @@ public:
     // that future threads can use it. If there is no finished thread, NULL
     // is returned.
     thread* get_next_finished_thread();
+
+    // Get a snapshot of the usage statistics. This may be called from any thread.
+    thread_group_stats stats() const;
+
+    // This notifier is notified whenever a thread of any thread group finishes.
+    // Use it to wait for results instead of polling.
+    static notifier& completions();
 };
 
 #endif
@@ -28,6 +28,9 @@
 #if HAVE_SCHED_YIELD
 # include <sched.h>
 #endif
+#if HAVE_GETRUSAGE
+# include <sys/resource.h>
+#endif
 
 #if HAVE_SYSCONF && HAVE_SCHED_YIELD
 #else
@@ -76,6 +79,22 @@ int sys::processors()
     return n;
 }
 
+uintmax_t sys::peak_memory()
+{
+#if HAVE_GETRUSAGE
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+# ifdef __APPLE__
+    return usage.ru_maxrss;                         // bytes
+# else
+    return static_cast<uintmax_t>(usage.ru_maxrss) * 1024;     // kilobytes
+# endif
+#else
+    return 0;
+#endif
+}
+
 void sys::msleep(unsigned long msecs)
 {
 #if HAVE_NANOSLEEP
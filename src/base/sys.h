@@ -25,6 +25,8 @@ namespace sys
 {
     uintmax_t total_ram();
     int processors();
+    // Peak resident memory of this process in bytes, or 0 if unknown
+    uintmax_t peak_memory();
 
     void usleep(unsigned long usecs);
     void msleep(unsigned long msecs);
@@ -0,0 +1,228 @@
+/*
+ * Copyright (C) 2013
+ * Martin Lambers <marlam@marlam.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <vector>
+#include <cstdio>
+#include <pthread.h>
+
+#include "msg.h"
+#include "fio.h"
+#include "str.h"
+#include "tmr.h"
+#include "pth.h"
+#include "trc.h"
+
+
+namespace trc
+{
+    class event
+    {
+    public:
+        const char* name;
+        int track;
+        long long begin;
+        long long end;
+    };
+
+    // Each thread records into its own buffer, so that threads do not contend
+    // on a common lock while tracing. The buffer lock is only ever contended
+    // by start() and stop(). Plain pthread mutexes are used so that tracing
+    // does not show up in the mutex contention profile.
+    class thread_buffer
+    {
+    public:
+        pthread_mutex_t mutex;
+        pthread_t thread;
+        int track;
+        bool orphaned;          // the owning thread has exited
+        std::vector<event> events;
+        size_t dropped_events;
+    };
+
+    // Limit memory usage to a few dozen MiB if tracing is left on for a long time.
+    static const size_t max_events_per_thread = 1 << 18;
+
+    std::atomic<bool> _active(false);
+    static std::string _filename;
+    static long long _start_time;
+    static pthread_t _main_thread;
+    static pthread_key_t _key;
+    static pthread_once_t _key_once = PTHREAD_ONCE_INIT;
+    static pthread_mutex_t _buffers_mutex = PTHREAD_MUTEX_INITIALIZER;
+    static std::vector<thread_buffer*> _buffers;        // index + 1 is the track
+}
+
+static void orphan_buffer(void* p)
+{
+    trc::thread_buffer* b = static_cast<trc::thread_buffer*>(p);
+    pthread_mutex_lock(&(b->mutex));
+    b->orphaned = true;
+    pthread_mutex_unlock(&(b->mutex));
+}
+
+static void create_key()
+{
+    (void)pthread_key_create(&trc::_key, orphan_buffer);
+}
+
+static trc::thread_buffer* this_buffer()
+{
+    pthread_once(&trc::_key_once, create_key);
+    trc::thread_buffer* b = static_cast<trc::thread_buffer*>(pthread_getspecific(trc::_key));
+    if (!b) {
+        b = new trc::thread_buffer;
+        pthread_mutex_init(&(b->mutex), NULL);
+        b->thread = pthread_self();
+        b->orphaned = false;
+        b->dropped_events = 0;
+        pthread_mutex_lock(&trc::_buffers_mutex);
+        // Reuse the track of a thread that has exited
+        b->track = 0;
+        for (size_t i = 0; i < trc::_buffers.size(); i++) {
+            if (!trc::_buffers[i]) {
+                trc::_buffers[i] = b;
+                b->track = i + 1;
+                break;
+            }
+        }
+        if (b->track == 0) {
+            trc::_buffers.push_back(b);
+            b->track = trc::_buffers.size();
+        }
+        pthread_mutex_unlock(&trc::_buffers_mutex);
+        pthread_setspecific(trc::_key, b);
+    }
+    return b;
+}
+
+void trc::start(const std::string& filename)
+{
+    pthread_mutex_lock(&_buffers_mutex);
+    _filename = filename;
+    _main_thread = pthread_self();
+    for (size_t i = 0; i < _buffers.size(); i++) {
+        thread_buffer* b = _buffers[i];
+        if (!b)
+            continue;
+        pthread_mutex_lock(&(b->mutex));
+        b->events.clear();
+        b->dropped_events = 0;
+        bool orphaned = b->orphaned;
+        pthread_mutex_unlock(&(b->mutex));
+        if (orphaned) {
+            pthread_mutex_destroy(&(b->mutex));
+            delete b;
+            _buffers[i] = NULL;
+        }
+    }
+    _start_time = timer::get(timer::monotonic);
+    _active = true;
+    pthread_mutex_unlock(&_buffers_mutex);
+}
+
+void trc::stop()
+{
+    if (!_active)
+        return;
+    // Collect the events of all threads
+    pthread_mutex_lock(&_buffers_mutex);
+    _active = false;
+    std::vector<event> events;
+    std::vector<int> tracks;
+    std::vector<bool> main_tracks;
+    size_t dropped_events = 0;
+    for (size_t i = 0; i < _buffers.size(); i++) {
+        thread_buffer* b = _buffers[i];
+        if (!b)
+            continue;
+        pthread_mutex_lock(&(b->mutex));
+        if (!b->events.empty()) {
+            tracks.push_back(b->track);
+            main_tracks.push_back(pthread_equal(b->thread, _main_thread));
+        }
+        events.insert(events.end(), b->events.begin(), b->events.end());
+        dropped_events += b->dropped_events;
+        std::vector<event>().swap(b->events);
+        b->dropped_events = 0;
+        bool orphaned = b->orphaned;
+        pthread_mutex_unlock(&(b->mutex));
+        if (orphaned) {
+            pthread_mutex_destroy(&(b->mutex));
+            delete b;
+            _buffers[i] = NULL;
+        }
+    }
+    pthread_mutex_unlock(&_buffers_mutex);
+
+    if (dropped_events > 0)
+        msg::wrn("Trace buffer full: dropped %lu spans", static_cast<unsigned long>(dropped_events));
+    std::string s = "{ \"traceEvents\": [\n";
+    s += "{ \"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 0, \"args\": { \"name\": \"GPU\" } }";
+    for (size_t i = 0; i < tracks.size(); i++) {
+        s += str::asprintf(",\n{ \"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, "
+                "\"args\": { \"name\": \"%s\" } }", tracks[i],
+                main_tracks[i] ? "Main" : str::asprintf("Thread %d", tracks[i]).c_str());
+    }
+    for (size_t i = 0; i < events.size(); i++) {
+        s += str::asprintf(",\n{ \"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %lld, \"dur\": %lld }",
+                events[i].name, events[i].track,
+                events[i].begin - _start_time, events[i].end - events[i].begin);
+    }
+    s += "\n] }\n";
+    FILE* f = fio::open(_filename, "w");
+    fio::write(s.c_str(), s.length(), 1, f, _filename);
+    fio::close(f, _filename);
+    msg::inf("Wrote %lu spans to trace file %s", static_cast<unsigned long>(events.size()), _filename.c_str());
+}
+
+long long trc::now()
+{
+    return timer::get(timer::monotonic);
+}
+
+int trc::thread_track()
+{
+    return this_buffer()->track;
+}
+
+static void record_in(trc::thread_buffer* b, const char* name, int track, long long begin, long long end)
+{
+    pthread_mutex_lock(&(b->mutex));
+    if (trc::_active) {
+        if (b->events.size() < trc::max_events_per_thread) {
+            trc::event e = { name, track, begin, end };
+            b->events.push_back(e);
+        } else {
+            b->dropped_events++;
+        }
+    }
+    pthread_mutex_unlock(&(b->mutex));
+}
+
+void trc::record(const char* name, int track, long long begin, long long end)
+{
+    record_in(this_buffer(), name, track, begin, end);
+}
+
+void trc::record(const char* name, long long begin, long long end)
+{
+    thread_buffer* b = this_buffer();
+    record_in(b, name, b->track, begin, end);
+}
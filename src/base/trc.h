@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2013
+ * Martin Lambers <marlam@marlam.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file trc.h
+ *
+ * Tracing of time spans for offline performance analysis.
+ *
+ * Spans are recorded with the TRC_SCOPE macro, which measures the lifetime of
+ * a scope on the monotonic clock. Recording happens only between trc::start()
+ * and trc::stop(); stop() writes all spans to a trace file in the Chrome
+ * trace event format, which can be viewed with chrome://tracing or Perfetto.
+ *
+ * The macros expand to nothing unless the package was configured with
+ * --enable-tracing.
+ */
+
+#ifndef TRC_H
+#define TRC_H
+
+#include <string>
+#include <atomic>
+
+
+namespace trc
+{
+    // Set from the GUI thread, read from all threads that record spans
+    extern std::atomic<bool> _active;
+
+    /* Start recording. The trace will be written to the given file. */
+    void start(const std::string& filename);
+    /* Stop recording and write the trace file. */
+    void stop();
+    /* Check whether recording is active. */
+    inline bool active()
+    {
+        return _active;
+    }
+
+    /* Current time in microseconds, on the same clock that is used for spans. */
+    long long now();
+
+    /* The track of the calling thread. Track 0 is reserved for GPU spans. */
+    int thread_track();
+    const int gpu_track = 0;
+
+    /* Record a span. The name must be a string literal (or otherwise stay
+     * valid until stop() is called). */
+    void record(const char* name, int track, long long begin, long long end);
+    /* Record a span on the track of the calling thread. */
+    void record(const char* name, long long begin, long long end);
+
+    /* Record the lifetime of a scope on the track of the calling thread. */
+    class scope
+    {
+    private:
+        const char* _name;
+        long long _begin;
+
+    public:
+        scope(const char* name) : _name(name), _begin(_active ? now() : -1)
+        {
+        }
+        ~scope()
+        {
+            if (_begin >= 0 && _active)
+                record(_name, _begin, now());
+        }
+    };
+}
+
+#if ENABLE_TRACING
+# define TRC_CONCAT_(a, b) a ## b
+# define TRC_CONCAT(a, b) TRC_CONCAT_(a, b)
+# define TRC_SCOPE(name) trc::scope TRC_CONCAT(_trc_scope_, __LINE__)(name)
+#else
+# define TRC_SCOPE(name)
+#endif
+
+#endif
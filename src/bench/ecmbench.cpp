@@ -0,0 +1,1012 @@
+/*
+ * Copyright (C) 2013
+ * Computer Graphics Group, University of Siegen, Germany.
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>.
+ * See http://www.cg.informatik.uni-siegen.de/ for contact information.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * ecmbench runs micro-benchmarks of core data structures and kernels. It does
+ * not need OpenGL, a display, or network access.
+ *
+ * Each benchmark is run with an increasing number of iterations until one run
+ * takes at least the minimum time. Then it is run repeatedly with that number
+ * of iterations, and the median time per iteration is reported. The output is
+ * a tab separated table with a fixed set of columns so that results of
+ * different builds can be compared with standard tools.
+ */
+
+#include "config.h"
+
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "dbg.h"
+#include "exc.h"
+#include "msg.h"
+#include "opt.h"
+#include "str.h"
+#include "fio.h"
+#include "tmr.h"
+#include "blb.h"
+#include "ser.h"
+#include "lru.h"
+#include "pth.h"
+#include "trc.h"
+
+#include "glvm.h"
+#include "glvm-algo.h"
+#include "glvm-ser.h"
+#include "glvm-gl.h"
+#include "uuid.h"
+#include "quad-cache.h"
+#include "culler.h"
+#include "lod.h"
+#include "state.h"
+#include "download.h"
+
+using namespace glvm;
+
+
+/* Results are written to this variable so that the compiler cannot
+ * remove the benchmarked code. */
+static volatile double sink;
+
+/* A simple deterministic pseudo random number generator, so that all
+ * builds benchmark the same data. */
+class prng
+{
+private:
+    unsigned long long _x;
+
+public:
+    prng(unsigned long long seed = 1) : _x(seed)
+    {
+    }
+
+    unsigned int next()
+    {
+        _x ^= _x << 13;
+        _x ^= _x >> 7;
+        _x ^= _x << 17;
+        return _x & 0xffffffffu;
+    }
+
+    // A value in [0,1)
+    double unit()
+    {
+        return next() / 4294967296.0;
+    }
+};
+
+
+/* Benchmark interface */
+
+class benchmark
+{
+public:
+    const std::string name;
+
+    benchmark(const std::string& name) : name(name)
+    {
+    }
+
+    virtual ~benchmark()
+    {
+    }
+
+    // Set up for n iterations. This is not timed.
+    virtual void prepare(unsigned long long /* n */)
+    {
+    }
+
+    // Run n iterations.
+    virtual void run(unsigned long long n) = 0;
+
+    // Clean up after a run. This is not timed.
+    virtual void cleanup()
+    {
+    }
+};
+
+
+/* lru_cache */
+
+class bench_lru_put : public benchmark
+{
+private:
+    const int _size;
+    lru_cache<int, int> _cache;
+    int _next_key;
+
+public:
+    bench_lru_put(int size) :
+        benchmark(str::asprintf("lru_put/%d", size)), _size(size), _cache(size), _next_key(0)
+    {
+    }
+
+    void prepare(unsigned long long /* n */)
+    {
+        // Fill the cache so that every put evicts one element
+        while (static_cast<int>(_cache.size()) < _size)
+            _cache.put(_next_key++, new int(0));
+    }
+
+    void run(unsigned long long n)
+    {
+        for (unsigned long long i = 0; i < n; i++)
+            _cache.put(_next_key++, new int(0));
+    }
+};
+
+class bench_lru_get : public benchmark
+{
+private:
+    const int _size;
+    const bool _hit;
+    lru_cache<int, int> _cache;
+    std::vector<int> _keys;
+
+public:
+    bench_lru_get(int size, bool hit) :
+        benchmark(str::asprintf("lru_get_%s/%d", hit ? "hit" : "miss", size)),
+        _size(size), _hit(hit), _cache(size), _keys(4096)
+    {
+        for (int i = 0; i < _size; i++)
+            _cache.put(2 * i, new int(i));
+        prng r;
+        for (size_t i = 0; i < _keys.size(); i++)
+            _keys[i] = 2 * (r.next() % _size) + (_hit ? 0 : 1);
+    }
+
+    void run(unsigned long long n)
+    {
+        int sum = 0;
+        for (unsigned long long i = 0; i < n; i++) {
+            const int* e = _cache.get(_keys[i % _keys.size()]);
+            sum += (e ? *e : 0);
+        }
+        sink = sum;
+    }
+};
+
+class bench_lru_shrink : public benchmark
+{
+private:
+    const int _size;
+    lru_cache<int, int, false> _cache;
+    int _next_key;
+
+public:
+    bench_lru_shrink(int size) :
+        benchmark(str::asprintf("lru_shrink/%d", size)), _size(size), _cache(size), _next_key(0)
+    {
+    }
+
+    void prepare(unsigned long long n)
+    {
+        // Overfill the cache by n elements; shrinking evicts them
+        while (_cache.size() < _size + n)
+            _cache.put(_next_key++, new int(0));
+    }
+
+    void run(unsigned long long /* n */)
+    {
+        _cache.shrink();
+    }
+};
+
+
+/* quad_key */
+
+class bench_quad_key_compare : public benchmark
+{
+private:
+    std::vector<quad_key> _keys;
+
+public:
+    bench_quad_key_compare() : benchmark("quad_key_compare")
+    {
+        // Few databases and many quads, like in a real session
+        std::vector<uuid> db_ids(4);
+        for (size_t i = 0; i < db_ids.size(); i++)
+            db_ids[i].generate();
+        prng r;
+        for (int i = 0; i < 1024; i++) {
+            int level = r.next() % 16;
+            ivec4 quad(r.next() % 6, level, r.next() % (1 << level), r.next() % (1 << level));
+            _keys.push_back(quad_key(db_ids[r.next() % db_ids.size()], quad, (r.next() % 4 == 0 ? level - 1 : -1)));
+        }
+    }
+
+    void run(unsigned long long n)
+    {
+        int less = 0;
+        for (unsigned long long i = 0; i < n; i++)
+            less += (_keys[i % 1024] < _keys[(7 * i + 1) % 1024] ? 1 : 0);
+        sink = less;
+    }
+};
+
+
+/* culler */
+
+class bench_frustum_cull : public benchmark
+{
+private:
+    culler _culler;
+    std::vector<vec3> _boxes;   // 8 corners per box
+
+public:
+    bench_frustum_cull() : benchmark("frustum_cull")
+    {
+        mat4 P = toMat4(perspective(0.8f, 4.0f / 3.0f, 0.1f, 100.0f));
+        mat4 MV = lookat(vec3(0.0f, 0.0f, 10.0f), vec3(0.0f), vec3(0.0f, 1.0f, 0.0f));
+        _culler.set_mvp(P * MV);
+        // Boxes scattered around the viewer so that some are culled and some are not
+        prng r;
+        for (int i = 0; i < 1024; i++) {
+            vec3 center(40.0f * r.unit() - 20.0f, 40.0f * r.unit() - 20.0f, 40.0f * r.unit() - 30.0f);
+            float s = 0.5f + 2.0f * r.unit();
+            for (int j = 0; j < 8; j++)
+                _boxes.push_back(center + s * vec3(j & 1 ? 1.0f : -1.0f, j & 2 ? 1.0f : -1.0f, j & 4 ? 1.0f : -1.0f));
+        }
+    }
+
+    void run(unsigned long long n)
+    {
+        int culled = 0;
+        for (unsigned long long i = 0; i < n; i++) {
+            const vec3* box = &(_boxes[8 * (i % 1024)]);
+            culled += (_culler.frustum_cull(box, box + 4) ? 1 : 0);
+        }
+        sink = culled;
+    }
+};
+
+
+/* Quadtree traversal with frustum culling during a flight close to the
+ * ground: the classic variant tests every visited node against all planes,
+ * the batched variant tests the four children of a node at once and skips
+ * planes that the parent is completely inside of. */
+
+class bench_cull_tree : public benchmark
+{
+private:
+    const bool _batched;
+    const double _altitude;
+    culler _culler;
+
+    class node
+    {
+    public:
+        double x, y, half;      // center and half size of the square
+        int level;
+        int cull;               // 0 = no, 1 = yes, 2 = not tested yet
+        unsigned int plane_mask;
+    };
+    std::vector<node> _stack;
+
+    static const double _extent;        // half size of the whole terrain
+    static const double _max_height;    // terrain height range is [0, _max_height]
+    static const int _max_level = 24;
+
+    // Bounding box relative to the viewer, which is at (0, 0, _altitude)
+    void bounding_box(const node& n, vec3 bb0[4], vec3 bb1[4]) const
+    {
+        for (int i = 0; i < 4; i++) {
+            double x = n.x + (i == 1 || i == 2 ? n.half : -n.half);
+            double y = n.y + (i >= 2 ? n.half : -n.half);
+            bb0[i] = vec3(x, y, -_altitude);
+            bb1[i] = vec3(x, y, _max_height - _altitude);
+        }
+    }
+
+    bool split(const node& n) const
+    {
+        double dist = std::sqrt(n.x * n.x + n.y * n.y + _altitude * _altitude);
+        return (n.level < _max_level && n.half > 0.1 * dist);
+    }
+
+public:
+    bench_cull_tree(bool batched, double altitude) :
+        benchmark(str::asprintf("cull_tree_%s/%g", batched ? "batched" : "classic", altitude)),
+        _batched(batched), _altitude(altitude)
+    {
+        // Look along the x axis, slightly down
+        mat4 P = toMat4(perspective(0.8f, 16.0f / 9.0f, 1.0f, static_cast<float>(4.0 * _extent)));
+        mat4 MV = lookat(vec3(0.0f), vec3(1.0f, 0.0f, -0.2f), vec3(0.0f, 0.0f, 1.0f));
+        _culler.set_mvp(P * MV);
+    }
+
+    // Return the number of leaves that are not culled
+    int traverse()
+    {
+        int leaves = 0;
+        _stack.resize(1);
+        _stack[0].x = 0.0;
+        _stack[0].y = 0.0;
+        _stack[0].half = _extent;
+        _stack[0].level = 0;
+        _stack[0].cull = 2;
+        _stack[0].plane_mask = culler::all_planes;
+        while (!_stack.empty()) {
+            node n = _stack.back();
+            _stack.pop_back();
+            if (n.cull == 2) {
+                vec3 bb0[4], bb1[4];
+                bounding_box(n, bb0, bb1);
+                if (_batched)
+                    n.cull = _culler.frustum_cull(bb0, bb1, &n.plane_mask) ? 1 : 0;
+                else
+                    n.cull = _culler.frustum_cull(bb0, bb1) ? 1 : 0;
+            }
+            if (n.cull == 1)
+                continue;
+            if (!split(n)) {
+                leaves++;
+                continue;
+            }
+            node children[4];
+            for (int i = 0; i < 4; i++) {
+                children[i].half = n.half / 2.0;
+                children[i].x = n.x + (i % 2 == 0 ? -1.0 : +1.0) * children[i].half;
+                children[i].y = n.y + (i / 2 == 0 ? -1.0 : +1.0) * children[i].half;
+                children[i].level = n.level + 1;
+                children[i].cull = 2;
+                children[i].plane_mask = n.plane_mask;
+            }
+            if (_batched) {
+                if (n.plane_mask == 0) {
+                    for (int i = 0; i < 4; i++)
+                        children[i].cull = 0;
+                } else {
+                    vec3 bb0[4][4], bb1[4][4];
+                    for (int i = 0; i < 4; i++)
+                        bounding_box(children[i], bb0[i], bb1[i]);
+                    bool cull[4];
+                    unsigned int plane_masks[4];
+                    _culler.frustum_cull4(bb0, bb1, n.plane_mask, cull, plane_masks);
+                    for (int i = 0; i < 4; i++) {
+                        children[i].cull = (cull[i] ? 1 : 0);
+                        children[i].plane_mask = plane_masks[i];
+                    }
+                }
+            }
+            for (int i = 0; i < 4; i++)
+                _stack.push_back(children[i]);
+        }
+        return leaves;
+    }
+
+    void run(unsigned long long n)
+    {
+        int leaves = 0;
+        for (unsigned long long i = 0; i < n; i++)
+            leaves += traverse();
+        sink = leaves;
+    }
+};
+
+const double bench_cull_tree::_extent = 4000000.0;
+const double bench_cull_tree::_max_height = 9000.0;
+
+
+/* glvm algorithms */
+
+class bench_convex_hull : public benchmark
+{
+private:
+    const bool _with_area;
+    std::vector<std::vector<vec2> > _point_sets;
+
+public:
+    bench_convex_hull(int points, bool with_area) :
+        benchmark(str::asprintf("%s/%d", with_area ? "convex_hull_area" : "convex_hull", points)),
+        _with_area(with_area), _point_sets(256)
+    {
+        prng r;
+        for (size_t i = 0; i < _point_sets.size(); i++)
+            for (int j = 0; j < points; j++)
+                _point_sets[i].push_back(vec2(r.unit(), r.unit()));
+    }
+
+    void run(unsigned long long n)
+    {
+        float sum = 0.0f;
+        for (unsigned long long i = 0; i < n; i++) {
+            std::vector<vec2> hull = convex_hull(_point_sets[i % _point_sets.size()]);
+            sum += (_with_area ? polygon_area(hull) : hull.size());
+        }
+        sink = sum;
+    }
+};
+
+
+/* ecm */
+
+static const double semi_major_axis = 6378137.0;        // WGS84
+static const double semi_minor_axis = 6356752.314245;
+
+static void random_quad(prng& r, int level, int quad[4])
+{
+    quad[0] = r.next() % 6;
+    quad[1] = level;
+    quad[2] = r.next() % (1 << level);
+    quad[3] = r.next() % (1 << level);
+}
+
+static void quad_corners(const class ecm& ecm, const int quad[4], double tl[3], double tr[3], double bl[3], double br[3])
+{
+    double ecmx, ecmy;
+    ecm.quad_to_ecm(quad[0], quad[1], quad[2], quad[3], ecm::corner_tl, &ecmx, &ecmy);
+    ecm.ecm_to_cartesian(ecmx, ecmy, tl);
+    ecm.quad_to_ecm(quad[0], quad[1], quad[2], quad[3], ecm::corner_tr, &ecmx, &ecmy);
+    ecm.ecm_to_cartesian(ecmx, ecmy, tr);
+    ecm.quad_to_ecm(quad[0], quad[1], quad[2], quad[3], ecm::corner_bl, &ecmx, &ecmy);
+    ecm.ecm_to_cartesian(ecmx, ecmy, bl);
+    ecm.quad_to_ecm(quad[0], quad[1], quad[2], quad[3], ecm::corner_br, &ecmx, &ecmy);
+    ecm.ecm_to_cartesian(ecmx, ecmy, br);
+}
+
+class bench_ecm_corners : public benchmark
+{
+private:
+    const class ecm _ecm;
+    std::vector<int> _quads;
+
+public:
+    bench_ecm_corners() : benchmark("ecm_quad_corners"),
+        _ecm(semi_major_axis, semi_minor_axis), _quads(4 * 1024)
+    {
+        prng r;
+        for (int i = 0; i < 1024; i++)
+            random_quad(r, 1 + r.next() % 16, &(_quads[4 * i]));
+    }
+
+    void run(unsigned long long n)
+    {
+        double tl[3], tr[3], bl[3], br[3];
+        double sum = 0.0;
+        for (unsigned long long i = 0; i < n; i++) {
+            quad_corners(_ecm, &(_quads[4 * (i % 1024)]), tl, tr, bl, br);
+            sum += tl[0] + tr[1] + bl[2] + br[0];
+        }
+        sink = sum;
+    }
+};
+
+class bench_ecm_plane : public benchmark
+{
+private:
+    const class ecm _ecm;
+    std::vector<int> _quads;
+    std::vector<double> _corners;       // 12 per quad
+
+public:
+    bench_ecm_plane() : benchmark("ecm_quad_plane"),
+        _ecm(semi_major_axis, semi_minor_axis), _quads(4 * 1024), _corners(12 * 1024)
+    {
+        prng r;
+        for (int i = 0; i < 1024; i++) {
+            random_quad(r, 1 + r.next() % 16, &(_quads[4 * i]));
+            double* c = &(_corners[12 * i]);
+            quad_corners(_ecm, &(_quads[4 * i]), c, c + 3, c + 6, c + 9);
+        }
+    }
+
+    void run(unsigned long long n)
+    {
+        double normal[3], distance;
+        double sum = 0.0;
+        for (unsigned long long i = 0; i < n; i++) {
+            const int* q = &(_quads[4 * (i % 1024)]);
+            const double* c = &(_corners[12 * (i % 1024)]);
+            _ecm.quad_plane(q[0], q[1], q[2], q[3], c, c + 3, c + 6, c + 9, normal, &distance);
+            sum += distance;
+        }
+        sink = sum;
+    }
+};
+
+/* LOD metrics: the screen space area of the projected bounding box (eight
+ * projections, a convex hull and a polygon area) versus the estimate
+ * from the bounding sphere. */
+
+class bench_lod_metric : public benchmark
+{
+private:
+    const bool _sphere;
+    const class ecm _ecm;
+    ecm_quadtree _quadtree;
+    std::vector<ecm_side_quadtree*> _quads;
+    std::vector<dvec3> _viewer_positions;
+    std::vector<dmat4> _rel_MVPs;
+    const ivec4 _VP;
+    double _pixels_per_tan;
+    std::vector<vec2> _bbs;
+
+public:
+    bench_lod_metric(bool sphere) :
+        benchmark(sphere ? "lod_metric_sphere" : "lod_metric_box"),
+        _sphere(sphere), _ecm(semi_major_axis, semi_minor_axis), _quadtree(_ecm),
+        _quads(1024), _viewer_positions(1024), _rel_MVPs(1024),
+        _VP(0, 0, 1920, 1080), _bbs(8)
+    {
+        dmat4 P = toMat4(dfrust(-0.5, 0.5, -0.28125, 0.28125, 1.0, 1e7));
+        _pixels_per_tan = max(P[0][0] * _VP[2], P[1][1] * _VP[3]) / 2.0;
+        prng r;
+        for (size_t i = 0; i < _quads.size(); i++) {
+            // Descend along a random path to a random level
+            ecm_side_quadtree* quad = _quadtree.side_root(r.next() % 6);
+            int level = 1 + r.next() % 16;
+            while (quad->level() < level) {
+                if (!quad->has_children())
+                    _quadtree.split(quad);
+                quad = quad->child(r.next() % 4);
+            }
+            _quads[i] = quad;
+            _quads[i]->min_elev() = -500.0 * r.unit();
+            _quads[i]->max_elev() = 4000.0 * r.unit();
+            _quads[i]->compute_bounding_box();
+            // Look at the quad from an altitude and a lateral offset of a few quad sizes
+            dvec3 center = (_quads[i]->corner(0) + _quads[i]->corner(1) + _quads[i]->corner(2) + _quads[i]->corner(3)) / 4.0;
+            double size = distance(_quads[i]->corner(0), _quads[i]->corner(1));
+            _viewer_positions[i] = center + size * dvec3(4.0 * r.unit() - 2.0, 4.0 * r.unit() - 2.0, 4.0 * r.unit() - 2.0)
+                + 4.0 * size * r.unit() * _quads[i]->plane_normal();
+            _rel_MVPs[i] = P * toMat4(center - _viewer_positions[i], dvec3(0.0, 0.0, -1.0));
+        }
+    }
+
+    void run(unsigned long long n)
+    {
+        float sum = 0.0f;
+        for (unsigned long long i = 0; i < n; i++) {
+            const ecm_side_quadtree* quad = _quads[i % _quads.size()];
+            const dvec3& viewer_pos = _viewer_positions[i % _quads.size()];
+            if (_sphere) {
+                sum += bounding_sphere_screen_area(quad->bounding_sphere_center(),
+                        quad->bounding_sphere_radius(), viewer_pos, _pixels_per_tan);
+            } else {
+                const dmat4& rel_MVP = _rel_MVPs[i % _quads.size()];
+                for (int j = 0; j < 8; j++) {
+                    vec3 bbp = vec3((j < 4 ? quad->bounding_box_inner()[j] : quad->bounding_box_outer()[j - 4])
+                            - viewer_pos);
+                    _bbs[j] = glvmProject(bbp, rel_MVP, _VP);
+                }
+                sum += polygon_area(convex_hull(_bbs));
+            }
+        }
+        sink = sum;
+    }
+};
+
+class bench_quad_base_data : public benchmark
+{
+private:
+    const class ecm _ecm;
+    const int _quad_size;
+    static const int _overlap = 2;      // as in quad_base_data_mem_cache_computer
+    std::vector<int> _quads;
+    blob _offsets, _normals;
+
+public:
+    bench_quad_base_data(int quad_size) : benchmark(str::asprintf("quad_base_data/%d", quad_size)),
+        _ecm(semi_major_axis, semi_minor_axis), _quad_size(quad_size), _quads(4 * 16),
+        _offsets((quad_size + 2 * _overlap) * (quad_size + 2 * _overlap) * 3 * sizeof(float)),
+        _normals((quad_size + 2 * _overlap) * (quad_size + 2 * _overlap) * 2 * sizeof(float))
+    {
+        prng r;
+        for (int i = 0; i < 16; i++)
+            random_quad(r, 1 + r.next() % 16, &(_quads[4 * i]));
+    }
+
+    void run(unsigned long long n)
+    {
+        double sum = 0.0;
+        for (unsigned long long i = 0; i < n; i++) {
+            const int* q = &(_quads[4 * (i % 16)]);
+            double tl[3], tr[3], bl[3], br[3];
+            double normal[3], distance, max_dist;
+            quad_corners(_ecm, q, tl, tr, bl, br);
+            _ecm.quad_plane(q[0], q[1], q[2], q[3], tl, tr, bl, br, normal, &distance);
+            _ecm.quad_base_data(q[0], q[1], q[2], q[3], tl, tr, bl, br, normal, distance,
+                    _quad_size, _overlap, _offsets.ptr<float>(), _normals.ptr<float>(), &max_dist);
+            sum += max_dist;
+        }
+        sink = sum;
+    }
+};
+
+
+/* State serialization */
+
+static void init_bench_state(class state& s)
+{
+    s.viewer_pos = dvec3(semi_major_axis * 1.5, 0.0, 0.0);
+    s.viewer_rot = dquat(0.0, 0.0, 0.0, 1.0);
+}
+
+static void save_bench_state(const class state& s, std::ostream& os)
+{
+    // This is what state::save_statefile() does for the parts that do not
+    // depend on opened databases, plus the renderer parameters.
+    s11n::save(os, "viewer_pos", s.viewer_pos);
+    os.put('\n');
+    s11n::save(os, "viewer_rot", s.viewer_rot);
+    os.put('\n');
+    s11n::save(os, "light", s.light);
+    os.put('\n');
+    s11n::save(os, "lens", s.lens);
+    os.put('\n');
+    s11n::save(os, "renderer", s.renderer);
+    os.put('\n');
+}
+
+class bench_state_save : public benchmark
+{
+private:
+    class state _state;
+
+public:
+    bench_state_save() : benchmark("ser_state_save")
+    {
+        init_bench_state(_state);
+    }
+
+    void run(unsigned long long n)
+    {
+        size_t len = 0;
+        for (unsigned long long i = 0; i < n; i++) {
+            std::ostringstream oss;
+            save_bench_state(_state, oss);
+            len += oss.str().length();
+        }
+        sink = len;
+    }
+};
+
+class bench_state_load : public benchmark
+{
+private:
+    std::vector<std::string> _lines;
+
+public:
+    bench_state_load() : benchmark("ser_state_load")
+    {
+        class state s;
+        init_bench_state(s);
+        std::ostringstream oss;
+        save_bench_state(s, oss);
+        std::istringstream iss(oss.str());
+        std::string line;
+        while (std::getline(iss, line))
+            _lines.push_back(line);
+    }
+
+    void run(unsigned long long n)
+    {
+        double sum = 0.0;
+        for (unsigned long long i = 0; i < n; i++) {
+            class state s;
+            std::string name, value;
+            // This is what state::load_statefile() does after reading the lines
+            for (size_t j = 0; j < _lines.size(); j++) {
+                std::istringstream iss(_lines[j]);
+                s11n::load(iss, name, value);
+                if (name == "viewer_pos")
+                    s11n::load(value, s.viewer_pos);
+                else if (name == "viewer_rot")
+                    s11n::load(value, s.viewer_rot);
+                else if (name == "light")
+                    s11n::load(value, s.light);
+                else if (name == "lens")
+                    s11n::load(value, s.lens);
+                else if (name == "renderer")
+                    s11n::load(value, s.renderer);
+            }
+            sum += s.viewer_pos.x;
+        }
+        sink = sum;
+    }
+};
+
+
+/* blob */
+
+class bench_blob_resize : public benchmark
+{
+private:
+    std::vector<size_t> _sizes;
+
+public:
+    bench_blob_resize() : benchmark("blob_resize"), _sizes(256)
+    {
+        // Sizes of typical quad data: from a few KiB to one MiB
+        prng r;
+        for (size_t i = 0; i < _sizes.size(); i++)
+            _sizes[i] = 4096 << (r.next() % 9);
+    }
+
+    void run(unsigned long long n)
+    {
+        blob b;
+        size_t sum = 0;
+        for (unsigned long long i = 0; i < n; i++) {
+            b.resize(_sizes[i % _sizes.size()]);
+            b.ptr<char>()[0] = 1;
+            sum += b.size();
+        }
+        sink = sum;
+    }
+};
+
+
+/* trc */
+
+class bench_trc_scope : public benchmark
+{
+private:
+    class worker : public thread
+    {
+    public:
+        unsigned long long n;
+        void run()
+        {
+            for (unsigned long long i = 0; i < n; i++) {
+                trc::scope s("bench");
+            }
+        }
+    };
+
+    const int _threads;
+    std::string _dir;
+    std::vector<worker> _workers;
+
+public:
+    bench_trc_scope(int threads) : benchmark(str::asprintf("trc_scope/%d", threads)),
+        _threads(threads), _workers(threads)
+    {
+    }
+
+    ~bench_trc_scope()
+    {
+        if (!_dir.empty())
+            fio::rm_r(_dir);
+    }
+
+    void prepare(unsigned long long n)
+    {
+        if (_dir.empty())
+            _dir = fio::mktempdir();
+        for (int i = 0; i < _threads; i++)
+            _workers[i].n = n / _threads + (static_cast<unsigned long long>(i) < n % _threads ? 1 : 0);
+        trc::start(_dir + "/trace.json");
+    }
+
+    // The spans are distributed over all threads, so the time per iteration
+    // only drops with more threads if recording does not contend.
+    void run(unsigned long long /* n */)
+    {
+        for (int i = 1; i < _threads; i++)
+            _workers[i].start();
+        _workers[0].run();
+        for (int i = 1; i < _threads; i++)
+            _workers[i].wait();
+    }
+
+    void cleanup()
+    {
+        trc::stop();
+    }
+};
+
+
+/* download */
+
+class bench_download : public benchmark
+{
+private:
+    const size_t _file_size;
+    std::string _dir, _src, _dst, _url;
+
+public:
+    bench_download(size_t file_size) :
+        benchmark(str::asprintf("download_file/%lu", static_cast<unsigned long>(file_size))),
+        _file_size(file_size)
+    {
+    }
+
+    ~bench_download()
+    {
+        cleanup();
+    }
+
+    void prepare(unsigned long long /* n */)
+    {
+        if (!_dir.empty())
+            return;
+        _dir = fio::mktempdir();
+        _src = _dir + "/src";
+        _dst = _dir + "/dst";
+        _url = "file://" + _src;
+        std::vector<char> data(_file_size);
+        prng r;
+        for (size_t i = 0; i < data.size(); i++)
+            data[i] = r.next();
+        FILE* f = fio::open(_src, "w");
+        fio::write(&(data[0]), 1, data.size(), f, _src);
+        fio::close(f, _src);
+    }
+
+    void run(unsigned long long n)
+    {
+        for (unsigned long long i = 0; i < n; i++)
+            download(_dst, _url);
+    }
+
+    void cleanup()
+    {
+        if (!_dir.empty()) {
+            fio::rm_r(_dir);
+            _dir.clear();
+        }
+    }
+};
+
+
+/* Measurement */
+
+static long long time_run(benchmark* b, unsigned long long n)
+{
+    b->prepare(n);
+    long long t0 = timer::get(timer::monotonic);
+    b->run(n);
+    long long t1 = timer::get(timer::monotonic);
+    b->cleanup();
+    return t1 - t0;
+}
+
+static void measure(benchmark* b, long long min_time, int repeat)
+{
+    // Warm up, so that first-use costs such as page faults and the
+    // adaptation of the memory allocator do not distort the calibration
+    time_run(b, 1);
+    // Calibrate the number of iterations
+    unsigned long long n = 1;
+    for (;;) {
+        long long t = time_run(b, n);
+        if (t >= min_time)
+            break;
+        // Grow fast while runs are too short to be measured reliably
+        unsigned long long f = (t <= 0 ? 100 : std::max(2LL, std::min(100LL, min_time * 12 / (10 * t))));
+        n *= f;
+    }
+    // Measure
+    std::vector<double> ns_per_op;
+    for (int r = 0; r < repeat; r++)
+        ns_per_op.push_back(time_run(b, n) * 1e3 / n);
+    std::sort(ns_per_op.begin(), ns_per_op.end());
+    double median = (ns_per_op.size() % 2 == 1 ? ns_per_op[ns_per_op.size() / 2]
+            : (ns_per_op[ns_per_op.size() / 2 - 1] + ns_per_op[ns_per_op.size() / 2]) / 2.0);
+    std::printf("%s\t%llu\t%.3f\t%.3f\t%.3f\n", b->name.c_str(), n,
+            median, ns_per_op.front(), ns_per_op.back());
+    std::fflush(stdout);
+}
+
+
+int main(int argc, char* argv[])
+{
+    /* Initialization: messages */
+    char *program_name = strrchr(argv[0], '/');
+    program_name = program_name ? program_name + 1 : argv[0];
+    msg::set_level(msg::INF);
+    msg::set_program_name(program_name);
+    msg::set_columns_from_env();
+    dbg::init_crashhandler();
+
+    /* Command line handling */
+    std::vector<opt::option *> options;
+    opt::info help("help", '\0', opt::optional);
+    options.push_back(&help);
+    opt::flag list("list", 'l', opt::optional);
+    options.push_back(&list);
+    opt::val<int> min_time("min-time", 't', opt::optional, 1, 60000, 200);
+    options.push_back(&min_time);
+    opt::val<int> repeat("repeat", 'r', opt::optional, 1, 1000, 5);
+    options.push_back(&repeat);
+
+    std::vector<std::string> arguments;
+    if (!opt::parse(argc, argv, options, 0, -1, arguments)) {
+        return 1;
+    }
+    if (help.value()) {
+        msg::req_txt("Usage: %s [option...] [filter...]\n"
+                "Run micro-benchmarks. If filters are given, only benchmarks whose names\n"
+                "contain one of them are run.\n"
+                "The output has one line per benchmark with tab separated columns: name,\n"
+                "iterations per run, and median, minimum, and maximum time per iteration\n"
+                "in nanoseconds.\n"
+                "    [--help]               Print help and exit\n"
+                "    [-l|--list]            List benchmarks and exit\n"
+                "    [-t|--min-time=<ms>]   Minimum time of a run. Default is 200.\n"
+                "    [-r|--repeat=<n>]      Number of runs. Default is 5.\n"
+                "Report bugs to <%s>.",
+                program_name, PACKAGE_BUGREPORT);
+        return 0;
+    }
+
+    std::vector<benchmark*> benchmarks;
+    int retval = 0;
+    try {
+        const int lru_sizes[] = { 256, 4096, 65536 };
+        for (int i = 0; i < 3; i++) {
+            benchmarks.push_back(new bench_lru_put(lru_sizes[i]));
+            benchmarks.push_back(new bench_lru_get(lru_sizes[i], true));
+            benchmarks.push_back(new bench_lru_get(lru_sizes[i], false));
+            benchmarks.push_back(new bench_lru_shrink(lru_sizes[i]));
+        }
+        benchmarks.push_back(new bench_quad_key_compare);
+        benchmarks.push_back(new bench_frustum_cull);
+        benchmarks.push_back(new bench_cull_tree(false, 10000.0));
+        benchmarks.push_back(new bench_cull_tree(true, 10000.0));
+        benchmarks.push_back(new bench_cull_tree(false, 100.0));
+        benchmarks.push_back(new bench_cull_tree(true, 100.0));
+        benchmarks.push_back(new bench_convex_hull(8, false));
+        benchmarks.push_back(new bench_convex_hull(8, true));
+        benchmarks.push_back(new bench_convex_hull(64, false));
+        benchmarks.push_back(new bench_convex_hull(64, true));
+        benchmarks.push_back(new bench_ecm_corners);
+        benchmarks.push_back(new bench_ecm_plane);
+        benchmarks.push_back(new bench_lod_metric(false));
+        benchmarks.push_back(new bench_lod_metric(true));
+        benchmarks.push_back(new bench_quad_base_data(64));
+        benchmarks.push_back(new bench_quad_base_data(256));
+        benchmarks.push_back(new bench_state_save);
+        benchmarks.push_back(new bench_state_load);
+        benchmarks.push_back(new bench_blob_resize);
+        benchmarks.push_back(new bench_trc_scope(1));
+        benchmarks.push_back(new bench_trc_scope(4));
+        benchmarks.push_back(new bench_download(64 * 1024));
+        benchmarks.push_back(new bench_download(4 * 1024 * 1024));
+
+        if (!list.value())
+            std::printf("# %s %s\n# name\titerations\tmedian_ns\tmin_ns\tmax_ns\n", PACKAGE_NAME, PACKAGE_VERSION);
+        for (size_t i = 0; i < benchmarks.size(); i++) {
+            bool selected = arguments.empty();
+            for (size_t j = 0; !selected && j < arguments.size(); j++)
+                selected = (benchmarks[i]->name.find(arguments[j]) != std::string::npos);
+            if (!selected)
+                continue;
+            if (list.value())
+                std::printf("%s\n", benchmarks[i]->name.c_str());
+            else
+                measure(benchmarks[i], min_time.value() * 1000LL, repeat.value());
+        }
+    }
+    catch (std::exception& e) {
+        msg::err("%s", e.what());
+        retval = 1;
+    }
+    for (size_t i = 0; i < benchmarks.size(); i++)
+        delete benchmarks[i];
+    return retval;
+}
@@ -20,6 +20,8 @@
 
 #include "config.h"
 
+#include "trc.h"
+
 #include "quad-base-data-cache.h"
 
 
@@ -36,6 +38,7 @@ quad_base_data_mem_cache_computer::~quad_base_data_mem_cache_computer()
 
 void quad_base_data_mem_cache_computer::run()
 {
+    TRC_SCOPE("compute base data");
     quad_base_data_mem.reset(new class quad_base_data_mem);
     
     const int overlap = 2;
@@ -70,7 +73,7 @@ void quad_base_data_mem_cache_computer::run()
 }
 
 quad_base_data_mem_cache_computers::quad_base_data_mem_cache_computers(unsigned char size, quad_base_data_mem_cache* qbdmc) :
-    thread_group(size), _quad_base_data_mem_cache(qbdmc)
+    thread_group(size), _quad_base_data_mem_cache(qbdmc), _mutex("base data computers")
 {
 }
 
@@ -87,10 +90,10 @@ bool quad_base_data_mem_cache_computers::start_compute(const quad_base_data_key&
     return r;
 }
 
-bool quad_base_data_mem_cache_computers::locked_start_compute(const quad_base_data_key& key, const class ecm& ecm, int quad_size)
+bool quad_base_data_mem_cache_computers::locked_start_compute(const quad_base_data_key& key, const class ecm& ecm, int quad_size, const char* file, int line)
 {
     bool r;
-    _mutex.lock();
+    _mutex.lock(file, line);
     try {
         r = start_compute(key, ecm, quad_size);
     }
@@ -82,7 +82,7 @@ public:
 class quad_base_data_gpu_cache : public lru_cache<quad_base_data_gpu, quad_base_data_key, false>
 {
 public:
-    quad_base_data_gpu_cache() : lru_cache<quad_base_data_gpu, quad_base_data_key, false>(0)
+    quad_base_data_gpu_cache() : lru_cache<quad_base_data_gpu, quad_base_data_key, false>(0, "base data gpu cache")
     {
     }
 };
@@ -104,7 +104,7 @@ public:
 class quad_base_data_mem_cache : public lru_cache<quad_base_data_mem, quad_base_data_key, false>
 {
 public:
-    quad_base_data_mem_cache() : lru_cache<quad_base_data_mem, quad_base_data_key, false>(0)
+    quad_base_data_mem_cache() : lru_cache<quad_base_data_mem, quad_base_data_key, false>(0, "base data mem cache")
     {
     }
 };
@@ -135,7 +135,7 @@ private:
 public:
     quad_base_data_mem_cache_computers(unsigned char size, quad_base_data_mem_cache* qbdmc);
     bool start_compute(const quad_base_data_key& key, const class ecm& ecm, int quad_size);
-    bool locked_start_compute(const quad_base_data_key& key, const class ecm& ecm, int quad_size);
+    bool locked_start_compute(const quad_base_data_key& key, const class ecm& ecm, int quad_size, const char* file = PTH_CALLER_FILE, int line = PTH_CALLER_LINE);
     void get_results();
 };
 
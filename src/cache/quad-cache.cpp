@@ -22,7 +22,12 @@
 
 #include <limits>
 #include <memory>
+#include <algorithm>
 #include <cstring>
+#include <cstdio>
+#include <sstream>
+
+#include <sys/stat.h>
 
 #include <ecmdb/ecmdb.h>
 
@@ -31,16 +36,92 @@
 #include "str.h"
 #include "msg.h"
 #include "fio.h"
+#include "trc.h"
 
 #include "download.h"
 
 #include "quad-cache.h"
 
 
+/* Elevation grid */
+
+void quad_elevation_grid::compute(const ecmdb& db, const void* data, const uint8_t* mask)
+{
+    assert(db.category() == ecmdb::category_elevation);
+    assert(db.channels() == 1);
+    const int qs = db.quad_size();
+    const int os = db.overlap();
+    const int tqs = db.total_quad_size();
+    valid = false;
+    for (int cy = 0; cy < size; cy++) {
+        for (int cx = 0; cx < size; cx++) {
+            // The cell covers the texels of its part of the quad plus a border
+            // of one texel, because rendering interpolates between texels.
+            int x0 = std::max(0, os + cx * qs / size - 1);
+            int x1 = std::min(tqs - 1, os + (cx + 1) * qs / size);
+            int y0 = std::max(0, os + cy * qs / size - 1);
+            int y1 = std::min(tqs - 1, os + (cy + 1) * qs / size);
+            float mine = +std::numeric_limits<float>::max();
+            float maxe = -std::numeric_limits<float>::max();
+            for (int y = y0; y <= y1; y++) {
+                for (int x = x0; x <= x1; x++) {
+                    int i = y * tqs + x;
+                    if (mask && mask[i] <= 127)
+                        continue;
+                    float v;
+                    // This matches the interpretation of the data in the processors
+                    if (db.type() == ecmdb::type_uint8)
+                        v = static_cast<const uint8_t*>(data)[i] / 255.0f;
+                    else if (db.type() == ecmdb::type_int16)
+                        v = static_cast<const int16_t*>(data)[i];
+                    else
+                        v = static_cast<const float*>(data)[i];
+                    v = db.data_offset() + db.data_factor() * v;
+                    if (v < mine)
+                        mine = v;
+                    if (v > maxe)
+                        maxe = v;
+                }
+            }
+            min_elev[cy * size + cx] = mine;
+            max_elev[cy * size + cx] = maxe;
+            if (mine <= maxe)
+                valid = true;
+        }
+    }
+}
+
+bool quad_elevation_grid::sub_quad_bounds(int level_difference, int x, int y, float* mine, float* maxe) const
+{
+    if (!valid || level_difference <= 0)
+        return false;
+    int cx0, cy0, cells;
+    if ((1 << level_difference) <= size) {
+        cells = size >> level_difference;
+        cx0 = x * cells;
+        cy0 = y * cells;
+    } else {
+        cells = 1;
+        cx0 = static_cast<int>((static_cast<long long>(x) * size) >> level_difference);
+        cy0 = static_cast<int>((static_cast<long long>(y) * size) >> level_difference);
+    }
+    *mine = +std::numeric_limits<float>::max();
+    *maxe = -std::numeric_limits<float>::max();
+    for (int cy = cy0; cy < cy0 + cells; cy++) {
+        for (int cx = cx0; cx < cx0 + cells; cx++) {
+            *mine = std::min(*mine, min_elev[cy * size + cx]);
+            *maxe = std::max(*maxe, max_elev[cy * size + cx]);
+        }
+    }
+    return (*mine <= *maxe);
+}
+
+
 /* GPU cache */
 
-quad_gpu::quad_gpu(quad_tex_pool* qtp, GLuint data_tex, GLuint mask_tex, const ecmdb::metadata& meta) :
-    _quad_tex_pool(qtp), data_tex(data_tex), mask_tex(mask_tex), meta(meta)
+quad_gpu::quad_gpu(quad_tex_pool* qtp, GLuint data_tex, GLuint mask_tex, const ecmdb::metadata& meta,
+        const quad_elevation_grid& elevation_grid) :
+    _quad_tex_pool(qtp), data_tex(data_tex), mask_tex(mask_tex), meta(meta), elevation_grid(elevation_grid)
 {
     assert(data_tex == 0 || meta.is_valid());
 };
@@ -54,8 +135,9 @@ quad_gpu::~quad_gpu()
 
 /* Memory cache */
 
-quad_mem_cache_loader::quad_mem_cache_loader(const quad_key& key, const ecmdb& db, const std::string& filename) :
-    _db(db), _filename(filename), key(key), quad_mem(), quad_mem_size(0)
+quad_mem_cache_loader::quad_mem_cache_loader(const quad_key& key, const ecmdb& db, const std::string& filename,
+        const quad_mem_processing* processing) :
+    _db(db), _filename(filename), _processing(processing), key(key), quad_mem(), quad_mem_size(0)
 {
 }
 
@@ -65,6 +147,7 @@ quad_mem_cache_loader::~quad_mem_cache_loader()
 
 void quad_mem_cache_loader::run()
 {
+    TRC_SCOPE("load quad");
     quad_mem.reset(new class quad_mem);
     quad_mem.get()->data.resize(_db.data_size());
     quad_mem.get()->mask.resize(_db.mask_size());
@@ -72,20 +155,34 @@ void quad_mem_cache_loader::run()
     _db.load_quad(_filename, quad_mem.get()->data.ptr(), quad_mem.get()->mask.ptr<uint8_t>(), &all_valid, &(quad_mem.get()->meta));
     if (all_valid)
         quad_mem.get()->mask.free();
-    quad_mem_size = _db.data_size() + _db.mask_size() + sizeof(ecmdb::metadata);
+    if (_processing) {
+        if (quad_mem.get()->data.ptr())
+            _processing->process(quad_mem.get());
+        quad_mem_size = quad_mem.get()->data.size() + quad_mem.get()->mask.size() + sizeof(ecmdb::metadata);
+        return;
+    }
+    if (_db.category() == ecmdb::category_elevation && quad_mem.get()->meta.is_valid()) {
+        quad_mem.get()->elevation_grid.compute(_db, quad_mem.get()->data.ptr(),
+                all_valid ? NULL : quad_mem.get()->mask.ptr<uint8_t>());
+    }
+    quad_mem_size = _db.data_size() + _db.mask_size() + sizeof(ecmdb::metadata) + sizeof(quad_elevation_grid);
 }
 
 
-quad_mem_cache_loaders::quad_mem_cache_loaders(unsigned char size, quad_mem_cache* qmc) :
-    thread_group(size), _quad_mem_cache(qmc)
+quad_mem_cache_loaders::quad_mem_cache_loaders(unsigned char size, quad_mem_cache* qmc, quad_metadata_cache* qmdc) :
+    thread_group(size), _quad_mem_cache(qmc), _quad_metadata_cache(qmdc), _mutex("mem loaders")
 {
 }
 
-bool quad_mem_cache_loaders::start_load(const quad_key& key, const ecmdb& db, const std::string& filename)
+bool quad_mem_cache_loaders::start_load(const quad_key& key, const ecmdb& db, const std::string& filename,
+        const quad_mem_processing* processing)
 {
+    std::unique_ptr<const quad_mem_processing> p(processing);
+    if (quad_trace::active())
+        quad_trace::record(quad_trace::op_start_load, quad_trace::tier_mem, key.db_id, key.quad, key.approx_level, 0);
     if (_active_loaders.find(key) != _active_loaders.end())
         return true;
-    std::unique_ptr<quad_mem_cache_loader> t(new quad_mem_cache_loader(key, db, filename));
+    std::unique_ptr<quad_mem_cache_loader> t(new quad_mem_cache_loader(key, db, filename, p.release()));
     bool r = this->start(t.get(), thread::priority_min);
     if (r) {
         _active_loaders.insert(key);
@@ -94,12 +191,13 @@ bool quad_mem_cache_loaders::start_load(const quad_key& key, const ecmdb& db, co
     return r;
 }
 
-bool quad_mem_cache_loaders::locked_start_load(const quad_key& key, const ecmdb& db, const std::string& filename)
+bool quad_mem_cache_loaders::locked_start_load(const quad_key& key, const ecmdb& db, const std::string& filename,
+        const quad_mem_processing* processing, const char* file, int line)
 {
     bool r;
-    _mutex.lock();
+    _mutex.lock(file, line);
     try {
-        r = start_load(key, db, filename);
+        r = start_load(key, db, filename, processing);
     }
     catch (exc& e) {
         _mutex.unlock();
@@ -120,6 +218,8 @@ void quad_mem_cache_loaders::get_results()
         auto it = _active_loaders.find(t->key);
         assert(it != _active_loaders.end());
         _active_loaders.erase(it);
+        if (_quad_metadata_cache && t->key.processing == 0)
+            _quad_metadata_cache->locked_put_pyramid(t->key, t->quad_mem.get());
         _quad_mem_cache->put(t->key, t->quad_mem.release(), t->quad_mem_size);
     }
 }
@@ -128,7 +228,7 @@ void quad_mem_cache_loaders::get_results()
 /* Disk cache */
 
 quad_disk_cache::quad_disk_cache(const std::string& app_id, const std::string& cache_dir) :
-    lru_cache<quad_disk, quad_key, false>(0), app_id(app_id), cache_dir(cache_dir)
+    lru_cache<quad_disk, quad_key, false>(0, "disk cache"), app_id(app_id), cache_dir(cache_dir)
 {
 }
 
@@ -160,6 +260,11 @@ std::string quad_disk_cache::quad_filename(const std::string& db_url, const glvm
     return cache_dir + '/' + db_dir(db_url) + '/' + ecmdb::quad_filename(quad[0], quad[1], quad[2], quad[3]);
 }
 
+std::string quad_disk_cache::metadata_pyramid_filename(const std::string& db_url)
+{
+    return cache_dir + '/' + db_dir(db_url) + "/metadata-pyramid";
+}
+
 quad_disk_cache_checker::quad_disk_cache_checker(const quad_key& key, const std::string& filename) :
     _filename(filename), key(key)
 {
@@ -167,6 +272,7 @@ quad_disk_cache_checker::quad_disk_cache_checker(const quad_key& key, const std:
 
 void quad_disk_cache_checker::run()
 {
+    TRC_SCOPE("check disk cache");
     struct stat buf;
     bool r = fio::stat(_filename, &buf);
     result = r ? (buf.st_size == 0 ? quad_disk::cached_empty : quad_disk::cached) : quad_disk::uncached;
@@ -174,12 +280,14 @@ void quad_disk_cache_checker::run()
 
 
 quad_disk_cache_checkers::quad_disk_cache_checkers(unsigned char size, quad_disk_cache *qcd) :
-    thread_group(size), _quad_disk_cache(qcd)
+    thread_group(size), _quad_disk_cache(qcd), _mutex("disk checkers")
 {
 }
 
 bool quad_disk_cache_checkers::start_check(const quad_key& key, const std::string& filename)
 {
+    if (quad_trace::active())
+        quad_trace::record(quad_trace::op_start_check, quad_trace::tier_disk, key.db_id, key.quad, key.approx_level, 0);
     if (_active_checkers.find(key) != _active_checkers.end())
         return true;
     std::unique_ptr<quad_disk_cache_checker> t(new quad_disk_cache_checker(key, filename));
@@ -191,10 +299,10 @@ bool quad_disk_cache_checkers::start_check(const quad_key& key, const std::strin
     return r;
 }
 
-bool quad_disk_cache_checkers::locked_start_check(const quad_key& key, const std::string& filename)
+bool quad_disk_cache_checkers::locked_start_check(const quad_key& key, const std::string& filename, const char* file, int line)
 {
     bool r;
-    _mutex.lock();
+    _mutex.lock(file, line);
     try {
         r = start_check(key, filename);
     }
@@ -224,12 +332,14 @@ void quad_disk_cache_checkers::get_results()
 
 quad_disk_cache_fetcher::quad_disk_cache_fetcher(const quad_disk_cache* qcd, const quad_key& key,
         const ecmdb& db, const std::string& db_url, const std::string& db_username, const std::string& db_password) :
-    _quad_disk_cache(qcd), _db(db), _db_url(db_url), _db_username(db_username), _db_password(db_password), key(key)
+    _quad_disk_cache(qcd), _db(db), _db_url(db_url), _db_username(db_username), _db_password(db_password), key(key),
+    result(quad_disk::uncached)
 {
 }
 
 void quad_disk_cache_fetcher::run()
 {
+    TRC_SCOPE("fetch quad");
     // This function may download the quad data and store it.
     // But it may also return immediately if it thinks that another process or
     // thread already is in the process of caching the quad.
@@ -304,10 +414,15 @@ void quad_disk_cache_fetcher::run()
             download(quad_tmp_f, quad_url, _db_username, _db_password);
         }
         catch (exc& e) {
-            if (e.sys_errno() == ENOENT)
+            if (e.sys_errno() == ENOENT) {
                 quad_is_empty = true;
-            else
+            } else {
+                // Remove the incomplete file so that the quad can be fetched
+                // again; the result stays uncached.
+                try { fio::close(quad_tmp_f, quad_tmp); } catch (...) { }
+                try { fio::remove(quad_tmp); } catch (...) { }
                 throw e;
+            }
         }
         fio::flush(quad_tmp_f, quad_tmp);
         fio::advise(quad_tmp_f, POSIX_FADV_DONTNEED, quad_tmp);
@@ -327,13 +442,15 @@ void quad_disk_cache_fetcher::run()
 
 
 quad_disk_cache_fetchers::quad_disk_cache_fetchers(unsigned char size, quad_disk_cache* qcd) :
-    thread_group(size), _quad_disk_cache(qcd)
+    thread_group(size), _quad_disk_cache(qcd), _mutex("disk fetchers")
 {
 }
 
 bool quad_disk_cache_fetchers::start_fetch(const quad_key& key,
             const ecmdb& db, const std::string& db_url, const std::string& db_username, const std::string& db_password)
 {
+    if (quad_trace::active())
+        quad_trace::record(quad_trace::op_start_fetch, quad_trace::tier_disk, key.db_id, key.quad, key.approx_level, 0);
     if (_active_fetchers.find(key) != _active_fetchers.end())
         return true;
     std::unique_ptr<quad_disk_cache_fetcher> t(new quad_disk_cache_fetcher(
@@ -347,10 +464,11 @@ bool quad_disk_cache_fetchers::start_fetch(const quad_key& key,
 }
 
 bool quad_disk_cache_fetchers::locked_start_fetch(const quad_key& key,
-            const ecmdb& db, const std::string& db_url, const std::string& db_username, const std::string& db_password)
+            const ecmdb& db, const std::string& db_url, const std::string& db_username, const std::string& db_password,
+            const char* file, int line)
 {
     bool r;
-    _mutex.lock();
+    _mutex.lock(file, line);
     try {
         r = start_fetch(key, db, db_url, db_username, db_password);
     }
@@ -377,3 +495,220 @@ void quad_disk_cache_fetchers::get_results()
             _quad_disk_cache->put(t->key, new quad_disk(t->result));
     }
 }
+
+
+/* Metadata pyramid */
+
+uint64_t quad_metadata_pyramid::identity(const ecmdb& db, const ecmdb::metadata& meta, const std::string& db_url)
+{
+    std::ostringstream oss;
+    db.save(oss);
+    meta.save(oss);
+    if (db_url.substr(0, 7) == "file://") {
+        // Local databases can be regenerated in place, e.g. by ecmdbgen.
+        const char* files[] = { "ecmdb.txt", "meta.txt" };
+        for (int i = 0; i < 2; i++) {
+            struct stat buf;
+            if (fio::stat(db_url.substr(7) + files[i], &buf))
+                oss << ' ' << static_cast<long long>(buf.st_mtime);
+        }
+    }
+    // djb2, as in quad_disk_cache::db_dir()
+    std::string s = oss.str();
+    uint64_t djb2_hash = 5381;
+    for (size_t i = 0; i < s.length(); i++)
+        djb2_hash = djb2_hash * 33 + static_cast<unsigned char>(s[i]);
+    return djb2_hash;
+}
+
+quad_metadata_pyramid::quad_metadata_pyramid(int db_levels, uint64_t identity, const std::string& filename) :
+    _filename(filename), _identity(identity), _levels(std::min(db_levels, static_cast<int>(max_levels))),
+    _state(6 * entries(_levels), static_cast<unsigned char>(unknown)),
+    _min_elev(6 * entries(_levels), 0.0f),
+    _max_elev(6 * entries(_levels), 0.0f),
+    _mutex("metadata pyramid"), _modified(false)
+{
+    if (!_filename.empty() && fio::test_f(_filename)) {
+        try {
+            load();
+        }
+        catch (exc& e) {
+            msg::wrn("Ignoring metadata pyramid: %s", e.what());
+            std::fill(_state.begin(), _state.end(), static_cast<unsigned char>(unknown));
+        }
+    }
+}
+
+quad_metadata_pyramid::~quad_metadata_pyramid()
+{
+    if (_modified && !_filename.empty()) {
+        try {
+            save();
+        }
+        catch (exc& e) {
+            msg::wrn("Cannot save metadata pyramid: %s", e.what());
+        }
+    }
+}
+
+static const char metadata_pyramid_magic[8] = { 'E', 'C', 'M', 'V', 'M', 'D', 'P', '2' };
+
+void quad_metadata_pyramid::load()
+{
+    FILE* f = fio::open(_filename, "r");
+    try {
+        char magic[8];
+        uint64_t identity;
+        int32_t levels;
+        fio::read(magic, sizeof(magic), 1, f, _filename);
+        fio::read(&identity, sizeof(identity), 1, f, _filename);
+        fio::read(&levels, sizeof(levels), 1, f, _filename);
+        if (std::memcmp(magic, metadata_pyramid_magic, sizeof(magic)) != 0 || levels != _levels)
+            throw exc(_filename + ": invalid or incompatible metadata pyramid");
+        if (identity != _identity)
+            throw exc(_filename + ": metadata pyramid belongs to a previous version of the database");
+        fio::read(&(_state[0]), sizeof(unsigned char), _state.size(), f, _filename);
+        fio::read(&(_min_elev[0]), sizeof(float), _min_elev.size(), f, _filename);
+        fio::read(&(_max_elev[0]), sizeof(float), _max_elev.size(), f, _filename);
+    }
+    catch (...) {
+        std::fclose(f);
+        throw;
+    }
+    fio::close(f, _filename);
+}
+
+void quad_metadata_pyramid::save()
+{
+    // Write to a temporary file first and rename it afterwards, so that other
+    // application instances never see an incomplete file.
+    fio::mkdir_p(fio::dirname(_filename));
+    FILE* f;
+    std::string tmp = fio::mktempfile(&f, fio::dirname(_filename));
+    try {
+        int32_t levels = _levels;
+        fio::write(metadata_pyramid_magic, sizeof(metadata_pyramid_magic), 1, f, tmp);
+        fio::write(&_identity, sizeof(_identity), 1, f, tmp);
+        fio::write(&levels, sizeof(levels), 1, f, tmp);
+        fio::write(&(_state[0]), sizeof(unsigned char), _state.size(), f, tmp);
+        fio::write(&(_min_elev[0]), sizeof(float), _min_elev.size(), f, tmp);
+        fio::write(&(_max_elev[0]), sizeof(float), _max_elev.size(), f, tmp);
+    }
+    catch (...) {
+        std::fclose(f);
+        fio::remove(tmp);
+        throw;
+    }
+    fio::close(f, tmp);
+    fio::rename(tmp, _filename);
+}
+
+void quad_metadata_pyramid::set(size_t i, unsigned char state, float min_elev, float max_elev)
+{
+    // The caller holds the mutex. See get() for the reader side.
+    volatile unsigned char* s = &(_state[i]);
+    *s = unknown;
+    atomic::barrier();
+    _min_elev[i] = min_elev;
+    _max_elev[i] = max_elev;
+    atomic::barrier();
+    *s = state;
+    _modified = true;
+}
+
+void quad_metadata_pyramid::put(const glvm::ivec4& quad, const ecmdb::metadata& meta,
+        const quad_elevation_grid& elevation_grid)
+{
+    if (quad[1] >= _levels)
+        return;
+    size_t i = index(quad);
+    _mutex.lock();
+    if (_state[i] & (exact | empty)) {
+        _mutex.unlock();
+        return;
+    }
+    if (!meta.is_valid()) {
+        set(i, empty, 0.0f, 0.0f);
+        _mutex.unlock();
+        return;
+    }
+    assert(meta.category == ecmdb::category_elevation);
+    set(i, exact, meta.elevation.min, meta.elevation.max);
+    if (!elevation_grid.valid) {
+        _mutex.unlock();
+        return;
+    }
+    // The grid resolves two levels below the quad.
+    for (int ld = 1; ld <= 2 && quad[1] + ld < _levels; ld++) {
+        for (int y = 0; y < (1 << ld); y++) {
+            for (int x = 0; x < (1 << ld); x++) {
+                glvm::ivec4 sub_quad(quad[0], quad[1] + ld, (quad[2] << ld) + x, (quad[3] << ld) + y);
+                size_t j = index(sub_quad);
+                float min_elev, max_elev;
+                if (_state[j] == unknown
+                        && elevation_grid.sub_quad_bounds(ld, x, y, &min_elev, &max_elev)) {
+                    set(j, derived,
+                            std::max(min_elev, meta.elevation.min),
+                            std::min(max_elev, meta.elevation.max));
+                }
+            }
+        }
+    }
+    _mutex.unlock();
+}
+
+void quad_metadata_pyramid::put_empty(const glvm::ivec4& quad)
+{
+    if (quad[1] >= _levels)
+        return;
+    size_t i = index(quad);
+    _mutex.lock();
+    if (_state[i] != empty)
+        set(i, empty, 0.0f, 0.0f);
+    _mutex.unlock();
+}
+
+quad_metadata_cache::~quad_metadata_cache()
+{
+    for (auto it = _pyramids.begin(); it != _pyramids.end(); it++)
+        delete it->second;
+}
+
+quad_metadata_pyramid* quad_metadata_cache::locked_get_pyramid(const uuid& db_id, const ecmdb& db, const ecmdb::metadata& meta,
+        const std::string& db_url, const std::string& filename)
+{
+    quad_metadata_pyramid* pyramid;
+    _pyramids_mutex.lock();
+    auto it = _pyramids.find(db_id);
+    if (it != _pyramids.end()) {
+        pyramid = it->second;
+    } else {
+        try {
+            pyramid = new quad_metadata_pyramid(db.levels(),
+                    quad_metadata_pyramid::identity(db, meta, db_url), filename);
+        }
+        catch (...) {
+            _pyramids_mutex.unlock();
+            throw;
+        }
+        _pyramids.insert(std::pair<uuid, quad_metadata_pyramid*>(db_id, pyramid));
+    }
+    _pyramids_mutex.unlock();
+    return pyramid;
+}
+
+void quad_metadata_cache::locked_put_pyramid(const quad_key& key, const quad_mem* qmem)
+{
+    // Only original quads have exact metadata
+    if (key.approx_level != key.quad[1])
+        return;
+    _pyramids_mutex.lock();
+    auto it = _pyramids.find(key.db_id);
+    if (it != _pyramids.end()) {
+        if (qmem->meta.is_valid())
+            it->second->put(key.quad, qmem->meta, qmem->elevation_grid);
+        else
+            it->second->put_empty(key.quad);
+    }
+    _pyramids_mutex.unlock();
+}
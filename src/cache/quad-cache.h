@@ -24,6 +24,8 @@
 #include <string>
 #include <memory>
 #include <set>
+#include <map>
+#include <vector>
 
 #include <GL/glew.h>
 
@@ -37,6 +39,7 @@
 #include "uuid.h"
 #include "lru.h"
 #include "quad-tex-pool.h"
+#include "quad-trace.h"
 
 
 /* A cache key for a quad */
@@ -47,12 +50,14 @@ public:
     uuid db_id;
     glvm::ivec4 quad;
     int approx_level;
+    unsigned int processing;    // 0 for the quad as stored, otherwise the CPU processing generation
 
-    quad_key(const uuid& db_id, const glvm::ivec4& quad, int approx_level = -1)
+    quad_key(const uuid& db_id, const glvm::ivec4& quad, int approx_level = -1, unsigned int processing = 0)
     {
         this->db_id = db_id;
         this->quad = quad;
         this->approx_level = approx_level;
+        this->processing = processing;
     }
 
     quad_key(const quad_key &key)
@@ -60,6 +65,7 @@ public:
         db_id = key.db_id;
         quad = key.quad;
         approx_level = key.approx_level;
+        processing = key.processing;
     }
 
     bool operator<(const quad_key& qk) const
@@ -86,10 +92,51 @@ public:
             return false;
         if (approx_level < qk.approx_level)
             return true;
+        if (approx_level > qk.approx_level)
+            return false;
+        if (processing < qk.processing)
+            return true;
         return false;
     }
 };
 
+/* Record a cache access in the quad trace, if recording is active */
+
+inline void trace_quad_access(enum quad_trace::tier tier, const quad_key& key, enum cache_access access, size_t size)
+{
+    if (quad_trace::active()) {
+        quad_trace::record(access == cache_access_hit ? quad_trace::op_hit
+                : access == cache_access_miss ? quad_trace::op_miss
+                : quad_trace::op_put,
+                tier, key.db_id, key.quad, key.approx_level, size);
+    }
+}
+
+/* Coarse elevation bounds for the parts of an elevation quad. As long as
+ * the metadata of a sub-quad is not available, its bounds from this grid
+ * are much tighter than the bounds of the whole quad. */
+
+class quad_elevation_grid
+{
+public:
+    static const int size = 4;          // The grid has size x size cells
+    bool valid;
+    float min_elev[size * size];        // Row-major, in the order of the quad data
+    float max_elev[size * size];
+
+    quad_elevation_grid() : valid(false)
+    {
+    }
+
+    // Compute the grid from the data and mask of an elevation quad. The mask
+    // may be NULL if all data is valid.
+    void compute(const ecmdb& db, const void* data, const uint8_t* mask);
+
+    // Get the bounds of the sub-quad with the relative coordinates (x, y) at
+    // the given level difference. Return false if the grid does not know them.
+    bool sub_quad_bounds(int level_difference, int x, int y, float* min_elev, float* max_elev) const;
+};
+
 /* GPU cache */
 
 class quad_gpu
@@ -101,18 +148,26 @@ public:
     const GLuint data_tex;
     const GLuint mask_tex;
     const ecmdb::metadata meta;
+    const quad_elevation_grid elevation_grid;
     // data_tex == 0: quad contains no valid data
     // data_tex != 0 && mask_tex == 0: quad contains fully valid data
     // data_tex != 0 && mask_tex != 0: quad data validity stored in mask_tex
 
-    quad_gpu(quad_tex_pool* qtp, GLuint data_tex, GLuint mask_tex, const ecmdb::metadata& meta);
+    quad_gpu(quad_tex_pool* qtp, GLuint data_tex, GLuint mask_tex, const ecmdb::metadata& meta,
+            const quad_elevation_grid& elevation_grid = quad_elevation_grid());
     ~quad_gpu();
 };
 
 class quad_gpu_cache : public lru_cache<quad_gpu, quad_key, false>
 {
+protected:
+    void observe_access(const quad_key& key, enum cache_access access, size_t size)
+    {
+        trace_quad_access(quad_trace::tier_gpu, key, access, size);
+    }
+
 public:
-    quad_gpu_cache() : lru_cache<quad_gpu, quad_key, false>(0)
+    quad_gpu_cache() : lru_cache<quad_gpu, quad_key, false>(0, "gpu cache")
     {
     }
 };
@@ -125,6 +180,7 @@ public:
     blob data;
     blob mask;
     ecmdb::metadata meta;
+    quad_elevation_grid elevation_grid;         // only for elevation quads
     // data.ptr() == 0: quad contains no valid data
     // data.ptr() != 0 && mask.ptr() == 0: quad contains fully valid data
     // data.ptr() != 0 && mask.ptr() != 0: quad data validity stored in mask_tex
@@ -132,24 +188,44 @@ public:
 
 class quad_mem_cache : public lru_cache<quad_mem, quad_key, false>
 {
+protected:
+    void observe_access(const quad_key& key, enum cache_access access, size_t size)
+    {
+        trace_quad_access(quad_trace::tier_mem, key, access, size);
+    }
+
 public:
-    quad_mem_cache() : lru_cache<quad_mem, quad_key, false>(0)
+    quad_mem_cache() : lru_cache<quad_mem, quad_key, false>(0, "mem cache")
     {
     }
 };
 
+/* Processing of a quad on a loader thread, after loading it. It replaces
+ * the data, mask, and metadata of the quad with the processed ones. The
+ * renderer uses this for CPU processing; see cpu_quad_processing. */
+
+class quad_mem_processing
+{
+public:
+    virtual ~quad_mem_processing() {}
+    virtual void process(quad_mem* qmem) const = 0;
+};
+
 class quad_mem_cache_loader : public thread
 {
 private:
     const ecmdb _db;
     const std::string _filename;
+    std::unique_ptr<const quad_mem_processing> _processing;
 
 public:
     quad_key key;
     std::unique_ptr<class quad_mem> quad_mem;
     size_t quad_mem_size;
 
-    quad_mem_cache_loader(const quad_key& key, const ecmdb& db, const std::string& filename);
+    // The loader takes ownership of the processing, which may be NULL.
+    quad_mem_cache_loader(const quad_key& key, const ecmdb& db, const std::string& filename,
+            const quad_mem_processing* processing = NULL);
     ~quad_mem_cache_loader();
     virtual void run();
 };
@@ -159,12 +235,18 @@ class quad_mem_cache_loaders : public thread_group
 private:
     std::set<quad_key> _active_loaders;
     quad_mem_cache* _quad_mem_cache;
+    class quad_metadata_cache* _quad_metadata_cache;
     mutex _mutex;
 
 public:
-    quad_mem_cache_loaders(unsigned char size, quad_mem_cache* qmc);
-    bool start_load(const quad_key& key, const ecmdb& db, const std::string& filename);
-    bool locked_start_load(const quad_key& key, const ecmdb& db, const std::string& filename);
+    quad_mem_cache_loaders(unsigned char size, quad_mem_cache* qmc, class quad_metadata_cache* qmdc = NULL);
+    // Start loading a quad, and processing it if processing is not NULL.
+    // These functions take ownership of the processing.
+    bool start_load(const quad_key& key, const ecmdb& db, const std::string& filename,
+            const quad_mem_processing* processing = NULL);
+    bool locked_start_load(const quad_key& key, const ecmdb& db, const std::string& filename,
+            const quad_mem_processing* processing = NULL,
+            const char* file = PTH_CALLER_FILE, int line = PTH_CALLER_LINE);
     void get_results();
 };
 
@@ -189,6 +271,12 @@ public:
 
 class quad_disk_cache : public lru_cache<quad_disk, quad_key, false>
 {
+protected:
+    void observe_access(const quad_key& key, enum cache_access access, size_t size)
+    {
+        trace_quad_access(quad_trace::tier_disk, key, access, size);
+    }
+
 public:
     const std::string app_id;
     const std::string cache_dir;
@@ -196,6 +284,7 @@ public:
     quad_disk_cache(const std::string& app_id, const std::string& cache_dir);
     static std::string db_dir(const std::string& db_url);
     std::string quad_filename(const std::string& db_url, const glvm::ivec4& quad);
+    std::string metadata_pyramid_filename(const std::string& db_url);
 };
 
 class quad_disk_cache_checker : public thread
@@ -221,7 +310,7 @@ private:
 public:
     quad_disk_cache_checkers(unsigned char size, quad_disk_cache* qcd);
     bool start_check(const quad_key& key, const std::string& filename);
-    bool locked_start_check(const quad_key& key, const std::string& filename);
+    bool locked_start_check(const quad_key& key, const std::string& filename, const char* file = PTH_CALLER_FILE, int line = PTH_CALLER_LINE);
     void get_results();
 };
 
@@ -255,18 +344,142 @@ public:
     bool start_fetch(const quad_key& key,
             const ecmdb& db, const std::string& db_url, const std::string& db_username, const std::string& db_password);
     bool locked_start_fetch(const quad_key& key,
-            const ecmdb& db, const std::string& db_url, const std::string& db_username, const std::string& db_password);
+            const ecmdb& db, const std::string& db_url, const std::string& db_username, const std::string& db_password,
+            const char* file = PTH_CALLER_FILE, int line = PTH_CALLER_LINE);
     void get_results();
 };
 
 /* Metadata cache (in main memory) */
 
-class quad_metadata_cache : public lru_cache<ecmdb::metadata, quad_key, false>
+class quad_metadata
 {
 public:
-    quad_metadata_cache() : lru_cache<ecmdb::metadata, quad_key, false>(0)
+    ecmdb::metadata meta;
+    quad_elevation_grid elevation_grid;
+
+    quad_metadata(const ecmdb::metadata& meta, const quad_elevation_grid& elevation_grid = quad_elevation_grid()) :
+        meta(meta), elevation_grid(elevation_grid)
+    {
+    }
+};
+
+/* Metadata pyramid (in main memory, persistent in the disk cache directory)
+ *
+ * A dense array of elevation bounds for all quads of one elevation database
+ * up to a fixed level. In contrast to the metadata cache, it never forgets
+ * anything, and lookups need neither locks nor allocation.
+ * Writers are serialized by a mutex. An entry only changes from unknown to
+ * derived, exact or empty, from derived to exact or empty, and from exact to
+ * empty. While its bounds are written, its state is unknown, so a reader that
+ * sees the same state before and after reading the bounds got consistent
+ * values.
+ * The saved file is tied to the identity of the database; see identity(). */
+
+class quad_metadata_pyramid
+{
+public:
+    static const int max_levels = 9;   // 6 * (4^9 - 1) / 3 entries of 9 bytes each = 4.5 MiB
+
+    enum {
+        unknown = 0,
+        exact = 1,      // bounds from the metadata of the quad itself
+        derived = 2,    // bounds from the elevation grid of an ancestor
+        empty = 4       // the quad contains no valid data
+    };
+
+private:
+    const std::string _filename;
+    const uint64_t _identity;
+    const int _levels;
+    mutex _mutex;
+    std::vector<unsigned char> _state;
+    std::vector<float> _min_elev;
+    std::vector<float> _max_elev;
+    bool _modified;
+
+    static size_t entries(int levels)
+    {
+        return ((static_cast<size_t>(1) << (2 * levels)) - 1) / 3;
+    }
+
+    size_t index(const glvm::ivec4& quad) const
+    {
+        return quad[0] * entries(_levels) + entries(quad[1])
+            + (static_cast<size_t>(quad[3]) << quad[1]) + quad[2];
+    }
+
+    void set(size_t i, unsigned char state, float min_elev, float max_elev);
+    void load();
+    void save();
+
+public:
+    // Compute the identity of a database from its description and metadata,
+    // and, for local databases, from the modification times of the files
+    // that hold them. A regenerated database gets a new identity.
+    static uint64_t identity(const ecmdb& db, const ecmdb::metadata& meta, const std::string& db_url);
+
+    // Create the pyramid for a database with the given number of levels.
+    // Previously saved entries are loaded from the given file if it was saved
+    // for a database with the same identity.
+    quad_metadata_pyramid(int db_levels, uint64_t identity, const std::string& filename);
+    // Save the pyramid if it changed.
+    ~quad_metadata_pyramid();
+
+    int levels() const
+    {
+        return _levels;
+    }
+
+    // Get the state of a quad, and its bounds if the state is exact or derived.
+    unsigned char get(const glvm::ivec4& quad, float* min_elev, float* max_elev) const
+    {
+        if (quad[1] >= _levels)
+            return unknown;
+        size_t i = index(quad);
+        const volatile unsigned char* state = &(_state[i]);
+        unsigned char state_before = *state;
+        atomic::barrier();
+        *min_elev = _min_elev[i];
+        *max_elev = _max_elev[i];
+        atomic::barrier();
+        return (*state == state_before ? state_before : static_cast<unsigned char>(unknown));
+    }
+
+    // Enter the metadata of a quad. If the elevation grid is valid, the
+    // bounds of descendants that are not known yet are derived from it.
+    void put(const glvm::ivec4& quad, const ecmdb::metadata& meta,
+            const quad_elevation_grid& elevation_grid = quad_elevation_grid());
+    // Enter a quad that contains no data.
+    void put_empty(const glvm::ivec4& quad);
+};
+
+class quad_metadata_cache : public lru_cache<quad_metadata, quad_key, false>
+{
+private:
+    std::map<uuid, quad_metadata_pyramid*> _pyramids;
+    mutex _pyramids_mutex;
+
+protected:
+    void observe_access(const quad_key& key, enum cache_access access, size_t size)
+    {
+        trace_quad_access(quad_trace::tier_metadata, key, access, size);
+    }
+
+public:
+    quad_metadata_cache() : lru_cache<quad_metadata, quad_key, false>(0, "metadata cache"),
+        _pyramids_mutex("metadata pyramids")
     {
     }
+    ~quad_metadata_cache();
+
+    // Get the metadata pyramid of an elevation database, creating it if
+    // necessary. The pyramid remains valid for the lifetime of this cache;
+    // clear() does not affect it.
+    quad_metadata_pyramid* locked_get_pyramid(const uuid& db_id, const ecmdb& db, const ecmdb::metadata& meta,
+            const std::string& db_url, const std::string& filename);
+    // Enter a newly loaded quad into the pyramid of its database, if that
+    // pyramid exists.
+    void locked_put_pyramid(const quad_key& key, const quad_mem* qmem);
 };
 
 #endif
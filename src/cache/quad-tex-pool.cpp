@@ -124,8 +124,10 @@ GLuint quad_tex_pool::get(GLint format, int size)
                  : format == GL_R32F ? "R32F"
                  : format == GL_RG32F ? "RG32F"
                  : "RGB32F"), size);
+        _stats.misses++;
         return xgl::CreateTex2D(format, size, size, GL_NEAREST);
     } else {
+        _stats.hits++;
         GLuint t = _texpool[index].back();
         _texpool[index].pop_back();
         return t;
@@ -145,9 +147,18 @@ void quad_tex_pool::put(GLuint tex)
         glBindTexture(GL_TEXTURE_2D, tex_bak);
         int index = get_texpool_index(format, size);
         _texpool[index].push_back(tex);
+        _stats.inserts++;
     }
 }
 
+size_t quad_tex_pool::size() const
+{
+    size_t s = 0;
+    for (int i = 0; i < _num_formats * _num_sizes; i++)
+        s += _texpool[i].size();
+    return s;
+}
+
 void quad_tex_pool::shrink(int keep)
 {
     assert(keep >= 0);
@@ -173,6 +184,8 @@ void quad_tex_pool::shrink(int keep)
                      : "RGB32F"),
                     size);
             glDeleteTextures(_texpool[i].size() - k, &(_texpool[i][k]));
+            _stats.evictions += _texpool[i].size() - k;
+            _stats.evicted_size += _texpool[i].size() - k;
             _texpool[i].resize(k);
         }
     }
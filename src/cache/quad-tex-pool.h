@@ -27,6 +27,8 @@
 
 #include <ecmdb/ecmdb.h>
 
+#include "lru.h"
+
 
 class quad_tex_pool
 {
@@ -43,6 +45,9 @@ private:
 
     int _quad_size;
     std::vector<GLuint> _texpool[_num_formats * _num_sizes];
+    // Hits and misses count reused and newly created textures, inserts count
+    // textures given back, and evictions count deleted textures.
+    cache_stats _stats;
 
     int get_texpool_index(GLint format, int size);
     void get_texpool_formatsize(int index, GLint* format, int* size);
@@ -58,6 +63,13 @@ public:
     GLuint get(GLint format, int size);
     void put(GLuint tex);
 
+    // Number of unused textures in the pool
+    size_t size() const;
+    cache_stats stats() const
+    {
+        return _stats;
+    }
+
     // Shrink the tex pool; free unused textures.
     // But keep enough textures that are needed for intermediate processing
     // steps for rendering the given number of quads.
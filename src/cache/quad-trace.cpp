@@ -0,0 +1,254 @@
+/*
+ * Copyright (C) 2013
+ * Computer Graphics Group, University of Siegen, Germany.
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>.
+ * See http://www.cg.informatik.uni-siegen.de/ for contact information.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <map>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+
+#include "exc.h"
+#include "fio.h"
+#include "msg.h"
+#include "pth.h"
+
+#include "quad-trace.h"
+
+
+namespace quad_trace
+{
+    // File header: magic, byte order mark, and event size.
+    static const char magic[8] = { 'E', 'C', 'M', 'Q', 'T', 'R', '\0', '\1' };
+    static const uint32_t byte_order_mark = 0x01020304;
+
+    // Events are written in batches of this size.
+    static const size_t buffer_size = 4096;
+
+    /* Writes full batches to the trace file, so that record() never does
+     * disk I/O. record() is called while quad cache locks are held. */
+    class writer : public thread
+    {
+    private:
+        mutex _mutex;
+        condition _cond;
+        std::vector<std::vector<event>*> _batches;
+        bool _stop;
+
+    public:
+        writer() : _stop(false)
+        {
+        }
+
+        void push(std::vector<event>* batch)
+        {
+            _mutex.lock();
+            _batches.push_back(batch);
+            _cond.wake_one();
+            _mutex.unlock();
+        }
+
+        void stop()
+        {
+            _mutex.lock();
+            _stop = true;
+            _cond.wake_one();
+            _mutex.unlock();
+        }
+
+        void run();
+    };
+
+    std::atomic<bool> _active(false);
+    static std::string _filename;
+    static FILE* _file = NULL;
+    static mutex _mutex;
+    static std::vector<event>* _buffer = NULL;
+    static std::map<uuid, int> _dbs;
+    static std::atomic<unsigned int> _frame(0);
+    static unsigned long long _events;
+    static writer* _writer = NULL;
+    static bool _write_error;
+}
+
+void quad_trace::writer::run()
+{
+    std::vector<std::vector<event>*> batches;
+    for (;;) {
+        _mutex.lock();
+        while (_batches.empty() && !_stop)
+            _cond.wait(_mutex);
+        batches.swap(_batches);
+        bool stop = _stop;
+        _mutex.unlock();
+        for (size_t i = 0; i < batches.size(); i++) {
+            if (!_write_error && !batches[i]->empty()) {
+                try {
+                    fio::write(&((*batches[i])[0]), sizeof(event), batches[i]->size(), _file, _filename);
+                }
+                catch (std::exception& ex) {
+                    // Do not disturb rendering; just stop recording.
+                    msg::err("%s", ex.what());
+                    _write_error = true;
+                    _active = false;
+                }
+            }
+            delete batches[i];
+        }
+        batches.clear();
+        if (stop)
+            break;
+    }
+}
+
+void quad_trace::start(const std::string& filename)
+{
+    _mutex.lock();
+    try {
+        _filename = filename;
+        _file = fio::open(_filename, "w");
+        uint32_t event_size = sizeof(event);
+        fio::write(magic, sizeof(magic), 1, _file, _filename);
+        fio::write(&byte_order_mark, sizeof(byte_order_mark), 1, _file, _filename);
+        fio::write(&event_size, sizeof(event_size), 1, _file, _filename);
+    }
+    catch (...) {
+        if (_file)
+            std::fclose(_file);
+        _file = NULL;
+        _mutex.unlock();
+        throw;
+    }
+    _buffer = new std::vector<event>;
+    _buffer->reserve(buffer_size);
+    _dbs.clear();
+    _frame = 0;
+    _events = 0;
+    _write_error = false;
+    _writer = new writer;
+    _writer->start();
+    _active = true;
+    _mutex.unlock();
+}
+
+void quad_trace::stop()
+{
+    _mutex.lock();
+    if (!_writer) {
+        _mutex.unlock();
+        return;
+    }
+    _active = false;
+    _writer->push(_buffer);
+    _buffer = NULL;
+    _writer->stop();
+    _writer->wait();
+    delete _writer;
+    _writer = NULL;
+    try {
+        fio::close(_file, _filename);
+    }
+    catch (...) {
+        _file = NULL;
+        _mutex.unlock();
+        throw;
+    }
+    _file = NULL;
+    if (!_write_error)
+        msg::inf("Wrote %llu quad cache events to %s", _events, _filename.c_str());
+    _mutex.unlock();
+}
+
+void quad_trace::set_frame(unsigned int frame)
+{
+    _frame = frame;
+}
+
+void quad_trace::record(enum op op, enum tier tier, const uuid& db_id, const glvm::ivec4& quad, int approx_level, size_t size)
+{
+    event e;
+    e.frame = _frame;
+    e.x = quad[2];
+    e.y = quad[3];
+    e.size = (size > std::numeric_limits<uint32_t>::max() ? std::numeric_limits<uint32_t>::max() : size);
+    e.op = op;
+    e.tier = tier;
+    e.side = quad[0];
+    e.level = quad[1];
+    e.approx_level = approx_level;
+    std::memset(e.reserved, 0, sizeof(e.reserved));
+    _mutex.lock();
+    if (!_active) {
+        _mutex.unlock();
+        return;
+    }
+    std::map<uuid, int>::iterator it = _dbs.find(db_id);
+    if (it == _dbs.end())
+        it = _dbs.insert(std::pair<uuid, int>(db_id, _dbs.size())).first;
+    e.db = it->second;
+    _buffer->push_back(e);
+    _events++;
+    if (_buffer->size() >= buffer_size) {
+        _writer->push(_buffer);
+        _buffer = new std::vector<event>;
+        _buffer->reserve(buffer_size);
+    }
+    _mutex.unlock();
+}
+
+void quad_trace::read(const std::string& filename, std::vector<event>& events)
+{
+    FILE* f = fio::open(filename, "r");
+    try {
+        char m[sizeof(magic)];
+        uint32_t bom, event_size;
+        fio::read(m, sizeof(m), 1, f, filename);
+        fio::read(&bom, sizeof(bom), 1, f, filename);
+        fio::read(&event_size, sizeof(event_size), 1, f, filename);
+        if (std::memcmp(m, magic, sizeof(magic)) != 0)
+            throw exc(filename + ": not a quad trace file");
+        if (bom != byte_order_mark || event_size != sizeof(event))
+            throw exc(filename + ": quad trace file was written on an incompatible platform");
+        events.clear();
+        event e;
+        while (std::fread(&e, sizeof(e), 1, f) == 1) {
+            if (e.op >= ops || e.tier >= tiers)
+                throw exc(filename + ": invalid quad trace event");
+            events.push_back(e);
+        }
+    }
+    catch (...) {
+        std::fclose(f);
+        throw;
+    }
+    fio::close(f, filename);
+}
+
+const char* quad_trace::tier_name(enum tier tier)
+{
+    static const char* names[] = { "metadata", "gpu", "mem", "disk" };
+    return names[tier];
+}
+
+const char* quad_trace::op_name(enum op op)
+{
+    static const char* names[] = { "hit", "miss", "put", "start check", "start fetch", "start load" };
+    return names[op];
+}
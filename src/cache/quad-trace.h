@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2013
+ * Computer Graphics Group, University of Siegen, Germany.
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>.
+ * See http://www.cg.informatik.uni-siegen.de/ for contact information.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file quad-trace.h
+ *
+ * Recording of quad cache accesses for offline simulation of cache policies.
+ *
+ * Between quad_trace::start() and quad_trace::stop(), every access to the
+ * quad caches (hits, misses, puts) and every start of a disk checker, disk
+ * fetcher or memory loader is appended to a compact binary trace file,
+ * together with the current frame number. Full batches of events are written
+ * by a separate thread, so that recording does no disk I/O while the quad
+ * cache locks are held. The ecmqtr tool replays such traces against
+ * different cache policies and sizes.
+ */
+
+#ifndef QUAD_TRACE_H
+#define QUAD_TRACE_H
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <stdint.h>
+
+#include "glvm.h"
+
+#include "uuid.h"
+
+
+namespace quad_trace
+{
+    enum tier {
+        tier_metadata,
+        tier_gpu,
+        tier_mem,
+        tier_disk,
+        tiers
+    };
+
+    enum op {
+        op_hit,             // cache get() found the quad
+        op_miss,            // cache get() did not find the quad
+        op_put,             // cache put(); size is in cache size units
+        op_start_check,     // disk cache checker was requested
+        op_start_fetch,     // disk cache fetcher was requested
+        op_start_load,      // memory cache loader was requested
+        ops
+    };
+
+    /* One trace event, as stored in the trace file (in host byte order). */
+    class event
+    {
+    public:
+        uint32_t frame;
+        int32_t x;
+        int32_t y;
+        uint32_t size;
+        uint8_t op;
+        uint8_t tier;
+        uint8_t side;
+        uint8_t level;
+        int8_t approx_level;
+        uint8_t db;         // database index, in order of first appearance
+        uint8_t reserved[2];
+    };
+
+    // Cleared by the writer thread on write errors, read by all recording threads
+    extern std::atomic<bool> _active;
+
+    /* Start recording to the given file. */
+    void start(const std::string& filename);
+    /* Stop recording and close the trace file. */
+    void stop();
+    /* Check whether recording is active. */
+    inline bool active()
+    {
+        return _active;
+    }
+
+    /* Set the frame number for subsequent events. */
+    void set_frame(unsigned int frame);
+
+    /* Record an event. */
+    void record(enum op op, enum tier tier, const uuid& db_id, const glvm::ivec4& quad, int approx_level, size_t size);
+
+    /* Read all events from a trace file. */
+    void read(const std::string& filename, std::vector<event>& events);
+
+    const char* tier_name(enum tier tier);
+    const char* op_name(enum op op);
+}
+
+#endif
@@ -38,10 +38,14 @@
 #include "fio.h"
 #include "msg.h"
 #include "opt.h"
+#include "pth.h"
+#include "trc.h"
 
 #include "uuid.h"
+#include "quad-trace.h"
 #include "state.h"
 #include "guimain.h"
+#include "benchmark.h"
 #if HAVE_LIBEQUALIZER
 # include "eqcontext.h"
 #endif
@@ -95,6 +99,28 @@ int main(int argc, char *argv[])
     options.push_back(&tracking);
     opt::flag equalizer("equalizer", 'E', opt::optional);
     options.push_back(&equalizer);
+    opt::string benchmark("benchmark", '\0', opt::optional);
+    options.push_back(&benchmark);
+    opt::string benchmark_output("benchmark-output", '\0', opt::optional);
+    options.push_back(&benchmark_output);
+    opt::tuple<int> benchmark_size("benchmark-size", '\0', opt::optional, 1, 16384,
+            std::vector<int>(), 2, "x");
+    options.push_back(&benchmark_size);
+    opt::val<int> benchmark_fps("benchmark-fps", '\0', opt::optional, 1, 1000, 30);
+    options.push_back(&benchmark_fps);
+    std::vector<std::string> benchmark_cache_values;
+    benchmark_cache_values.push_back("cold");
+    benchmark_cache_values.push_back("warm");
+    opt::val<std::string> benchmark_cache("benchmark-cache", '\0', opt::optional, benchmark_cache_values, "cold");
+    options.push_back(&benchmark_cache);
+    opt::string trace("trace", '\0', opt::optional);
+    options.push_back(&trace);
+    opt::string quad_trace_file("quad-trace", '\0', opt::optional);
+    options.push_back(&quad_trace_file);
+    opt::flag lock_profile("lock-profile", '\0', opt::optional);
+    options.push_back(&lock_profile);
+    opt::flag log_async("log-async", '\0', opt::optional);
+    options.push_back(&log_async);
     // Accept some Equalizer options. These are passed to Equalizer for interpretation.
     opt::val<std::string> eq_server("eq-server", '\0', opt::optional);
     options.push_back(&eq_server);
@@ -131,6 +157,20 @@ int main(int argc, char *argv[])
                 "    [-s|--state=<file>]    Load the given state.\n"
                 "    [--tracking=<t>]       Set tracking: off, eqevent, or dtrack. Default is off.\n"
                 "    [-E|--equalizer]       Start in Equalizer mode; do not start GUI.\n"
+                "    [--benchmark=<path>]   Replay the given camera path offscreen and report\n"
+                "                           frame time statistics as JSON; do not start GUI.\n"
+                "    [--benchmark-output=<file>]\n"
+                "                           Write benchmark results to file instead of stdout.\n"
+                "    [--benchmark-size=<w>x<h>]\n"
+                "                           Set benchmark frame size. Default is 1024x768.\n"
+                "    [--benchmark-fps=<n>]  Set benchmark camera path sampling rate. Default is 30.\n"
+                "    [--benchmark-cache=<c>]\n"
+                "                           Start benchmark with cold or warm caches. Default is cold.\n"
+                "    [--trace=<file>]       Write a performance trace in Chrome trace format.\n"
+                "    [--quad-trace=<file>]  Record quad cache accesses for replay with ecmqtr.\n"
+                "    [--lock-profile]       Profile lock contention and report it at exit.\n"
+                "    [--log-async]          Format and print debug and info messages in a\n"
+                "                           background thread.\n"
                 "Report bugs to <%s>.",
                 program_name, PACKAGE_BUGREPORT);
     }
@@ -161,10 +201,26 @@ int main(int argc, char *argv[])
             : tracking.value().compare("eqevent") == 0 ? 1
             : 2);
 
+    if (!trace.value().empty()) {
+#if ENABLE_TRACING
+        trc::start(trace.value());
+#else
+        msg::wrn("This version of " PACKAGE_NAME " was compiled without support for tracing.");
+#endif
+    }
+    if (lock_profile.value()) {
+        mutex_profiler::start();
+    }
+    if (log_async.value()) {
+        msg::start_async();
+    }
+
     int retval = 0;
     try {
         fio::mkdir_p(fio::dirname(conf_file));
         fio::mkdir_p(cache_dir);
+        if (!quad_trace_file.value().empty())
+            quad_trace::start(quad_trace_file.value());
         class state master_state(msg::level(), app_id, conf_file, cache_dir, track);
 #if W32
         msg::set_file(fio::open(fio::dirname(conf_file) + "/log.txt", "w"));
@@ -189,6 +245,17 @@ int main(int argc, char *argv[])
 #else
             throw exc("This version of " PACKAGE_NAME " was compiled without support for Equalizer.");
 #endif
+        } else if (!benchmark.value().empty()) {
+            benchmark_options bo;
+            bo.path_file = benchmark.value();
+            bo.output_file = benchmark_output.value();
+            if (benchmark_size.value().size() == 2) {
+                bo.width = benchmark_size.value()[0];
+                bo.height = benchmark_size.value()[1];
+            }
+            bo.fps = benchmark_fps.value();
+            bo.warm_cache = (benchmark_cache.value().compare("warm") == 0);
+            retval = gui_benchmark(&master_state, bo);
         } else {
             retval = gui_run(&master_state);
         }
@@ -197,6 +264,19 @@ int main(int argc, char *argv[])
         msg::err("%s", e.what());
         retval = 1;
     }
+    try {
+        trc::stop();
+        quad_trace::stop();
+        if (mutex_profiler::active()) {
+            mutex_profiler::stop();
+            msg::inf_txt(mutex_profiler::report());
+        }
+        msg::stop_async();
+    }
+    catch (std::exception& e) {
+        msg::err("%s", e.what());
+        retval = 1;
+    }
     if (!equalizer.value()) {
         gui_deinitialize();
     }
@@ -28,6 +28,7 @@
 #include "pth.h"
 #include "msg.h"
 #include "sys.h"
+#include "tmr.h"
 
 #include "glvm.h"
 #include "renderer.h"
@@ -366,9 +367,9 @@ protected:
         quad_disk_cache_checkers = new class quad_disk_cache_checkers(16, quad_disk_cache);
         quad_disk_cache_fetchers = new class quad_disk_cache_fetchers(16, quad_disk_cache);
         quad_mem_cache = new class quad_mem_cache();
-        quad_mem_cache_loaders = new class quad_mem_cache_loaders(
-                min(255, sys::processors() * 3 / 2 + 1), quad_mem_cache);
         quad_metadata_cache = new class quad_metadata_cache();
+        quad_mem_cache_loaders = new class quad_mem_cache_loaders(
+                min(255, sys::processors() * 3 / 2 + 1), quad_mem_cache, quad_metadata_cache);
         quad_base_data_mem_cache = new class quad_base_data_mem_cache();
         quad_base_data_mem_cache_computers = new class quad_base_data_mem_cache_computers(
                 min(255, sys::processors() * 3 / 2 + 1), quad_base_data_mem_cache);
@@ -580,10 +581,13 @@ protected:
         if (atomic::bool_compare_and_swap(&(node->per_node_maintenance_assigned), 0, 1)) {
             return true;
         } else {
+            long long t0 = (mutex_profiler::active() ? timer::get(timer::monotonic) : 0);
             while (!(node->per_node_maintenance_finished)) {
                 // busy loop until maintenance thread called finish_per_node_maintenance()
                 sys::sched_yield();
             }
+            if (mutex_profiler::active())
+                mutex_profiler::record("eq per-node maintenance", __FILE__, __LINE__, timer::get(timer::monotonic) - t0);
             return false;
         }
     }
@@ -597,10 +601,13 @@ protected:
         if (atomic::bool_compare_and_swap(&(window->per_glcontext_maintenance_assigned), 0, 1)) {
             return true;
         } else {
+            long long t0 = (mutex_profiler::active() ? timer::get(timer::monotonic) : 0);
             while (!(window->per_glcontext_maintenance_finished)) {
                 // busy loop until maintenance thread called finish_per_glcontext_maintenance()
                 sys::sched_yield();
             }
+            if (mutex_profiler::active())
+                mutex_profiler::record("eq per-glcontext maintenance", __FILE__, __LINE__, timer::get(timer::monotonic) - t0);
             return false;
         }
     }
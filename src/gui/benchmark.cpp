@@ -0,0 +1,420 @@
+/*
+ * Copyright (C) 2013
+ * Computer Graphics Group, University of Siegen, Germany.
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>.
+ * See http://www.cg.informatik.uni-siegen.de/ for contact information.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <cstdio>
+#include <cmath>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+#include <GL/glew.h>
+
+#include <QGLFormat>
+#include <QGLPixelBuffer>
+
+#include "exc.h"
+#include "fio.h"
+#include "msg.h"
+#include "str.h"
+#include "sys.h"
+#include "tmr.h"
+
+#include "glvm.h"
+#include "xgl.h"
+
+#include "renderer.h"
+#include "renderer-context.h"
+#include "quad-cache.h"
+#include "quad-base-data-cache.h"
+#include "quad-tex-pool.h"
+
+#include "benchmark.h"
+
+using namespace glvm;
+
+
+/* A renderer context without a window. The GL context must be current. */
+
+class BenchmarkContext : public renderer_context
+{
+private:
+    bool _initialized;
+    class state* _master_state;
+    ivec4 _viewport;
+    dfrust _frustum;
+    renderer _renderer;
+
+    class quad_disk_cache _quad_disk_cache;
+    class quad_disk_cache_checkers _quad_disk_cache_checkers;
+    class quad_disk_cache_fetchers _quad_disk_cache_fetchers;
+    class quad_mem_cache _quad_mem_cache;
+    class quad_mem_cache_loaders _quad_mem_cache_loaders;
+    class quad_gpu_cache _quad_gpu_cache;
+    class quad_metadata_cache _quad_metadata_cache;
+    class quad_base_data_mem_cache _quad_base_data_mem_cache;
+    class quad_base_data_mem_cache_computers _quad_base_data_mem_cache_computers;
+    class quad_base_data_gpu_cache _quad_base_data_gpu_cache;
+    class quad_tex_pool _quad_tex_pool;
+
+public:
+    BenchmarkContext(class state* master_state, int width, int height);
+    ~BenchmarkContext();
+
+    /* Empty the memory and GPU caches (not the disk cache) */
+    void clear_caches();
+
+    const renderpass_info& last_frame_info() const
+    {
+        return _renderer.get_info();
+    }
+
+    /* renderer_context functions for use by the application */
+    virtual void init_gl();
+    virtual void exit_gl();
+    virtual void render();
+
+    /* renderer_context functions for use by the renderer */
+    virtual const class state& state() const { return *_master_state; }
+    virtual bool start_per_node_maintenance() { return true; }
+    virtual void finish_per_node_maintenance() {}
+    virtual bool start_per_glcontext_maintenance() { return true; }
+    virtual void finish_per_glcontext_maintenance() {}
+    virtual class quad_disk_cache* quad_disk_cache() { return &_quad_disk_cache; }
+    virtual class quad_disk_cache_checkers* quad_disk_cache_checkers() { return &_quad_disk_cache_checkers; }
+    virtual class quad_disk_cache_fetchers* quad_disk_cache_fetchers() { return &_quad_disk_cache_fetchers; }
+    virtual class quad_mem_cache* quad_mem_cache() { return &_quad_mem_cache; }
+    virtual class quad_mem_cache_loaders* quad_mem_cache_loaders() { return &_quad_mem_cache_loaders; }
+    virtual class quad_gpu_cache* quad_gpu_cache() { return &_quad_gpu_cache; }
+    virtual class quad_metadata_cache* quad_metadata_cache() { return &_quad_metadata_cache; }
+    virtual class quad_base_data_mem_cache* quad_base_data_mem_cache() { return &_quad_base_data_mem_cache; }
+    virtual class quad_base_data_mem_cache_computers* quad_base_data_mem_cache_computers() { return &_quad_base_data_mem_cache_computers; }
+    virtual class quad_base_data_gpu_cache* quad_base_data_gpu_cache() { return &_quad_base_data_gpu_cache; }
+    virtual class quad_tex_pool* quad_tex_pool() { return &_quad_tex_pool; }
+};
+
+BenchmarkContext::BenchmarkContext(class state* master_state, int width, int height) :
+    _initialized(false),
+    _master_state(master_state), _viewport(0, 0, width, height), _renderer(*this),
+    _quad_disk_cache(master_state->app_id, master_state->cache_dir),
+    _quad_disk_cache_checkers(16, &_quad_disk_cache),
+    _quad_disk_cache_fetchers(16, &_quad_disk_cache),
+    _quad_mem_cache(),
+    _quad_mem_cache_loaders(min(255, sys::processors() * 3 / 2 + 1), &_quad_mem_cache, &_quad_metadata_cache),
+    _quad_gpu_cache(),
+    _quad_metadata_cache(),
+    _quad_base_data_mem_cache(),
+    _quad_base_data_mem_cache_computers(min(255, sys::processors() * 3 / 2 + 1), &_quad_base_data_mem_cache),
+    _quad_base_data_gpu_cache(),
+    _quad_tex_pool()
+{
+    // Same frustum as the GUI uses for a window of this size
+    double w = static_cast<double>(width) / 100.0 * 0.0254;
+    double h = static_cast<double>(height) / 100.0 * 0.0254;
+    _frustum.l() = - w / 2.0;
+    _frustum.r() = + w / 2.0;
+    _frustum.b() = - h / 2.0;
+    _frustum.t() = + h / 2.0;
+    _frustum.n() = 0.5;
+    _frustum.f() = 100.0;
+}
+
+BenchmarkContext::~BenchmarkContext()
+{
+    exit_gl();
+}
+
+void BenchmarkContext::init_gl()
+{
+    if (!_initialized) {
+        std::vector<std::string> missing_gl_features = renderer_context::initialize_gl();
+        if (!missing_gl_features.empty()) {
+            std::string list("");
+            for (size_t i = 0; i < missing_gl_features.size(); i++)
+                list += missing_gl_features[i] + std::string(" ");
+            throw exc("The following OpenGL features are not available: " + list);
+        }
+        _quad_tex_pool.init_gl();
+        _renderer.init_gl();
+        xgl::CheckError(HERE);
+        _initialized = true;
+    }
+}
+
+void BenchmarkContext::exit_gl()
+{
+    if (_initialized) {
+        _quad_gpu_cache.clear();
+        _quad_base_data_gpu_cache.clear();
+        _quad_tex_pool.exit_gl();
+        _renderer.exit_gl();
+        xgl::CheckError(HERE);
+        _initialized = false;
+    }
+}
+
+void BenchmarkContext::clear_caches()
+{
+    _quad_mem_cache_loaders.get_results();
+    _quad_base_data_mem_cache_computers.get_results();
+    _quad_gpu_cache.locked_clear();
+    _quad_base_data_gpu_cache.locked_clear();
+    _quad_mem_cache.locked_clear();
+    _quad_metadata_cache.locked_clear();
+    _quad_base_data_mem_cache.locked_clear();
+}
+
+void BenchmarkContext::render()
+{
+    glViewport(_viewport[0], _viewport[1], _viewport[2], _viewport[3]);
+    _renderer.render(_viewport, _frustum, dmat4(1.0));
+    tick();
+}
+
+
+/* Camera path */
+
+class key_frame
+{
+public:
+    double t;
+    dvec3 pos;
+    dquat rot;
+};
+
+static std::vector<key_frame> read_path(const std::string& filename)
+{
+    std::vector<key_frame> path;
+    FILE* f = fio::open(filename, "r");
+    int line_number = 0;
+    while (fio::has_more(f, filename)) {
+        std::string line = str::trim(fio::readline(f, filename));
+        line_number++;
+        if (line.empty() || line[0] == '#')
+            continue;
+        std::vector<std::string> t = str::tokens(line, " \t");
+        key_frame kf;
+        if (t.size() != 8
+                || !str::to(t[0], &kf.t)
+                || !str::to(t[1], &kf.pos.x) || !str::to(t[2], &kf.pos.y) || !str::to(t[3], &kf.pos.z)
+                || !str::to(t[4], &kf.rot.x) || !str::to(t[5], &kf.rot.y) || !str::to(t[6], &kf.rot.z)
+                || !str::to(t[7], &kf.rot.w)
+                || (!path.empty() && kf.t < path.back().t)) {
+            fio::close(f, filename);
+            throw exc(filename + ", line " + str::from(line_number) + ": invalid key frame");
+        }
+        kf.rot = normalize(kf.rot);
+        path.push_back(kf);
+    }
+    fio::close(f, filename);
+    if (path.empty())
+        throw exc(filename + ": no key frames");
+    return path;
+}
+
+static void interpolate_path(const std::vector<key_frame>& path, double t, dvec3* pos, dquat* rot)
+{
+    size_t i = 0;
+    while (i + 1 < path.size() && path[i + 1].t <= t)
+        i++;
+    if (i + 1 == path.size() || path[i + 1].t <= path[i].t) {
+        *pos = path[i].pos;
+        *rot = path[i].rot;
+    } else {
+        double alpha = (t - path[i].t) / (path[i + 1].t - path[i].t);
+        *pos = mix(path[i].pos, path[i + 1].pos, alpha);
+        // Normalized linear interpolation, along the shorter arc
+        dquat q1 = path[i + 1].rot;
+        if (dot(dvec4(path[i].rot), dvec4(q1)) < 0.0)
+            q1 = -q1;
+        *rot = normalize(dquat(mix(dvec4(path[i].rot), dvec4(q1), alpha)));
+    }
+}
+
+
+/* Statistics */
+
+static double percentile(const std::vector<double>& sorted_values, double p)
+{
+    // nearest-rank method
+    size_t rank = static_cast<size_t>(std::ceil(p / 100.0 * sorted_values.size()));
+    return sorted_values[rank == 0 ? 0 : rank - 1];
+}
+
+static std::string json_stats(const std::vector<double>& values)
+{
+    std::vector<double> v(values);
+    std::sort(v.begin(), v.end());
+    double sum = 0.0;
+    for (size_t i = 0; i < v.size(); i++)
+        sum += v[i];
+    return str::asprintf("{ \"min\": %.3f, \"mean\": %.3f, \"p50\": %.3f, \"p95\": %.3f, \"p99\": %.3f, \"max\": %.3f }",
+            v.front(), sum / v.size(), percentile(v, 50.0), percentile(v, 95.0), percentile(v, 99.0), v.back());
+}
+
+
+/* The benchmark */
+
+int gui_benchmark(state* master_state, const benchmark_options& options)
+{
+    if (options.width < 1 || options.height < 1 || options.fps < 1)
+        throw exc("Invalid benchmark options");
+    std::vector<key_frame> path = read_path(options.path_file);
+    double duration = path.back().t - path.front().t;
+    int frames = static_cast<int>(duration * options.fps) + 1;
+
+    QGLFormat fmt(QGL::DepthBuffer | QGL::Rgba | QGL::NoAlphaChannel | QGL::NoAccumBuffer
+            | QGL::NoStencilBuffer | QGL::NoStereoBuffers | QGL::NoOverlay | QGL::NoSampleBuffers);
+    if (!QGLPixelBuffer::hasOpenGLPbuffers())
+        throw exc("Offscreen rendering is not available (no pixel buffer support)");
+    QGLPixelBuffer pbuffer(options.width, options.height, fmt);
+    if (!pbuffer.isValid() || !pbuffer.makeCurrent())
+        throw exc("Cannot create an offscreen OpenGL context");
+
+    std::vector<double> frame_times;    // milliseconds
+    std::vector<double> submit_times;   // milliseconds
+    std::vector<double> finish_times;   // milliseconds
+    long long quads_rendered = 0, quads_culled = 0, quads_horizon_culled = 0, quads_occlusion_culled = 0, quads_approximated = 0;
+    long long lod_metric_disagreements = 0;
+    long long quads_split = 0, quads_merged = 0, quads_held = 0;
+    long long lod_evaluations = 0, lod_operations_queued = 0;
+    long long overdraw_fragments = 0, overdraw_pixels = 0;
+    unsigned long long gradient_uploads = 0;
+    renderpass_info::cache_info caches[renderpass_info::caches];
+    thread_group_stats workers[renderpass_info::worker_groups];
+    {
+        BenchmarkContext context(master_state, options.width, options.height);
+        context.init_gl();
+        for (int run = (options.warm_cache ? 0 : 1); run < 2; run++) {
+            bool measure = (run == 1);
+            if (measure && !options.warm_cache)
+                context.clear_caches();
+            for (int frame = 0; frame < frames; frame++) {
+                interpolate_path(path, path.front().t + static_cast<double>(frame) / options.fps,
+                        &(master_state->viewer_pos), &(master_state->viewer_rot));
+                long long t0 = timer::get(timer::monotonic);
+                context.render();
+                long long t1 = timer::get(timer::monotonic);
+                glFinish();
+                long long t2 = timer::get(timer::monotonic);
+                if (measure) {
+                    submit_times.push_back((t1 - t0) / 1e3);
+                    finish_times.push_back((t2 - t1) / 1e3);
+                    frame_times.push_back((t2 - t0) / 1e3);
+                    const renderpass_info& info = context.last_frame_info();
+                    for (int i = 0; i < info.depth_passes; i++) {
+                        quads_rendered += info.quads_rendered[i];
+                        quads_culled += info.quads_culled[i];
+                        quads_horizon_culled += info.quads_horizon_culled[i];
+                        quads_occlusion_culled += info.quads_occlusion_culled[i];
+                        quads_approximated += info.quads_approximated[i];
+                        lod_metric_disagreements += info.lod_metric_disagreements[i];
+                        quads_split += info.quads_split[i];
+                        quads_merged += info.quads_merged[i];
+                        quads_held += info.quads_held[i];
+                        lod_evaluations += info.lod_evaluations[i];
+                        lod_operations_queued += info.lod_operations_queued[i];
+                        if (info.overdraw(i) >= 0.0f) {
+                            overdraw_fragments += (info.fragments_prepass[i] >= 0
+                                    ? info.fragments_prepass[i] : info.fragments_shaded[i]);
+                            overdraw_pixels += info.pixels_covered[i];
+                        }
+                    }
+                    for (int c = 0; c < renderpass_info::caches; c++) {
+                        caches[c].stats += info.cache[c].stats;
+                        caches[c].size = info.cache[c].size;
+                        caches[c].max_size = info.cache[c].max_size;
+                    }
+                    for (int w = 0; w < renderpass_info::worker_groups; w++)
+                        workers[w] += info.workers[w];
+                    gradient_uploads += info.gradient_uploads;
+                }
+            }
+        }
+        context.exit_gl();
+    }
+    pbuffer.doneCurrent();
+
+    std::string caches_json;
+    for (int c = 0; c < renderpass_info::caches; c++) {
+        const cache_stats& s = caches[c].stats;
+        caches_json += str::asprintf("    \"%s\": { \"hits\": %llu, \"misses\": %llu, \"hit_ratio\": %.4f, "
+                "\"inserts\": %llu, \"evictions\": %llu, \"evicted_size\": %llu, "
+                "\"size\": %llu, \"max_size\": %llu }%s\n",
+                renderpass_info::cache_name(c), s.hits, s.misses, s.hit_ratio(),
+                s.inserts, s.evictions, s.evicted_size,
+                static_cast<unsigned long long>(caches[c].size),
+                static_cast<unsigned long long>(caches[c].max_size),
+                c < renderpass_info::caches - 1 ? "," : "");
+    }
+    std::string workers_json;
+    for (int w = 0; w < renderpass_info::worker_groups; w++) {
+        const thread_group_stats& s = workers[w];
+        workers_json += str::asprintf("    \"%s\": { \"started\": %llu, \"rejected\": %llu, \"completed\": %llu, "
+                "\"latency_ms\": { \"p50\": %g, \"p95\": %g, \"p99\": %g } }%s\n",
+                renderpass_info::worker_group_name(w), s.started, s.rejected, s.completed,
+                s.latency_percentile(0.50f), s.latency_percentile(0.95f), s.latency_percentile(0.99f),
+                w < renderpass_info::worker_groups - 1 ? "," : "");
+    }
+
+    std::string json = "{\n"
+        + str::asprintf("  \"frames\": %d,\n", frames)
+        + str::asprintf("  \"width\": %d,\n", options.width)
+        + str::asprintf("  \"height\": %d,\n", options.height)
+        + str::asprintf("  \"fps\": %d,\n", options.fps)
+        + str::asprintf("  \"cache\": \"%s\",\n", options.warm_cache ? "warm" : "cold")
+        + "  \"frame_time_ms\": " + json_stats(frame_times) + ",\n"
+        + "  \"stages_ms\": {\n"
+        + "    \"submit\": " + json_stats(submit_times) + ",\n"
+        + "    \"finish\": " + json_stats(finish_times) + "\n"
+        + "  },\n"
+        + str::asprintf("  \"quads_per_frame\": { \"rendered\": %.1f, \"culled\": %.1f, \"horizon_culled\": %.1f, \"occlusion_culled\": %.1f, \"approximated\": %.1f },\n",
+                static_cast<double>(quads_rendered) / frames,
+                static_cast<double>(quads_culled) / frames,
+                static_cast<double>(quads_horizon_culled) / frames,
+                static_cast<double>(quads_occlusion_culled) / frames,
+                static_cast<double>(quads_approximated) / frames)
+        + str::asprintf("  \"lod_metric_disagreements_per_frame\": %.1f,\n",
+                static_cast<double>(lod_metric_disagreements) / frames)
+        + str::asprintf("  \"lod_churn_per_frame\": { \"split\": %.1f, \"merged\": %.1f, \"held\": %.1f, "
+                "\"evaluated\": %.1f, \"queued\": %.1f },\n",
+                static_cast<double>(quads_split) / frames,
+                static_cast<double>(quads_merged) / frames,
+                static_cast<double>(quads_held) / frames,
+                static_cast<double>(lod_evaluations) / frames,
+                static_cast<double>(lod_operations_queued) / frames)
+        + str::asprintf("  \"overdraw\": %.3f,\n", overdraw_pixels > 0
+                ? static_cast<double>(overdraw_fragments) / overdraw_pixels : -1.0)
+        + "  \"caches\": {\n" + caches_json + "  },\n"
+        + "  \"workers\": {\n" + workers_json + "  },\n"
+        + str::asprintf("  \"gradient_uploads\": %llu,\n", gradient_uploads)
+        + str::asprintf("  \"peak_memory_bytes\": %llu\n", static_cast<unsigned long long>(sys::peak_memory()))
+        + "}\n";
+    if (options.output_file.empty()) {
+        fio::write(json.c_str(), 1, json.length(), stdout, "standard output");
+        fio::flush(stdout, "standard output");
+    } else {
+        FILE* f = fio::open(options.output_file, "w");
+        fio::write(json.c_str(), 1, json.length(), f, options.output_file);
+        fio::close(f, options.output_file);
+    }
+    return 0;
+}
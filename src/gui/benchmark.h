@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2013
+ * Computer Graphics Group, University of Siegen, Germany.
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>.
+ * See http://www.cg.informatik.uni-siegen.de/ for contact information.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <string>
+
+#include "state.h"
+
+
+/* Headless benchmark: replay a camera path in an offscreen GL context and
+ * write frame time statistics as JSON.
+ *
+ * The camera path is a text file with one key frame per line:
+ *   <time in seconds> <viewer_pos: x y z> <viewer_rot: x y z w>
+ * Empty lines and lines starting with '#' are ignored. Frames are rendered
+ * at fixed time steps of 1/fps seconds; the viewer position and rotation
+ * are interpolated between the key frames. Each frame is rendered and
+ * finished before the next one starts, so the measured time is the time
+ * to render one frame, independent of the display refresh rate.
+ *
+ * With a cold cache, the memory and GPU caches start empty when the
+ * measurement starts (use an empty --cache directory to also start with
+ * an empty disk cache). With a warm cache, the path is replayed once
+ * before the measurement starts. */
+
+class benchmark_options
+{
+public:
+    std::string path_file;
+    std::string output_file;    // empty for standard output
+    int width;
+    int height;
+    int fps;
+    bool warm_cache;
+
+    benchmark_options() : width(1024), height(768), fps(30), warm_cache(false)
+    {
+    }
+};
+
+int gui_benchmark(state* master_state, const benchmark_options& options);
+
+#endif
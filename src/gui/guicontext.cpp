@@ -56,7 +56,7 @@ GUIContext::GUIContext(class state* master_state, QWidget* parent) : QGLWidget(p
     _quad_disk_cache_checkers(16, &_quad_disk_cache),
     _quad_disk_cache_fetchers(16, &_quad_disk_cache),
     _quad_mem_cache(),
-    _quad_mem_cache_loaders(min(255, sys::processors() * 3 / 2 + 1), &_quad_mem_cache),
+    _quad_mem_cache_loaders(min(255, sys::processors() * 3 / 2 + 1), &_quad_mem_cache, &_quad_metadata_cache),
     _quad_gpu_cache(),
     _quad_metadata_cache(),
     _quad_base_data_mem_cache(),
@@ -242,6 +242,28 @@ QImage* GUIContext::get_current_image()
     return img;
 }
 
+dfrust GUIContext::frustum_for_size(int width, int height) const
+{
+    // Compute a new frustum. The aspect ratio of objects in the current view should remain the
+    // same in the requested view, even if the aspect ratio of the requested view differs from
+    // the aspect ratio of the current view.
+    const double old_frustum_w = (_frustum.r() - _frustum.l());
+    const double old_frustum_h = (_frustum.t() - _frustum.b());
+    const double old_frustum_ar = old_frustum_w / old_frustum_h;
+    const double new_frustum_ar = static_cast<double>(width) / static_cast<double>(height);
+    dfrust new_frustum = _frustum;
+    if (new_frustum_ar > old_frustum_ar) {
+        const double additional_width = (new_frustum_ar / old_frustum_ar) * old_frustum_w - old_frustum_w;
+        new_frustum.l() -= additional_width / 2.0;
+        new_frustum.r() += additional_width / 2.0;
+    } else if (new_frustum_ar < old_frustum_ar) {
+        const double additional_height = (old_frustum_ar / new_frustum_ar) * old_frustum_h - old_frustum_h;
+        new_frustum.b() -= additional_height / 2.0;
+        new_frustum.t() += additional_height / 2.0;
+    }
+    return new_frustum;
+}
+
 QImage* GUIContext::render_to_image(int width, int height)
 {
     if (_permanent_failure || !_initialized) {
@@ -254,24 +276,7 @@ QImage* GUIContext::render_to_image(int width, int height)
     blob *array = new blob();
     try {
         array->resize(width, height, 4 * sizeof(unsigned char));
-        // Compute a new frustum. The aspect ratio of objects in the current view should remain the
-        // same in the requested view, even if the aspect ratio of the requested view differs from
-        // the aspect ratio of the current view.
-        const double old_frustum_w = (_frustum.r() - _frustum.l());
-        const double old_frustum_h = (_frustum.t() - _frustum.b());
-        const double old_frustum_ar = old_frustum_w / old_frustum_h;
-        const double new_frustum_ar = static_cast<double>(width) / static_cast<double>(height);
-        dfrust new_frustum = _frustum;
-        if (new_frustum_ar > old_frustum_ar) {
-            const double additional_width = (new_frustum_ar / old_frustum_ar) * old_frustum_w - old_frustum_w;
-            new_frustum.l() -= additional_width / 2.0;
-            new_frustum.r() += additional_width / 2.0;
-        } else if (new_frustum_ar < old_frustum_ar) {
-            const double additional_height = (old_frustum_ar / new_frustum_ar) * old_frustum_h - old_frustum_h;
-            new_frustum.b() -= additional_height / 2.0;
-            new_frustum.t() += additional_height / 2.0;
-        }
-        _renderer.render(new_frustum, width, height, array->ptr());
+        _renderer.render(frustum_for_size(width, height), width, height, array->ptr());
     }
     catch (exc &e) {
         QApplication::restoreOverrideCursor();
@@ -289,6 +294,30 @@ QImage* GUIContext::render_to_image(int width, int height)
     return img;
 }
 
+bool GUIContext::render_to_file(int width, int height, const std::string& filename)
+{
+    if (_permanent_failure || !_initialized) {
+        return false;
+    }
+
+    QApplication::setOverrideCursor(QCursor(Qt::WaitCursor));
+    makeCurrent();
+
+    bool success = true;
+    try {
+        gta_tile_writer writer(filename, width, height);
+        _renderer.render_tiles(frustum_for_size(width, height), width, height, writer);
+        writer.close();
+    }
+    catch (exc &e) {
+        msg::err("%s", e.what());
+        success = false;
+    }
+
+    QApplication::restoreOverrideCursor();
+    return success;
+}
+
 /* Fullscreen */
 
 void GUIContext::enter_fullscreen(int screens)
@@ -76,6 +76,7 @@ private:
     class quad_tex_pool _quad_tex_pool;
 
     void permanent_failure(const exc &e);
+    glvm::dfrust frustum_for_size(int width, int height) const;
 
 public:
     GUIContext(class state *master_state, QWidget* parent = NULL);
@@ -84,6 +85,9 @@ public:
     bool works() const { return _initialized && !_permanent_failure; }
     QImage* get_current_image();
     QImage* render_to_image(int width, int height);
+    // Render the view in tiles directly into a GTA file, without keeping the
+    // whole image in memory. Errors are reported via msg::err().
+    bool render_to_file(int width, int height, const std::string& filename);
 
     // Fullscreen management:
     bool fullscreen() const { return _fullscreen; }
@@ -51,6 +51,7 @@
 #include "fio.h"
 #include "str.h"
 #include "msg.h"
+#include "tmr.h"
 
 #if HAVE_LIBEQUALIZER
 # include "eqcontext.h"
@@ -61,7 +62,8 @@
 
 
 MainWindow::MainWindow(int* argc, char** argv, state* master_state, QWidget* parent) :
-    QMainWindow(parent), _argc(argc), _argv(argv), _master_state(master_state), _eqcontext(NULL)
+    QMainWindow(parent), _argc(argc), _argv(argv), _master_state(master_state), _eqcontext(NULL),
+    _render_time(-1.0f)
 {
     // Set application properties
     setWindowTitle(PACKAGE_NAME);
@@ -205,6 +207,9 @@ MainWindow::MainWindow(int* argc, char** argv, state* master_state, QWidget* par
     QAction *save_view_act = new QAction("Save view...", this);
     connect(save_view_act, SIGNAL(triggered()), this, SLOT(save_view()));
     view_menu->addAction(save_view_act);
+    QAction *save_view_to_file_act = new QAction("Save large view to GTA file...", this);
+    connect(save_view_to_file_act, SIGNAL(triggered()), this, SLOT(save_view_to_file()));
+    view_menu->addAction(save_view_to_file_act);
     // Dialog menu
     QMenu *dialog_menu = menuBar()->addMenu("&Dialog");
     QAction *renderprops_act = new QAction("Toggle O&ptions", this);
@@ -284,12 +289,20 @@ void MainWindow::closeEvent(QCloseEvent *event)
 
 void MainWindow::renderloop()
 {
+    // Adapt the quality to the time it took to render the previous frame.
+    // Both render() calls return when the frame is done, so this measures the
+    // work of the renderers and not the idle time between loop iterations.
+    _quality_controller.update(*_master_state, _render_time);
     // GUI: render and update statistics
+    long long t0 = timer::get(timer::monotonic);
     _guicontext->render();
+    long long render_time = timer::get(timer::monotonic) - t0;
 #if HAVE_LIBEQUALIZER
     // Equalizer: render and update statistics
     if (_eqcontext && _eqcontext->is_running()) {
+        t0 = timer::get(timer::monotonic);
         _eqcontext->render();
+        render_time += timer::get(timer::monotonic) - t0;
         if (_statistics) {
             _statistics->update_eq(_eqcontext->fps());
         }
@@ -304,6 +317,7 @@ void MainWindow::renderloop()
         }
     }
 #endif
+    _render_time = render_time / 1e3f;
 }
 
 /* Menu actions */
@@ -632,6 +646,36 @@ void MainWindow::save_view()
     delete img;
 }
 
+void MainWindow::save_view_to_file()
+{
+    WidthHeightDialog *wh_dialog = new WidthHeightDialog(_guicontext->width(), _guicontext->height(), this);
+    int w, h;
+    if (!wh_dialog->run(w, h))
+        return;
+
+    QFileDialog *file_dialog = new QFileDialog(this);
+    _settings->beginGroup("Session");
+    file_dialog->setDirectory(_settings->value("last-save-image-dir", QDir::homePath()).toString());
+    _settings->endGroup();
+    file_dialog->setWindowTitle(tr("Save image"));
+    file_dialog->setAcceptMode(QFileDialog::AcceptSave);
+    file_dialog->setFileMode(QFileDialog::AnyFile);
+    file_dialog->setDefaultSuffix("gta");
+    QStringList filters;
+    filters << tr("GTA files (*.gta)") << tr("All files (*)");
+    file_dialog->setFilters(filters);
+    if (!file_dialog->exec() || file_dialog->selectedFiles().empty())
+        return;
+
+    QString file_name = file_dialog->selectedFiles().at(0);
+    _settings->beginGroup("Session");
+    _settings->setValue("last-save-image-dir", file_dialog->directory().path());
+    _settings->endGroup();
+
+    if (!_guicontext->render_to_file(w, h, fio::from_sys(file_name.toStdString())))
+        QMessageBox::critical(this, tr("Error"), QString(tr("Saving %1 failed.")).arg(file_name));
+}
+
 void MainWindow::toggle_renderprops()
 {
     if (_renderprops && _renderprops->isVisible()) {
@@ -41,6 +41,7 @@
 #include "quaddebug.h"
 #include "renderprops.h"
 #include "statistics.h"
+#include "quality-controller.h"
 
 class eq_context;
 
@@ -58,6 +59,8 @@ private:
 
     GUIContext* _guicontext;
     eq_context* _eqcontext;
+    quality_controller _quality_controller;     // Adapts the quality of all contexts in lock-step
+    float _render_time;                         // Render time of the last loop iteration in ms, or -1
 
     DBs* _dbs;
     Info* _info;
@@ -96,6 +99,7 @@ private slots:
     void copy_current_view();
     void save_current_view();
     void save_view();
+    void save_view_to_file();
     // Menu actions: Dialog
     void toggle_equalizer();
     void toggle_renderprops();
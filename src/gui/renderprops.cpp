@@ -81,6 +81,70 @@ RenderProps::RenderProps(const class renderer_parameters& renderer_parameters, Q
     layout->addWidget(_fixed_quadtree_depth_combobox, row, 1);
     row++;
 
+    QLabel *lod_metric_label = new QLabel("LOD metric:");
+    layout->addWidget(lod_metric_label, row, 0);
+    _lod_metric_combobox = new QComboBox(this);
+    _lod_metric_combobox->addItem("Bounding box area");
+    _lod_metric_combobox->addItem("Bounding sphere");
+    _lod_metric_combobox->setCurrentIndex(renderer_parameters.lod_metric);
+    connect(_lod_metric_combobox, SIGNAL(currentIndexChanged(int)), this, SLOT(send_signal()));
+    layout->addWidget(_lod_metric_combobox, row, 1);
+    row++;
+
+    QLabel *lod_metric_comparison_label = new QLabel("Compare LOD metrics:");
+    layout->addWidget(lod_metric_comparison_label, row, 0);
+    _lod_metric_comparison_checkbox = new QCheckBox(this);
+    _lod_metric_comparison_checkbox->setChecked(renderer_parameters.lod_metric_comparison);
+    connect(_lod_metric_comparison_checkbox, SIGNAL(toggled(bool)), this, SLOT(send_signal()));
+    layout->addWidget(_lod_metric_comparison_checkbox, row, 1);
+    row++;
+
+    QLabel *lod_hysteresis_label = new QLabel("LOD hysteresis:");
+    layout->addWidget(lod_hysteresis_label, row, 0);
+    _lod_hysteresis_spinbox = new QDoubleSpinBox(this);
+    _lod_hysteresis_spinbox->setRange(0.0, 0.9);
+    _lod_hysteresis_spinbox->setSingleStep(0.05);
+    _lod_hysteresis_spinbox->setValue(renderer_parameters.lod_hysteresis);
+    connect(_lod_hysteresis_spinbox, SIGNAL(valueChanged(double)), this, SLOT(send_signal()));
+    layout->addWidget(_lod_hysteresis_spinbox, row, 1);
+    row++;
+
+    QLabel *lod_min_residence_label = new QLabel("Min. frames before merging:");
+    layout->addWidget(lod_min_residence_label, row, 0);
+    _lod_min_residence_spinbox = new QSpinBox(this);
+    _lod_min_residence_spinbox->setRange(0, 999);
+    _lod_min_residence_spinbox->setSingleStep(1);
+    _lod_min_residence_spinbox->setValue(renderer_parameters.lod_min_residence);
+    connect(_lod_min_residence_spinbox, SIGNAL(valueChanged(int)), this, SLOT(send_signal()));
+    layout->addWidget(_lod_min_residence_spinbox, row, 1);
+    row++;
+
+    QLabel *lod_hold_pending_label = new QLabel("Hold LOD while loading:");
+    layout->addWidget(lod_hold_pending_label, row, 0);
+    _lod_hold_pending_checkbox = new QCheckBox(this);
+    _lod_hold_pending_checkbox->setChecked(renderer_parameters.lod_hold_pending);
+    connect(_lod_hold_pending_checkbox, SIGNAL(toggled(bool)), this, SLOT(send_signal()));
+    layout->addWidget(_lod_hold_pending_checkbox, row, 1);
+    row++;
+
+    QLabel *lod_incremental_label = new QLabel("Incremental LOD (sphere metric):");
+    layout->addWidget(lod_incremental_label, row, 0);
+    _lod_incremental_checkbox = new QCheckBox(this);
+    _lod_incremental_checkbox->setChecked(renderer_parameters.lod_incremental);
+    connect(_lod_incremental_checkbox, SIGNAL(toggled(bool)), this, SLOT(send_signal()));
+    layout->addWidget(_lod_incremental_checkbox, row, 1);
+    row++;
+
+    QLabel *lod_max_operations_label = new QLabel("Max. LOD changes per frame:");
+    layout->addWidget(lod_max_operations_label, row, 0);
+    _lod_max_operations_spinbox = new QSpinBox(this);
+    _lod_max_operations_spinbox->setRange(1, 9999);
+    _lod_max_operations_spinbox->setSingleStep(8);
+    _lod_max_operations_spinbox->setValue(renderer_parameters.lod_max_operations);
+    connect(_lod_max_operations_spinbox, SIGNAL(valueChanged(int)), this, SLOT(send_signal()));
+    layout->addWidget(_lod_max_operations_spinbox, row, 1);
+    row++;
+
     QLabel *quad_subdivision_label = new QLabel("Quad subdivision level:");
     layout->addWidget(quad_subdivision_label, row, 0);
     _quad_subdivision_spinbox = new QSpinBox(this);
@@ -91,6 +155,32 @@ RenderProps::RenderProps(const class renderer_parameters& renderer_parameters, Q
     layout->addWidget(_quad_subdivision_spinbox, row, 1);
     row++;
 
+    QLabel *adaptive_quality_label = new QLabel("Adaptive quality:");
+    layout->addWidget(adaptive_quality_label, row, 0);
+    _adaptive_quality_checkbox = new QCheckBox(this);
+    _adaptive_quality_checkbox->setChecked(renderer_parameters.adaptive_quality);
+    connect(_adaptive_quality_checkbox, SIGNAL(toggled(bool)), this, SLOT(send_signal()));
+    layout->addWidget(_adaptive_quality_checkbox, row, 1);
+    row++;
+
+    QLabel *target_frame_time_label = new QLabel("Target frame time (ms):");
+    layout->addWidget(target_frame_time_label, row, 0);
+    _target_frame_time_spinbox = new QDoubleSpinBox(this);
+    _target_frame_time_spinbox->setRange(1.0, 1000.0);
+    _target_frame_time_spinbox->setSingleStep(1.0);
+    _target_frame_time_spinbox->setValue(renderer_parameters.target_frame_time);
+    connect(_target_frame_time_spinbox, SIGNAL(valueChanged(double)), this, SLOT(send_signal()));
+    layout->addWidget(_target_frame_time_spinbox, row, 1);
+    row++;
+
+    QLabel *adaptive_subdivision_label = new QLabel("Adaptive subdivision:");
+    layout->addWidget(adaptive_subdivision_label, row, 0);
+    _adaptive_subdivision_checkbox = new QCheckBox(this);
+    _adaptive_subdivision_checkbox->setChecked(renderer_parameters.adaptive_subdivision);
+    connect(_adaptive_subdivision_checkbox, SIGNAL(toggled(bool)), this, SLOT(send_signal()));
+    layout->addWidget(_adaptive_subdivision_checkbox, row, 1);
+    row++;
+
     QLabel *wireframe_label = new QLabel("Wireframe:");
     layout->addWidget(wireframe_label, row, 0);
     _wireframe_checkbox = new QCheckBox(this);
@@ -131,6 +221,46 @@ RenderProps::RenderProps(const class renderer_parameters& renderer_parameters, Q
     layout->addWidget(_force_lod_sync_checkbox, row, 1);
     row++;
 
+    QLabel *depth_prepass_label = new QLabel("Depth pre-pass:");
+    layout->addWidget(depth_prepass_label, row, 0);
+    _depth_prepass_checkbox = new QCheckBox(this);
+    _depth_prepass_checkbox->setChecked(renderer_parameters.depth_prepass);
+    connect(_depth_prepass_checkbox, SIGNAL(toggled(bool)), this, SLOT(send_signal()));
+    layout->addWidget(_depth_prepass_checkbox, row, 1);
+    row++;
+
+    QLabel *front_to_back_label = new QLabel("Front-to-back order:");
+    layout->addWidget(front_to_back_label, row, 0);
+    _front_to_back_checkbox = new QCheckBox(this);
+    _front_to_back_checkbox->setChecked(renderer_parameters.front_to_back);
+    connect(_front_to_back_checkbox, SIGNAL(toggled(bool)), this, SLOT(send_signal()));
+    layout->addWidget(_front_to_back_checkbox, row, 1);
+    row++;
+
+    QLabel *overdraw_counter_label = new QLabel("Overdraw counter:");
+    layout->addWidget(overdraw_counter_label, row, 0);
+    _overdraw_counter_checkbox = new QCheckBox(this);
+    _overdraw_counter_checkbox->setChecked(renderer_parameters.overdraw_counter);
+    connect(_overdraw_counter_checkbox, SIGNAL(toggled(bool)), this, SLOT(send_signal()));
+    layout->addWidget(_overdraw_counter_checkbox, row, 1);
+    row++;
+
+    QLabel *occlusion_culling_label = new QLabel("Occlusion culling:");
+    layout->addWidget(occlusion_culling_label, row, 0);
+    _occlusion_culling_checkbox = new QCheckBox(this);
+    _occlusion_culling_checkbox->setChecked(renderer_parameters.occlusion_culling);
+    connect(_occlusion_culling_checkbox, SIGNAL(toggled(bool)), this, SLOT(send_signal()));
+    layout->addWidget(_occlusion_culling_checkbox, row, 1);
+    row++;
+
+    QLabel *cpu_processing_label = new QLabel("CPU processing:");
+    layout->addWidget(cpu_processing_label, row, 0);
+    _cpu_processing_checkbox = new QCheckBox(this);
+    _cpu_processing_checkbox->setChecked(renderer_parameters.cpu_processing);
+    connect(_cpu_processing_checkbox, SIGNAL(toggled(bool)), this, SLOT(send_signal()));
+    layout->addWidget(_cpu_processing_checkbox, row, 1);
+    row++;
+
     QLabel *statistics_overlay_label = new QLabel("Statistics Overlay:");
     layout->addWidget(statistics_overlay_label, row, 0);
     _statistics_overlay_checkbox = new QCheckBox(this);
@@ -190,12 +320,27 @@ void RenderProps::send_signal()
     renderer_params.background_color[2] = qBlue(rgb);
     renderer_params.quad_screen_size_ratio = _quad_screen_size_ratio_spinbox->value();
     renderer_params.fixed_quadtree_depth = _fixed_quadtree_depth_combobox->currentIndex();
+    renderer_params.lod_metric = _lod_metric_combobox->currentIndex();
+    renderer_params.lod_metric_comparison = _lod_metric_comparison_checkbox->isChecked();
+    renderer_params.lod_hysteresis = _lod_hysteresis_spinbox->value();
+    renderer_params.lod_min_residence = _lod_min_residence_spinbox->value();
+    renderer_params.lod_hold_pending = _lod_hold_pending_checkbox->isChecked();
+    renderer_params.lod_incremental = _lod_incremental_checkbox->isChecked();
+    renderer_params.lod_max_operations = _lod_max_operations_spinbox->value();
     renderer_params.quad_subdivision = _quad_subdivision_spinbox->value();
+    renderer_params.adaptive_quality = _adaptive_quality_checkbox->isChecked();
+    renderer_params.target_frame_time = _target_frame_time_spinbox->value();
+    renderer_params.adaptive_subdivision = _adaptive_subdivision_checkbox->isChecked();
     renderer_params.wireframe = _wireframe_checkbox->isChecked();
     renderer_params.bounding_boxes = _bounding_boxes_checkbox->isChecked();
     renderer_params.quad_borders = _quad_borders_checkbox->isChecked();
     renderer_params.mipmapping = _mipmapping_checkbox->isChecked();
     renderer_params.force_lod_sync = _force_lod_sync_checkbox->isChecked();
+    renderer_params.depth_prepass = _depth_prepass_checkbox->isChecked();
+    renderer_params.front_to_back = _front_to_back_checkbox->isChecked();
+    renderer_params.overdraw_counter = _overdraw_counter_checkbox->isChecked();
+    renderer_params.occlusion_culling = _occlusion_culling_checkbox->isChecked();
+    renderer_params.cpu_processing = _cpu_processing_checkbox->isChecked();
     renderer_params.statistics_overlay = _statistics_overlay_checkbox->isChecked();
     renderer_params.gpu_cache_size = static_cast<size_t>(_gpu_cache_size_spinbox->value()) * static_cast<size_t>(1 << 20);
     renderer_params.mem_cache_size = static_cast<size_t>(_mem_cache_size_spinbox->value()) * static_cast<size_t>(1 << 20);
@@ -41,12 +41,27 @@ private:
     QLabel* _background_color_label;
     QDoubleSpinBox* _quad_screen_size_ratio_spinbox;
     QComboBox* _fixed_quadtree_depth_combobox;
+    QComboBox* _lod_metric_combobox;
+    QCheckBox* _lod_metric_comparison_checkbox;
+    QDoubleSpinBox* _lod_hysteresis_spinbox;
+    QSpinBox* _lod_min_residence_spinbox;
+    QCheckBox* _lod_hold_pending_checkbox;
+    QCheckBox* _lod_incremental_checkbox;
+    QSpinBox* _lod_max_operations_spinbox;
     QSpinBox* _quad_subdivision_spinbox;
+    QCheckBox* _adaptive_quality_checkbox;
+    QDoubleSpinBox* _target_frame_time_spinbox;
+    QCheckBox* _adaptive_subdivision_checkbox;
     QCheckBox* _wireframe_checkbox;
     QCheckBox* _bounding_boxes_checkbox;
     QCheckBox* _quad_borders_checkbox;
     QCheckBox* _mipmapping_checkbox;
     QCheckBox* _force_lod_sync_checkbox;
+    QCheckBox* _depth_prepass_checkbox;
+    QCheckBox* _front_to_back_checkbox;
+    QCheckBox* _overdraw_counter_checkbox;
+    QCheckBox* _occlusion_culling_checkbox;
+    QCheckBox* _cpu_processing_checkbox;
     QCheckBox* _statistics_overlay_checkbox;
     QSpinBox* _gpu_cache_size_spinbox;
     QSpinBox* _mem_cache_size_spinbox;
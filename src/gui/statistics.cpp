@@ -25,8 +25,12 @@
 #include <QPushButton>
 #include <QLabel>
 #include <QGroupBox>
+#include <QMessageBox>
+#include <QTextDocument>
 
 #include "str.h"
+#include "msg.h"
+#include "pth.h"
 
 #include "guitools.h"
 #include "statistics.h"
@@ -47,10 +51,22 @@ Statistics::Statistics(QWidget* parent) : QDialog(parent)
     _gui_box_layout->addWidget(new QLabel("Near:"), 2, 0);
     _gui_box_layout->addWidget(new QLabel("Far:"), 3, 0);
     _gui_box_layout->addWidget(new QLabel("Quads culled:"), 4, 0);
-    _gui_box_layout->addWidget(new QLabel("Quads rendered:"), 5, 0);
-    _gui_box_layout->addWidget(new QLabel("Quads approximated:"), 6, 0);
-    _gui_box_layout->addWidget(new QLabel("Lowest quad level:"), 7, 0);
-    _gui_box_layout->addWidget(new QLabel("Highest quad level:"), 8, 0);
+    _gui_box_layout->addWidget(new QLabel("Quads behind horizon:"), 5, 0);
+    _gui_box_layout->addWidget(new QLabel("Quads occluded:"), 6, 0);
+    _gui_box_layout->addWidget(new QLabel("Quads rendered:"), 7, 0);
+    _gui_box_layout->addWidget(new QLabel("Quads approximated:"), 8, 0);
+    _gui_box_layout->addWidget(new QLabel("Lowest quad level:"), 9, 0);
+    _gui_box_layout->addWidget(new QLabel("Highest quad level:"), 10, 0);
+    _gui_box_layout->addWidget(new QLabel("Fragments depth pre-pass:"), 11, 0);
+    _gui_box_layout->addWidget(new QLabel("Fragments shaded:"), 12, 0);
+    _gui_box_layout->addWidget(new QLabel("Lens texels processed:"), 13, 0);
+    _gui_box_layout->addWidget(new QLabel("LOD metric disagreements:"), 14, 0);
+    _gui_box_layout->addWidget(new QLabel("Quads split:"), 15, 0);
+    _gui_box_layout->addWidget(new QLabel("Quads merged:"), 16, 0);
+    _gui_box_layout->addWidget(new QLabel("Quads held:"), 17, 0);
+    _gui_box_layout->addWidget(new QLabel("LOD evaluations:"), 18, 0);
+    _gui_box_layout->addWidget(new QLabel("LOD changes queued:"), 19, 0);
+    _gui_box_layout->addWidget(new QLabel("Overdraw:"), 20, 0);
     for (int dp = 0; dp < 4; dp++) {
         _gui_box_layout->addWidget(new QLabel(str::asprintf("Depth pass %d  ", dp).c_str()), 1, dp + 1);
         _gui_near_info[dp] = new QLabel("");
@@ -59,18 +75,87 @@ Statistics::Statistics(QWidget* parent) : QDialog(parent)
         _gui_box_layout->addWidget(_gui_far_info[dp], 3, dp + 1);
         _gui_qc_info[dp] = new QLabel("");
         _gui_box_layout->addWidget(_gui_qc_info[dp], 4, dp + 1);
+        _gui_qh_info[dp] = new QLabel("");
+        _gui_box_layout->addWidget(_gui_qh_info[dp], 5, dp + 1);
+        _gui_qo_info[dp] = new QLabel("");
+        _gui_box_layout->addWidget(_gui_qo_info[dp], 6, dp + 1);
         _gui_qr_info[dp] = new QLabel("");
-        _gui_box_layout->addWidget(_gui_qr_info[dp], 5, dp + 1);
+        _gui_box_layout->addWidget(_gui_qr_info[dp], 7, dp + 1);
         _gui_qa_info[dp] = new QLabel("");
-        _gui_box_layout->addWidget(_gui_qa_info[dp], 6, dp + 1);
+        _gui_box_layout->addWidget(_gui_qa_info[dp], 8, dp + 1);
         _gui_lq_info[dp] = new QLabel("");
-        _gui_box_layout->addWidget(_gui_lq_info[dp], 7, dp + 1);
+        _gui_box_layout->addWidget(_gui_lq_info[dp], 9, dp + 1);
         _gui_hq_info[dp] = new QLabel("");
-        _gui_box_layout->addWidget(_gui_hq_info[dp], 8, dp + 1);
+        _gui_box_layout->addWidget(_gui_hq_info[dp], 10, dp + 1);
+        _gui_fp_info[dp] = new QLabel("");
+        _gui_box_layout->addWidget(_gui_fp_info[dp], 11, dp + 1);
+        _gui_fs_info[dp] = new QLabel("");
+        _gui_box_layout->addWidget(_gui_fs_info[dp], 12, dp + 1);
+        _gui_lt_info[dp] = new QLabel("");
+        _gui_box_layout->addWidget(_gui_lt_info[dp], 13, dp + 1);
+        _gui_md_info[dp] = new QLabel("");
+        _gui_box_layout->addWidget(_gui_md_info[dp], 14, dp + 1);
+        _gui_qs_info[dp] = new QLabel("");
+        _gui_box_layout->addWidget(_gui_qs_info[dp], 15, dp + 1);
+        _gui_qm_info[dp] = new QLabel("");
+        _gui_box_layout->addWidget(_gui_qm_info[dp], 16, dp + 1);
+        _gui_qhl_info[dp] = new QLabel("");
+        _gui_box_layout->addWidget(_gui_qhl_info[dp], 17, dp + 1);
+        _gui_le_info[dp] = new QLabel("");
+        _gui_box_layout->addWidget(_gui_le_info[dp], 18, dp + 1);
+        _gui_lo_info[dp] = new QLabel("");
+        _gui_box_layout->addWidget(_gui_lo_info[dp], 19, dp + 1);
+        _gui_od_info[dp] = new QLabel("");
+        _gui_box_layout->addWidget(_gui_od_info[dp], 20, dp + 1);
     }
     _gui_box->setLayout(_gui_box_layout);
     layout->addWidget(_gui_box, layout_row++, 0);
 
+    _cache_box = new QGroupBox("Caches (per frame)");
+    QGridLayout* _cache_box_layout = new QGridLayout;
+    _cache_box_layout->addWidget(new QLabel("Hit ratio  "), 0, 1);
+    _cache_box_layout->addWidget(new QLabel("Hits / misses  "), 0, 2);
+    _cache_box_layout->addWidget(new QLabel("Evictions  "), 0, 3);
+    _cache_box_layout->addWidget(new QLabel("Size / max  "), 0, 4);
+    for (int c = 0; c < renderpass_info::caches; c++) {
+        _cache_box_layout->addWidget(new QLabel((std::string(renderpass_info::cache_name(c)) + ":").c_str()), c + 1, 0);
+        _cache_hr_info[c] = new QLabel("");
+        _cache_box_layout->addWidget(_cache_hr_info[c], c + 1, 1);
+        _cache_hm_info[c] = new QLabel("");
+        _cache_box_layout->addWidget(_cache_hm_info[c], c + 1, 2);
+        _cache_ev_info[c] = new QLabel("");
+        _cache_box_layout->addWidget(_cache_ev_info[c], c + 1, 3);
+        _cache_sz_info[c] = new QLabel("");
+        _cache_box_layout->addWidget(_cache_sz_info[c], c + 1, 4);
+    }
+    int workers_row = renderpass_info::caches + 1;
+    _cache_box_layout->addWidget(new QLabel("In flight  "), workers_row, 1);
+    _cache_box_layout->addWidget(new QLabel("Completed  "), workers_row, 2);
+    _cache_box_layout->addWidget(new QLabel("Latency p95  "), workers_row, 3);
+    for (int w = 0; w < renderpass_info::worker_groups; w++) {
+        _cache_box_layout->addWidget(new QLabel((std::string(renderpass_info::worker_group_name(w)) + ":").c_str()), workers_row + w + 1, 0);
+        _workers_if_info[w] = new QLabel("");
+        _cache_box_layout->addWidget(_workers_if_info[w], workers_row + w + 1, 1);
+        _workers_cr_info[w] = new QLabel("");
+        _cache_box_layout->addWidget(_workers_cr_info[w], workers_row + w + 1, 2);
+        _workers_lt_info[w] = new QLabel("");
+        _cache_box_layout->addWidget(_workers_lt_info[w], workers_row + w + 1, 3);
+    }
+    int uploads_row = workers_row + renderpass_info::worker_groups + 1;
+    _cache_box_layout->addWidget(new QLabel("gradient_uploads:"), uploads_row, 0);
+    _gradient_uploads_info = new QLabel("");
+    _cache_box_layout->addWidget(_gradient_uploads_info, uploads_row, 1);
+    _cache_box->setLayout(_cache_box_layout);
+    layout->addWidget(_cache_box, layout_row++, 0);
+
+    QPushButton* lock_report_button = new QPushButton("Lock contention report...");
+    if (!mutex_profiler::active()) {
+        lock_report_button->setEnabled(false);
+        lock_report_button->setToolTip("Start with --lock-profile to enable lock contention profiling.");
+    }
+    connect(lock_report_button, SIGNAL(clicked()), this, SLOT(show_lock_report()));
+    layout->addWidget(lock_report_button, layout_row++, 0, Qt::AlignLeft);
+
 #if HAVE_LIBEQUALIZER
     _eq_box = new QGroupBox("Equalizer");
     QGridLayout* _eq_box_layout = new QGridLayout;
@@ -94,6 +179,13 @@ Statistics::~Statistics()
 {
 }
 
+void Statistics::show_lock_report()
+{
+    std::string report = mutex_profiler::report();
+    msg::inf_txt(report);
+    QMessageBox::information(this, "Lock contention", QString("<pre>") + Qt::escape(toQString(report)) + QString("</pre>"));
+}
+
 void Statistics::update_gui(float fps, const class renderpass_info& info)
 {
     if (this->isVisible()) {
@@ -104,33 +196,104 @@ void Statistics::update_gui(float fps, const class renderpass_info& info)
                     _gui_near_info[dp]->setText(toQString(str::human_readable_length(info.frustum[dp].n())));
                     _gui_far_info[dp]->setText(toQString(str::human_readable_length(info.frustum[dp].f())));
                     _gui_qc_info[dp]->setText(toQString(str::from(info.quads_culled[dp])));
+                    _gui_qh_info[dp]->setText(toQString(str::from(info.quads_horizon_culled[dp])));
+                    _gui_qo_info[dp]->setText(toQString(str::from(info.quads_occlusion_culled[dp])));
                     _gui_qr_info[dp]->setText(toQString(str::from(info.quads_rendered[dp])));
                     _gui_qa_info[dp]->setText(toQString(str::from(info.quads_approximated[dp])));
                     _gui_lq_info[dp]->setText(toQString(str::from(info.lowest_quad_level[dp])));
                     _gui_hq_info[dp]->setText(toQString(str::from(info.highest_quad_level[dp])));
+                    _gui_fp_info[dp]->setText(info.fragments_prepass[dp] < 0 ? ""
+                            : toQString(str::from(info.fragments_prepass[dp])));
+                    _gui_fs_info[dp]->setText(info.fragments_shaded[dp] < 0 ? ""
+                            : toQString(str::from(info.fragments_shaded[dp])));
+                    _gui_lt_info[dp]->setText(toQString(str::from(info.lens_texels_processed[dp])));
+                    _gui_md_info[dp]->setText(toQString(str::from(info.lod_metric_disagreements[dp])));
+                    _gui_qs_info[dp]->setText(toQString(str::from(info.quads_split[dp])));
+                    _gui_qm_info[dp]->setText(toQString(str::from(info.quads_merged[dp])));
+                    _gui_qhl_info[dp]->setText(toQString(str::from(info.quads_held[dp])));
+                    _gui_le_info[dp]->setText(toQString(str::from(info.lod_evaluations[dp])));
+                    _gui_lo_info[dp]->setText(toQString(str::from(info.lod_operations_queued[dp])));
+                    _gui_od_info[dp]->setText(info.overdraw(dp) < 0.0f ? ""
+                            : toQString(str::asprintf("%.2f", info.overdraw(dp))));
                 } else {
                     _gui_near_info[dp]->setText("");
                     _gui_far_info[dp]->setText("");
                     _gui_qc_info[dp]->setText("");
+                    _gui_qh_info[dp]->setText("");
+                    _gui_qo_info[dp]->setText("");
                     _gui_qr_info[dp]->setText("");
                     _gui_qa_info[dp]->setText("");
                     _gui_lq_info[dp]->setText("");
                     _gui_hq_info[dp]->setText("");
+                    _gui_fp_info[dp]->setText("");
+                    _gui_fs_info[dp]->setText("");
+                    _gui_lt_info[dp]->setText("");
+                    _gui_md_info[dp]->setText("");
+                    _gui_qs_info[dp]->setText("");
+                    _gui_qm_info[dp]->setText("");
+                    _gui_qhl_info[dp]->setText("");
+                    _gui_le_info[dp]->setText("");
+                    _gui_lo_info[dp]->setText("");
+                    _gui_od_info[dp]->setText("");
                 }
             }
             _gui_box->setEnabled(true);
+            for (int c = 0; c < renderpass_info::caches; c++) {
+                const cache_stats& s = info.cache[c].stats;
+                _cache_hr_info[c]->setText(s.hits + s.misses == 0 ? ""
+                        : toQString(str::asprintf("%.1f%%", 100.0f * s.hit_ratio())));
+                _cache_hm_info[c]->setText(toQString(str::asprintf("%llu / %llu", s.hits, s.misses)));
+                _cache_ev_info[c]->setText(toQString(str::from(s.evictions)));
+                _cache_sz_info[c]->setText(info.cache[c].max_size == 0
+                        ? toQString(str::from(info.cache[c].size))
+                        : toQString(str::from(info.cache[c].size) + " / " + str::from(info.cache[c].max_size)));
+            }
+            for (int w = 0; w < renderpass_info::worker_groups; w++) {
+                const thread_group_stats& s = info.workers[w];
+                _workers_if_info[w]->setText(toQString(str::from(s.in_flight)));
+                _workers_cr_info[w]->setText(toQString(str::from(s.completed)));
+                _workers_lt_info[w]->setText(s.completed == 0 ? ""
+                        : toQString(str::asprintf("< %g ms", s.latency_percentile(0.95f))));
+            }
+            _gradient_uploads_info->setText(toQString(str::from(info.gradient_uploads)));
+            _cache_box->setEnabled(true);
         } else {
             _gui_fps_info->setText("");
             for (int dp = 0; dp < 4; dp++) {
                 _gui_near_info[dp]->setText("");
                 _gui_far_info[dp]->setText("");
                 _gui_qc_info[dp]->setText("");
+                _gui_qh_info[dp]->setText("");
+                _gui_qo_info[dp]->setText("");
                 _gui_qr_info[dp]->setText("");
                 _gui_qa_info[dp]->setText("");
                 _gui_lq_info[dp]->setText("");
                 _gui_hq_info[dp]->setText("");
+                _gui_fp_info[dp]->setText("");
+                _gui_fs_info[dp]->setText("");
+                _gui_lt_info[dp]->setText("");
+                _gui_md_info[dp]->setText("");
+                _gui_qs_info[dp]->setText("");
+                _gui_qm_info[dp]->setText("");
+                _gui_qhl_info[dp]->setText("");
+                _gui_le_info[dp]->setText("");
+                _gui_lo_info[dp]->setText("");
+                _gui_od_info[dp]->setText("");
             }
             _gui_box->setEnabled(false);
+            for (int c = 0; c < renderpass_info::caches; c++) {
+                _cache_hr_info[c]->setText("");
+                _cache_hm_info[c]->setText("");
+                _cache_ev_info[c]->setText("");
+                _cache_sz_info[c]->setText("");
+            }
+            for (int w = 0; w < renderpass_info::worker_groups; w++) {
+                _workers_if_info[w]->setText("");
+                _workers_cr_info[w]->setText("");
+                _workers_lt_info[w]->setText("");
+            }
+            _gradient_uploads_info->setText("");
+            _cache_box->setEnabled(false);
         }
     }
 }
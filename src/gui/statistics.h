@@ -40,12 +40,33 @@ private:
     QLabel* _gui_near_info[4];
     QLabel* _gui_far_info[4];
     QLabel* _gui_qc_info[4];
+    QLabel* _gui_qh_info[4];
+    QLabel* _gui_qo_info[4];
     QLabel* _gui_qr_info[4];
     QLabel* _gui_qa_info[4];
     QLabel* _gui_lq_info[4];
     QLabel* _gui_hq_info[4];
+    QLabel* _gui_fp_info[4];
+    QLabel* _gui_fs_info[4];
+    QLabel* _gui_lt_info[4];
+    QLabel* _gui_md_info[4];
+    QLabel* _gui_qs_info[4];
+    QLabel* _gui_qm_info[4];
+    QLabel* _gui_qhl_info[4];
+    QLabel* _gui_le_info[4];
+    QLabel* _gui_lo_info[4];
+    QLabel* _gui_od_info[4];
     QLabel* _gui_bt_info[4];
     QLabel* _gui_rt_info[4];
+    QGroupBox* _cache_box;
+    QLabel* _cache_hr_info[renderpass_info::caches];
+    QLabel* _cache_hm_info[renderpass_info::caches];
+    QLabel* _cache_ev_info[renderpass_info::caches];
+    QLabel* _cache_sz_info[renderpass_info::caches];
+    QLabel* _workers_if_info[renderpass_info::worker_groups];
+    QLabel* _workers_cr_info[renderpass_info::worker_groups];
+    QLabel* _workers_lt_info[renderpass_info::worker_groups];
+    QLabel* _gradient_uploads_info;
 #if HAVE_LIBEQUALIZER
     QGroupBox* _eq_box;
     QLabel* _eq_fps_info;
@@ -57,6 +78,7 @@ public:
 
 public slots:
     void update_gui(float fps, const renderpass_info& info);
+    void show_lock_report();
 #if HAVE_LIBEQUALIZER
     void update_eq(float fps);
 #endif
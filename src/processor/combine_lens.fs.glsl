@@ -38,6 +38,7 @@ uniform float base_data_mirror_y;
 uniform mat3 base_data_matrix;
 uniform vec3 lens_pos;
 uniform float lens_radius;
+uniform vec4 lens_rect;
 uniform vec3 quad_tl;
 uniform vec3 quad_tr;
 uniform vec3 quad_bl;
@@ -61,8 +62,11 @@ void main()
     offset *= base_data_matrix;
     cart_coord += offset;
 
+    // Texels outside of lens_rect were not processed with lens parameters
     float dist_to_lens_center = length(cart_coord - lens_pos);
-    if (dist_to_lens_center > lens_radius) {
+    if (dist_to_lens_center > lens_radius
+            || any(lessThan(gl_TexCoord[0].xy, lens_rect.xy))
+            || any(greaterThan(gl_TexCoord[0].xy, lens_rect.zw))) {
         vec2 q0 = vec2(texcoord0_offset) + texcoord0_factor * gl_TexCoord[0].xy;
         gl_FragData[0] = texture2D(data0_tex, q0);
         gl_FragData[1] = texture2D(mask0_tex, q0);
@@ -0,0 +1,433 @@
+/*
+ * Copyright (C) 2013
+ * Computer Graphics Group, University of Siegen, Germany.
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>.
+ * See http://www.cg.informatik.uni-siegen.de/ for contact information.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+
+#include "dbg.h"
+#include "trc.h"
+
+#include "glvm.h"
+
+#include "cpu_processor.h"
+
+using namespace glvm;
+
+
+/* Helpers */
+
+static float srgb_to_linear(float x)
+{
+    // Exact formula, as used by the GL for sRGB textures
+    return (x <= 0.04045f ? x / 12.92f : std::pow((x + 0.055f) / 1.055f, 2.4f));
+}
+
+static void srgb8_to_linear_lut(float lut[256])
+{
+    for (int i = 0; i < 256; i++)
+        lut[i] = srgb_to_linear(i / 255.0f);
+}
+
+static float linear_to_srgb(float x)
+{
+    // Exact formula, as used by the GL for GL_FRAMEBUFFER_SRGB
+    return (x <= 0.0031308f ? x * 12.92f : 1.055f * std::pow(x, 1.0f / 2.4f) - 0.055f);
+}
+
+// dst[i] = clamp(a * src[i] + b, lo, hi)
+static void affine_clamp(const float* src, float* dst, int n, float a, float b, float lo, float hi)
+{
+    int i = 0;
+#ifdef __SSE2__
+    __m128 va = _mm_set1_ps(a);
+    __m128 vb = _mm_set1_ps(b);
+    __m128 vlo = _mm_set1_ps(lo);
+    __m128 vhi = _mm_set1_ps(hi);
+    for (; i + 4 <= n; i += 4) {
+        __m128 v = _mm_loadu_ps(src + i);
+        v = _mm_add_ps(_mm_mul_ps(v, va), vb);
+        v = _mm_min_ps(_mm_max_ps(v, vlo), vhi);
+        _mm_storeu_ps(dst + i, v);
+    }
+#endif
+    for (; i < n; i++)
+        dst[i] = min(max(a * src[i] + b, lo), hi);
+}
+
+/* A color gradient as an sRGB8 texture with linear filtering and the default
+ * GL_REPEAT wrap mode would provide it. */
+class cpu_gradient
+{
+private:
+    int _length;
+    std::vector<float> _rgb;
+
+public:
+    cpu_gradient(int length, const uint8_t* gradient) : _length(length), _rgb(3 * length)
+    {
+        float lut[256];
+        srgb8_to_linear_lut(lut);
+        for (int i = 0; i < 3 * length; i++)
+            _rgb[i] = lut[gradient[i]];
+    }
+
+    vec3 get(float x) const
+    {
+        if (!std::isfinite(x))
+            x = 0.0f;
+        float u = x * _length - 0.5f;
+        float fl = std::floor(u);
+        float f = u - fl;
+        int i0 = static_cast<int>(fl) % _length;
+        if (i0 < 0)
+            i0 += _length;
+        int i1 = (i0 + 1) % _length;
+        return vec3(
+                (1.0f - f) * _rgb[3 * i0 + 0] + f * _rgb[3 * i1 + 0],
+                (1.0f - f) * _rgb[3 * i0 + 1] + f * _rgb[3 * i1 + 1],
+                (1.0f - f) * _rgb[3 * i0 + 2] + f * _rgb[3 * i1 + 2]);
+    }
+};
+
+/* Write the gradient color for the values in [0,1] of one row */
+static void colorize_row(const float* values, int n, const cpu_gradient& gradient, bool adapt_brightness, float* dst)
+{
+    for (int i = 0; i < n; i++) {
+        vec3 rgb = gradient.get(values[i]);
+        if (adapt_brightness)
+            rgb *= values[i];
+        dst[3 * i + 0] = rgb.r;
+        dst[3 * i + 1] = rgb.g;
+        dst[3 * i + 2] = rgb.b;
+    }
+}
+
+
+/* cpu_processor */
+
+cpu_processor::cpu_processor() :
+    _min_elev(0.0f), _max_elev(0.0f)
+{
+}
+
+void cpu_processor::set_elevation_bounds(float min_elev, float max_elev)
+{
+    _min_elev = min_elev;
+    _max_elev = max_elev;
+}
+
+bool cpu_processor::supported(const database_description& dd, bool lens)
+{
+    const processing_parameters& pp = dd.processing_parameters[lens ? 1 : 0];
+    if (pp.category_e2c)
+        return false;
+    switch (dd.db.category()) {
+    case ecmdb::category_elevation:
+    case ecmdb::category_texture:
+        return true;
+    case ecmdb::category_sar_amplitude:
+        return (pp.sar_amplitude.despeckling_method == processing_parameters::sar_amplitude_despeckling_none
+                && pp.sar_amplitude.drr_method != processing_parameters::sar_amplitude_drr_schlicklocal
+                && pp.sar_amplitude.drr_method != processing_parameters::sar_amplitude_drr_reinhardlocal);
+    default:
+        return false;
+    }
+}
+
+void cpu_processor::unpack(const database_description& dd, const void* data, float* result)
+{
+    size_t n = static_cast<size_t>(dd.db.total_quad_size()) * dd.db.total_quad_size() * dd.db.channels();
+    if (dd.db.type() == ecmdb::type_uint8) {
+        const uint8_t* d = static_cast<const uint8_t*>(data);
+        float lut[256];
+        if (dd.db.category() == ecmdb::category_texture) {
+            srgb8_to_linear_lut(lut);
+        } else {
+            for (int i = 0; i < 256; i++)
+                lut[i] = i / 255.0f;
+        }
+        for (size_t i = 0; i < n; i++)
+            result[i] = lut[d[i]];
+    } else if (dd.db.type() == ecmdb::type_int16) {
+        // The renderer undoes the normalization to [-1,1], so we use the plain values
+        const int16_t* d = static_cast<const int16_t*>(data);
+        for (size_t i = 0; i < n; i++)
+            result[i] = d[i];
+    } else {
+        assert(dd.db.type() == ecmdb::type_float32);
+        std::memcpy(result, data, n * sizeof(float));
+    }
+}
+
+void cpu_processor::linear_to_srgb8(const float* src, uint8_t* dst, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        float x = src[i];
+        // Clamp like a fixed point color buffer; this also maps NaN to 0
+        x = (x > 0.0f ? (x < 1.0f ? x : 1.0f) : 0.0f);
+        dst[i] = static_cast<uint8_t>(linear_to_srgb(x) * 255.0f + 0.5f);
+    }
+}
+
+int cpu_processor::dst_overlap(const database_description& dd) const
+{
+    return (dd.db.category() == ecmdb::category_elevation ? 2 : 1);
+}
+
+int cpu_processor::dst_size(const database_description& dd) const
+{
+    return dd.db.quad_size() + 2 * dst_overlap(dd);
+}
+
+void cpu_processor::process(const database_description& dd, bool lens,
+        int src_size, const float* src_data, const uint8_t* src_mask,
+        const ecmdb::metadata& quad_meta,
+        float* dst_data, uint8_t* dst_mask,
+        ecmdb::metadata* meta) const
+{
+    TRC_SCOPE("process cpu");
+    assert(supported(dd, lens));
+    int ds = dst_size(dd);
+    int src_overlap = (src_size - (ds - 2 * dst_overlap(dd))) / 2;
+    assert(src_overlap >= dst_overlap(dd));
+
+    if (src_mask) {
+        assert(dst_mask);
+        int offset = src_overlap - dst_overlap(dd);
+        for (int y = 0; y < ds; y++)
+            std::memcpy(dst_mask + y * ds, src_mask + (y + offset) * src_size + offset, ds);
+    }
+    *meta = quad_meta;
+    if (dd.db.category() == ecmdb::category_elevation) {
+        process_elevation(dd, lens, src_size, src_overlap, src_data, dst_data);
+        const processing_parameters& pp = dd.processing_parameters[lens ? 1 : 0];
+        const float& sf = pp.elevation.scale_factor;
+        const float& sc = pp.elevation.scale_center;
+        meta->elevation.min = clamp((quad_meta.elevation.min - sc) * sf + sc, _min_elev, _max_elev);
+        meta->elevation.max = clamp((quad_meta.elevation.max - sc) * sf + sc, _min_elev, _max_elev);
+    } else if (dd.db.category() == ecmdb::category_texture) {
+        process_texture(dd, lens, src_size, src_overlap, src_data, dst_data);
+    } else {
+        assert(dd.db.category() == ecmdb::category_sar_amplitude);
+        process_sar_amplitude(dd, lens, src_size, src_overlap, src_data, dst_data);
+    }
+}
+
+void cpu_processor::process_elevation(const database_description& dd, bool lens, int src_size, int src_overlap,
+        const float* src_data, float* dst_data) const
+{
+    // See elevation/scale.fs.glsl
+    const processing_parameters& pp = dd.processing_parameters[lens ? 1 : 0];
+    int ds = dst_size(dd);
+    int offset = src_overlap - 2;
+    // (data_offset + data_factor * x - scale_center) * scale_factor + scale_center
+    float a = dd.db.data_factor() * pp.elevation.scale_factor;
+    float b = (dd.db.data_offset() - pp.elevation.scale_center) * pp.elevation.scale_factor + pp.elevation.scale_center;
+    for (int y = 0; y < ds; y++)
+        affine_clamp(src_data + (y + offset) * src_size + offset, dst_data + y * ds, ds, a, b, _min_elev, _max_elev);
+}
+
+void cpu_processor::process_texture(const database_description& dd, bool lens, int src_size, int src_overlap,
+        const float* src_data, float* dst_data) const
+{
+    // See texture/color_correct.fs.glsl
+    const processing_parameters& pp = dd.processing_parameters[lens ? 1 : 0];
+    int channels = dd.db.channels();
+    int ds = dst_size(dd);
+    int offset = src_overlap - 1;
+    bool need_color_correction = (pp.texture.contrast < 0.0f || pp.texture.contrast > 0.0f)
+        || (pp.texture.brightness < 0.0f || pp.texture.brightness > 0.0f)
+        || (pp.texture.saturation < 0.0f || pp.texture.saturation > 0.0f)
+        || (pp.texture.hue < 0.0f || pp.texture.hue > 0.0f);
+
+    /* The conversion sRGB -> YUV, the adjustment, and the conversion YUV -> sRGB
+     * are all affine, so they are combined into one affine map M * srgb + c. */
+    mat3 m;
+    vec3 c;
+    if (need_color_correction) {
+        const mat3 srgb_to_yuv(
+                0.299f, -0.168736f,  0.5f,
+                0.587f, -0.331264f, -0.418688f,
+                0.114f,  0.5f,      -0.081312f);
+        const mat3 yuv_to_srgb(
+                1.0f,    1.0f,      1.0f,
+                0.0f,   -0.344136f, 1.772f,
+                1.402f, -0.714136f, 0.0f);
+        float cos_hue = std::cos(pp.texture.hue * const_pi<float>());
+        float sin_hue = std::sin(pp.texture.hue * const_pi<float>());
+        float sat = pp.texture.saturation + 1.0f;
+        float contrast = pp.texture.contrast + 1.0f;
+        // adjust_yuv() is A * (yuv - 0.5) + (brightness + 0.5, 0.5, 0.5), and the
+        // (0, 0.5, 0.5) offsets of the YUV conversions cancel out with it.
+        const mat3 adjust(
+                contrast, 0.0f, 0.0f,
+                0.0f, cos_hue * sat, sin_hue * sat,
+                0.0f, -sin_hue * sat, cos_hue * sat);
+        m = yuv_to_srgb * adjust * srgb_to_yuv;
+        c = yuv_to_srgb * vec3(pp.texture.brightness + 0.5f - 0.5f * contrast, 0.0f, 0.0f);
+    }
+    for (int y = 0; y < ds; y++) {
+        const float* src_row = src_data + ((y + offset) * src_size + offset) * channels;
+        float* dst_row = dst_data + y * ds * 3;
+        for (int x = 0; x < ds; x++) {
+            vec3 rgb = (channels == 1
+                    ? vec3(src_row[x])
+                    : vec3(src_row[3 * x + 0], src_row[3 * x + 1], src_row[3 * x + 2]));
+            if (need_color_correction) {
+                // The shader uses the approximation pow(x, 1/2.2) for the sRGB conversions
+                vec3 srgb = vec3(std::pow(rgb.r, 1.0f / 2.2f), std::pow(rgb.g, 1.0f / 2.2f), std::pow(rgb.b, 1.0f / 2.2f));
+                srgb = m * srgb + c;
+                rgb = vec3(std::pow(max(srgb.r, 0.0f), 2.2f),
+                        std::pow(max(srgb.g, 0.0f), 2.2f),
+                        std::pow(max(srgb.b, 0.0f), 2.2f));
+            }
+            dst_row[3 * x + 0] = rgb.r;
+            dst_row[3 * x + 1] = rgb.g;
+            dst_row[3 * x + 2] = rgb.b;
+        }
+    }
+}
+
+void cpu_processor::process_sar_amplitude(const database_description& dd, bool lens, int src_size, int src_overlap,
+        const float* src_data, float* dst_data) const
+{
+    // See sar-amplitude/normalization.fs.glsl, the global drr-*.fs.glsl, and sar-amplitude/coloring.fs.glsl
+    const processing_parameters& pp = dd.processing_parameters[lens ? 1 : 0];
+    int ds = dst_size(dd);
+    int offset = src_overlap - 1;
+    const float inf = std::numeric_limits<float>::infinity();
+    cpu_gradient gradient(pp.sar_amplitude.gradient_length, pp.sar_amplitude.gradient);
+    std::vector<float> row(ds);
+
+    float norm_min = dd.meta.sar_amplitude.min;
+    float norm_max = dd.meta.sar_amplitude.max;
+    float norm_a = 1.0f / (norm_max - norm_min);
+    float norm_b = -norm_min * norm_a;
+    for (int y = 0; y < ds; y++) {
+        affine_clamp(src_data + (y + offset) * src_size + offset, &(row[0]), ds, norm_a, norm_b, -inf, inf);
+        switch (pp.sar_amplitude.drr_method) {
+        case processing_parameters::sar_amplitude_drr_linear:
+            {
+                float min_amp = pp.sar_amplitude.drr.linear.min_amp;
+                float max_amp = pp.sar_amplitude.drr.linear.max_amp;
+                float maxmin_diff = max(0.0f, max_amp - min_amp);
+                affine_clamp(&(row[0]), &(row[0]), ds, 1.0f, 0.0f, min_amp, max_amp);
+                affine_clamp(&(row[0]), &(row[0]), ds, 1.0f / maxmin_diff, -min_amp / maxmin_diff, -inf, inf);
+            }
+            break;
+        case processing_parameters::sar_amplitude_drr_log:
+            {
+                float min_amp = pp.sar_amplitude.drr.log.min_amp;
+                float max_amp = pp.sar_amplitude.drr.log.max_amp;
+                float prescale = pp.sar_amplitude.drr.log.prescale;
+                float diff = max(0.0f, max_amp - min_amp);
+                float log_1_prescale = std::log(1.0f + prescale);
+                affine_clamp(&(row[0]), &(row[0]), ds, 1.0f, 0.0f, min_amp, max_amp);
+                affine_clamp(&(row[0]), &(row[0]), ds, 1.0f / diff, -min_amp / diff, -inf, inf);
+                for (int x = 0; x < ds; x++)
+                    row[x] = std::log(1.0f + prescale * row[x]) / log_1_prescale;
+            }
+            break;
+        case processing_parameters::sar_amplitude_drr_gamma:
+            {
+                float min_amp = pp.sar_amplitude.drr.gamma.min_amp;
+                float diff = pp.sar_amplitude.drr.gamma.max_amp - pp.sar_amplitude.drr.gamma.min_amp;
+                float gamma_reciprocal = 1.0f / pp.sar_amplitude.drr.gamma.gamma;
+                for (int x = 0; x < ds; x++)
+                    row[x] = min(1.0f, std::pow(max(0.0f, row[x] - min_amp) / diff, gamma_reciprocal));
+            }
+            break;
+        case processing_parameters::sar_amplitude_drr_schlick:
+            {
+                float p = pp.sar_amplitude.drr.schlick.brightness;
+                for (int x = 0; x < ds; x++)
+                    row[x] = clamp((p * row[x]) / ((p - 1.0f) * row[x] + 1.0f), 0.0f, 1.0f);
+            }
+            break;
+        case processing_parameters::sar_amplitude_drr_reinhard:
+            {
+                // Parameters as in DynamicRangeReductionReinhard::apply()
+                float min_amp = dd.meta.sar_amplitude.min;
+                float max_amp = dd.meta.sar_amplitude.max;
+                float avg_amp = dd.meta.sar_amplitude.sum / dd.meta.sar_amplitude.valid;
+                float m = 0.3f + 0.7f * std::pow((1.0f - (avg_amp / max_amp)) / (1.0f - (min_amp / max_amp)), 1.4f);
+                float b = std::exp(-pp.sar_amplitude.drr.reinhard.brightness);
+                float l = 1.0f - pp.sar_amplitude.drr.reinhard.contrast;
+                float r_min = min_amp / max_amp;
+                float r_avg = avg_amp / max_amp;
+                for (int x = 0; x < ds; x++) {
+                    float I_a = l * row[x] + (1.0f - l) * r_avg;
+                    float g = row[x] / (row[x] + std::pow(b * I_a, m));
+                    row[x] = clamp((g - r_min) / (1.0f - r_min), 0.0f, 1.0f);
+                }
+            }
+            break;
+        default:
+            assert(false);
+            break;
+        }
+        colorize_row(&(row[0]), ds, gradient, pp.sar_amplitude.adapt_brightness, dst_data + y * ds * 3);
+    }
+}
+
+
+/* cpu_quad_processing */
+
+cpu_quad_processing::cpu_quad_processing(const cpu_processor& processor, const database_description& dd, bool lens) :
+    _processor(processor), _dd(dd), _lens(lens)
+{
+}
+
+void cpu_quad_processing::process(quad_mem* qmem) const
+{
+    assert(qmem->data.ptr());
+    int src_size = _dd.db.total_quad_size();
+    int ds = _processor.dst_size(_dd);
+    bool elevation = (_dd.db.category() == ecmdb::category_elevation);
+    int dst_channels = (elevation ? 1 : 3);
+
+    std::vector<float> src_data(static_cast<size_t>(src_size) * src_size * _dd.db.channels());
+    cpu_processor::unpack(_dd, qmem->data.ptr(), &(src_data[0]));
+    std::vector<float> dst_data(static_cast<size_t>(ds) * ds * dst_channels);
+    std::vector<uint8_t> dst_mask(qmem->mask.ptr() ? ds * ds : 0);
+    ecmdb::metadata meta;
+    _processor.process(_dd, _lens, src_size, &(src_data[0]), qmem->mask.ptr<uint8_t>(), qmem->meta,
+            &(dst_data[0]), dst_mask.empty() ? NULL : &(dst_mask[0]), &meta);
+
+    if (elevation) {
+        qmem->data.resize(dst_data.size() * sizeof(float));
+        std::memcpy(qmem->data.ptr(), &(dst_data[0]), qmem->data.size());
+    } else {
+        qmem->data.resize(dst_data.size());
+        cpu_processor::linear_to_srgb8(&(dst_data[0]), qmem->data.ptr<uint8_t>(), dst_data.size());
+    }
+    if (!dst_mask.empty()) {
+        qmem->mask.resize(dst_mask.size());
+        std::memcpy(qmem->mask.ptr(), &(dst_mask[0]), dst_mask.size());
+    }
+    qmem->meta = meta;
+}
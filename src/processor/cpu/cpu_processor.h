@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2013
+ * Computer Graphics Group, University of Siegen, Germany.
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>.
+ * See http://www.cg.informatik.uni-siegen.de/ for contact information.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CPU_PROCESSOR_H
+#define CPU_PROCESSOR_H
+
+#include <vector>
+#include <stdint.h>
+
+#include <ecmdb/ecmdb.h>
+
+#include "database_description.h"
+#include "quad-cache.h"
+
+/*
+ * CPU implementations of the processing steps that the GPU processors perform
+ * in their shaders. They need no GL context and can therefore run on worker
+ * threads, or on machines without a GPU.
+ *
+ * Quads are stored as in the textures: square, rows from bottom to top,
+ * float data with 1 (elevation, SAR amplitude) or 1 or 3 (texture) channels,
+ * and uint8 masks (0 = invalid, 255 = valid). Texture data is linear RGB,
+ * i.e. sRGB-decoded, as the shaders see it. Processed texture data is always
+ * linear RGB with 3 channels.
+ *
+ * Like on the GPU, the destination quads have an overlap of 2 for elevation
+ * and of 1 for all other categories, and the source quads have the overlap of
+ * their database.
+ *
+ * The affine scale and clamp steps use SSE2 where available.
+ *
+ * Elevation to color (e2c) is not implemented here: its input is processed
+ * elevation data, which only exists on the GPU.
+ *
+ * When CPU processing is enabled, the renderer processes quads with this
+ * implementation on the memory cache loader threads; see cpu_quad_processing
+ * and processor::set_cpu_processing().
+ */
+
+class cpu_processor
+{
+private:
+    float _min_elev, _max_elev;         // elevation bounds
+
+    void process_elevation(const database_description& dd, bool lens, int src_size, int src_overlap,
+            const float* src_data, float* dst_data) const;
+    void process_texture(const database_description& dd, bool lens, int src_size, int src_overlap,
+            const float* src_data, float* dst_data) const;
+    void process_sar_amplitude(const database_description& dd, bool lens, int src_size, int src_overlap,
+            const float* src_data, float* dst_data) const;
+
+public:
+    cpu_processor();
+
+    /* Same as the corresponding functions of the GPU processors. */
+    void set_elevation_bounds(float min_elev, float max_elev);
+
+    /* Check if the CPU implementation can process the given database with
+     * the current processing parameters. Not supported are SAR amplitude
+     * despeckling and local SAR amplitude dynamic range reduction. */
+    static bool supported(const database_description& dd, bool lens);
+
+    /* Convert raw quad data as loaded from the database (see quad_mem) into
+     * the float representation that the GPU sees after uploading it.
+     * The result must have room for total_quad_size^2 * channels floats. */
+    static void unpack(const database_description& dd, const void* data, float* result);
+
+    /* Conversion from linear floats to sRGB8 as stored in GL_SRGB textures,
+     * with the exact formula that the GL uses. */
+    static void linear_to_srgb8(const float* src, uint8_t* dst, size_t n);
+
+    /* Process one quad. The source has a size of src_size x src_size; the mask
+     * may be NULL for full validity. The destination has a size of
+     * (quad_size + 2 * dst_overlap)^2 with dst_overlap as described above,
+     * and dst_mask may be NULL if src_mask is NULL. */
+    void process(const database_description& dd, bool lens,
+            int src_size, const float* src_data, const uint8_t* src_mask,
+            const ecmdb::metadata& quad_meta,
+            float* dst_data, uint8_t* dst_mask,
+            ecmdb::metadata* meta) const;
+
+    /* Size and overlap of a processed quad of the given database. */
+    int dst_overlap(const database_description& dd) const;
+    int dst_size(const database_description& dd) const;
+};
+
+/*
+ * Processing of a quad on a memory cache loader thread. It replaces the raw
+ * quad data with processed data in the format of the destination textures:
+ * float elevations, or sRGB8 RGB colors for all other categories. The mask
+ * is replaced by the mask of the destination quad; it stays empty for fully
+ * valid quads. The processor and the database description are copied, so
+ * later parameter changes do not affect a running load.
+ */
+
+class cpu_quad_processing : public quad_mem_processing
+{
+private:
+    const cpu_processor _processor;
+    const database_description _dd;
+    const bool _lens;
+
+public:
+    cpu_quad_processing(const cpu_processor& processor, const database_description& dd, bool lens);
+
+    virtual void process(quad_mem* qmem) const;
+};
+
+#endif
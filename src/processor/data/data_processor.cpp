@@ -22,6 +22,8 @@
 
 #include <cmath>
 
+#include "trc.h"
+
 #include "glvm.h"
 #include "xgl.h"
 
@@ -59,5 +61,6 @@ void data_processor::process(
         bool* full_validity,
         ecmdb::metadata* meta)
 {
+    TRC_SCOPE("process data");
     assert(false);
 }
@@ -23,6 +23,7 @@
 #include <cmath>
 
 #include "str.h"
+#include "trc.h"
 
 #include "glvm-gl.h"
 #include "xgl.h"
@@ -33,9 +34,9 @@
 using namespace glvm;
 
 
-e2c_processor::e2c_processor() :
-    _last_frame(-1), _min_elev(0.0f), _max_elev(0.0f),
-    _prg(0), _prg_isolines(0), _pbo(0), _gradient_tex(0)
+e2c_processor::e2c_processor(gradient_cache* gradient_cache) :
+    _gradient_cache(gradient_cache), _min_elev(0.0f), _max_elev(0.0f),
+    _prg(0), _prg_isolines(0)
 {
 }
 
@@ -53,14 +54,6 @@ void e2c_processor::exit_gl()
         xgl::DeleteProgram(_prg_isolines);
         _prg_isolines = 0;
     }
-    if (_pbo != 0) {
-        glDeleteBuffers(1, &_pbo);
-        _pbo = 0;
-    }
-    if (_gradient_tex != 0) {
-        glDeleteTextures(1, &_gradient_tex);
-        _gradient_tex = 0;
-    }
 }
 
 void e2c_processor::set_e2c_info(int quad_size, float min_elev, float max_elev)
@@ -80,17 +73,17 @@ bool e2c_processor::processing_is_necessary(
 }
 
 void e2c_processor::process(
-        unsigned int frame,
+        unsigned int /* frame */,
         const database_description& dd, bool lens,
         const glvm::ivec4& /* quad */,
         const ecmdb::metadata& quad_meta,
         bool* /* full_validity */,
         ecmdb::metadata* meta)
 {
+    TRC_SCOPE("process e2c");
     assert(xgl::CheckError(HERE));
 
     const processing_parameters& pp = dd.processing_parameters[lens ? 1 : 0];
-    bool need_gradient_upload = (frame != _last_frame);
     bool need_isolines = (pp.e2c.isolines_distance > 0.0f && pp.e2c.isolines_thickness > 0.0f);
 
     if (!need_isolines && _prg == 0) {
@@ -115,17 +108,6 @@ void e2c_processor::process(
         glvmUniform(xgl::GetUniformLocation(_prg_isolines, "gradient_tex"), 2);
         assert(xgl::CheckError(HERE));
     }
-    if (_pbo == 0) {
-        glGenBuffers(1, &_pbo);
-    }
-    if (_gradient_tex == 0 || xgl::GetTex2DParameter(_gradient_tex, GL_TEXTURE_WIDTH) != pp.e2c.gradient_length) {
-        need_gradient_upload = true;
-        if (_gradient_tex != 0) {
-            glDeleteTextures(1, &_gradient_tex);
-        }
-        _gradient_tex = xgl::CreateTex2D(GL_SRGB8, pp.e2c.gradient_length, 1, GL_LINEAR);
-        assert(xgl::CheckError(HERE));
-    }
     GLuint prg = need_isolines ? _prg_isolines : _prg;
     glUseProgram(prg);
 
@@ -147,13 +129,8 @@ void e2c_processor::process(
         glvmUniform(xgl::GetUniformLocation(prg, "isolines_color"), isolines_color);
     }
     assert(xgl::CheckError(HERE));
-    if (need_gradient_upload) {
-        xgl::WriteTex2D(_gradient_tex, 0, 0, pp.e2c.gradient_length, 1, GL_RGB, GL_UNSIGNED_BYTE,
-                pp.e2c.gradient_length * 3 * sizeof(uint8_t), pp.e2c.gradient, _pbo);
-        assert(xgl::CheckError(HERE));
-    }
     glActiveTexture(GL_TEXTURE2);
-    glBindTexture(GL_TEXTURE_2D, _gradient_tex);
+    glBindTexture(GL_TEXTURE_2D, _gradient_cache->get(pp.e2c.gradient_length, pp.e2c.gradient));
     assert(xgl::CheckError(HERE));
 
     assert(input_tex_size - _quad_size >= 0);
@@ -165,5 +142,4 @@ void e2c_processor::process(
     xgl::DrawQuad(-1.0f, -1.0f, 2.0f, 2.0f, t, t, s, s);
     assert(xgl::CheckError(HERE));
     *meta = quad_meta;
-    _last_frame = frame;
 }
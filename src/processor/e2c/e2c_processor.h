@@ -22,21 +22,20 @@
 #define E2C_PROCESSOR_H
 
 #include "../processor.h"
+#include "../gradient_cache.h"
 
 class e2c_processor : public dbcategory_processor
 {
 private:
-    unsigned int _last_frame;
+    gradient_cache* _gradient_cache;
     int _quad_size;
     float _min_elev;
     float _max_elev;
     GLuint _prg;
     GLuint _prg_isolines;
-    GLuint _pbo;
-    GLuint _gradient_tex;
 
 public:
-    e2c_processor();
+    e2c_processor(gradient_cache* gradient_cache);
 
     virtual void init_gl();
     virtual void exit_gl();
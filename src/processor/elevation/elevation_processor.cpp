@@ -20,6 +20,10 @@
 
 #include "config.h"
 
+#include <cstring>
+
+#include "trc.h"
+
 #include "glvm-gl.h"
 #include "xgl.h"
 
@@ -30,7 +34,7 @@ using namespace glvm;
 
 
 elevation_processor::elevation_processor() :
-    _min_elev(0.0f), _max_elev(0.0f), _prg(0)
+    _min_elev(0.0f), _max_elev(0.0f), _prg(0), _uniform_values_valid(false)
 {
 }
 
@@ -64,6 +68,7 @@ void elevation_processor::exit_gl()
         xgl::DeleteProgram(_prg);
         _prg = 0;
     }
+    _uniform_values_valid = false;
 }
 
 bool elevation_processor::processing_is_necessary(
@@ -86,6 +91,7 @@ void elevation_processor::process(
         bool* /* full_validity */,
         ecmdb::metadata* meta)
 {
+    TRC_SCOPE("process elevation");
     assert(xgl::CheckError(HERE));
 
     const processing_parameters& pp = dd.processing_parameters[lens ? 1 : 0];
@@ -102,15 +108,28 @@ void elevation_processor::process(
         _scale_center_loc = xgl::GetUniformLocation(_prg, "scale_center");
         _min_elev_loc = xgl::GetUniformLocation(_prg, "min_elev");
         _max_elev_loc = xgl::GetUniformLocation(_prg, "max_elev");
+        _uniform_values_valid = false;
     }
 
     glUseProgram(_prg);
-    glvmUniform(_data_offset_loc, dd.db.data_offset());
-    glvmUniform(_data_factor_loc, dd.db.data_factor());
-    glvmUniform(_scale_factor_loc, pp.elevation.scale_factor);
-    glvmUniform(_scale_center_loc, pp.elevation.scale_center);
-    glvmUniform(_min_elev_loc, _min_elev);
-    glvmUniform(_max_elev_loc, _max_elev);
+    // Uniform values are kept by the program, so they only need to be set
+    // when they change.
+    const float values[6] = {
+        dd.db.data_offset(), dd.db.data_factor(),
+        pp.elevation.scale_factor, pp.elevation.scale_center,
+        _min_elev, _max_elev
+    };
+    if (!_uniform_values_valid || std::memcmp(values, _uniform_values, sizeof(values)) != 0) {
+        glvmUniform(_data_offset_loc, values[0]);
+        glvmUniform(_data_factor_loc, values[1]);
+        glvmUniform(_scale_factor_loc, values[2]);
+        glvmUniform(_scale_center_loc, values[3]);
+        glvmUniform(_min_elev_loc, values[4]);
+        glvmUniform(_max_elev_loc, values[5]);
+        std::memcpy(_uniform_values, values, sizeof(values));
+        _uniform_values_valid = true;
+    }
+
     float step = 1.0f / dd.db.total_quad_size(); 
     float t = step * (dd.db.overlap() - 2);
     float s = step * (dd.db.quad_size() + 4);
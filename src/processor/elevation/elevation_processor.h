@@ -35,6 +35,10 @@ private:
     GLint _scale_center_loc;
     GLint _min_elev_loc;
     GLint _max_elev_loc;
+    // The uniform values that were last set in _prg. They depend only on the
+    // database and its parameters, so they rarely change between quads.
+    float _uniform_values[6];
+    bool _uniform_values_valid;
 
 public:
     elevation_processor();
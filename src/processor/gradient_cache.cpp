@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2013
+ * Computer Graphics Group, University of Siegen, Germany.
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>.
+ * See http://www.cg.informatik.uni-siegen.de/ for contact information.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <cstring>
+
+#include "dbg.h"
+#include "msg.h"
+
+#include "xgl.h"
+
+#include "gradient_cache.h"
+
+
+gradient_cache::gradient_cache() :
+    _cache(_max_gradients), _pbo(0), _uploads(0)
+{
+}
+
+gradient_cache::~gradient_cache()
+{
+}
+
+void gradient_cache::exit_gl()
+{
+    _cache.clear();
+    if (_pbo != 0) {
+        glDeleteBuffers(1, &_pbo);
+        _pbo = 0;
+    }
+}
+
+unsigned long long gradient_cache::hash(int length, const uint8_t* gradient)
+{
+    // 64 bit FNV-1a
+    unsigned long long h = 14695981039346656037ULL;
+    for (int i = 0; i < 3 * length; i++) {
+        h ^= gradient[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+GLuint gradient_cache::get(int gradient_length, const uint8_t* gradient)
+{
+    assert(gradient_length > 0);
+    key k(hash(gradient_length, gradient), gradient_length);
+    gradient_tex* gt = const_cast<gradient_tex*>(_cache.get(k));
+    if (gt && std::memcmp(&(gt->gradient[0]), gradient, 3 * gradient_length) == 0)
+        return gt->tex;
+
+    if (_pbo == 0) {
+        glGenBuffers(1, &_pbo);
+    }
+    if (gt) {
+        // Hash collision: replace the gradient of the existing texture, which has the same length.
+        msg::dbg("Gradient cache: hash collision");
+        std::memcpy(&(gt->gradient[0]), gradient, 3 * gradient_length);
+    } else {
+        gt = new gradient_tex(xgl::CreateTex2D(GL_SRGB8, gradient_length, 1, GL_LINEAR), gradient_length, gradient);
+        _cache.put(k, gt);
+    }
+    xgl::WriteTex2D(gt->tex, 0, 0, gradient_length, 1, GL_RGB, GL_UNSIGNED_BYTE,
+            gradient_length * 3 * sizeof(uint8_t), gradient, _pbo);
+    assert(xgl::CheckError(HERE));
+    _uploads++;
+    return gt->tex;
+}
@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2013
+ * Computer Graphics Group, University of Siegen, Germany.
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>.
+ * See http://www.cg.informatik.uni-siegen.de/ for contact information.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GRADIENT_CACHE_H
+#define GRADIENT_CACHE_H
+
+#include <vector>
+#include <stdint.h>
+
+#include <GL/glew.h>
+
+#include "lru.h"
+
+
+/* A small cache of color gradient textures (gradient_length x 1 texels, GL_SRGB8).
+ * The textures are addressed by their contents, so a gradient is uploaded only
+ * the first time it is seen. The cache is shared by all processors, so that
+ * identical gradients of different databases or of the lens and non-lens
+ * processing parameters use the same texture. */
+
+class gradient_cache
+{
+private:
+    class key
+    {
+    public:
+        unsigned long long hash;
+        int length;
+
+        key(unsigned long long h, int l) : hash(h), length(l)
+        {
+        }
+
+        bool operator<(const key& k) const
+        {
+            return (hash < k.hash || (hash == k.hash && length < k.length));
+        }
+    };
+
+    class gradient_tex
+    {
+    public:
+        GLuint tex;
+        std::vector<uint8_t> gradient;  // RGB triplets; to detect hash collisions
+
+        gradient_tex(GLuint t, int length, const uint8_t* g) :
+            tex(t), gradient(g, g + 3 * length)
+        {
+        }
+
+        ~gradient_tex()
+        {
+            glDeleteTextures(1, &tex);
+        }
+    };
+
+    static const size_t _max_gradients = 16;
+    lru_cache<gradient_tex, key> _cache;
+    GLuint _pbo;
+    unsigned long long _uploads;
+
+    static unsigned long long hash(int length, const uint8_t* gradient);
+
+public:
+    gradient_cache();
+    ~gradient_cache();
+
+    void exit_gl();
+
+    /* Return a texture that contains the given gradient (gradient_length RGB
+     * triplets). The texture may be evicted by the next call to get(). */
+    GLuint get(int gradient_length, const uint8_t* gradient);
+
+    /* Number of gradient uploads so far (for statistics). */
+    unsigned long long uploads() const
+    {
+        return _uploads;
+    }
+};
+
+#endif
@@ -20,6 +20,9 @@
 
 #include "config.h"
 
+#include <vector>
+#include <sstream>
+
 #include <GL/glew.h>
 
 #include <ecmdb/ecm.h>
@@ -27,6 +30,8 @@
 #include "dbg.h"
 #include "msg.h"
 #include "str.h"
+#include "ser.h"
+#include "trc.h"
 
 #include "glvm-gl.h"
 #include "xgl.h"
@@ -44,16 +49,44 @@
 using namespace glvm;
 
 
-processor::processor()
+void dbcategory_processor::setup_job(const processing_job& job)
+{
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, job.dst_data_tex, 0);
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, job.dst_mask_tex, 0);
+    assert(xgl::CheckFBO(GL_DRAW_FRAMEBUFFER, HERE));
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, job.src_data_tex);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, job.src_mask_tex);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+}
+
+void dbcategory_processor::process_batch(
+        unsigned int frame,
+        const database_description& dd, bool lens,
+        size_t njobs, processing_job* jobs)
+{
+    for (size_t i = 0; i < njobs; i++) {
+        setup_job(jobs[i]);
+        process(frame, dd, lens, jobs[i].quad, jobs[i].quad_meta, &(jobs[i].full_validity), &(jobs[i].meta));
+    }
+}
+
+
+processor::processor() :
+    _cpu_processing(false), _min_elev(0.0f), _max_elev(0.0f), _cpu_generation(0)
 {
     assert(ecmdb::category_elevation == 1);
     assert(ecmdb::category_texture == 2);
     assert(ecmdb::category_sar_amplitude == 3);
     assert(ecmdb::category_data == 4);
-    _procs[0] = new e2c_processor();
+    _procs[0] = new e2c_processor(&_gradient_cache);
     _procs[1] = new elevation_processor();
     _procs[2] = new texture_processor();
-    _procs[3] = new sar_amplitude_processor();
+    _procs[3] = new sar_amplitude_processor(&_gradient_cache);
     _procs[4] = new data_processor();
     for (int i = 0; i < max_combinable_quads - 1; i++)
         _prg_combine[i] = 0;
@@ -77,6 +110,7 @@ void processor::exit_gl()
             _procs[i]->exit_gl();
         }
     }
+    _gradient_cache.exit_gl();
     for (int i = 0; i < max_combinable_quads - 1; i++) {
         if (_prg_combine[i] != 0) {
             xgl::DeleteProgram(_prg_combine[i]);
@@ -89,9 +123,61 @@ void processor::exit_gl()
     }
 }
 
+void processor::set_cpu_processing(bool cpu_processing, const std::vector<database_description>& dds)
+{
+    _cpu_processing = cpu_processing;
+    if (!_cpu_processing) {
+        _cpu_parameters[0].clear();
+        _cpu_parameters[1].clear();
+        return;
+    }
+    for (int l = 0; l < 2; l++) {
+        std::map<uuid, std::pair<std::string, unsigned int> > parameters;
+        for (size_t i = 0; i < dds.size(); i++) {
+            std::ostringstream oss;
+            dds[i].processing_parameters[l].save(oss);
+            if (dds[i].db.category() == ecmdb::category_elevation) {
+                s11n::save(oss, _min_elev);
+                s11n::save(oss, _max_elev);
+            }
+            std::map<uuid, std::pair<std::string, unsigned int> >::const_iterator it
+                = _cpu_parameters[l].find(dds[i].uuid);
+            if (it != _cpu_parameters[l].end() && it->second.first == oss.str())
+                parameters[dds[i].uuid] = it->second;
+            else
+                parameters[dds[i].uuid] = std::pair<std::string, unsigned int>(oss.str(), ++_cpu_generation);
+        }
+        _cpu_parameters[l].swap(parameters);
+    }
+}
+
+bool processor::use_cpu(const database_description& dd, bool lens) const
+{
+    return (_cpu_processing && !dd.processing_parameters[0].category_e2c
+            && cpu_processor::supported(dd, lens)
+            && _cpu_parameters[lens ? 1 : 0].find(dd.uuid) != _cpu_parameters[lens ? 1 : 0].end());
+}
+
+unsigned int processor::cpu_processing_generation(const database_description& dd, bool lens) const
+{
+    std::map<uuid, std::pair<std::string, unsigned int> >::const_iterator it
+        = _cpu_parameters[lens ? 1 : 0].find(dd.uuid);
+    assert(it != _cpu_parameters[lens ? 1 : 0].end());
+    return it->second.second;
+}
+
+quad_mem_processing* processor::cpu_quad_processing(const database_description& dd, bool lens) const
+{
+    assert(use_cpu(dd, lens));
+    return new class cpu_quad_processing(_cpu_processor, dd, lens);
+}
+
 void processor::set_elevation_bounds(float min_elev, float max_elev)
 {
     static_cast<elevation_processor *>(_procs[ecmdb::category_elevation])->set_elevation_bounds(min_elev, max_elev);
+    _cpu_processor.set_elevation_bounds(min_elev, max_elev);
+    _min_elev = min_elev;
+    _max_elev = max_elev;
 }
 
 void processor::get_processed_quad_elevation_bounds(
@@ -137,6 +223,19 @@ void processor::process(
         _procs[dd.db.category()]->process(frame, dd, lens, quad, quad_meta, full_validity, meta);
 }
 
+void processor::process_batch(
+        unsigned int frame,
+        const database_description& dd, bool lens,
+        size_t njobs, processing_job* jobs)
+{
+    if (njobs == 0)
+        return;
+    if (dd.processing_parameters[0].category_e2c)
+        _procs[0]->process_batch(frame, dd, lens, njobs, jobs);
+    else
+        _procs[dd.db.category()]->process_batch(frame, dd, lens, njobs, jobs);
+}
+
 void processor::combine(
         unsigned int /* frame */,
         unsigned int /* ndds */, const database_description* const* dds,
@@ -147,6 +246,7 @@ void processor::combine(
         const ecmdb::metadata* metas,
         ecmdb::metadata* meta)
 {
+    TRC_SCOPE("combine");
     assert(quads >= 2);
     
     int prg_index = quads - 2;
@@ -229,11 +329,13 @@ void processor::combine_lens(
         int total_dst_quad_size,
         const vec3& lens_rel_pos,
         float lens_radius,
+        const ivec4& lens_rect,
         const vec3 quad_corner_rel_pos[4],
         const ecmdb::metadata& meta0,
         const ecmdb::metadata& meta1,
         ecmdb::metadata* meta)
 {
+    TRC_SCOPE("combine lens");
     if (_prg_combine_lens == 0) {
         std::string src(COMBINE_LENS_FS_GLSL_STR);
         _prg_combine_lens = xgl::CreateProgram("combine-lens", "", "", src);
@@ -257,6 +359,7 @@ void processor::combine_lens(
         _base_data_matrix_loc = xgl::GetUniformLocation(_prg_combine_lens, "base_data_matrix");
         _lens_pos_loc = xgl::GetUniformLocation(_prg_combine_lens, "lens_pos");
         _lens_radius_loc = xgl::GetUniformLocation(_prg_combine_lens, "lens_radius");
+        _lens_rect_loc = xgl::GetUniformLocation(_prg_combine_lens, "lens_rect");
         _quad_bl_loc = xgl::GetUniformLocation(_prg_combine_lens, "quad_bl");
         _quad_br_loc = xgl::GetUniformLocation(_prg_combine_lens, "quad_br");
         _quad_tl_loc = xgl::GetUniformLocation(_prg_combine_lens, "quad_tl");
@@ -296,6 +399,9 @@ void processor::combine_lens(
     glvmUniform(_base_data_matrix_loc, base_data_matrix);
     glvmUniform(_lens_pos_loc, lens_rel_pos);
     glvmUniform(_lens_radius_loc, lens_radius);
+    glvmUniform(_lens_rect_loc, vec4(lens_rect[0], lens_rect[1],
+                lens_rect[0] + lens_rect[2], lens_rect[1] + lens_rect[3])
+            / static_cast<float>(total_dst_quad_size));
     glvmUniform(_quad_bl_loc, quad_corner_rel_pos[ecm::corner_bl]);
     glvmUniform(_quad_br_loc, quad_corner_rel_pos[ecm::corner_br]);
     glvmUniform(_quad_tl_loc, quad_corner_rel_pos[ecm::corner_tl]);
@@ -21,14 +21,40 @@
 #ifndef PROCESSOR_H
 #define PROCESSOR_H
 
+#include <map>
+#include <string>
+#include <vector>
+
 #include <GL/glew.h>
 
 #include "glvm.h"
 #include "state.h"
 
+#include "gradient_cache.h"
+#include "cpu/cpu_processor.h"
+
+
+/* One quad for batched processing; see dbcategory_processor::process_batch(). */
+class processing_job
+{
+public:
+    glvm::ivec4 quad;
+    ecmdb::metadata quad_meta;
+    GLuint src_data_tex;
+    GLuint src_mask_tex;        // never 0; use a valid mask texture instead
+    GLuint dst_data_tex;
+    GLuint dst_mask_tex;
+    bool full_validity;         // input and output, as for process()
+    ecmdb::metadata meta;       // output
+};
 
 class dbcategory_processor
 {
+protected:
+    // Attach the destination textures of the job to the active FBO and
+    // bind its input textures, as process() expects.
+    static void setup_job(const processing_job& job);
+
 public:
     virtual ~dbcategory_processor() {}
 
@@ -47,6 +73,14 @@ public:
             const ecmdb::metadata& quad_meta,
             bool* full_validity,
             ecmdb::metadata* meta) = 0;
+    // Process several quads of the same database with the same parameters.
+    // The default implementation calls process() for each job. Processors
+    // that do not need per-quad setup override this to avoid redundant
+    // program and uniform changes.
+    virtual void process_batch(
+            unsigned int frame,
+            const database_description& dd, bool lens,
+            size_t njobs, processing_job* jobs);
 };
 
 class processor
@@ -57,6 +91,7 @@ public:
 private:
     static const int _nprocs = 5;
     dbcategory_processor *_procs[_nprocs];
+    gradient_cache _gradient_cache;
     GLuint _prg_combine[max_combinable_quads - 1];
     GLint _priorities_loc[max_combinable_quads - 1];
     GLint _weights_loc[max_combinable_quads - 1];
@@ -76,10 +111,17 @@ private:
     GLint _base_data_matrix_loc;
     GLint _lens_pos_loc;
     GLint _lens_radius_loc;
+    GLint _lens_rect_loc;
     GLint _quad_bl_loc;
     GLint _quad_br_loc;
     GLint _quad_tl_loc;
     GLint _quad_tr_loc;
+    cpu_processor _cpu_processor;
+    bool _cpu_processing;
+    float _min_elev, _max_elev;
+    // Serialized CPU processing parameters and their generation, per database; index 0=global, 1=lens
+    std::map<uuid, std::pair<std::string, unsigned int> > _cpu_parameters[2];
+    unsigned int _cpu_generation;
 
 public:
     processor();
@@ -88,6 +130,27 @@ public:
     void init_gl();
     void exit_gl();
 
+    // Process quads on the CPU instead of the GPU, for the databases and
+    // parameters that the CPU implementation supports. The caller does this
+    // on the memory cache loader threads with the processing returned by
+    // cpu_quad_processing(), and uploads the results instead of calling
+    // process(). Call this once per frame with the current databases: each
+    // change of the parameters of a database starts a new generation, so
+    // that results of older parameters can be told apart from current ones.
+    void set_cpu_processing(bool cpu_processing, const std::vector<database_description>& dds);
+    // Check if quads of this database are processed on the CPU.
+    bool use_cpu(const database_description& dd, bool lens) const;
+    // The current generation of the CPU processing parameters of this database.
+    unsigned int cpu_processing_generation(const database_description& dd, bool lens) const;
+    // Create a processing for the memory cache loaders (see quad_mem_cache_loaders).
+    quad_mem_processing* cpu_quad_processing(const database_description& dd, bool lens) const;
+
+    // Number of color gradient texture uploads so far (for statistics).
+    unsigned long long gradient_uploads() const
+    {
+        return _gradient_cache.uploads();
+    }
+
     /* Functions that apply only to the elevation processor. */
 
     // Set total min/max elevation for the entire scene.
@@ -126,6 +189,19 @@ public:
             bool* full_validity,
             ecmdb::metadata* meta);
 
+    /**
+     * Process a batch of quads from the given database.
+     * Assumptions:
+     * - the active FBO is set up for rendering into two destination textures
+     *   (the attachments are changed for each job)
+     * - the destination textures have the overlap described for process()
+     * The input texture bindings of texture units 0 and 1 are changed.
+     */
+    void process_batch(
+            unsigned int frame,
+            const database_description& dd, bool lens,
+            size_t njobs, processing_job* jobs);
+
     /**
      * Combine a set of processed quads into a single quad.
      * Assumptions:
@@ -159,6 +235,8 @@ public:
      * - the offsets texture is bound to texture unit 4
      * - the active FBO is set up for rendering into two destination textures:
      *   the data texture at COLOR_ATTACHMENT0 and the mask texture at COLOR_ATTACHMENT1
+     * The lens input is only used inside lens_rect (x, y, width, height in
+     * texels of the destination quad); outside, its texels may be undefined.
      * If the input quads are fully valid, then the output quad will
      * also be fully valid.
      */
@@ -168,6 +246,7 @@ public:
             int quad_size,
             int total_dst_quad_size,
             const glvm::vec3& lens_rel_pos, float lens_radius,
+            const glvm::ivec4& lens_rect,
             const glvm::vec3 quad_corner_rel_pos[4],
             const ecmdb::metadata& meta0,
             const ecmdb::metadata& meta1,
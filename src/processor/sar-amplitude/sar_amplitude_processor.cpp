@@ -23,6 +23,7 @@
 #include <cmath>
 
 #include "str.h"
+#include "trc.h"
 
 #include "glvm-gl.h"
 #include "xgl.h"
@@ -37,10 +38,10 @@
 using namespace glvm;
 
 
-sar_amplitude_processor::sar_amplitude_processor() :
-    _last_frame(-1),
+sar_amplitude_processor::sar_amplitude_processor(gradient_cache* gradient_cache) :
+    _gradient_cache(gradient_cache),
     _pingpong { 0, 0 }, _despeckling(NULL), _drr(NULL),
-    _prg0(0), _prg1(0), _pbo(0), _gradient_tex(0)
+    _prg0(0), _prg1(0)
 {
 }
 
@@ -73,14 +74,6 @@ void sar_amplitude_processor::exit_gl()
         xgl::DeleteProgram(_prg1);
         _prg1 = 0;
     }
-    if (_pbo != 0) {
-        glDeleteBuffers(1, &_pbo);
-        _pbo = 0;
-    }
-    if (_gradient_tex != 0) {
-        glDeleteTextures(1, &_gradient_tex);
-        _gradient_tex = 0;
-    }
 }
 
 bool sar_amplitude_processor::processing_is_necessary(
@@ -93,17 +86,17 @@ bool sar_amplitude_processor::processing_is_necessary(
 }
 
 void sar_amplitude_processor::process(
-        unsigned int frame,
+        unsigned int /* frame */,
         const database_description& dd, bool lens,
         const glvm::ivec4& quad,
         const ecmdb::metadata& quad_meta,
         bool* /* full_validity */,
         ecmdb::metadata* meta)
 {
+    TRC_SCOPE("process sar amplitude");
     assert(xgl::CheckError(HERE));
 
     const processing_parameters& pp = dd.processing_parameters[lens ? 1 : 0];
-    bool need_gradient_upload = (frame != _last_frame);
 
     if (_pingpong[0] == 0 || xgl::GetTex2DParameter(_pingpong[0], GL_TEXTURE_WIDTH) != dd.db.total_quad_size()) {
         // XXX This is a performance problem. We recreate the pingpong textures everytime
@@ -206,21 +199,11 @@ void sar_amplitude_processor::process(
         glvmUniform(xgl::GetUniformLocation(_prg1, "gradient_tex"), 2);
         assert(xgl::CheckError(HERE));
     }
-    if (_pbo == 0) {
-        glGenBuffers(1, &_pbo);
-    }
-    if (_gradient_tex == 0 || xgl::GetTex2DParameter(_gradient_tex, GL_TEXTURE_WIDTH) != pp.sar_amplitude.gradient_length) {
-        need_gradient_upload = true;
-        if (_gradient_tex != 0)
-            glDeleteTextures(1, &_gradient_tex);
-        _gradient_tex = xgl::CreateTex2D(GL_SRGB8, pp.sar_amplitude.gradient_length, 1, GL_LINEAR);
-        assert(xgl::CheckError(HERE));
-    }
-    if (need_gradient_upload) {
-        xgl::WriteTex2D(_gradient_tex, 0, 0, pp.sar_amplitude.gradient_length, 1, GL_RGB, GL_UNSIGNED_BYTE,
-                pp.sar_amplitude.gradient_length * 3 * sizeof(uint8_t), pp.sar_amplitude.gradient, _pbo);
-        assert(xgl::CheckError(HERE));
-    }
+
+    // The intermediate processing steps work on the complete quad. A scissor
+    // rectangle (used for lens processing) only applies to the final step.
+    GLboolean scissor_test = glIsEnabled(GL_SCISSOR_TEST);
+    glDisable(GL_SCISSOR_TEST);
 
     // For the intermediate processing steps, only one FBO output is used.
     // Save the FBO state here and restore it later.
@@ -275,6 +258,8 @@ void sar_amplitude_processor::process(
     glDrawBuffers(2, draw_buffers);
     glViewport(0, 0, dd.db.quad_size() + 2, dd.db.quad_size() + 2);
     assert(xgl::CheckFBO(GL_DRAW_FRAMEBUFFER, HERE));
+    if (scissor_test)
+        glEnable(GL_SCISSOR_TEST);
 
     // Convert normalized data to color.
     // TODO: integrate this into the DRR shaders to save one render pass.
@@ -282,7 +267,7 @@ void sar_amplitude_processor::process(
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, src_tex);
     glActiveTexture(GL_TEXTURE2);
-    glBindTexture(GL_TEXTURE_2D, _gradient_tex);
+    glBindTexture(GL_TEXTURE_2D, _gradient_cache->get(pp.sar_amplitude.gradient_length, pp.sar_amplitude.gradient));
     assert(xgl::CheckError(HERE));
     glUseProgram(_prg1);
     glvmUniform(xgl::GetUniformLocation(_prg1, "adapt_brightness"), pp.sar_amplitude.adapt_brightness ? 1.0f : 0.0f);
@@ -294,5 +279,4 @@ void sar_amplitude_processor::process(
     xgl::DrawQuad(-1.0f, -1.0f, 2.0f, 2.0f, t, t, s, s); 
     assert(xgl::CheckError(HERE));
     *meta = quad_meta;
-    _last_frame = frame;
 }
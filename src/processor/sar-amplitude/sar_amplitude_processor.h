@@ -22,6 +22,7 @@
 #define SAR_AMPLITUDE_PROCESSOR_H
 
 #include "../processor.h"
+#include "../gradient_cache.h"
 
 class SubProcessor;
 
@@ -30,16 +31,14 @@ class sar_amplitude_processor : public dbcategory_processor
 {
 private:
     std::vector<unsigned char> _xgl_stack;
-    unsigned int _last_frame;
+    gradient_cache* _gradient_cache;
     GLuint _pingpong[2];
     SubProcessor* _despeckling;
     SubProcessor* _drr;
     GLuint _prg0, _prg1;
-    GLuint _pbo;
-    GLuint _gradient_tex;
 
 public:
-    sar_amplitude_processor();
+    sar_amplitude_processor(gradient_cache* gradient_cache);
 
     virtual void init_gl();
     virtual void exit_gl();
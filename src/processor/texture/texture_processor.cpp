@@ -23,6 +23,7 @@
 #include <cmath>
 
 #include "str.h"
+#include "trc.h"
 
 #include "glvm-gl.h"
 #include "xgl.h"
@@ -66,13 +67,11 @@ bool texture_processor::processing_is_necessary(
         || (pp.texture.hue < 0.0f || pp.texture.hue > 0.0f);
 }
 
-void texture_processor::process(
+void texture_processor::setup(
         unsigned int frame,
         const database_description& dd, bool lens,
         const glvm::ivec4& quad,
-        const ecmdb::metadata& quad_meta,
-        bool* /* full_validity */,
-        ecmdb::metadata* meta)
+        const ecmdb::metadata& quad_meta)
 {
     assert(xgl::CheckError(HERE));
 
@@ -115,10 +114,44 @@ void texture_processor::process(
         }
         glUseProgram(_noop_prg);
     }
+    assert(xgl::CheckError(HERE));
+}
+
+void texture_processor::draw(const database_description& dd)
+{
     float step = 1.0f / dd.db.total_quad_size(); 
     float t = step * (dd.db.overlap() - 1);
     float s = step * (dd.db.quad_size() + 2);
     xgl::DrawQuad(-1.0f, -1.0f, 2.0f, 2.0f, t, t, s, s); 
     assert(xgl::CheckError(HERE));
+}
+
+void texture_processor::process(
+        unsigned int frame,
+        const database_description& dd, bool lens,
+        const glvm::ivec4& quad,
+        const ecmdb::metadata& quad_meta,
+        bool* /* full_validity */,
+        ecmdb::metadata* meta)
+{
+    TRC_SCOPE("process texture");
+    setup(frame, dd, lens, quad, quad_meta);
+    draw(dd);
     *meta = quad_meta;
 }
+
+void texture_processor::process_batch(
+        unsigned int frame,
+        const database_description& dd, bool lens,
+        size_t njobs, processing_job* jobs)
+{
+    TRC_SCOPE("process texture batch");
+    // The color correction depends only on the database parameters,
+    // so the program and its uniforms are set up once for all jobs.
+    setup(frame, dd, lens, jobs[0].quad, jobs[0].quad_meta);
+    for (size_t i = 0; i < njobs; i++) {
+        setup_job(jobs[i]);
+        draw(dd);
+        jobs[i].meta = jobs[i].quad_meta;
+    }
+}
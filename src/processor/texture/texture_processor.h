@@ -34,6 +34,10 @@ private:
     GLint _cos_hue_loc;
     GLint _sin_hue_loc;
 
+    void setup(unsigned int frame, const database_description& dd, bool lens,
+            const glvm::ivec4& quad, const ecmdb::metadata& quad_meta);
+    void draw(const database_description& dd);
+
 public:
     texture_processor();
 
@@ -52,6 +56,10 @@ public:
             const ecmdb::metadata& quad_meta,
             bool* full_validity,
             ecmdb::metadata* meta);
+    virtual void process_batch(
+            unsigned int frame,
+            const database_description& dd, bool lens,
+            size_t njobs, processing_job* jobs);
 };
 
 #endif
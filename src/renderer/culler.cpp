@@ -22,6 +22,10 @@
 
 #include <limits>
 
+#ifdef __SSE__
+# include <xmmintrin.h>
+#endif
+
 #include "dbg.h"
 
 #include "glvm-str.h"
@@ -31,7 +35,7 @@
 using namespace glvm;
 
 
-culler::culler()
+culler::culler() : _horizon_valid(false)
 {
 #ifndef NDEBUG
     _plane[0].x = std::numeric_limits<float>::quiet_NaN();
@@ -90,23 +94,125 @@ void culler::set_mvp(const mat4& MVP)
 }
 
 bool culler::frustum_cull(const vec3 bb0[4], const vec3 bb1[4]) const
+{
+    unsigned int plane_mask = all_planes;
+    return frustum_cull(bb0, bb1, &plane_mask);
+}
+
+bool culler::frustum_cull(const vec3 bb0[4], const vec3 bb1[4], unsigned int* plane_mask) const
 {
     assert(isfinite(_plane[0].x));
 
-    bool cull;
     for (int i = 0; i < 6; i++) {
-        cull = true;
+        if (!(*plane_mask & (1u << i)))
+            continue;
+        int inside = 0;
         for (int j = 0; j < 4; j++) {
             float dbb0 = _plane[i].w + dot(bb0[j], _plane[i].xyz());
             float dbb1 = _plane[i].w + dot(bb1[j], _plane[i].xyz());
-            if (dbb0 >= 0.0f || dbb1 >= 0.0f) {
-                cull = false;
-                break;
-            }
+            inside += (dbb0 >= 0.0f ? 1 : 0) + (dbb1 >= 0.0f ? 1 : 0);
         }
-        if (cull) {
-            break;
+        if (inside == 0)
+            return true;
+        if (inside == 8)
+            *plane_mask &= ~(1u << i);
+    }
+    return false;
+}
+
+void culler::frustum_cull4(const vec3 bb0[4][4], const vec3 bb1[4][4], unsigned int plane_mask,
+        bool cull[4], unsigned int plane_masks[4]) const
+{
+    assert(isfinite(_plane[0].x));
+
+#ifdef __SSE__
+    // Structure of arrays: corner k of all four boxes in one register.
+    // Corners 0-3 are from bb0, corners 4-7 from bb1.
+    __m128 x[8], y[8], z[8];
+    for (int k = 0; k < 8; k++) {
+        const vec3 (*bb)[4] = (k < 4 ? bb0 : bb1);
+        const int j = k % 4;
+        x[k] = _mm_set_ps(bb[3][j].x, bb[2][j].x, bb[1][j].x, bb[0][j].x);
+        y[k] = _mm_set_ps(bb[3][j].y, bb[2][j].y, bb[1][j].y, bb[0][j].y);
+        z[k] = _mm_set_ps(bb[3][j].z, bb[2][j].z, bb[1][j].z, bb[0][j].z);
+    }
+    const __m128 zero = _mm_setzero_ps();
+    int culled = 0;
+    for (int c = 0; c < 4; c++)
+        plane_masks[c] = plane_mask;
+    for (int i = 0; i < 6 && culled != 0xf; i++) {
+        if (!(plane_mask & (1u << i)))
+            continue;
+        const __m128 px = _mm_set1_ps(_plane[i].x);
+        const __m128 py = _mm_set1_ps(_plane[i].y);
+        const __m128 pz = _mm_set1_ps(_plane[i].z);
+        const __m128 pw = _mm_set1_ps(_plane[i].w);
+        __m128 any_inside = zero;
+        __m128 all_inside = _mm_cmpeq_ps(zero, zero);
+        for (int k = 0; k < 8; k++) {
+            __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px, x[k]), _mm_mul_ps(py, y[k])),
+                    _mm_add_ps(_mm_mul_ps(pz, z[k]), pw));
+            __m128 inside = _mm_cmpge_ps(d, zero);
+            any_inside = _mm_or_ps(any_inside, inside);
+            all_inside = _mm_and_ps(all_inside, inside);
         }
+        culled |= (~_mm_movemask_ps(any_inside)) & 0xf;
+        int inside_mask = _mm_movemask_ps(all_inside);
+        for (int c = 0; c < 4; c++)
+            if (inside_mask & (1 << c))
+                plane_masks[c] &= ~(1u << i);
+    }
+    for (int c = 0; c < 4; c++)
+        cull[c] = (culled & (1 << c));
+#else
+    for (int c = 0; c < 4; c++) {
+        plane_masks[c] = plane_mask;
+        cull[c] = frustum_cull(bb0[c], bb1[c], &(plane_masks[c]));
+    }
+#endif
+}
+
+void culler::set_horizon(const dvec3& viewer_pos, const dvec3& polar_axis,
+        double semi_major_axis, double semi_minor_axis)
+{
+    // Scale the space so that the occluder ellipsoid becomes the unit sphere.
+    // The scaling is linear, so lines and convex sets stay what they are.
+    _horizon_polar_axis = polar_axis;
+    _horizon_scale = dvec2(1.0 / semi_major_axis, 1.0 / semi_minor_axis);
+    _horizon_viewer = horizon_space(viewer_pos);
+    _horizon_vh2 = dot(_horizon_viewer, _horizon_viewer) - 1.0;
+    _horizon_valid = (semi_major_axis > 0.0 && semi_minor_axis > 0.0 && _horizon_vh2 > 0.0);
+}
+
+dvec3 culler::horizon_space(const dvec3& p) const
+{
+    double polar = dot(p, _horizon_polar_axis);
+    dvec3 equatorial = p - polar * _horizon_polar_axis;
+    return _horizon_scale.x * equatorial + (_horizon_scale.y * polar) * _horizon_polar_axis;
+}
+
+bool culler::behind_horizon(const dvec3& p) const
+{
+    // The point is hidden if it lies beyond the plane of the horizon circle
+    // and inside the cone from the viewer that touches the unit sphere.
+    // Both sets are convex, so a box is hidden if all its corners are.
+    dvec3 vt = horizon_space(p) - _horizon_viewer;
+    double vt_dot_vc = -dot(vt, _horizon_viewer);
+    return (vt_dot_vc > _horizon_vh2 && vt_dot_vc * vt_dot_vc > _horizon_vh2 * dot(vt, vt));
+}
+
+bool culler::horizon_cull(const dvec3 bb0[4], const dvec3 bb1[4]) const
+{
+    if (!_horizon_valid)
+        return false;
+    // Test the outer corners first: they are the most likely ones to be visible.
+    for (int j = 0; j < 4; j++) {
+        if (!behind_horizon(bb1[j]))
+            return false;
+    }
+    for (int j = 0; j < 4; j++) {
+        if (!behind_horizon(bb0[j]))
+            return false;
     }
-    return cull;
+    return true;
 }
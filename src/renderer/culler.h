@@ -28,6 +28,15 @@ class culler
 {
 private:
     glvm::vec4 _plane[6];
+    // Horizon culling, in a space in which the occluder is the unit sphere
+    bool _horizon_valid;
+    glvm::dvec3 _horizon_polar_axis;
+    glvm::dvec2 _horizon_scale;
+    glvm::dvec3 _horizon_viewer;
+    double _horizon_vh2;
+
+    glvm::dvec3 horizon_space(const glvm::dvec3& p) const;
+    bool behind_horizon(const glvm::dvec3& p) const;
 
     glvm::vec4 coeffs(float a, float b, float c, float d);
 
@@ -42,6 +51,37 @@ public:
 
     /* Frustum culling of bounding boxes given by two quads bb0 and bb1. */
     bool frustum_cull(const glvm::vec3 bb0[4], const glvm::vec3 bb1[4]) const;
+
+    /* Plane masks: bit i is set if frustum plane i needs to be tested. If a
+     * bounding box is completely inside a plane, then everything contained in
+     * the box is inside that plane, too, so descendants of a quad need not
+     * test planes that the quad's bounding box is completely inside of. */
+    static const unsigned int all_planes = 0x3f;
+
+    /* Frustum culling that only tests the planes in the mask. If the box is
+     * not culled, the bits of the planes that it is completely inside of are
+     * cleared in the mask. */
+    bool frustum_cull(const glvm::vec3 bb0[4], const glvm::vec3 bb1[4], unsigned int* plane_mask) const;
+
+    /* Frustum culling of four bounding boxes at once, typically those of the
+     * four children of a quad, which start with the same plane mask. Uses SSE
+     * if available. */
+    void frustum_cull4(const glvm::vec3 bb0[4][4], const glvm::vec3 bb1[4][4], unsigned int plane_mask,
+            bool cull[4], unsigned int plane_masks[4]) const;
+
+    /* Set the occluder for horizon culling: an ellipsoid with the given axes
+     * around the planet center, with its polar axis along the given unit
+     * vector. It must lie completely below the terrain surface. The viewer
+     * position is planet-centric. Required before calling horizon_cull(). */
+    void set_horizon(const glvm::dvec3& viewer_pos, const glvm::dvec3& polar_axis,
+            double semi_major_axis, double semi_minor_axis);
+
+    /* Horizon culling of bounding boxes given by two quads bb0 and bb1. Unlike
+     * the other functions, this works on planet-centric coordinates, because
+     * the test needs double precision anyway. Returns true if the box is
+     * completely hidden by the occluder. If the viewer is inside the
+     * occluder, nothing is culled. */
+    bool horizon_cull(const glvm::dvec3 bb0[4], const glvm::dvec3 bb1[4]) const;
 };
 
 #endif
@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2011, 2012
+ * Computer Graphics Group, University of Siegen, Germany.
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>.
+ * See http://www.cg.informatik.uni-siegen.de/ for contact information.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#version 120
+
+/* Depth pre-pass: only fill the depth buffer where the texture mask is set,
+ * so that the shading pass can use GL_EQUAL depth testing without discard. */
+
+uniform sampler2D texture_mask;
+uniform float texture_texcoord_factor;
+uniform float texture_texcoord_offset;
+
+void main()
+{
+    vec2 q = gl_TexCoord[0].xy;
+
+    vec2 texture_texcoords = vec2(texture_texcoord_factor)
+        * vec2(q.x, 1.0 - q.y)
+        + vec2(texture_texcoord_offset);
+
+    float mask = texture2D(texture_mask, texture_texcoords).r;
+    if (mask < 0.5)
+        discard;
+
+    gl_FragColor = vec4(0.0);
+}
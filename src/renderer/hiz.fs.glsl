@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2013
+ * Computer Graphics Group, University of Siegen, Germany.
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>.
+ * See http://www.cg.informatik.uni-siegen.de/ for contact information.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#version 120
+
+// Reduce blocks of 4x4 texels to their minimum and maximum depth.
+// The input is either a depth texture or the output of a previous reduction.
+
+uniform sampler2D tex;
+uniform bool depth_input;
+
+uniform vec2 in_size;
+uniform vec2 out_size;
+
+void main()
+{
+    vec2 out_index = floor(gl_TexCoord[0].xy * out_size);
+    vec2 in0_index = 4.0 * out_index;
+
+    float min_depth = 1.0;
+    float max_depth = 0.0;
+    for (int y = 0; y < 4; y++) {
+        for (int x = 0; x < 4; x++) {
+            vec2 in_index = min(in0_index + vec2(x, y), in_size - vec2(1.0));
+            vec2 d = texture2D(tex, (in_index + vec2(0.5)) / in_size).rg;
+            if (depth_input)
+                d.g = d.r;
+            if (d.r < min_depth)
+                min_depth = d.r;
+            if (d.g > max_depth)
+                max_depth = d.g;
+        }
+    }
+
+    gl_FragColor = vec4(min_depth, max_depth, 0.0, 1.0);
+}
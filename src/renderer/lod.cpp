@@ -58,10 +58,17 @@ void ecm_side_quadtree::set_data(const class ecm& ecm, const ivec4& quad)
     _level = quad[1];
     _x = quad[2];
     _y = quad[3];
+    _split_frame = 0;
+    _lod_viewer_pos = dvec3(0.0);
+    _lod_slack = 0.0;
+    _lod_due = -1.0;
+    _lod_cut_index = -1;
+    _lod_culled = false;
     _max_dist_to_quad_plane = 0.0;
     _max_dist_to_quad_plane_is_valid = false;
     _min_elev = +std::numeric_limits<float>::max();
     _max_elev = -std::numeric_limits<float>::max();
+    _minmax_elev_valid = false;
     for (int i = 0; i < 4; i++) {
         dvec2 corner_ecm;
         ecm::quad_to_ecm(_side, _level, _x, _y, i, &(corner_ecm[0]), &(corner_ecm[1]));
@@ -108,6 +115,16 @@ void ecm_side_quadtree::compute_bounding_box()
         double t = (dI - dot(_plane_normal, _bounding_box_outer[i])) / dot(_plane_normal, _plane_normal);
         _bounding_box_inner[i] = _bounding_box_outer[i] + t * _plane_normal;
     }
+    // The bounding sphere is centered at the center of the bounding box.
+    _bounding_sphere_center = dvec3(0.0);
+    for (int i = 0; i < 4; i++)
+        _bounding_sphere_center += _bounding_box_inner[i] + _bounding_box_outer[i];
+    _bounding_sphere_center /= 8.0;
+    _bounding_sphere_radius = 0.0;
+    for (int i = 0; i < 4; i++) {
+        _bounding_sphere_radius = max(_bounding_sphere_radius, distance(_bounding_box_inner[i], _bounding_sphere_center));
+        _bounding_sphere_radius = max(_bounding_sphere_radius, distance(_bounding_box_outer[i], _bounding_sphere_center));
+    }
 }
 
 
@@ -125,3 +142,16 @@ ecm_quadtree::~ecm_quadtree()
         delete _side_roots[i];
     }
 }
+
+ecm_side_quadtree* ecm_quadtree::find(const ivec4& quad)
+{
+    ecm_side_quadtree* node = _side_roots[quad[0]];
+    for (int level = 1; level <= quad[1]; level++) {
+        if (!node->has_children())
+            return NULL;
+        int x = quad[2] >> (quad[1] - level);
+        int y = quad[3] >> (quad[1] - level);
+        node = node->child(2 * (y & 1) + (x & 1));
+    }
+    return node;
+}
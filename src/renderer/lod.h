@@ -21,6 +21,9 @@
 #ifndef LOD_H
 #define LOD_H
 
+#include <cmath>
+#include <limits>
+
 #include <ecmdb/ecmdb.h>
 
 #include "blb.h"
@@ -49,11 +52,22 @@ private:
     int _x, _y;                         // Quad coordinates
     signed char _side;                  // Quad side
     signed char _level;                 // Quad level
+    // LOD history
+    unsigned int _split_frame;          // The frame in which this quad was last split
+    glvm::dvec3 _lod_viewer_pos;        // The viewer position at the last split decision
+    double _lod_slack;                  // The distance the viewer may move before that decision can change
+    double _lod_due;                    // Incremental LOD: viewer travel at which the decision is due again; < 0 if not scheduled
+    int _lod_cut_index;                 // Incremental LOD: index in the list of leaves, or -1
+    bool _lod_culled;                   // Incremental LOD: the quad was culled at the last split decision
     /* Volatile quad data (valid only for the current frame) */
     float _min_elev;                    // Minimum elevation value
     float _max_elev;                    // Maximum elevation value
+    bool _minmax_elev_valid;            // The elevation values come from the metadata of this quad
     glvm::dvec3 _bounding_box_inner[4]; // The four inner points of the bounding box
     glvm::dvec3 _bounding_box_outer[4]; // The four outer points of the bounding box
+    glvm::dvec3 _bounding_sphere_center;        // The bounding sphere of the bounding box
+    double _bounding_sphere_radius;
+    bool _lod_metric_disagreement;      // The LOD metrics disagree on splitting. Only available for quads marked for rendering.
     int _lens_status;                   // 0 = outside, 1 = inside, 2 = intersect. Only available for quads marked for rendering.
 
     ecm_side_quadtree(const class ecm& ecm, const ecm_side_quadtree* parent, int side, int level, int x, int y);
@@ -81,7 +95,7 @@ public:
     ecm_side_quadtree(const class ecm& ecm, int side);
     ~ecm_side_quadtree();
 
-    // Compute the bounding box.
+    // Compute the bounding box and the bounding sphere.
     void compute_bounding_box();
 
     /* Member access */
@@ -150,6 +164,14 @@ public:
     {
         return _max_elev;
     }
+    bool minmax_elev_valid() const
+    {
+        return _minmax_elev_valid;
+    }
+    bool& minmax_elev_valid()
+    {
+        return _minmax_elev_valid;
+    }
     const glvm::dvec3& corner(int i) const
     {
         return _corner_cart[i];
@@ -174,6 +196,54 @@ public:
     {
         return _max_dist_to_quad_plane;
     }
+    unsigned int split_frame() const
+    {
+        return _split_frame;
+    }
+    unsigned int& split_frame()
+    {
+        return _split_frame;
+    }
+    const glvm::dvec3& lod_viewer_pos() const
+    {
+        return _lod_viewer_pos;
+    }
+    glvm::dvec3& lod_viewer_pos()
+    {
+        return _lod_viewer_pos;
+    }
+    double lod_slack() const
+    {
+        return _lod_slack;
+    }
+    double& lod_slack()
+    {
+        return _lod_slack;
+    }
+    double lod_due() const
+    {
+        return _lod_due;
+    }
+    double& lod_due()
+    {
+        return _lod_due;
+    }
+    int lod_cut_index() const
+    {
+        return _lod_cut_index;
+    }
+    int& lod_cut_index()
+    {
+        return _lod_cut_index;
+    }
+    bool lod_culled() const
+    {
+        return _lod_culled;
+    }
+    bool& lod_culled()
+    {
+        return _lod_culled;
+    }
     bool max_dist_to_quad_plane_is_valid() const
     {
         return _max_dist_to_quad_plane_is_valid;
@@ -190,6 +260,22 @@ public:
     {
         return _bounding_box_outer;
     }
+    const glvm::dvec3& bounding_sphere_center() const
+    {
+        return _bounding_sphere_center;
+    }
+    double bounding_sphere_radius() const
+    {
+        return _bounding_sphere_radius;
+    }
+    bool lod_metric_disagreement() const
+    {
+        return _lod_metric_disagreement;
+    }
+    bool& lod_metric_disagreement()
+    {
+        return _lod_metric_disagreement;
+    }
     int lens_status() const
     {
         return _lens_status;
@@ -202,6 +288,27 @@ public:
     friend class ecm_quadtree;
 };
 
+/* Estimate the screen space area in pixels that is covered by a bounding
+ * sphere. This needs only a few operations, in contrast to the area of the
+ * convex hull of the projected bounding box corners. The estimate is the area
+ * of the square inscribed in the projected disk, which matches a quad seen
+ * head-on. It does not shrink for quads seen at grazing angles.
+ * The pixels_per_tan value is the number of pixels per unit of the tangent of
+ * the angle to the view direction. */
+inline float bounding_sphere_screen_area(const glvm::dvec3& center, double radius,
+        const glvm::dvec3& viewer_pos, double pixels_per_tan)
+{
+    glvm::dvec3 d = center - viewer_pos;
+    double d2 = glvm::dot(d, d);
+    double r2 = radius * radius;
+    if (d2 <= r2)
+        return std::numeric_limits<float>::max();
+    // tangent of the angular radius of the sphere
+    double t = radius / std::sqrt(d2 - r2);
+    double r = pixels_per_tan * t;
+    return 2.0 * r * r;
+}
+
 class ecm_quadtree
 {
 private:
@@ -222,6 +329,10 @@ public:
         return _side_roots[side];
     }
 
+    // Find the node of the given quad. Returns NULL if the tree is not split
+    // down to the level of the quad.
+    ecm_side_quadtree* find(const glvm::ivec4& quad);
+
     /* Manipulation */
 
     void split(ecm_side_quadtree* node)
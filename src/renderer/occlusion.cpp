@@ -0,0 +1,187 @@
+/*
+ * Copyright (C) 2013
+ * Computer Graphics Group, University of Siegen, Germany.
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>.
+ * See http://www.cg.informatik.uni-siegen.de/ for contact information.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <algorithm>
+#include <limits>
+#include <cmath>
+
+#include "occlusion.h"
+
+using namespace glvm;
+
+
+bool occlusion_feedback::is_occluded(const ivec4& quad) const
+{
+    return std::binary_search(occluded_quads.begin(), occluded_quads.end(), quad, quad_less());
+}
+
+// Boxes are occluded if they are at least this much (relative to the
+// occluder distance) behind the occluder. Boxes that are less far behind
+// are borderline cases.
+static const float occlusion_margin = 0.02f;
+
+// Give up if the parallax caused by viewer movement exceeds this number of texels.
+static const double max_parallax = 8.0;
+
+occlusion_culler::occlusion_culler() : _texels_per_radian(0.0)
+{
+}
+
+void occlusion_culler::init(const depth_map& map)
+{
+    _width.clear();
+    _height.clear();
+    if (map.width <= 0 || map.height <= 0)
+        return;
+
+    _viewer_pos = map.viewer_pos;
+    _rel_MVP = map.P * map.rel_MV;
+    // Texels per radian at the frustum border, where the projection stretches
+    // angles the most.
+    double tx = 1.0 / map.P[0][0];
+    double ty = 1.0 / map.P[1][1];
+    _texels_per_radian = max(map.P[0][0] * map.width, map.P[1][1] * map.height) / 2.0
+        * (1.0 + tx * tx + ty * ty);
+
+    // Level 0: convert window depth to eye depth. Tiles without any
+    // geometry (depth 1) do not occlude anything.
+    const dmat4 inv_P = inverse(map.P);
+    _width.push_back(map.width);
+    _height.push_back(map.height);
+    _min_eye_depth.resize(1);
+    _max_eye_depth.resize(1);
+    _min_eye_depth[0].resize(map.width * map.height);
+    _max_eye_depth[0].resize(map.width * map.height);
+    for (int i = 0; i < map.width * map.height; i++) {
+        for (int j = 0; j < 2; j++) {
+            float d = map.depth[2 * i + j];
+            float e;
+            if (d >= 1.0f) {
+                e = std::numeric_limits<float>::max();
+            } else {
+                dvec4 v = inv_P * dvec4(0.0, 0.0, 2.0 * d - 1.0, 1.0);
+                e = -v.z / v.w;
+            }
+            (j == 0 ? _min_eye_depth : _max_eye_depth)[0][i] = e;
+        }
+    }
+    // Higher levels
+    while (_width.back() > 1 || _height.back() > 1) {
+        const int l = _width.size();
+        const int pw = _width[l - 1];
+        const int ph = _height[l - 1];
+        const int w = (pw + 1) / 2;
+        const int h = (ph + 1) / 2;
+        _width.push_back(w);
+        _height.push_back(h);
+        _min_eye_depth.resize(l + 1);
+        _max_eye_depth.resize(l + 1);
+        _min_eye_depth[l].resize(w * h);
+        _max_eye_depth[l].resize(w * h);
+        for (int y = 0; y < h; y++) {
+            for (int x = 0; x < w; x++) {
+                float mine = std::numeric_limits<float>::max();
+                float maxe = 0.0f;
+                for (int yy = 2 * y; yy < min(2 * y + 2, ph); yy++) {
+                    for (int xx = 2 * x; xx < min(2 * x + 2, pw); xx++) {
+                        mine = min(mine, _min_eye_depth[l - 1][yy * pw + xx]);
+                        maxe = max(maxe, _max_eye_depth[l - 1][yy * pw + xx]);
+                    }
+                }
+                _min_eye_depth[l][y * w + x] = mine;
+                _max_eye_depth[l][y * w + x] = maxe;
+            }
+        }
+    }
+}
+
+void occlusion_culler::lookup(int x0, int y0, int x1, int y1, float* min_eye_depth, float* max_eye_depth) const
+{
+    // Use the first level on which the area is covered by at most 2x2 texels.
+    // These texels may cover more than the area, which is conservative.
+    int l = 0;
+    while ((x1 >> l) - (x0 >> l) > 1 || (y1 >> l) - (y0 >> l) > 1)
+        l++;
+    *min_eye_depth = std::numeric_limits<float>::max();
+    *max_eye_depth = 0.0f;
+    for (int y = (y0 >> l); y <= (y1 >> l); y++) {
+        for (int x = (x0 >> l); x <= (x1 >> l); x++) {
+            *min_eye_depth = min(*min_eye_depth, _min_eye_depth[l][y * _width[l] + x]);
+            *max_eye_depth = max(*max_eye_depth, _max_eye_depth[l][y * _width[l] + x]);
+        }
+    }
+}
+
+int occlusion_culler::test(const dvec3 bb0[4], const dvec3 bb1[4], const dvec3& viewer_pos) const
+{
+    if (!is_valid())
+        return visible;
+
+    // Project the box into the old view
+    double xmin = +std::numeric_limits<double>::max();
+    double xmax = -std::numeric_limits<double>::max();
+    double ymin = +std::numeric_limits<double>::max();
+    double ymax = -std::numeric_limits<double>::max();
+    double nearest = +std::numeric_limits<double>::max();
+    for (int i = 0; i < 8; i++) {
+        dvec4 c = _rel_MVP * dvec4((i < 4 ? bb0[i] : bb1[i - 4]) - _viewer_pos, 1.0);
+        if (c.w <= 0.0)
+            return visible;     // the box reaches behind the old viewer
+        double x = (c.x / c.w * 0.5 + 0.5) * _width[0];
+        double y = (c.y / c.w * 0.5 + 0.5) * _height[0];
+        xmin = min(xmin, x);
+        xmax = max(xmax, x);
+        ymin = min(ymin, y);
+        ymax = max(ymax, y);
+        nearest = min(nearest, c.w);    // w is the eye depth
+    }
+
+    // Widen the area until it contains all occluders that could have moved
+    // in front of the box. The nearest occluder in the area determines the
+    // largest parallax.
+    const double moved = length(viewer_pos - _viewer_pos);
+    double parallax = 0.0;
+    int x0, y0, x1, y1;
+    float min_eye_depth, max_eye_depth;
+    for (int i = 0; ; i++) {
+        x0 = std::floor(xmin - parallax);
+        x1 = std::floor(xmax + parallax);
+        y0 = std::floor(ymin - parallax);
+        y1 = std::floor(ymax + parallax);
+        if (x0 < 0 || y0 < 0 || x1 >= _width[0] || y1 >= _height[0])
+            return visible;     // the old view does not show all of it
+        lookup(x0, y0, x1, y1, &min_eye_depth, &max_eye_depth);
+        double p = moved / min_eye_depth * _texels_per_radian;
+        if (p <= parallax)
+            break;
+        if (p > max_parallax || i == 4)
+            return visible;
+        parallax = p;
+    }
+
+    if (nearest > max_eye_depth * (1.0f + occlusion_margin))
+        return occluded;
+    else if (nearest > max_eye_depth)
+        return borderline;
+    else
+        return visible;
+}
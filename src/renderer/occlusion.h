@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2013
+ * Computer Graphics Group, University of Siegen, Germany.
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>.
+ * See http://www.cg.informatik.uni-siegen.de/ for contact information.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+
+#include <vector>
+
+#include "glvm.h"
+
+
+/* A coarse copy of the depth buffer of a previous frame, together with the
+ * view that it was rendered with. Each texel holds the minimum and maximum
+ * window depth of a tile of tile_size x tile_size pixels. */
+
+class depth_map
+{
+public:
+    static const int tile_size = 16;
+
+    int width, height;          // in tiles; 0 if there is no data
+    std::vector<float> depth;   // min and max per tile, starting with the lowest row
+    glvm::dvec3 viewer_pos;     // viewer position
+    glvm::dmat4 rel_MV;         // modelview matrix relative to the viewer position
+    glvm::dmat4 P;              // projection matrix
+
+    depth_map() : width(0), height(0)
+    {
+    }
+};
+
+/* Strict weak ordering of quads, for sorted lists of quads. */
+
+class quad_less
+{
+public:
+    bool operator()(const glvm::ivec4& q0, const glvm::ivec4& q1) const
+    {
+        for (int i = 0; i < 4; i++) {
+            if (q0[i] < q1[i])
+                return true;
+            if (q0[i] > q1[i])
+                return false;
+        }
+        return false;
+    }
+};
+
+/* What the renderer learned about occlusion in previous frames. This is input
+ * for the LOD threads. */
+
+class occlusion_feedback
+{
+public:
+    depth_map depth;
+    std::vector<glvm::ivec4> occluded_quads;    // confirmed by occlusion queries; sorted with quad_less
+
+    bool is_occluded(const glvm::ivec4& quad) const;
+};
+
+/* Hierarchical occlusion culling against the depth map of a previous frame.
+ *
+ * Scattering the old depth values into the current view would leave holes
+ * wherever the view changed. Instead, bounding boxes are projected into the
+ * old view and tested against a min/max depth pyramid there. The viewer
+ * movement since the old frame is taken into account by widening the tested
+ * area by the largest parallax that an occluder in that area can have.
+ * Rotations of the viewer do not change occlusion. */
+
+class occlusion_culler
+{
+private:
+    glvm::dvec3 _viewer_pos;
+    glvm::dmat4 _rel_MVP;
+    double _texels_per_radian;
+    std::vector<int> _width, _height;
+    std::vector<std::vector<float> > _min_eye_depth;
+    std::vector<std::vector<float> > _max_eye_depth;
+
+    void lookup(int x0, int y0, int x1, int y1, float* min_eye_depth, float* max_eye_depth) const;
+
+public:
+    enum {
+        visible,
+        occluded,
+        borderline      // probably occluded; needs confirmation
+    };
+
+    occlusion_culler();
+
+    /* Build the depth pyramid from the given depth map. An empty map disables
+     * occlusion culling. */
+    void init(const depth_map& map);
+
+    bool is_valid() const
+    {
+        return _width.size() > 0;
+    }
+
+    /* Test a bounding box given by two quads bb0 and bb1 in planet-centric
+     * coordinates, as seen from the given current viewer position. */
+    int test(const glvm::dvec3 bb0[4], const glvm::dvec3 bb1[4], const glvm::dvec3& viewer_pos) const;
+};
+
+#endif
@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2013
+ * Computer Graphics Group, University of Siegen, Germany.
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>.
+ * See http://www.cg.informatik.uni-siegen.de/ for contact information.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "glvm.h"
+
+#include "quality-controller.h"
+
+using namespace glvm;
+
+
+// Weight of the newest render time in the smoothed render time
+static const float smoothing = 0.1f;
+// Relative width of the band around the target frame time in which nothing changes
+static const float hysteresis = 0.1f;
+// Maximum relative change of the quad screen size ratio per frame
+static const float max_step = 0.05f;
+// Range of the factor applied to the quad screen size ratio
+static const float min_ratio_factor = 0.25f;
+static const float max_ratio_factor = 8.0f;
+// Maximum reduction of the quad subdivision level, and the number of frames
+// between two changes of it (each change re-creates the quad VBO)
+static const int max_subdivision_reduction = 3;
+static const int subdivision_interval = 60;
+// Render times longer than this (in milliseconds) are outliers, e.g. the
+// first frame after a data set was opened
+static const float max_render_time = 1000.0f;
+
+quality_controller::quality_controller() :
+    _frame_time(-1.0f), _subdivision_frames(0)
+{
+}
+
+void quality_controller::update(class state& state, float render_time)
+{
+    if (!state.renderer.adaptive_quality) {
+        state.quality_ratio_factor = 1.0f;
+        state.quality_subdivision_reduction = 0;
+        _frame_time = -1.0f;
+        return;
+    }
+    if (!state.renderer.adaptive_subdivision)
+        state.quality_subdivision_reduction = 0;
+    if (render_time < 0.0f || render_time > max_render_time)
+        return;
+
+    _frame_time = (_frame_time < 0.0f ? render_time : _frame_time + smoothing * (render_time - _frame_time));
+    float load = _frame_time / max(state.renderer.target_frame_time, 1.0f);
+    bool too_slow = (load > 1.0f + hysteresis);
+    bool too_fast = (load < 1.0f - hysteresis);
+
+    // The number of rendered quads is roughly inversely proportional to
+    // the quad screen size ratio, so scale the ratio with the load.
+    if (too_slow || too_fast) {
+        float step = clamp(load, 1.0f / (1.0f + max_step), 1.0f + max_step);
+        state.quality_ratio_factor = clamp(state.quality_ratio_factor * step,
+                min_ratio_factor, max_ratio_factor);
+    }
+
+    if (state.renderer.adaptive_subdivision) {
+        _subdivision_frames++;
+        if (_subdivision_frames >= subdivision_interval) {
+            if (too_slow && state.quality_ratio_factor >= max_ratio_factor
+                    && state.quality_subdivision_reduction < max_subdivision_reduction
+                    && state.quad_subdivision() > 0) {
+                state.quality_subdivision_reduction++;
+                _subdivision_frames = 0;
+            } else if (too_fast && state.quality_ratio_factor <= 1.0f
+                    && state.quality_subdivision_reduction > 0) {
+                state.quality_subdivision_reduction--;
+                _subdivision_frames = 0;
+            }
+        }
+    }
+}
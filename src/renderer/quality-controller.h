@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2013
+ * Computer Graphics Group, University of Siegen, Germany.
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>.
+ * See http://www.cg.informatik.uni-siegen.de/ for contact information.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef QUALITY_CONTROLLER_H
+#define QUALITY_CONTROLLER_H
+
+#include "state.h"
+
+
+/* Adapt the rendering quality to a target frame time.
+ *
+ * The controller smoothes the measured render times. When they leave a band
+ * around the target frame time, it scales the quad screen size ratio in small
+ * steps. Only when the ratio reaches its coarsest value and the frames are
+ * still too slow does it reduce the quad subdivision level (if allowed), and it
+ * restores that level only after the ratio is back at the user setting.
+ *
+ * There is one controller per render loop, working on the master state. Its
+ * results are part of the state, so all rendering nodes use the same values
+ * for the same frame. */
+
+class quality_controller
+{
+private:
+    float _frame_time;                  // smoothed render time in milliseconds, or -1
+    int _subdivision_frames;            // frames since the last subdivision change
+
+public:
+    quality_controller();
+
+    // Adapt the quality parameters of the state to the measured render time
+    // of the previous frame in milliseconds (negative if unknown). Call this
+    // once per frame before rendering.
+    void update(class state& state, float render_time);
+
+    // The smoothed render time in milliseconds, or -1 if unknown.
+    float frame_time() const
+    {
+        return _frame_time;
+    }
+};
+
+#endif
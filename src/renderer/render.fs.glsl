@@ -28,9 +28,15 @@
 // NO_QUAD_BORDERS
 #define $quad_borders
 
+// MASK_DISCARD
+// NO_MASK_DISCARD
+#define $mask_discard
+
 /* Texture data */
 uniform sampler2D texture_data;
+#ifdef MASK_DISCARD
 uniform sampler2D texture_mask;
+#endif
 uniform float texture_texcoord_factor;
 uniform float texture_texcoord_offset;
 
@@ -68,9 +74,13 @@ void main()
         * vec2(q.x, 1.0 - q.y)
         + vec2(texture_texcoord_offset);
 
+#ifdef MASK_DISCARD
+    /* Without a depth pre-pass, masked fragments must be discarded here.
+     * With a depth pre-pass, they already failed the depth test. */
     float mask = texture2D(texture_mask, texture_texcoords).r;
     if (mask < 0.5)
         discard;
+#endif
 
 #ifdef LIGHTING
     vec2 t = cart_coords_texcoord_offset + cart_coords_texcoord_factor * q;
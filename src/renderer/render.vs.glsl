@@ -33,6 +33,9 @@ uniform float cart_coords_halfstep;
 varying vec3 P;
 #endif
 
+/* The depth pre-pass and the shading pass must produce identical depth values */
+invariant gl_Position;
+
 void main()
 {
     vec2 q_orig = gl_Vertex.xy;
@@ -27,10 +27,11 @@
 #include "glvm-str.h"
 
 #include "msg.h"
-#include "sys.h"
 
 #include "xgl.h"
 
+#include "quad-trace.h"
+
 #include "renderer.h"
 
 using namespace glvm;
@@ -41,7 +42,10 @@ const int renderer::_max_depth_passes;
 
 renderer::renderer(renderer_context& renderer_context) :
     _renderer_context(renderer_context),
-    _info(new renderpass_info())
+    _info(new renderpass_info()),
+    _last_cache_stats(renderpass_info::caches),
+    _last_worker_stats(renderpass_info::worker_groups),
+    _last_gradient_uploads(0)
 {
     // Defer all OpenGL initialization to a later point.
 }
@@ -194,6 +198,54 @@ void renderer::compute_depth_passes(const dfrust& frustum, int depth_bits)
     */
 }
 
+void renderer::get_cache_info()
+{
+    cache_stats stats[renderpass_info::caches];
+    size_t sizes[renderpass_info::caches];
+    size_t max_sizes[renderpass_info::caches];
+    stats[renderpass_info::cache_metadata] = _renderer_context.quad_metadata_cache()->stats();
+    sizes[renderpass_info::cache_metadata] = _renderer_context.quad_metadata_cache()->size();
+    max_sizes[renderpass_info::cache_metadata] = _renderer_context.quad_metadata_cache()->max_size();
+    stats[renderpass_info::cache_disk] = _renderer_context.quad_disk_cache()->stats();
+    sizes[renderpass_info::cache_disk] = _renderer_context.quad_disk_cache()->size();
+    max_sizes[renderpass_info::cache_disk] = _renderer_context.quad_disk_cache()->max_size();
+    stats[renderpass_info::cache_mem] = _renderer_context.quad_mem_cache()->stats();
+    sizes[renderpass_info::cache_mem] = _renderer_context.quad_mem_cache()->size();
+    max_sizes[renderpass_info::cache_mem] = _renderer_context.quad_mem_cache()->max_size();
+    stats[renderpass_info::cache_gpu] = _renderer_context.quad_gpu_cache()->stats();
+    sizes[renderpass_info::cache_gpu] = _renderer_context.quad_gpu_cache()->size();
+    max_sizes[renderpass_info::cache_gpu] = _renderer_context.quad_gpu_cache()->max_size();
+    stats[renderpass_info::cache_base_data_mem] = _renderer_context.quad_base_data_mem_cache()->stats();
+    sizes[renderpass_info::cache_base_data_mem] = _renderer_context.quad_base_data_mem_cache()->size();
+    max_sizes[renderpass_info::cache_base_data_mem] = _renderer_context.quad_base_data_mem_cache()->max_size();
+    stats[renderpass_info::cache_base_data_gpu] = _renderer_context.quad_base_data_gpu_cache()->stats();
+    sizes[renderpass_info::cache_base_data_gpu] = _renderer_context.quad_base_data_gpu_cache()->size();
+    max_sizes[renderpass_info::cache_base_data_gpu] = _renderer_context.quad_base_data_gpu_cache()->max_size();
+    stats[renderpass_info::cache_tex_pool] = _renderer_context.quad_tex_pool()->stats();
+    sizes[renderpass_info::cache_tex_pool] = _renderer_context.quad_tex_pool()->size();
+    max_sizes[renderpass_info::cache_tex_pool] = 0;
+    for (int c = 0; c < renderpass_info::caches; c++) {
+        _info->cache[c].stats = stats[c] - _last_cache_stats[c];
+        _info->cache[c].size = sizes[c];
+        _info->cache[c].max_size = max_sizes[c];
+        _last_cache_stats[c] = stats[c];
+    }
+
+    thread_group_stats worker_stats[renderpass_info::worker_groups];
+    worker_stats[renderpass_info::workers_disk_checkers] = _renderer_context.quad_disk_cache_checkers()->stats();
+    worker_stats[renderpass_info::workers_disk_fetchers] = _renderer_context.quad_disk_cache_fetchers()->stats();
+    worker_stats[renderpass_info::workers_mem_loaders] = _renderer_context.quad_mem_cache_loaders()->stats();
+    worker_stats[renderpass_info::workers_base_data_computers] = _renderer_context.quad_base_data_mem_cache_computers()->stats();
+    for (int w = 0; w < renderpass_info::worker_groups; w++) {
+        _info->workers[w] = worker_stats[w] - _last_worker_stats[w];
+        _last_worker_stats[w] = worker_stats[w];
+    }
+
+    unsigned long long gradient_uploads = _terrain.gradient_uploads();
+    _info->gradient_uploads = gradient_uploads - _last_gradient_uploads;
+    _last_gradient_uploads = gradient_uploads;
+}
+
 void renderer::render(const ivec4& viewport, const dfrust& frustum, const dmat4& viewer_transform)
 {
     assert(xgl::CheckError(HERE));
@@ -283,6 +335,7 @@ void renderer::render(const ivec4& viewport, const dfrust& frustum, const dmat4&
 
     /* Render the depth passes */
     msg::dbg("Renderer: frame %u", frame);
+    quad_trace::set_frame(frame);
     // Viewer position
     dvec3 viewer_pos = state.viewer_pos + translation(viewer_transform);
     msg::dbg("Renderer: viewer_pos %s", str::from(state.viewer_pos).c_str());
@@ -311,6 +364,7 @@ void renderer::render(const ivec4& viewport, const dfrust& frustum, const dmat4&
     for (int dp = 0; dp < _info->depth_passes; dp++) {
         _last_frame_quads += _info->quads_rendered[dp];
     }
+    get_cache_info();
     frame++;
 
     glPopClientAttrib();
@@ -318,14 +372,66 @@ void renderer::render(const ivec4& viewport, const dfrust& frustum, const dmat4&
     assert(xgl::CheckError(HERE));
 }
 
+int renderer::workers_in_flight()
+{
+    return _renderer_context.quad_disk_cache_checkers()->stats().in_flight
+        + _renderer_context.quad_disk_cache_fetchers()->stats().in_flight
+        + _renderer_context.quad_mem_cache_loaders()->stats().in_flight
+        + _renderer_context.quad_base_data_mem_cache_computers()->stats().in_flight;
+}
+
+void renderer::render_full_detail(const ivec4& viewport, const dfrust& frustum)
+{
+    // Number of renderings in a row without any busy worker. Some of them are
+    // needed to upload data that is ready. If quads are still approximated
+    // after that (e.g. after a failed fetch or a rejected job), fall back to
+    // waiting so that the GPU is not kept busy with useless renderings.
+    const int max_idle_renders = 3;
+    int idle_renders = 0;
+    for (;;) {
+        // Get the completion count before rendering so that no completion
+        // that happens during rendering is missed.
+        unsigned long long completions = thread_group::completions().count();
+        render(viewport, frustum, dmat4(1.0));
+        int approximated_quads = 0;
+        const renderpass_info& info = get_info();
+        for (int i = 0; i < info.depth_passes; i++)
+            approximated_quads += info.quads_approximated[i];
+        if (approximated_quads == 0)
+            break;
+        // If no worker is busy, the missing data is uploaded during rendering,
+        // so render again immediately, but only a few times. Otherwise, wait
+        // for the next worker to finish. The timeout covers results that are
+        // collected by another context of the same node.
+        if (workers_in_flight() > 0) {
+            idle_renders = 0;
+            MSG_DBG("rendering tile: waiting for %d quads", approximated_quads);
+            thread_group::completions().wait(completions, 100000);
+        } else if (++idle_renders > max_idle_renders) {
+            MSG_DBG("rendering tile: no worker busy, waiting for %d quads", approximated_quads);
+            thread_group::completions().wait(completions, 100000);
+        }
+    }
+}
+
 void renderer::render(const dfrust& frustum, int width, int height, void* buffer)
 {
-    const int block_width = 1024;
-    const int block_height = 1024;
-    const int blocks_x = width / block_width + (width % block_width == 0 ? 0 : 1);
-    const int last_block_width = (width % block_width == 0 ? block_width : width % block_width);
-    const int blocks_y = height / block_height + (height % block_height == 0 ? 0 : 1);
-    const int last_block_height = (height % block_height == 0 ? block_height : height % block_height);
+    buffer_tile_writer writer(buffer, width);
+    render_tiles(frustum, width, height, writer);
+}
+
+int renderer::tiles(int width, int height)
+{
+    return (width / tile_size + (width % tile_size == 0 ? 0 : 1))
+        * (height / tile_size + (height % tile_size == 0 ? 0 : 1));
+}
+
+void renderer::render_tiles(const dfrust& frustum, int width, int height, tile_writer& writer)
+{
+    const int tiles_x = width / tile_size + (width % tile_size == 0 ? 0 : 1);
+    const int last_tile_width = (width % tile_size == 0 ? tile_size : width % tile_size);
+    const int tiles_y = height / tile_size + (height % tile_size == 0 ? 0 : 1);
+    const int last_tile_height = (height % tile_size == 0 ? tile_size : height % tile_size);
 
     xgl::CheckFBO(GL_FRAMEBUFFER, HERE);
     xgl::PushEverything(_xgl_stack);
@@ -347,76 +453,49 @@ void renderer::render(const dfrust& frustum, int width, int height, void* buffer
     assert(xgl::CheckError(HERE));
 
     exc exception;
-    for (int y = 0; exception.empty() && y < blocks_y; y++) {
-        const int by = y * block_height;
-        const int bh = (y == blocks_y - 1 ? last_block_height : block_height);
-        for (int x = 0; exception.empty() && x < blocks_x; x++) {
-            const int bx = x * block_width;
-            const int bw = (x == blocks_x - 1 ? last_block_width : block_width);
-
+    blob tile_array;
+    int tex_w = 0, tex_h = 0;
+    for (int t = 0; exception.empty() && t < tiles_x * tiles_y; t++) {
+        const int x = t % tiles_x;
+        const int y = t / tiles_x;
+        const int tx = x * tile_size;
+        const int ty = y * tile_size;
+        const int tw = (x == tiles_x - 1 ? last_tile_width : tile_size);
+        const int th = (y == tiles_y - 1 ? last_tile_height : tile_size);
+
+        if (tw != tex_w || th != tex_h) {
             glBindTexture(GL_TEXTURE_2D, tex);
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_SRGB, bw, bh, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_SRGB, tw, th, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
             glBindRenderbuffer(GL_RENDERBUFFER, rb);
-            glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, bw, bh);
+            glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, tw, th);
             glBindFramebuffer(GL_FRAMEBUFFER, fbo);
             glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tex, 0);
             glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, rb);
             assert(xgl::CheckFBO(GL_FRAMEBUFFER, HERE));
             assert(xgl::CheckError(HERE));
-
-            dfrust bf;
-            bf.l() = frustum.l() + static_cast<double>(bx) / static_cast<double>(width) * (frustum.r() - frustum.l());
-            bf.r() = bf.l() + static_cast<double>(bw) / static_cast<double>(width) * (frustum.r() - frustum.l());
-            bf.b() = frustum.b() + static_cast<double>(by) / static_cast<double>(height) * (frustum.t() - frustum.b());
-            bf.t() = bf.b() + static_cast<double>(bh) / static_cast<double>(height) * (frustum.t() - frustum.b());
-            bf.n() = frustum.n();
-            bf.f() = frustum.f();
-
-            int approximated_quads = 0;
-            do {
-                try {
-                    render(ivec4(0, 0, bw, bh), bf, dmat4(1.0));
-                    approximated_quads = 0;
-                    const renderpass_info& info = get_info();
-                    for (int i = 0; i < info.depth_passes; i++)
-                        approximated_quads += info.quads_approximated[i];
-                    if (approximated_quads > 0) {
-                        msg::dbg("rendering block %d,%d to buffer: waiting for %d quads", x, y, approximated_quads);
-                        sys::msleep(100);
-                    }
-                }
-                catch (exc& e) {
-                    exception = e;
-                }
-            }
-            while (exception.empty() && approximated_quads > 0);
-
-            blob block_array;
-            if (exception.empty()) {
-                try {
-                    block_array.resize(bw, bh, 4);
-                }
-                catch (exc& e) {
-                    exception = e;
-                }
-            }
-            if (exception.empty()) {
-                glBindTexture(GL_TEXTURE_2D, tex);
-                glGetTexImage(GL_TEXTURE_2D, 0, GL_BGRA, GL_UNSIGNED_BYTE, block_array.ptr());
-                assert(xgl::CheckError(HERE));
-                for (int r = 0; r < bh; r++) {
-                    for (int c = 0; c < bw; c++) {
-                        for (int i = 0; i < 4; i++) {
-                            // Avoid integer overflow for the array index
-                            size_t array_index = static_cast<size_t>((r + by) * width);
-                            array_index += static_cast<size_t>(c + bx);
-                            array_index *= 4;
-                            array_index += i;
-                            static_cast<unsigned char*>(buffer)[array_index] = *block_array.ptr<unsigned char>(4 * (r * bw + c) + i);
-                        }
-                    }
-                }
-            }
+            tex_w = tw;
+            tex_h = th;
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+
+        dfrust tf;
+        tf.l() = frustum.l() + static_cast<double>(tx) / static_cast<double>(width) * (frustum.r() - frustum.l());
+        tf.r() = tf.l() + static_cast<double>(tw) / static_cast<double>(width) * (frustum.r() - frustum.l());
+        tf.b() = frustum.b() + static_cast<double>(ty) / static_cast<double>(height) * (frustum.t() - frustum.b());
+        tf.t() = tf.b() + static_cast<double>(th) / static_cast<double>(height) * (frustum.t() - frustum.b());
+        tf.n() = frustum.n();
+        tf.f() = frustum.f();
+
+        try {
+            render_full_detail(ivec4(0, 0, tw, th), tf);
+            tile_array.resize(tw, th, 4);
+            glBindTexture(GL_TEXTURE_2D, tex);
+            glGetTexImage(GL_TEXTURE_2D, 0, GL_BGRA, GL_UNSIGNED_BYTE, tile_array.ptr());
+            assert(xgl::CheckError(HERE));
+            writer.write_tile(tx, ty, tw, th, tile_array.ptr());
+        }
+        catch (exc& e) {
+            exception = e;
         }
     }
 
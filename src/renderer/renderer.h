@@ -27,10 +27,14 @@
 
 #include "glvm.h"
 
+#include "lru.h"
+#include "pth.h"
+
 #include "xgl.h"
 
 #include "renderer-context.h"
 #include "terrain.h"
+#include "tile-writer.h"
 
 
 class renderpass_info;
@@ -50,8 +54,14 @@ private:
     terrain _terrain;
     std::vector<unsigned char> _xgl_stack;
     renderpass_info* _info;
+    std::vector<cache_stats> _last_cache_stats;
+    std::vector<thread_group_stats> _last_worker_stats;
+    unsigned long long _last_gradient_uploads;
 
     void compute_depth_passes(const glvm::dfrust& frustum, int depth_bits);
+    void get_cache_info();
+    int workers_in_flight();
+    void render_full_detail(const glvm::ivec4& viewport, const glvm::dfrust& frustum);
 
 public:
     /* Constructor/Destructor */
@@ -68,6 +78,13 @@ public:
     /* Render the scene into a buffer in the format 0xffRRGGBB */
     void render(const glvm::dfrust& frustum, int width, int height, void* buffer);
 
+    /* Render the scene offscreen in full detail, tile by tile, and pass each
+     * tile to the writer as soon as it is finished. Tiles are rendered row by
+     * row, starting at the lower left corner. */
+    static const int tile_size = 1024;
+    static int tiles(int width, int height);
+    void render_tiles(const glvm::dfrust& frustum, int width, int height, tile_writer& writer);
+
     /* After a call to render(), information about the last render pass can
      * be retrieved using the following function. */
     const renderpass_info& get_info() const
@@ -86,10 +103,22 @@ public:
     // Per-depth-pass information
     glvm::dfrust frustum[renderer::_max_depth_passes];   // View frustrum
     int quads_culled[renderer::_max_depth_passes];       // Number of quads culled
+    int quads_horizon_culled[renderer::_max_depth_passes]; // Number of quads culled because they are behind the horizon
+    int quads_occlusion_culled[renderer::_max_depth_passes]; // Number of quads culled because they are occluded
+    int lod_metric_disagreements[renderer::_max_depth_passes]; // Number of quads on which the LOD metrics disagree (only in comparison mode)
+    int quads_split[renderer::_max_depth_passes];        // Number of quads split in this frame
+    int quads_merged[renderer::_max_depth_passes];       // Number of quads merged in this frame
+    int quads_held[renderer::_max_depth_passes];         // Number of quads held at their level (waiting for data or minimum residence time)
+    int lod_evaluations[renderer::_max_depth_passes];    // Number of quads for which the split decision was evaluated
+    int lod_operations_queued[renderer::_max_depth_passes]; // Number of split/merge operations queued (incremental LOD only)
     int quads_rendered[renderer::_max_depth_passes];     // Number of quads rendered
     int quads_approximated[renderer::_max_depth_passes]; // Number of quads approximated
+    int lens_texels_processed[renderer::_max_depth_passes]; // Number of texels processed with lens parameters
     int lowest_quad_level[renderer::_max_depth_passes];  // Lowest quad level rendered
     int highest_quad_level[renderer::_max_depth_passes]; // Highest quad level rendered
+    int fragments_prepass[renderer::_max_depth_passes];  // Fragments passing the depth pre-pass, or -1
+    int fragments_shaded[renderer::_max_depth_passes];   // Fragments shaded, or -1
+    int pixels_covered[renderer::_max_depth_passes];     // Pixels covered by terrain, or -1 (only with the overdraw counter)
     // Information about the pointer position
     glvm::dvec3 pointer_coord;                           // Cartesian coordinates, or 0
     // Information about the debug quad
@@ -97,6 +126,55 @@ public:
     float debug_quad_max_dist_to_quad_plane;             // Max dist to quad plane
     float debug_quad_min_elev;                           // Min elevation
     float debug_quad_max_elev;                           // Max elevation
+    // Cache and worker statistics. The counters cover the time since the
+    // previous frame, the sizes are the current sizes.
+    enum {
+        cache_metadata,
+        cache_disk,
+        cache_mem,
+        cache_gpu,
+        cache_base_data_mem,
+        cache_base_data_gpu,
+        cache_tex_pool,
+        caches
+    };
+    enum {
+        workers_disk_checkers,
+        workers_disk_fetchers,
+        workers_mem_loaders,
+        workers_base_data_computers,
+        worker_groups
+    };
+    class cache_info
+    {
+    public:
+        cache_stats stats;
+        size_t size;
+        size_t max_size;                                 // 0 if unlimited
+
+        cache_info() : size(0), max_size(0)
+        {
+        }
+    };
+    cache_info cache[caches];
+    thread_group_stats workers[worker_groups];
+    unsigned long long gradient_uploads;                 // Color gradient texture uploads
+
+    static const char* cache_name(int c)
+    {
+        static const char* names[caches] = {
+            "metadata", "disk", "mem", "gpu", "base_data_mem", "base_data_gpu", "tex_pool"
+        };
+        return names[c];
+    }
+
+    static const char* worker_group_name(int w)
+    {
+        static const char* names[worker_groups] = {
+            "disk_checkers", "disk_fetchers", "mem_loaders", "base_data_computers"
+        };
+        return names[w];
+    }
 
     renderpass_info()
     {
@@ -106,6 +184,7 @@ public:
     void clear()
     {
         depth_passes = 0;
+        gradient_uploads = 0;
         pointer_coord = glvm::dvec3(0.0);
         debug_quad = glvm::ivec4(-1);
     }
@@ -114,10 +193,31 @@ public:
     {
         frustum[dp] = glvm::dfrust(0.0, 0.0, 0.0, 0.0, 0.0, 0.0);
         quads_culled[dp] = 0;
+        quads_horizon_culled[dp] = 0;
+        quads_occlusion_culled[dp] = 0;
+        lod_metric_disagreements[dp] = 0;
+        quads_split[dp] = 0;
+        quads_merged[dp] = 0;
+        quads_held[dp] = 0;
+        lod_evaluations[dp] = 0;
+        lod_operations_queued[dp] = 0;
         quads_rendered[dp] = 0;
         quads_approximated[dp] = 0;
+        lens_texels_processed[dp] = 0;
         lowest_quad_level[dp] = -1;
         highest_quad_level[dp] = -1;
+        fragments_prepass[dp] = -1;
+        fragments_shaded[dp] = -1;
+        pixels_covered[dp] = -1;
+    }
+
+    // The number of fragments that passed the depth test in the pass that
+    // writes the depth buffer, per covered pixel. Returns -1 if unknown.
+    float overdraw(int dp) const
+    {
+        int fragments = (fragments_prepass[dp] >= 0 ? fragments_prepass[dp] : fragments_shaded[dp]);
+        return (fragments >= 0 && pixels_covered[dp] > 0
+                ? static_cast<float>(fragments) / pixels_covered[dp] : -1.0f);
     }
 };
 
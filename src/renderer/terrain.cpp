@@ -21,12 +21,15 @@
 #include "config.h"
 
 #include <vector>
+#include <algorithm>
+#include <cmath>
 
 #include <GL/glew.h>
 
 #include "msg.h"
 #include "dbg.h"
 #include "tmr.h"
+#include "trc.h"
 
 #include "glvm.h"
 #include "glvm-gl.h"
@@ -34,6 +37,7 @@
 #include "glvm-str.h"
 #include "xgl.h"
 #include "xgl-gta.h"
+#include "xgl-trc.h"
 
 #include "state.h"
 
@@ -47,6 +51,8 @@
 #include "cart-coord.fs.glsl.h"
 #include "render.vs.glsl.h"
 #include "render.fs.glsl.h"
+#include "depth.fs.glsl.h"
+#include "hiz.fs.glsl.h"
 
 using namespace glvm;
 
@@ -54,9 +60,16 @@ using namespace glvm;
 lod_thread::lod_thread() :
     _bbs(8),
     _quadtree(NULL),
+    _lod_incremental_valid(false),
+    _n_lod_operations(0),
+    _lod_travel(0.0),
+    _lod_pixels_per_tan(0.0),
+    _lod_split_area(0.0f),
+    _lod_hysteresis(0.0f),
     _n_elevation_dds(0),
     _n_texture_dds(0),
-    _n_render_quads(0)
+    _n_render_quads(0),
+    _n_query_quads(0)
 {
 }
 
@@ -72,6 +85,7 @@ void lod_thread::init(
         const glvm::dmat4& MV,
         int depth_pass,
         const glvm::dmat4& P,
+        const occlusion_feedback& occlusion,
         renderpass_info* info)
 {
     _context = context;
@@ -83,14 +97,70 @@ void lod_thread::init(
     _depth_pass = depth_pass;
     _P = P;
     _info = info;
+    // Copy this since the renderer updates it while we run
+    _occlusion_feedback = occlusion;
 
     _n_elevation_dds = 0;
     _n_texture_dds = 0;
     _n_render_quads = 0;
+    _n_query_quads = 0;
+}
+
+/* Get the metadata for a quad from the metadata of an ancestor. For elevation
+ * data, the elevation grid of the ancestor gives tighter bounds. */
+static ecmdb::metadata sub_quad_metadata(const ecmdb::metadata& meta, const quad_elevation_grid& elevation_grid,
+        const ivec4& quad, int level_difference)
+{
+    ecmdb::metadata sub_meta = meta;
+    if (level_difference > 0 && meta.is_valid() && meta.category == ecmdb::category_elevation) {
+        int mask = (1 << level_difference) - 1;
+        float mine, maxe;
+        if (elevation_grid.sub_quad_bounds(level_difference, quad[2] & mask, quad[3] & mask, &mine, &maxe)) {
+            MSG_DBG(4, "elevation grid: bounds [%g,%g] instead of [%g,%g]",
+                    mine, maxe, meta.elevation.min, meta.elevation.max);
+            sub_meta.elevation.min = max(mine, meta.elevation.min);
+            sub_meta.elevation.max = min(maxe, meta.elevation.max);
+        }
+    }
+    return sub_meta;
+}
+
+/* Get the metadata for a quad from the metadata pyramid, if the quad or its
+ * parent are known there. In that case, there is nothing to load, so the
+ * caches do not need to be consulted. */
+static bool get_pyramid_metadata(const quad_metadata_pyramid& pyramid,
+        const ivec4& quad, ecmdb::metadata* meta, int* level_difference)
+{
+    float derived_min = -std::numeric_limits<float>::max();
+    float derived_max = +std::numeric_limits<float>::max();
+    for (int ld = 0; ld <= 1 && ld <= quad[1]; ld++) {
+        float mine, maxe;
+        unsigned char state = pyramid.get(ivec4(quad[0], quad[1] - ld, quad[2] >> ld, quad[3] >> ld), &mine, &maxe);
+        if (state & quad_metadata_pyramid::empty) {
+            *meta = ecmdb::metadata();
+            *level_difference = 0;
+            return true;
+        } else if (state & quad_metadata_pyramid::exact) {
+            *meta = ecmdb::metadata(ecmdb::category_elevation);
+            meta->elevation.min = max(mine, derived_min);
+            meta->elevation.max = min(maxe, derived_max);
+            if (meta->elevation.min > meta->elevation.max) {
+                meta->elevation.min = mine;
+                meta->elevation.max = maxe;
+            }
+            *level_difference = ld;
+            return true;
+        } else if (state & quad_metadata_pyramid::derived) {
+            derived_min = max(mine, derived_min);
+            derived_max = min(maxe, derived_max);
+        }
+    }
+    return false;
 }
 
 ecmdb::metadata lod_thread::get_metadata_with_caching(
         const database_description& dd,
+        quad_metadata_pyramid* pyramid,
         const glvm::ivec4& quad,
         int* level_difference)
 {
@@ -102,19 +172,26 @@ ecmdb::metadata lod_thread::get_metadata_with_caching(
     quad_disk_cache_checkers& disk_cache_checkers = *(_context->quad_disk_cache_checkers());
     quad_disk_cache_fetchers& disk_cache_fetchers = *(_context->quad_disk_cache_fetchers());
 
-    const ecmdb::metadata* qm;
+    const quad_metadata* qm;
     const quad_gpu *qgpu;
     const quad_mem *qmem;
     const quad_disk *qdisk;
 
-    msg::dbg("get_metadata_with_caching: %s from %s:", str::from(quad).c_str(), dd.url.c_str());
+    MSG_DBG("get_metadata_with_caching: %s from %s:", str::from(quad).c_str(), dd.url.c_str());
+    if (pyramid && quad[1] < dd.db.levels()) {
+        ecmdb::metadata meta;
+        if (get_pyramid_metadata(*pyramid, quad, &meta, level_difference)) {
+            MSG_DBG(4, "metadata pyramid: hit at leveldiff %d", *level_difference);
+            return meta;
+        }
+    }
     int approx_level = quad[1];
     assert(!(dd.uuid == uuid()));
     quad_key key(dd.uuid, quad, approx_level);
     if ((qm = metadata_cache.locked_get(key))) {
-        msg::dbg(4, "metadata cache: exact hit");
+        MSG_DBG(4, "metadata cache: exact hit");
         *level_difference = 0;
-        return *qm;
+        return qm->meta;
     } else {
         if (quad[1] >= dd.db.levels()) {
             // We don't have original quads in this level and must look
@@ -122,12 +199,12 @@ ecmdb::metadata lod_thread::get_metadata_with_caching(
             approx_level = dd.db.levels() - 1;
             key = quad_key(dd.uuid, quad, approx_level);
             if ((qm = metadata_cache.locked_get(key))) {
-                msg::dbg(4, "metadata cache: found computed approx at leveldiff %d", quad[1] - approx_level);
+                MSG_DBG(4, "metadata cache: found computed approx at leveldiff %d", quad[1] - approx_level);
                 *level_difference = 0;
-                return *qm;
+                return qm->meta;
             } else if ((qgpu = gpu_cache.locked_get(key))) {
-                msg::dbg(4, "quad gpu cache: found computed approx at leveldiff %d", quad[1] - approx_level);
-                metadata_cache.locked_put(key, new ecmdb::metadata(qgpu->meta));
+                MSG_DBG(4, "quad gpu cache: found computed approx at leveldiff %d", quad[1] - approx_level);
+                metadata_cache.locked_put(key, new quad_metadata(qgpu->meta));
                 *level_difference = 0;
                 return qgpu->meta;
             }
@@ -148,57 +225,81 @@ ecmdb::metadata lod_thread::get_metadata_with_caching(
         }
         if (!dd.db.has_quad(qs, ql, qx, qy)) {
             // Return invalid metadata
-            msg::dbg(4, "database does not have this quad");
+            MSG_DBG(4, "database does not have this quad");
             *level_difference = 0;
             return ecmdb::metadata();
         }
         while (ql >= 0) {
+            if (pyramid && ql < quad[1] - 1) {
+                // No loading is started at this level, so the pyramid suffices.
+                float mine, maxe;
+                unsigned char state = pyramid->get(ivec4(qs, ql, qx, qy), &mine, &maxe);
+                if (state & (quad_metadata_pyramid::exact | quad_metadata_pyramid::empty)) {
+                    MSG_DBG(4, "metadata pyramid: approx at leveldiff %d", quad[1] - ql);
+                    ecmdb::metadata meta;
+                    if (state & quad_metadata_pyramid::exact) {
+                        meta = ecmdb::metadata(ecmdb::category_elevation);
+                        meta.elevation.min = mine;
+                        meta.elevation.max = maxe;
+                    }
+                    *level_difference = quad[1] - ql;
+                    return meta;
+                }
+            }
             key = quad_key(dd.uuid, ivec4(qs, ql, qx, qy), ql);
             if ((qm = metadata_cache.locked_get(key))) {
-                msg::dbg(4, "metadata cache: approx at leveldiff %d", quad[1] - ql);
+                MSG_DBG(4, "metadata cache: approx at leveldiff %d", quad[1] - ql);
+                if (pyramid)
+                    pyramid->put(key.quad, qm->meta, qm->elevation_grid);
                 *level_difference = quad[1] - ql;
-                return *qm;
+                return sub_quad_metadata(qm->meta, qm->elevation_grid, quad, *level_difference);
             } else if ((qgpu = gpu_cache.locked_get(key))) {
-                msg::dbg(4, "quad gpu cache: approx at leveldiff %d", quad[1] - ql);
-                metadata_cache.locked_put(key, new ecmdb::metadata(qgpu->meta));
+                MSG_DBG(4, "quad gpu cache: approx at leveldiff %d", quad[1] - ql);
+                metadata_cache.locked_put(key, new quad_metadata(qgpu->meta, qgpu->elevation_grid));
+                if (pyramid)
+                    pyramid->put(key.quad, qgpu->meta, qgpu->elevation_grid);
                 *level_difference = quad[1] - ql;
-                return qgpu->meta;
+                return sub_quad_metadata(qgpu->meta, qgpu->elevation_grid, quad, *level_difference);
             } else if ((qmem = mem_cache.locked_get(key))) {
-                msg::dbg(4, "quad mem cache: approx at leveldiff %d", quad[1] - ql);
-                metadata_cache.locked_put(key, new ecmdb::metadata(qmem->meta));
+                MSG_DBG(4, "quad mem cache: approx at leveldiff %d", quad[1] - ql);
+                metadata_cache.locked_put(key, new quad_metadata(qmem->meta, qmem->elevation_grid));
+                if (pyramid)
+                    pyramid->put(key.quad, qmem->meta, qmem->elevation_grid);
                 *level_difference = quad[1] - ql;
-                return qmem->meta;
+                return sub_quad_metadata(qmem->meta, qmem->elevation_grid, quad, *level_difference);
             } else if ((qdisk = disk_cache.locked_get(key))) {
                 switch (qdisk->status) {
                 case quad_disk::uncached:
                     if (ql == quad[1] - 1) {
-                        msg::dbg(4, "quad disk cache: start fetching at leveldiff %d", quad[1] - ql);
+                        MSG_DBG(4, "quad disk cache: start fetching at leveldiff %d", quad[1] - ql);
                         (void)disk_cache_fetchers.locked_start_fetch(
                                 key, dd.db, dd.url, dd.username, dd.password);
                     }
                     break;
                 case quad_disk::cached:
                     if (ql == quad[1] - 1) {
-                        msg::dbg(4, "quad disk cache: start loading at leveldiff %d", quad[1] - ql);
+                        MSG_DBG(4, "quad disk cache: start loading at leveldiff %d", quad[1] - ql);
                         (void)mem_cache_loaders.locked_start_load(
                                 key, dd.db, disk_cache.quad_filename(dd.url, ivec4(qs, ql, qx, qy)));
                     }
                     break;
                 case quad_disk::cached_empty:
                     // We have nothing. Return invalid metadata.
-                    msg::dbg(4, "quad disk cache: database does not have this quad");
+                    MSG_DBG(4, "quad disk cache: database does not have this quad");
+                    if (pyramid)
+                        pyramid->put_empty(key.quad);
                     *level_difference = 0;
                     return ecmdb::metadata();
                     break;
                 case quad_disk::checking:
                 case quad_disk::caching:
-                    msg::dbg(4, "quad disk cache: waiting for ongoing operation");
+                    MSG_DBG(4, "quad disk cache: waiting for ongoing operation");
                     // disk cache operation ongoing; we need to wait for it
                     break;
                 }
             } else {
                 if (ql == quad[1] - 1) {
-                    msg::dbg(4, "quad disk cache: start checking at leveldiff %d", quad[1] - ql);
+                    MSG_DBG(4, "quad disk cache: start checking at leveldiff %d", quad[1] - ql);
                     (void)disk_cache_checkers.locked_start_check(key, disk_cache.quad_filename(dd.url, ivec4(qs, ql, qx, qy)));
                 }
             }
@@ -206,7 +307,7 @@ ecmdb::metadata lod_thread::get_metadata_with_caching(
                 assert(qx == 0);
                 assert(qy == 0);
                 // OK, we have nothing. Use global metadata.
-                msg::dbg(4, "falling back to global metadata - ugh!");
+                MSG_DBG(4, "falling back to global metadata - ugh!");
                 ecmdb::metadata meta(dd.db.category());
                 if (dd.db.category() == ecmdb::category_elevation) {
                     meta.elevation.min = dd.meta.elevation.min;
@@ -226,33 +327,53 @@ ecmdb::metadata lod_thread::get_metadata_with_caching(
     }
 }
 
+void lod_thread::sort_front_to_back(const ecm_side_quadtree** quads, unsigned int n)
+{
+    if (_distance_quads.size() < n)
+        _distance_quads.resize(n);
+    for (unsigned int i = 0; i < n; i++) {
+        _distance_quads[i].distance = max(0.0, distance(quads[i]->bounding_sphere_center(), _state->viewer_pos)
+                - quads[i]->bounding_sphere_radius());
+        _distance_quads[i].quad = quads[i];
+    }
+    std::sort(_distance_quads.begin(), _distance_quads.begin() + n);
+    for (unsigned int i = 0; i < n; i++)
+        quads[i] = _distance_quads[i].quad;
+}
+
 void lod_thread::get_quad_elevation_bounds(
         const glvm::ivec4& quad,
-        bool quad_intersects_lens,
+        int quad_lens_status,
         unsigned int ndds, const database_description** dds,
-        float* min_elev, float* max_elev, bool* valid)
+        quad_metadata_pyramid* const* pyramids,
+        float* min_elev, float* max_elev, bool* valid, bool* pending)
 {
     *valid = false;
+    *pending = false;
     *min_elev = +std::numeric_limits<float>::max();
     *max_elev = -std::numeric_limits<float>::max();
     bool have_values = false;
     for (unsigned i = 0; i < ndds; i++) {
         float mine, maxe;
         int level_difference = -1;
-        ecmdb::metadata meta = get_metadata_with_caching(*(dds[i]), quad, &level_difference);
+        ecmdb::metadata meta = get_metadata_with_caching(*(dds[i]), pyramids[i], quad, &level_difference);
         assert(level_difference >= 0);
         if (meta.is_valid()) {
             assert(meta.category == ecmdb::category_elevation);
             assert(isfinite(meta.elevation.min));
             assert(isfinite(meta.elevation.max));
             assert(meta.elevation.max >= meta.elevation.min);
-            _processor->get_processed_quad_elevation_bounds(_frame,
-                    *(dds[i]), false, quad, meta, &mine, &maxe);
-            if (mine < *min_elev)
-                *min_elev = mine;
-            if (maxe > *max_elev)
-                *max_elev = maxe;
-            if (quad_intersects_lens) {
+            // Quads completely inside the lens only need the lens bounds,
+            // quads completely outside the lens only need the non-lens bounds.
+            if (quad_lens_status != 1) {
+                _processor->get_processed_quad_elevation_bounds(_frame,
+                        *(dds[i]), false, quad, meta, &mine, &maxe);
+                if (mine < *min_elev)
+                    *min_elev = mine;
+                if (maxe > *max_elev)
+                    *max_elev = maxe;
+            }
+            if (quad_lens_status != 0) {
                 _processor->get_processed_quad_elevation_bounds(_frame,
                         *(dds[i]), true, quad, meta, &mine, &maxe);
                 if (mine < *min_elev)
@@ -260,8 +381,13 @@ void lod_thread::get_quad_elevation_bounds(
                 if (maxe > *max_elev)
                     *max_elev = maxe;
             }
-            if (level_difference == 0)
+            if (level_difference == 0) {
                 *valid = true;
+            } else if (quad[1] < dds[i]->db.levels()) {
+                // The data for this quad has not arrived yet; until then,
+                // the bounds come from a lower level.
+                *pending = true;
+            }
             have_values = true;
         }
     }
@@ -271,12 +397,131 @@ void lod_thread::get_quad_elevation_bounds(
     }
 }
 
+bool lod_thread::update_quad_bounds(const class ecm& ecm, const dvec3& lens_pos,
+        ecm_side_quadtree* quad, bool* minmax_elev_pending, bool* need_base_data)
+{
+    class quad_base_data_mem_cache& quad_base_data_mem_cache = *(_context->quad_base_data_mem_cache());
+    class quad_base_data_gpu_cache& quad_base_data_gpu_cache = *(_context->quad_base_data_gpu_cache());
+
+    if (_state->lens.active) {
+        dvec3 quad_center = (quad->corner(0) + quad->corner(1) + quad->corner(2) + quad->corner(3)) / 4.0;
+        double quad_radius = max(
+                length(quad->corner(0) - quad_center),
+                length(quad->corner(1) - quad_center),
+                length(quad->corner(2) - quad_center),
+                length(quad->corner(3) - quad_center))
+            + quad->max_dist_to_quad_plane();
+        double dist = length(lens_pos - quad_center);
+        if (dist <= _state->lens.radius - quad_radius) {
+            quad->lens_status() = 1;
+        } else if (dist > _state->lens.radius + quad_radius) {
+            quad->lens_status() = 0;
+        } else {
+            quad->lens_status() = 2;
+        }
+    } else {
+        quad->lens_status() = 0;
+    }
+    float min_elev = 0.0f, max_elev = 0.0f;
+    bool minmax_elev_valid = false;
+    *minmax_elev_pending = false;
+    if (_n_elevation_dds > 0) {
+        get_quad_elevation_bounds(quad->quad(), quad->lens_status(),
+                _n_elevation_dds, &(_elevation_dds[0]), &(_elevation_pyramids[0]),
+                &min_elev, &max_elev, &minmax_elev_valid, minmax_elev_pending);
+    }
+    quad->minmax_elev_valid() = minmax_elev_valid;
+    assert(min_elev >= static_cast<float>(_state->inner_bounding_sphere_radius - ecm.semi_major_axis()));
+    assert(max_elev <= static_cast<float>(_state->outer_bounding_sphere_radius - ecm.semi_minor_axis()));
+    *need_base_data = false;
+    bool minmax_elev_changed = (min_elev < quad->min_elev() || min_elev > quad->min_elev()
+            || max_elev < quad->max_elev() || max_elev > quad->max_elev());
+    if (minmax_elev_changed || !quad->max_dist_to_quad_plane_is_valid()) {
+        MSG_DBG(4, "recomputing bounding box");
+        quad->min_elev() = min_elev;
+        quad->max_elev() = max_elev;
+        // Get quad base data
+        ivec4 quad_base_data_sym_quad;
+        ecm::symmetry_quad(quad->quad()[0], quad->quad()[1], quad->quad()[2], quad->quad()[3],
+                &(quad_base_data_sym_quad[0]), &(quad_base_data_sym_quad[1]), &(quad_base_data_sym_quad[2]), &(quad_base_data_sym_quad[3]),
+                NULL, NULL, NULL);
+        quad_base_data_key qbdkey(quad_base_data_sym_quad);
+        const quad_base_data_gpu *qbdgpu = quad_base_data_gpu_cache.locked_get(qbdkey);
+        if (!qbdgpu) {
+            const quad_base_data_mem *qbdmem = quad_base_data_mem_cache.locked_get(qbdkey);
+            if (!qbdmem) {
+                double max_dist_to_quad_plane = ecm.max_quad_plane_distance_estimation(
+                        quad->quad()[0], quad->quad()[1], quad->quad()[2], quad->quad()[3],
+                        quad->plane_normal().vl, quad->plane_distance());
+                if (max_dist_to_quad_plane < 0.01) {
+                    MSG_DBG(4, "quad %s: max_dist_to_quad_plane estimate = %g: don't need quad base data",
+                            str::from(quad->quad()).c_str(), max_dist_to_quad_plane);
+                    quad->max_dist_to_quad_plane() = 0.0;
+                    quad->max_dist_to_quad_plane_is_valid() = true;
+                    // Remember that we don't need quad base data here
+                    quad_base_data_gpu_cache.locked_put(qbdkey, new quad_base_data_gpu(NULL, 0, 0, 0.0));
+                    quad_base_data_mem_cache.locked_put(qbdkey, new quad_base_data_mem());
+                } else {
+                    quad->max_dist_to_quad_plane() = max_dist_to_quad_plane;
+                    quad->max_dist_to_quad_plane_is_valid() = false;
+                    // Only compute this once we know that the quad is not culled
+                    *need_base_data = true;
+                }
+            } else {
+                // Do not move the data to the GPU now since we don't know yet if we will need it there.
+                quad->max_dist_to_quad_plane() = qbdmem->max_dist_to_quad_plane;
+                quad->max_dist_to_quad_plane_is_valid() = true;
+            }
+        } else {
+            quad->max_dist_to_quad_plane() = qbdgpu->max_dist_to_quad_plane;
+            quad->max_dist_to_quad_plane_is_valid() = true;
+        }
+        // Compute bounding box
+        quad->compute_bounding_box();
+        return true;
+    }
+    return false;
+}
+
+void lod_thread::start_quad_base_data(const class ecm& ecm, int quad_size, const ecm_side_quadtree* quad)
+{
+    class quad_base_data_mem_cache_computers& quad_base_data_mem_cache_computers = *(_context->quad_base_data_mem_cache_computers());
+    ivec4 quad_base_data_sym_quad;
+    ecm::symmetry_quad(quad->quad()[0], quad->quad()[1], quad->quad()[2], quad->quad()[3],
+            &(quad_base_data_sym_quad[0]), &(quad_base_data_sym_quad[1]), &(quad_base_data_sym_quad[2]), &(quad_base_data_sym_quad[3]),
+            NULL, NULL, NULL);
+    quad_base_data_key qbdkey(quad_base_data_sym_quad);
+    (void)quad_base_data_mem_cache_computers.locked_start_compute(qbdkey, ecm, quad_size);
+}
+
+bool lod_thread::is_at_highest_level(const ecm_side_quadtree* quad) const
+{
+    bool at_highest_level = true;
+    for (unsigned int i = 0; i < _n_texture_dds && at_highest_level; i++) {
+        if (_texture_dds[i]->processing_parameters[0].category_e2c)
+            continue;
+        if (quad->level() < _texture_dds[i]->db.levels() - 1 && _texture_dds[i]->db.has_quad(
+                    quad->quad()[0], quad->quad()[1], quad->quad()[2], quad->quad()[3]))
+            at_highest_level = false;
+    }
+    if (_texture_dds[0]->processing_parameters[0].category_e2c) {
+        for (unsigned int i = 0; i < _n_elevation_dds && at_highest_level; i++) {
+            if (quad->level() < _elevation_dds[i]->db.levels() - 1 && _elevation_dds[i]->db.has_quad(
+                        quad->quad()[0], quad->quad()[1], quad->quad()[2], quad->quad()[3]))
+                at_highest_level = false;
+        }
+    }
+    return at_highest_level;
+}
+
 void lod_thread::run()
 {
+    TRC_SCOPE("lod");
     if (!_state->have_databases()) {
         _n_elevation_dds = 0;
         _n_texture_dds = 0;
         _n_render_quads = 0;
+        _n_query_quads = 0;
         return;
     }
 #ifndef NDEBUG
@@ -299,9 +544,13 @@ void lod_thread::run()
             if (dd.db.levels() - 1 > max_level)
                 max_level = dd.db.levels() - 1;
             if (dd.db.category() == ecmdb::category_elevation) {
-                if (_elevation_dds.size() < _n_elevation_dds + 1)
+                if (_elevation_dds.size() < _n_elevation_dds + 1) {
                     _elevation_dds.resize(_n_elevation_dds + 1);
+                    _elevation_pyramids.resize(_n_elevation_dds + 1);
+                }
                 _elevation_dds[_n_elevation_dds] = &dd;
+                _elevation_pyramids[_n_elevation_dds] = _context->quad_metadata_cache()->locked_get_pyramid(
+                        dd.uuid, dd.db, dd.meta, dd.url, _context->quad_disk_cache()->metadata_pyramid_filename(dd.url));
                 _n_elevation_dds++;
             } else {
                 if (_texture_dds.size() < _n_texture_dds + 1)
@@ -319,15 +568,13 @@ void lod_thread::run()
         return;
     }
     assert(max_level < ecmdb::max_levels);
-    class quad_base_data_mem_cache& quad_base_data_mem_cache = *(_context->quad_base_data_mem_cache());
-    class quad_base_data_mem_cache_computers& quad_base_data_mem_cache_computers = *(_context->quad_base_data_mem_cache_computers());
-    class quad_base_data_gpu_cache& quad_base_data_gpu_cache = *(_context->quad_base_data_gpu_cache());
 
     /* Throw away / recreate obsolete data structures */
     if (!_quadtree || _quadtree->ecm() != ecm) {
-        msg::dbg("Rebuilding LOD quadtree from scratch");
+        MSG_DBG("Rebuilding LOD quadtree from scratch");
         delete _quadtree;
         _quadtree = new ecm_quadtree(ecm);
+        _lod_incremental_valid = false;
     }
 
     /* Compute global information */
@@ -337,6 +584,9 @@ void lod_thread::run()
     _rel_MV = _MV * rel_T;
     mat4 rel_MVP = _P * _rel_MV;
     _culler.set_mvp(rel_MVP);
+    // Pixels per unit of the tangent of the angle to the view direction, for the bounding sphere LOD metric
+    double pixels_per_tan = max(_P[0][0] * _VP[2], _P[1][1] * _VP[3]) / 2.0;
+    float split_area_base = _state->quad_screen_size_ratio() * quad_size * quad_size;
     _elevation_min = _state->inner_bounding_sphere_radius - ecm.semi_major_axis();
     _elevation_max = _state->outer_bounding_sphere_radius - ecm.semi_minor_axis();
     if (_n_elevation_dds == 0) {
@@ -367,172 +617,242 @@ void lod_thread::run()
         }
     }
 
-    /* Build LOD quadtree */
+    /* Set up horizon culling. The occluder is the ellipsoid, shrunk by the
+     * lowest processed elevation so that it lies completely below the terrain.
+     * If elevations are exaggerated, the per-quad bounds that are derived from
+     * coarser levels or missing metadata can be far off, so we use a
+     * conservative variant: a sphere inside the ellipsoid, shrunk by the lowest
+     * elevation that processing can produce at all, and no horizon culling for
+     * quads without their own elevation bounds. */
+    float max_elevation_scale = 1.0f;
+    for (unsigned int i = 0; i < _n_elevation_dds; i++) {
+        for (int j = 0; j < (_state->lens.active ? 2 : 1); j++) {
+            float sf = abs(_elevation_dds[i]->processing_parameters[j].elevation.scale_factor);
+            if (sf > max_elevation_scale)
+                max_elevation_scale = sf;
+        }
+    }
+    const bool horizon_conservative = (max_elevation_scale > 1.0f);
+    dvec3 polar_axis;
+    ecm.geodetic_to_cartesian(const_pi<double>() / 2.0, 0.0, 0.0, polar_axis.vl);
+    polar_axis = normalize(polar_axis);
+    if (horizon_conservative) {
+        double r = ecm.semi_minor_axis() + min(0.0f, _elevation_min);
+        _culler.set_horizon(_state->viewer_pos, polar_axis, r, r);
+    } else {
+        // The ellipsoid shrunk along the axes pokes out of the ellipsoid shrunk along
+        // the surface normals by a tiny amount; the factor covers that.
+        double e = min(0.0f, _e2c_elevation_min);
+        _culler.set_horizon(_state->viewer_pos, polar_axis,
+                (ecm.semi_major_axis() + e) * (1.0 - 1e-5),
+                (ecm.semi_minor_axis() + e) * (1.0 - 1e-5));
+    }
+
+    /* Set up occlusion culling against the depth buffer of a previous frame. */
+    _occlusion_culler.init(_state->renderer.occlusion_culling ? _occlusion_feedback.depth : depth_map());
+
     _info->quads_culled[_depth_pass] = 0;
-    unsigned int lod_quads = 0;
-    if (_lod_quads.size() < 6)
-        _lod_quads.resize(6);
-    for (int i = 0; i < 6; i++)
-        _lod_quads[lod_quads++] = _quadtree->side_root(i);
+    _info->quads_horizon_culled[_depth_pass] = 0;
+    _info->quads_occlusion_culled[_depth_pass] = 0;
+    _info->lod_metric_disagreements[_depth_pass] = 0;
+    _info->quads_split[_depth_pass] = 0;
+    _info->quads_merged[_depth_pass] = 0;
+    _info->quads_held[_depth_pass] = 0;
+    _info->lod_evaluations[_depth_pass] = 0;
+    _info->lod_operations_queued[_depth_pass] = 0;
+
+    /* Build LOD quadtree. The incremental mode needs the bounding sphere
+     * metric, because it relies on split decisions that only depend on the
+     * distance to the viewer; otherwise, decide from scratch. */
+    bool incremental = (_state->renderer.lod_incremental
+            && _state->renderer.lod_metric == 1 && !_state->renderer.lod_metric_comparison
+            && _state->renderer.fixed_quadtree_depth <= 0);
     _n_render_quads = 0;
+    unsigned int query_quads = 0;
+    unsigned int lod_quads = 0;
+    if (incremental) {
+        run_incremental(ecm, quad_size, lens_pos, max_level, pixels_per_tan, split_area_base,
+                horizon_conservative, &query_quads);
+    } else {
+        // The changes made below are not tracked for the incremental mode
+        _lod_incremental_valid = false;
+        if (_lod_quads.size() < 6)
+            _lod_quads.resize(6);
+        for (int i = 0; i < 6; i++) {
+            _lod_quads[lod_quads].quad = _quadtree->side_root(i);
+            _lod_quads[lod_quads].parent_plane_mask = culler::all_planes;
+            _lod_quads[lod_quads].cull = 2;
+            lod_quads++;
+        }
+    }
     while (lod_quads > 0) {
-        ecm_side_quadtree* quad = _lod_quads[--lod_quads];
-        msg::dbg("LOD: quad %s", str::from(quad->quad()).c_str());
+        lod_quad lq = _lod_quads[--lod_quads];
+        ecm_side_quadtree* quad = lq.quad;
+        MSG_DBG("LOD: quad %s", str::from(quad->quad()).c_str());
         bool split;
         int cull = 2;   // 0 = no, 1 = yes, 2 = undecided
+        // Frustum planes that this quad needs to be tested against
+        unsigned int plane_mask = lq.parent_plane_mask;
         if (quad->level() == 0) {
             /* Always make sure to split the top level so that
              * 1) all childless quads have a parent
              * 2) we can use the ecm_quad_base_data symmetry optimization unconditionally. */
-            msg::dbg(4, "splitting: level 0");
+            MSG_DBG(4, "splitting: level 0");
             split = true;
         } else {
-            if (_state->lens.active) {
-                dvec3 quad_center = (quad->corner(0) + quad->corner(1) + quad->corner(2) + quad->corner(3)) / 4.0;
-                double quad_radius = max(
-                        length(quad->corner(0) - quad_center),
-                        length(quad->corner(1) - quad_center),
-                        length(quad->corner(2) - quad_center),
-                        length(quad->corner(3) - quad_center))
-                    + quad->max_dist_to_quad_plane();
-                double dist = length(lens_pos - quad_center);
-                if (dist <= _state->lens.radius - quad_radius) {
-                    quad->lens_status() = 1;
-                } else if (dist > _state->lens.radius + quad_radius) {
-                    quad->lens_status() = 0;
-                } else {
-                    quad->lens_status() = 2;
-                }
-            } else {
-                quad->lens_status() = 0;
+            bool minmax_elev_pending;
+            bool need_base_data;
+            if (update_quad_bounds(ecm, lens_pos, quad, &minmax_elev_pending, &need_base_data)) {
+                // The test in advance used the old bounding box
+                lq.cull = 2;
             }
-            float min_elev = 0.0f, max_elev = 0.0f;
-            bool minmax_elev_valid = false;
-            if (_n_elevation_dds > 0) {
-                get_quad_elevation_bounds(quad->quad(), quad->lens_status(),
-                        _n_elevation_dds, &(_elevation_dds[0]),
-                        &min_elev, &max_elev, &minmax_elev_valid);
+            bool minmax_elev_valid = quad->minmax_elev_valid();
+            if (lq.cull != 2) {
+                cull = lq.cull;
+                plane_mask = lq.plane_mask;
+            } else if (plane_mask == 0) {
+                cull = 0;
             }
-            assert(min_elev >= static_cast<float>(_state->inner_bounding_sphere_radius - ecm.semi_major_axis()));
-            assert(max_elev <= static_cast<float>(_state->outer_bounding_sphere_radius - ecm.semi_minor_axis()));
-            bool minmax_elev_changed = (min_elev < quad->min_elev() || min_elev > quad->min_elev()
-                    || max_elev < quad->max_elev() || max_elev > quad->max_elev());
-            if (minmax_elev_changed || !quad->max_dist_to_quad_plane_is_valid()) {
-                msg::dbg(4, "recomputing bounding box");
-                quad->min_elev() = min_elev;
-                quad->max_elev() = max_elev;
-                // Get quad base data
-                ivec4 quad_base_data_sym_quad;
-                ecm::symmetry_quad(quad->quad()[0], quad->quad()[1], quad->quad()[2], quad->quad()[3],
-                        &(quad_base_data_sym_quad[0]), &(quad_base_data_sym_quad[1]), &(quad_base_data_sym_quad[2]), &(quad_base_data_sym_quad[3]),
-                        NULL, NULL, NULL);
-                quad_base_data_key qbdkey(quad_base_data_sym_quad);
-                const quad_base_data_gpu *qbdgpu = quad_base_data_gpu_cache.locked_get(qbdkey);
-                if (!qbdgpu) {
-                    const quad_base_data_mem *qbdmem = quad_base_data_mem_cache.locked_get(qbdkey);
-                    if (!qbdmem) {
-                        double max_dist_to_quad_plane = ecm.max_quad_plane_distance_estimation(
-                                quad->quad()[0], quad->quad()[1], quad->quad()[2], quad->quad()[3],
-                                quad->plane_normal().vl, quad->plane_distance());
-                        if (max_dist_to_quad_plane < 0.01) {
-                            msg::dbg(4, "quad %s: max_dist_to_quad_plane estimate = %g: don't need quad base data",
-                                    str::from(quad->quad()).c_str(), max_dist_to_quad_plane);
-                            quad->max_dist_to_quad_plane() = 0.0;
-                            quad->max_dist_to_quad_plane_is_valid() = true;
-                            // Remember that we don't need quad base data here
-                            quad_base_data_gpu_cache.locked_put(qbdkey, new quad_base_data_gpu(NULL, 0, 0, 0.0));
-                            quad_base_data_mem_cache.locked_put(qbdkey, new quad_base_data_mem());
-                        } else {
-                            quad->max_dist_to_quad_plane() = max_dist_to_quad_plane;
-                            quad->max_dist_to_quad_plane_is_valid() = false;
-                            (void)quad_base_data_mem_cache_computers.locked_start_compute(qbdkey, ecm, quad_size);
-                        }
-                    } else {
-                        // Do not move the data to the GPU now since we don't know yet if we will need it there.
-                        quad->max_dist_to_quad_plane() = qbdmem->max_dist_to_quad_plane;
-                        quad->max_dist_to_quad_plane_is_valid() = true;
-                    }
-                } else {
-                    quad->max_dist_to_quad_plane() = qbdgpu->max_dist_to_quad_plane;
-                    quad->max_dist_to_quad_plane_is_valid() = true;
+            if (cull == 2) {
+                vec3 bb0[4], bb1[4];
+                for (int i = 0; i < 4; i++) {
+                    bb0[i] = vec3(quad->bounding_box_inner()[i] - _state->viewer_pos);
+                    bb1[i] = vec3(quad->bounding_box_outer()[i] - _state->viewer_pos);
                 }
-                // Compute bounding box
-                quad->compute_bounding_box();
+                cull = _culler.frustum_cull(bb0, bb1, &plane_mask) ? 1 : 0;
             }
-            // Check if we are at the highest level that has data for this quad
-            bool at_highest_level = true;
-            for (unsigned int i = 0; i < _n_texture_dds && at_highest_level; i++) {
-                if (_texture_dds[i]->processing_parameters[0].category_e2c)
-                    continue;
-                if (quad->level() < _texture_dds[i]->db.levels() - 1 && _texture_dds[i]->db.has_quad(
-                            quad->quad()[0], quad->quad()[1], quad->quad()[2], quad->quad()[3]))
-                    at_highest_level = false;
+            bool behind_horizon = false;
+            if (cull == 0 && (minmax_elev_valid || !horizon_conservative)
+                    && _culler.horizon_cull(quad->bounding_box_inner(), quad->bounding_box_outer())) {
+                cull = 1;
+                behind_horizon = true;
             }
-            if (_texture_dds[0]->processing_parameters[0].category_e2c) {
-                for (unsigned int i = 0; i < _n_elevation_dds && at_highest_level; i++) {
-                    if (quad->level() < _elevation_dds[i]->db.levels() - 1 && _elevation_dds[i]->db.has_quad(
-                                quad->quad()[0], quad->quad()[1], quad->quad()[2], quad->quad()[3]))
-                        at_highest_level = false;
+            bool occluded = false;
+            bool needs_query = false;
+            if (cull == 0 && _occlusion_culler.is_valid()) {
+                int o = _occlusion_culler.test(quad->bounding_box_inner(), quad->bounding_box_outer(), _state->viewer_pos);
+                if (o == occlusion_culler::occluded
+                        || (o == occlusion_culler::borderline && _occlusion_feedback.is_occluded(quad->quad()))) {
+                    cull = 1;
+                    occluded = true;
+                } else if (o == occlusion_culler::borderline) {
+                    needs_query = true;
                 }
             }
+            if (need_base_data && cull == 0)
+                start_quad_base_data(ecm, quad_size, quad);
+            // Check if we are at the highest level that has data for this quad
+            bool at_highest_level = is_at_highest_level(quad);
             // Now check if we want to split this quad
+            quad->lod_metric_disagreement() = false;
             if (_state->renderer.fixed_quadtree_depth > 0) {
                 split = (quad->level() < _state->renderer.fixed_quadtree_depth - 1);
-                msg::dbg(4, "%ssplitting: fixed quadtree depth", split ? "" : "not ");
+                MSG_DBG(4, "%ssplitting: fixed quadtree depth", split ? "" : "not ");
             } else if (at_highest_level) {
                 /* Avoid overflow of quad coordinates and needless splitting of quads that
                  * are at the highest available LOD */
-                msg::dbg(4, "not splitting: max level");
+                MSG_DBG(4, "not splitting: max level");
                 split = false;
             } else {
                 /* Do not split the quad if it is outside the view frustum */
-                vec3 bb0[4], bb1[4];
-                for (int i = 0; i < 4; i++) {
-                    bb0[i] = vec3(quad->bounding_box_inner()[i] - _state->viewer_pos);
-                    bb1[i] = vec3(quad->bounding_box_outer()[i] - _state->viewer_pos);
-                }
-                cull = _culler.frustum_cull(bb0, bb1) ? 1 : 0;
                 if (cull) {
-                    msg::dbg(4, "not splitting: quad is culled");
+                    MSG_DBG(4, "not splitting: quad is culled");
                     split = false;
+                } else if (minmax_elev_pending && _state->renderer.lod_hold_pending) {
+                    /* Keep the quad at its level until its elevation bounds arrive;
+                     * deciding with the preliminary bounds would often be reverted
+                     * right afterwards. */
+                    split = quad->has_children();
+                    MSG_DBG(4, "%ssplitting: waiting for data", split ? "" : "not ");
+                    _info->quads_held[_depth_pass]++;
                 } else {
-                    /* Split the quad if the screen space area covered by its bounding box
-                     * is larger than the quad size. */
-                    for (int i = 0; i < 8; i++) {
-                        _bbs[i] = glvmProject(i < 4 ? bb0[i] : bb1[i - 4], rel_MVP, _VP);
+                    _info->lod_evaluations[_depth_pass]++;
+                    /* Apply hysteresis: a split quad only merges if its screen area
+                     * falls clearly below the threshold, and an unsplit quad only splits
+                     * if its screen area is clearly above it. */
+                    float hysteresis = (quad->has_children() ? -1.0f : +1.0f) * _state->renderer.lod_hysteresis;
+                    float split_area = split_area_base * (1.0f + hysteresis);
+                    bool compare = _state->renderer.lod_metric_comparison;
+                    bool split_box = false;
+                    bool split_sphere = false;
+                    if (_state->renderer.lod_metric == 0 || compare) {
+                        /* Split the quad if the screen space area covered by its bounding box
+                         * is larger than the quad size. */
+                        for (int i = 0; i < 8; i++) {
+                            vec3 bbp = vec3((i < 4 ? quad->bounding_box_inner()[i] : quad->bounding_box_outer()[i - 4])
+                                    - _state->viewer_pos);
+                            _bbs[i] = glvmProject(bbp, rel_MVP, _VP);
+                        }
+                        std::vector<vec2> bbs_convex_hull = glvm::convex_hull(_bbs);
+                        float bbs_area = glvm::polygon_area(bbs_convex_hull);
+                        split_box = (bbs_area > split_area);
+                        MSG_DBG(4, "bounding box metric: screen area = %g * quad area", bbs_area / (quad_size * quad_size));
+                        if (split_box && !minmax_elev_valid && quad->quad()[1] > max_level / 2) {
+                            // prevent elongated quads as long as we don't have valid data
+                            float max_bb_height = max(distance(_bbs[0], _bbs[4]), distance(_bbs[1], _bbs[5]), distance(_bbs[2], _bbs[6]), distance(_bbs[3], _bbs[7]));
+                            float max_bb0_side = max(distance(_bbs[0], _bbs[1]), distance(_bbs[1], _bbs[2]), distance(_bbs[2], _bbs[3]), distance(_bbs[3], _bbs[0]));
+                            float max_bb1_side = max(distance(_bbs[4], _bbs[5]), distance(_bbs[5], _bbs[6]), distance(_bbs[6], _bbs[7]), distance(_bbs[7], _bbs[4]));
+                            if (max_bb_height > 0.5f * max(max_bb0_side, max_bb1_side)) {
+                                MSG_DBG(4, "bounding box metric: quad is very high and we have no reliable info yet");
+                                split_box = false;
+                            }
+                        }
                     }
-                    std::vector<vec2> bbs_convex_hull = glvm::convex_hull(_bbs);
-                    float bbs_area = glvm::polygon_area(bbs_convex_hull);
-                    split = (bbs_area / _state->renderer.quad_screen_size_ratio > quad_size * quad_size);
-                    msg::dbg(4, "splitting: screen area = %g * quad area", bbs_area / (quad_size * quad_size));
-                    if (split && !minmax_elev_valid && quad->quad()[1] > max_level / 2) {
-                        // prevent elongated quads as long as we don't have valid data
-                        float max_bb_height = max(distance(_bbs[0], _bbs[4]), distance(_bbs[1], _bbs[5]), distance(_bbs[2], _bbs[6]), distance(_bbs[3], _bbs[7]));
-                        float max_bb0_side = max(distance(_bbs[0], _bbs[1]), distance(_bbs[1], _bbs[2]), distance(_bbs[2], _bbs[3]), distance(_bbs[3], _bbs[0]));
-                        float max_bb1_side = max(distance(_bbs[4], _bbs[5]), distance(_bbs[5], _bbs[6]), distance(_bbs[6], _bbs[7]), distance(_bbs[7], _bbs[4]));
-                        if (max_bb_height > 0.5f * max(max_bb0_side, max_bb1_side)) {
-                            msg::dbg(4, "not splitting: quad is very high and we have no reliable info yet");
-                            split = false;
+                    if (_state->renderer.lod_metric == 1 || compare) {
+                        /* Split the quad if the screen space area covered by its bounding sphere
+                         * is larger than the quad size. This needs neither projections nor
+                         * allocations. */
+                        float bs_area = bounding_sphere_screen_area(quad->bounding_sphere_center(),
+                                quad->bounding_sphere_radius(), _state->viewer_pos, pixels_per_tan);
+                        split_sphere = (bs_area > split_area);
+                        MSG_DBG(4, "bounding sphere metric: screen area = %g * quad area", bs_area / (quad_size * quad_size));
+                        if (split_sphere && !minmax_elev_valid && quad->quad()[1] > max_level / 2) {
+                            // prevent elongated quads as long as we don't have valid data;
+                            // here the check is done in world space
+                            const dvec3* bbi = quad->bounding_box_inner();
+                            const dvec3* bbo = quad->bounding_box_outer();
+                            double max_bb_height = max(distance(bbi[0], bbo[0]), distance(bbi[1], bbo[1]), distance(bbi[2], bbo[2]), distance(bbi[3], bbo[3]));
+                            double max_bb_side = max(distance(bbo[0], bbo[1]), distance(bbo[1], bbo[2]), distance(bbo[2], bbo[3]), distance(bbo[3], bbo[0]));
+                            if (max_bb_height > 0.5 * max_bb_side) {
+                                MSG_DBG(4, "bounding sphere metric: quad is very high and we have no reliable info yet");
+                                split_sphere = false;
+                            }
                         }
                     }
+                    split = (_state->renderer.lod_metric == 0 ? split_box : split_sphere);
+                    MSG_DBG(4, "%ssplitting: screen area", split ? "" : "not ");
+                    if (compare && split_box != split_sphere) {
+                        _info->lod_metric_disagreements[_depth_pass]++;
+                        quad->lod_metric_disagreement() = true;
+                    }
                 }
             }
+            if (!split && quad->has_children()
+                    && _frame - quad->split_frame() < static_cast<unsigned int>(_state->renderer.lod_min_residence)) {
+                /* Do not merge a quad shortly after it was split */
+                MSG_DBG(4, "splitting: minimum residence time");
+                split = true;
+                _info->quads_held[_depth_pass]++;
+            }
             if (split) {
-                msg::dbg(4, "not rendering: splitting");
+                MSG_DBG(4, "not rendering: splitting");
             } else {
-                if (cull == 2) {
-                    vec3 bb0[4], bb1[4];
-                    for (int i = 0; i < 4; i++) {
-                        bb0[i] = vec3(quad->bounding_box_inner()[i] - _state->viewer_pos);
-                        bb1[i] = vec3(quad->bounding_box_outer()[i] - _state->viewer_pos);
-                    }
-                    cull = _culler.frustum_cull(bb0, bb1) ? 1 : 0;
-                }
-                if (cull == 1) {
-                    msg::dbg(4, "not rendering: culled");
+                if (behind_horizon) {
+                    MSG_DBG(4, "not rendering: behind horizon");
+                    _info->quads_horizon_culled[_depth_pass]++;
+                } else if (occluded) {
+                    MSG_DBG(4, "not rendering: occluded");
+                    _info->quads_occlusion_culled[_depth_pass]++;
+                } else if (cull == 1) {
+                    MSG_DBG(4, "not rendering: culled");
                     _info->quads_culled[_depth_pass] += cull;
+                } else if (needs_query) {
+                    MSG_DBG(4, "rendering: probably occluded");
+                    if (_query_quads.size() < query_quads + 1)
+                        _query_quads.resize(query_quads + 1);
+                    _query_quads[query_quads++] = quad;
                 } else {
-                    msg::dbg(4, "rendering");
+                    MSG_DBG(4, "rendering");
                     if (_render_quads.size() < _n_render_quads + 1)
                         _render_quads.resize(_n_render_quads + 1);
                     _render_quads[_n_render_quads++] = quad;
@@ -540,27 +860,511 @@ void lod_thread::run()
             }
         }
         if (split && !quad->has_children()) {
-            msg::dbg(4, "final decision: splitting");
+            MSG_DBG(4, "final decision: splitting");
             _quadtree->split(quad);
+            quad->split_frame() = _frame;
+            _info->quads_split[_depth_pass]++;
         } else if (!split && quad->has_children()) {
-            msg::dbg(4, "final decision: merging");
+            MSG_DBG(4, "final decision: merging");
             _quadtree->merge(quad);
+            _info->quads_merged[_depth_pass]++;
         }
         if (quad->has_children()) {
             if (_lod_quads.size() < lod_quads + 4)
                 _lod_quads.resize(lod_quads + 4);
-            _lod_quads[lod_quads++] = quad->child(0);
-            _lod_quads[lod_quads++] = quad->child(1);
-            _lod_quads[lod_quads++] = quad->child(2);
-            _lod_quads[lod_quads++] = quad->child(3);
+            // Test the children against the remaining frustum planes in one
+            // batch. This requires that they all have a bounding box already;
+            // new children get theirs when they are visited.
+            bool children_have_bounding_box = true;
+            for (int i = 0; i < 4; i++) {
+                lod_quad& clq = _lod_quads[lod_quads + i];
+                clq.quad = quad->child(i);
+                clq.parent_plane_mask = plane_mask;
+                clq.cull = 2;
+                if (clq.quad->min_elev() > clq.quad->max_elev())
+                    children_have_bounding_box = false;
+            }
+            if (plane_mask != 0 && children_have_bounding_box) {
+                vec3 cbb0[4][4], cbb1[4][4];
+                for (int i = 0; i < 4; i++) {
+                    for (int j = 0; j < 4; j++) {
+                        cbb0[i][j] = vec3(quad->child(i)->bounding_box_inner()[j] - _state->viewer_pos);
+                        cbb1[i][j] = vec3(quad->child(i)->bounding_box_outer()[j] - _state->viewer_pos);
+                    }
+                }
+                bool ccull[4];
+                unsigned int cplane_masks[4];
+                _culler.frustum_cull4(cbb0, cbb1, plane_mask, ccull, cplane_masks);
+                for (int i = 0; i < 4; i++) {
+                    _lod_quads[lod_quads + i].cull = (ccull[i] ? 1 : 0);
+                    _lod_quads[lod_quads + i].plane_mask = cplane_masks[i];
+                }
+            }
+            lod_quads += 4;
         }
     }
+    // Render front to back, so that early depth testing rejects hidden
+    // fragments before they are shaded. The quads that need occlusion
+    // queries stay last.
+    if (_state->renderer.front_to_back) {
+        if (_n_render_quads > 1)
+            sort_front_to_back(&(_render_quads[0]), _n_render_quads);
+        if (query_quads > 1)
+            sort_front_to_back(&(_query_quads[0]), query_quads);
+    }
+    // The quads that need occlusion queries come last
+    if (_render_quads.size() < _n_render_quads + query_quads)
+        _render_quads.resize(_n_render_quads + query_quads);
+    for (unsigned int i = 0; i < query_quads; i++)
+        _render_quads[_n_render_quads++] = _query_quads[i];
+    _n_query_quads = query_quads;
 #ifndef NDEBUG
     int64_t time_lod_stop = timer::get(timer::monotonic);
-    msg::dbg("Time: depth pass %d: LOD took %.6f seconds", _depth_pass, (time_lod_stop - time_lod_start) / 1e6f);
+    MSG_DBG("Time: depth pass %d: LOD took %.6f seconds", _depth_pass, (time_lod_stop - time_lod_start) / 1e6f);
 #endif
 }
 
+void lod_thread::schedule_lod_decision(ecm_side_quadtree* quad, double slack)
+{
+    quad->lod_viewer_pos() = _state->viewer_pos;
+    quad->lod_slack() = slack;
+    push_lod_event(quad, _lod_travel + slack);
+}
+
+void lod_thread::push_lod_event(ecm_side_quadtree* quad, double due)
+{
+    quad->lod_due() = due;
+    lod_event e;
+    e.due = due;
+    e.quad = quad->quad();
+    _lod_events.push_back(e);
+    std::push_heap(_lod_events.begin(), _lod_events.end());
+}
+
+void lod_thread::add_to_lod_cut(ecm_side_quadtree* quad)
+{
+    quad->lod_cut_index() = static_cast<int>(_lod_cut.size());
+    _lod_cut.push_back(quad);
+}
+
+void lod_thread::remove_from_lod_cut(ecm_side_quadtree* quad)
+{
+    if (quad->has_children()) {
+        for (int i = 0; i < 4; i++)
+            remove_from_lod_cut(quad->child(i));
+    } else if (quad->lod_cut_index() >= 0) {
+        int i = quad->lod_cut_index();
+        _lod_cut[i] = _lod_cut.back();
+        _lod_cut[i]->lod_cut_index() = i;
+        _lod_cut.pop_back();
+        quad->lod_cut_index() = -1;
+    }
+}
+
+void lod_thread::reset_lod_decisions(ecm_side_quadtree* quad)
+{
+    quad->lod_culled() = false;
+    schedule_lod_decision(quad, 0.0);
+    if (quad->has_children()) {
+        quad->lod_cut_index() = -1;
+        for (int i = 0; i < 4; i++)
+            reset_lod_decisions(quad->child(i));
+    } else {
+        add_to_lod_cut(quad);
+    }
+}
+
+void lod_thread::run_incremental(const class ecm& ecm, int quad_size, const dvec3& lens_pos,
+        int max_level, double pixels_per_tan, float split_area_base, bool horizon_conservative,
+        unsigned int* query_quads)
+{
+    /* The split decisions that the quads remember stay valid as long as the
+     * parameters that they depend on do not change. The split area changes
+     * in every frame with adaptive quality, so the decisions are made for all
+     * split areas in a band around a reference value. */
+    const float split_area_band = 1.25f;
+    std::vector<float> parameters;
+    std::vector<uuid> databases;
+    parameters.push_back(_elevation_min);
+    parameters.push_back(_elevation_max);
+    parameters.push_back(_state->lens.active ? 1.0f : 0.0f);
+    if (_state->lens.active) {
+        parameters.push_back(_state->lens.pos[0]);
+        parameters.push_back(_state->lens.pos[1]);
+        parameters.push_back(_state->lens.radius);
+    }
+    for (unsigned int i = 0; i < _n_elevation_dds; i++) {
+        databases.push_back(_elevation_dds[i]->uuid);
+        for (int j = 0; j < 2; j++) {
+            parameters.push_back(_elevation_dds[i]->processing_parameters[j].elevation.scale_factor);
+            parameters.push_back(_elevation_dds[i]->processing_parameters[j].elevation.scale_center);
+        }
+    }
+    for (unsigned int i = 0; i < _n_texture_dds; i++)
+        databases.push_back(_texture_dds[i]->uuid);
+    if (!_lod_incremental_valid
+            || pixels_per_tan < _lod_pixels_per_tan || pixels_per_tan > _lod_pixels_per_tan
+            || split_area_base < _lod_split_area / split_area_band || split_area_base > _lod_split_area * split_area_band
+            || _state->renderer.lod_hysteresis < _lod_hysteresis || _state->renderer.lod_hysteresis > _lod_hysteresis
+            || parameters != _lod_parameters || databases != _lod_databases) {
+        MSG_DBG("Incremental LOD: evaluating all quads");
+        _lod_pixels_per_tan = pixels_per_tan;
+        _lod_split_area = split_area_base;
+        _lod_hysteresis = _state->renderer.lod_hysteresis;
+        _lod_parameters.swap(parameters);
+        _lod_databases.swap(databases);
+        _lod_travel = 0.0;
+        _lod_viewer_pos = _state->viewer_pos;
+        _lod_cut.clear();
+        _lod_events.clear();
+        _n_lod_operations = 0;
+        for (int i = 0; i < 6; i++) {
+            // The top level is always split; see run()
+            ecm_side_quadtree* root = _quadtree->side_root(i);
+            if (!root->has_children()) {
+                _quadtree->split(root);
+                root->split_frame() = _frame;
+                _info->quads_split[_depth_pass]++;
+            }
+            reset_lod_decisions(root);
+        }
+        _lod_incremental_valid = true;
+    } else {
+        _lod_travel += distance(_state->viewer_pos, _lod_viewer_pos);
+        _lod_viewer_pos = _state->viewer_pos;
+    }
+    // The lowest split area above which unsplit quads split, and the highest
+    // split area below which split quads merge, over the whole band
+    const float split_area_min = _lod_split_area / split_area_band * (1.0f + _lod_hysteresis);
+    const float merge_area_max = _lod_split_area * split_area_band * (1.0f - _lod_hysteresis);
+
+    /* Apply the split and merge operations that the previous run selected.
+     * This cannot be done at the end of that run because its render quads
+     * are still in use then. New quads are evaluated in this run. */
+    for (unsigned int i = 0; i < _n_lod_operations; i++) {
+        const lod_operation& op = _lod_operations[i];
+        ecm_side_quadtree* quad = _quadtree->find(op.quad);
+        if (!quad) {
+            // an ancestor was merged in the meantime
+            continue;
+        }
+        if (op.split && !quad->has_children()) {
+            remove_from_lod_cut(quad);
+            _quadtree->split(quad);
+            quad->split_frame() = _frame;
+            for (int j = 0; j < 4; j++) {
+                add_to_lod_cut(quad->child(j));
+                schedule_lod_decision(quad->child(j), 0.0);
+            }
+            _info->quads_split[_depth_pass]++;
+        } else if (!op.split && quad->has_children()) {
+            remove_from_lod_cut(quad);
+            _quadtree->merge(quad);
+            add_to_lod_cut(quad);
+            _info->quads_merged[_depth_pass]++;
+        }
+    }
+    _n_lod_operations = 0;
+
+    /* Collect the quads whose split decision is due: the viewer has traveled
+     * far enough since the last decision for the screen area of the bounding
+     * sphere to cross the threshold. Events of quads that were evaluated
+     * again in the meantime or that were removed are outdated. */
+    unsigned int candidates = 0;
+    while (!_lod_events.empty() && _lod_events.front().due <= _lod_travel) {
+        lod_event e = _lod_events.front();
+        std::pop_heap(_lod_events.begin(), _lod_events.end());
+        _lod_events.pop_back();
+        ecm_side_quadtree* quad = _quadtree->find(e.quad);
+        if (!quad || quad->lod_due() < e.due || quad->lod_due() > e.due)
+            continue;
+        double moved = distance(_state->viewer_pos, quad->lod_viewer_pos());
+        if (moved < quad->lod_slack()) {
+            // The viewer did not move straight away; the decision still holds
+            push_lod_event(quad, _lod_travel + (quad->lod_slack() - moved));
+            continue;
+        }
+        quad->lod_due() = -1.0;
+        if (_lod_candidates.size() < candidates + 1)
+            _lod_candidates.resize(candidates + 1);
+        _lod_candidates[candidates++] = quad;
+    }
+
+    /* Decide about the candidates. Changes are queued for the next run; the
+     * remembered slack refers to the level that the quad will have then. */
+    for (unsigned int c = 0; c < candidates; c++) {
+        ecm_side_quadtree* quad = _lod_candidates[c];
+        MSG_DBG("LOD: evaluating quad %s", str::from(quad->quad()).c_str());
+        _info->lod_evaluations[_depth_pass]++;
+        bool minmax_elev_pending = false;
+        bool need_base_data = false;
+        if (quad->level() > 0)
+            update_quad_bounds(ecm, lens_pos, quad, &minmax_elev_pending, &need_base_data);
+        bool split;
+        float priority = 1.0f;
+        double slack = -1.0;    // < 0: the decision does not depend on the viewer position
+        quad->lod_culled() = false;
+        if (quad->level() == 0) {
+            MSG_DBG(4, "splitting: level 0");
+            split = true;
+        } else if (is_at_highest_level(quad)) {
+            MSG_DBG(4, "not splitting: max level");
+            split = false;
+        } else {
+            bool culled = false;
+            if (!quad->has_children()) {
+                vec3 bb0[4], bb1[4];
+                for (int i = 0; i < 4; i++) {
+                    bb0[i] = vec3(quad->bounding_box_inner()[i] - _state->viewer_pos);
+                    bb1[i] = vec3(quad->bounding_box_outer()[i] - _state->viewer_pos);
+                }
+                unsigned int plane_mask = culler::all_planes;
+                culled = _culler.frustum_cull(bb0, bb1, &plane_mask)
+                    || ((quad->minmax_elev_valid() || !horizon_conservative)
+                            && _culler.horizon_cull(quad->bounding_box_inner(), quad->bounding_box_outer()));
+            }
+            if (culled) {
+                /* Do not split a quad outside the view; it is evaluated again
+                 * when it comes into view. Split quads that are out of view
+                 * are merged by the visibility pass below. */
+                MSG_DBG(4, "not splitting: quad is culled");
+                split = false;
+                quad->lod_culled() = true;
+            } else if (minmax_elev_pending && _state->renderer.lod_hold_pending) {
+                split = quad->has_children();
+                MSG_DBG(4, "%ssplitting: waiting for data", split ? "" : "not ");
+                _info->quads_held[_depth_pass]++;
+                slack = 0.0;
+            } else {
+                /* The bounding sphere metric with hysteresis, as in run() */
+                float hysteresis = (quad->has_children() ? -1.0f : +1.0f) * _lod_hysteresis;
+                float split_area = split_area_base * (1.0f + hysteresis);
+                float area = bounding_sphere_screen_area(quad->bounding_sphere_center(),
+                        quad->bounding_sphere_radius(), _state->viewer_pos, pixels_per_tan);
+                split = (area > split_area);
+                MSG_DBG(4, "bounding sphere metric: screen area = %g * quad area", area / (quad_size * quad_size));
+                bool vetoed = false;
+                if (split && !quad->minmax_elev_valid() && quad->quad()[1] > max_level / 2) {
+                    const dvec3* bbi = quad->bounding_box_inner();
+                    const dvec3* bbo = quad->bounding_box_outer();
+                    double max_bb_height = max(distance(bbi[0], bbo[0]), distance(bbi[1], bbo[1]), distance(bbi[2], bbo[2]), distance(bbi[3], bbo[3]));
+                    double max_bb_side = max(distance(bbo[0], bbo[1]), distance(bbo[1], bbo[2]), distance(bbo[2], bbo[3]), distance(bbo[3], bbo[0]));
+                    if (max_bb_height > 0.5 * max_bb_side) {
+                        MSG_DBG(4, "bounding sphere metric: quad is very high and we have no reliable info yet");
+                        split = false;
+                        vetoed = true;
+                    }
+                }
+                MSG_DBG(4, "%ssplitting: screen area", split ? "" : "not ");
+                priority = (split ? area / split_area : split_area / max(area, 1.0f));
+                /* The screen area of the bounding sphere equals a at distance
+                 * sqrt(r^2 + 2 p^2 r^2 / a) from its center (see
+                 * bounding_sphere_screen_area()). Until the viewer has moved
+                 * by the difference to this distance, the decision holds for
+                 * all split areas in the band. */
+                double r2 = quad->bounding_sphere_radius() * quad->bounding_sphere_radius();
+                double dist = distance(quad->bounding_sphere_center(), _state->viewer_pos);
+                if (minmax_elev_pending) {
+                    // The bounds will change when the data arrives
+                    slack = 0.0;
+                } else if (split) {
+                    double merge_dist = std::sqrt(r2 + 2.0 * pixels_per_tan * pixels_per_tan * r2 / merge_area_max);
+                    slack = max(merge_dist - dist, 0.0);
+                } else if (!vetoed) {
+                    double split_dist = std::sqrt(r2 + 2.0 * pixels_per_tan * pixels_per_tan * r2 / split_area_min);
+                    slack = max(dist - split_dist, 0.0);
+                }
+            }
+        }
+        if (!split && quad->has_children()
+                && _frame - quad->split_frame() < static_cast<unsigned int>(_state->renderer.lod_min_residence)) {
+            MSG_DBG(4, "splitting: minimum residence time");
+            split = true;
+            _info->quads_held[_depth_pass]++;
+            slack = 0.0;
+        }
+        if (split != quad->has_children()) {
+            if (_lod_operations.size() < _n_lod_operations + 1)
+                _lod_operations.resize(_n_lod_operations + 1);
+            lod_operation& op = _lod_operations[_n_lod_operations++];
+            op.quad = quad->quad();
+            op.split = split;
+            op.priority = priority;
+            MSG_DBG(4, "queueing %s with priority %g", split ? "split" : "merge", priority);
+            _info->lod_operations_queued[_depth_pass]++;
+        }
+        if (slack >= 0.0)
+            schedule_lod_decision(quad, slack);
+    }
+
+    /* Every evaluation leaves an outdated event behind if the quad was still
+     * scheduled. Remove them when they outnumber the quads. */
+    if (_lod_events.size() > 4 * _lod_cut.size() + 1024) {
+        size_t n = 0;
+        for (size_t i = 0; i < _lod_events.size(); i++) {
+            const ecm_side_quadtree* quad = _quadtree->find(_lod_events[i].quad);
+            if (quad && quad->lod_due() >= _lod_events[i].due && quad->lod_due() <= _lod_events[i].due)
+                _lod_events[n++] = _lod_events[i];
+        }
+        _lod_events.resize(n);
+        std::make_heap(_lod_events.begin(), _lod_events.end());
+    }
+
+    /* Determine the visible quads of the cut. Visibility depends on the view
+     * direction, so this is done in every run, but hierarchically as in run():
+     * the split quads above the cut are culled first, and the children are
+     * only tested against the frustum planes that their parent intersects.
+     * Culled split quads are merged, so that the quadtree does not keep the
+     * detail of regions that are out of view. */
+    unsigned int lod_quads = 0;
+    if (_lod_quads.size() < 6)
+        _lod_quads.resize(6);
+    for (int i = 0; i < 6; i++) {
+        _lod_quads[lod_quads].quad = _quadtree->side_root(i);
+        _lod_quads[lod_quads].parent_plane_mask = culler::all_planes;
+        _lod_quads[lod_quads].cull = 2;
+        lod_quads++;
+    }
+    while (lod_quads > 0) {
+        lod_quad lq = _lod_quads[--lod_quads];
+        ecm_side_quadtree* quad = lq.quad;
+        int cull = 0;
+        bool behind_horizon = false;
+        unsigned int plane_mask = lq.parent_plane_mask;
+        // The top level is always split and has no bounding box; see run()
+        if (quad->level() > 0) {
+            cull = 2;
+            if (lq.cull != 2) {
+                cull = lq.cull;
+                plane_mask = lq.plane_mask;
+            } else if (plane_mask == 0) {
+                cull = 0;
+            }
+            if (cull == 2) {
+                vec3 bb0[4], bb1[4];
+                for (int j = 0; j < 4; j++) {
+                    bb0[j] = vec3(quad->bounding_box_inner()[j] - _state->viewer_pos);
+                    bb1[j] = vec3(quad->bounding_box_outer()[j] - _state->viewer_pos);
+                }
+                cull = _culler.frustum_cull(bb0, bb1, &plane_mask) ? 1 : 0;
+            }
+            if (cull == 0 && (quad->minmax_elev_valid() || !horizon_conservative)
+                    && _culler.horizon_cull(quad->bounding_box_inner(), quad->bounding_box_outer())) {
+                cull = 1;
+                behind_horizon = true;
+            }
+        }
+        if (quad->has_children()) {
+            if (cull == 1) {
+                if (behind_horizon)
+                    _info->quads_horizon_culled[_depth_pass]++;
+                else
+                    _info->quads_culled[_depth_pass]++;
+                if (_frame - quad->split_frame() >= static_cast<unsigned int>(_state->renderer.lod_min_residence)) {
+                    // The merged quad is evaluated again when it comes into view
+                    quad->lod_culled() = true;
+                    if (_lod_operations.size() < _n_lod_operations + 1)
+                        _lod_operations.resize(_n_lod_operations + 1);
+                    lod_operation& op = _lod_operations[_n_lod_operations++];
+                    op.quad = quad->quad();
+                    op.split = false;
+                    op.priority = 0.0f;
+                    MSG_DBG(4, "LOD: queueing merge of culled quad %s", str::from(quad->quad()).c_str());
+                    _info->lod_operations_queued[_depth_pass]++;
+                }
+                continue;
+            }
+            quad->lod_culled() = false;
+            if (_lod_quads.size() < lod_quads + 4)
+                _lod_quads.resize(lod_quads + 4);
+            bool children_have_bounding_box = true;
+            for (int j = 0; j < 4; j++) {
+                lod_quad& clq = _lod_quads[lod_quads + j];
+                clq.quad = quad->child(j);
+                clq.parent_plane_mask = plane_mask;
+                clq.cull = 2;
+                if (clq.quad->min_elev() > clq.quad->max_elev())
+                    children_have_bounding_box = false;
+            }
+            if (plane_mask != 0 && children_have_bounding_box) {
+                vec3 cbb0[4][4], cbb1[4][4];
+                for (int j = 0; j < 4; j++) {
+                    for (int k = 0; k < 4; k++) {
+                        cbb0[j][k] = vec3(quad->child(j)->bounding_box_inner()[k] - _state->viewer_pos);
+                        cbb1[j][k] = vec3(quad->child(j)->bounding_box_outer()[k] - _state->viewer_pos);
+                    }
+                }
+                bool ccull[4];
+                unsigned int cplane_masks[4];
+                _culler.frustum_cull4(cbb0, cbb1, plane_mask, ccull, cplane_masks);
+                for (int j = 0; j < 4; j++) {
+                    _lod_quads[lod_quads + j].cull = (ccull[j] ? 1 : 0);
+                    _lod_quads[lod_quads + j].plane_mask = cplane_masks[j];
+                }
+            }
+            lod_quads += 4;
+            continue;
+        }
+        quad->lod_metric_disagreement() = false;
+        if (cull == 0) {
+            bool due_now = (quad->lod_due() >= 0.0 && quad->lod_due() <= _lod_travel);
+            if (quad->lod_culled() && !due_now) {
+                // The quad came into view; decide about splitting it in the next run
+                quad->lod_culled() = false;
+                schedule_lod_decision(quad, 0.0);
+            } else if (!quad->max_dist_to_quad_plane_is_valid()) {
+                // Get the exact bounding box once the base data is available
+                start_quad_base_data(ecm, quad_size, quad);
+                if (!due_now)
+                    schedule_lod_decision(quad, 0.0);
+            }
+        }
+        bool occluded = false;
+        bool needs_query = false;
+        if (cull == 0 && _occlusion_culler.is_valid()) {
+            int o = _occlusion_culler.test(quad->bounding_box_inner(), quad->bounding_box_outer(), _state->viewer_pos);
+            if (o == occlusion_culler::occluded
+                    || (o == occlusion_culler::borderline && _occlusion_feedback.is_occluded(quad->quad()))) {
+                cull = 1;
+                occluded = true;
+            } else if (o == occlusion_culler::borderline) {
+                needs_query = true;
+            }
+        }
+        if (behind_horizon) {
+            _info->quads_horizon_culled[_depth_pass]++;
+        } else if (occluded) {
+            _info->quads_occlusion_culled[_depth_pass]++;
+        } else if (cull == 1) {
+            _info->quads_culled[_depth_pass]++;
+        } else if (needs_query) {
+            if (_query_quads.size() < *query_quads + 1)
+                _query_quads.resize(*query_quads + 1);
+            _query_quads[(*query_quads)++] = quad;
+        } else {
+            if (_render_quads.size() < _n_render_quads + 1)
+                _render_quads.resize(_n_render_quads + 1);
+            _render_quads[_n_render_quads++] = quad;
+        }
+    }
+
+    /* Keep only the most urgent split and merge operations for the next run.
+     * The quads of the others are evaluated again then; merges of culled
+     * quads are queued again by the next run anyway. */
+    unsigned int max_lod_operations = _state->renderer.lod_max_operations;
+    if (_n_lod_operations > max_lod_operations) {
+        std::partial_sort(_lod_operations.begin(), _lod_operations.begin() + max_lod_operations,
+                _lod_operations.begin() + _n_lod_operations);
+        for (unsigned int i = max_lod_operations; i < _n_lod_operations; i++) {
+            ecm_side_quadtree* quad = _quadtree->find(_lod_operations[i].quad);
+            assert(quad);
+            if (_lod_operations[i].split || !quad->lod_culled())
+                schedule_lod_decision(quad, 0.0);
+        }
+        _n_lod_operations = max_lod_operations;
+    }
+}
+
 
 depth_pass_renderer::depth_pass_renderer() : _initialized_gl(false)
 {
@@ -597,6 +1401,8 @@ void depth_pass_renderer::init_gl()
         _approx_minmax_pyramid_quad_size = -1;
         _cart_coord_prg = 0;
         _render_prg = 0;
+        _depth_prg = 0;
+        _hiz_prg = 0;
 	_initialized_gl = true;
     }
 }
@@ -611,6 +1417,7 @@ void depth_pass_renderer::exit_gl()
         glDeleteTextures(1, &_invalid_data_tex);
         glDeleteTextures(1, &_invalid_mask_tex);
         glDeleteTextures(1, &_valid_mask_tex);
+        _gpu_tracer.exit_gl();
         xgl::DeleteProgram(_approx_prg);
         xgl::DeleteProgram(_approx_minmax_prep_prg);
         xgl::DeleteProgram(_approx_minmax_prg);
@@ -620,6 +1427,26 @@ void depth_pass_renderer::exit_gl()
         }
         xgl::DeleteProgram(_cart_coord_prg);
         xgl::DeleteProgram(_render_prg);
+        xgl::DeleteProgram(_depth_prg);
+        if (_fragment_queries.size() > 0) {
+            glDeleteQueries(_fragment_queries.size(), &(_fragment_queries[0]));
+            _fragment_queries.clear();
+            _fragment_queries_issued.clear();
+            _fragment_queries_split.clear();
+        }
+        xgl::DeleteProgram(_hiz_prg);
+        for (size_t i = 0; i < _occlusion.size(); i++) {
+            occlusion_readback& o = _occlusion[i];
+            if (o.depth_tex != 0) {
+                glDeleteTextures(1, &o.depth_tex);
+                glDeleteTextures(2, o.hiz_texs);
+            }
+            if (o.pbo != 0)
+                glDeleteBuffers(1, &o.pbo);
+            if (o.queries.size() > 0)
+                glDeleteQueries(o.queries.size(), &(o.queries[0]));
+        }
+        _occlusion.clear();
         _initialized_gl = false;
     }
 }
@@ -628,6 +1455,7 @@ static quad_gpu* mem_quad_to_gpu(
         renderer_context& context,
         const GLuint pbo[2], const database_description& dd, const quad_mem* qmem, size_t* approx_size_on_gpu)
 {
+    TRC_SCOPE("upload");
     assert(qmem->data.ptr());
 
     class quad_tex_pool& quad_tex_pool = *(context.quad_tex_pool());
@@ -679,7 +1507,7 @@ static quad_gpu* mem_quad_to_gpu(
     }
     *approx_size_on_gpu += tqs * tqs * dd.db.element_size();    // assuming the GPU and CPU representations have the same size
 
-    return new quad_gpu(&quad_tex_pool, data_tex, mask_tex, qmem->meta);
+    return new quad_gpu(&quad_tex_pool, data_tex, mask_tex, qmem->meta, qmem->elevation_grid);
 }
 
 quad_gpu* depth_pass_renderer::create_approximation(
@@ -687,6 +1515,8 @@ quad_gpu* depth_pass_renderer::create_approximation(
         const database_description& dd, const glvm::ivec4& quad, int approx_level,
         const quad_gpu* qgpu, size_t* approx_size_on_gpu)
 {
+    TRC_SCOPE("approximation");
+    TRC_GPU_SCOPE(_gpu_tracer, "approximation");
     assert(qgpu->data_tex != 0);
 
     class quad_tex_pool& quad_tex_pool = *(context.quad_tex_pool());
@@ -924,10 +1754,10 @@ void depth_pass_renderer::get_quad_with_caching(
     const quad_mem *qmem;
     const quad_disk *qdisk;
 
-    msg::dbg("get_quad_with_caching: %s from %s:", str::from(quad).c_str(), dd.url.c_str());
+    MSG_DBG("get_quad_with_caching: %s from %s:", str::from(quad).c_str(), dd.url.c_str());
     if (quad[1] < dd.db.levels()) {
         if (!dd.db.has_quad(quad[0], quad[1], quad[2], quad[3])) {
-            msg::dbg(4, "database does not have this quad");
+            MSG_DBG(4, "database does not have this quad");
             *data_tex = 0;
             *mask_tex = 0;
             *meta = ecmdb::metadata();
@@ -936,14 +1766,14 @@ void depth_pass_renderer::get_quad_with_caching(
         }
         quad_key key(dd.uuid, quad, quad[1]);
         if ((qgpu = gpu_cache.locked_get(key))) {              // In GPU cache?
-            msg::dbg(4, "gpu: exact hit");
+            MSG_DBG(4, "gpu: exact hit");
             *data_tex = qgpu->data_tex;
             *mask_tex = qgpu->mask_tex;
             *meta = qgpu->meta;
             *level_difference = 0;
             return;
         } else if ((qmem = mem_cache.locked_get(key))) {       // In Memory cache?
-            msg::dbg(4, "mem: exact hit");
+            MSG_DBG(4, "mem: exact hit");
             size_t s;
             if (qmem->data.ptr()) {
                 qgpu = mem_quad_to_gpu(context, _pbo, dd, qmem, &s);
@@ -962,21 +1792,21 @@ void depth_pass_renderer::get_quad_with_caching(
             case quad_disk::checking:
             case quad_disk::caching:
                 // Do nothing now; just wait until this operation is finished
-                msg::dbg(4, "disk: op ongoing");
+                MSG_DBG(4, "disk: op ongoing");
                 break;
             case quad_disk::uncached:
                 // Start caching this quad. Ignore if the fetcher start fails; we will retry later.
-                msg::dbg(4, "disk: start fetching");
+                MSG_DBG(4, "disk: start fetching");
                 (void)disk_cache_fetchers.locked_start_fetch(key, dd.db, dd.url, dd.username, dd.password);
                 break;
             case quad_disk::cached:
                 // Start transferring this quad to memory. Ignore if the loader start fails; we will retry later.
-                msg::dbg(4, "mem: start loading");
+                MSG_DBG(4, "mem: start loading");
                 (void)mem_cache_loaders.locked_start_load(key, dd.db, disk_cache.quad_filename(dd.url, quad));
                 break;
             case quad_disk::cached_empty:
                 // We can handle this case immediately.
-                msg::dbg(4, "disk: exact hit (empty)");
+                MSG_DBG(4, "disk: exact hit (empty)");
                 qgpu = new quad_gpu(&tex_pool, 0, 0, ecmdb::metadata());
                 gpu_cache.locked_put(key, qgpu, 0);
                 *data_tex = qgpu->data_tex;
@@ -988,7 +1818,7 @@ void depth_pass_renderer::get_quad_with_caching(
         } else {
             // We do not have a disk status yet; start getting one now.
             // Ignore if the checker start fails; we will retry later.
-            msg::dbg(4, "disk: start checking");
+            MSG_DBG(4, "disk: start checking");
             (void)disk_cache_checkers.locked_start_check(key, disk_cache.quad_filename(dd.url, quad));
         }
     }
@@ -998,7 +1828,7 @@ void depth_pass_renderer::get_quad_with_caching(
     while (approx_quad[1] >= 0) {
         if (approx_quad[1] < dd.db.levels()) {
             if (!dd.db.has_quad(approx_quad[0], approx_quad[1], approx_quad[2], approx_quad[3])) {
-                msg::dbg(4, "database cannot approximate this quad");
+                MSG_DBG(4, "database cannot approximate this quad");
                 *data_tex = 0;
                 *mask_tex = 0;
                 *meta = ecmdb::metadata();
@@ -1007,7 +1837,7 @@ void depth_pass_renderer::get_quad_with_caching(
             }
             quad_key approx_key(dd.uuid, quad, approx_quad[1]);
             if ((qgpu = gpu_cache.locked_get(approx_key))) {           // Approximation in GPU cache?
-                msg::dbg(4, "gpu: approx hit at leveldiff %d", quad[1] - approx_quad[1]);
+                MSG_DBG(4, "gpu: approx hit at leveldiff %d", quad[1] - approx_quad[1]);
                 *data_tex = qgpu->data_tex;
                 *mask_tex = qgpu->mask_tex;
                 *meta = qgpu->meta;
@@ -1016,7 +1846,7 @@ void depth_pass_renderer::get_quad_with_caching(
             }
             quad_key key(dd.uuid, approx_quad, approx_quad[1]);
             if ((qgpu = gpu_cache.locked_get(key))) {                  // Original in GPU cache?
-                msg::dbg(4, "gpu: create approx at leveldiff %d", quad[1] - approx_quad[1]);
+                MSG_DBG(4, "gpu: create approx at leveldiff %d", quad[1] - approx_quad[1]);
                 size_t s;
                 if (qgpu->data_tex == 0) {
                     s = 0;
@@ -1032,7 +1862,7 @@ void depth_pass_renderer::get_quad_with_caching(
                 return;
             }
             if ((qmem = mem_cache.locked_get(key))) {                  // Original in Memory cache?
-                msg::dbg(4, "mem: create approx at leveldiff %d", quad[1] - approx_quad[1]);
+                MSG_DBG(4, "mem: create approx at leveldiff %d", quad[1] - approx_quad[1]);
                 size_t s;
                 if (qmem->data.ptr()) {
                     qgpu = mem_quad_to_gpu(context, _pbo, dd, qmem, &s);
@@ -1059,21 +1889,21 @@ void depth_pass_renderer::get_quad_with_caching(
                     case quad_disk::checking:
                     case quad_disk::caching:
                         // Do nothing now; just wait until this operation is finished
-                        msg::dbg(4, "disk: approx op ongoing");
+                        MSG_DBG(4, "disk: approx op ongoing");
                         break;
                     case quad_disk::uncached:
                         // Start caching this quad. Ignore if the fetcher start fails; we will retry later.
-                        msg::dbg(4, "disk: approx start fetching");
+                        MSG_DBG(4, "disk: approx start fetching");
                         (void)disk_cache_fetchers.locked_start_fetch(key, dd.db, dd.url, dd.username, dd.password);
                         break;
                     case quad_disk::cached:
                         // Start transferring this quad to memory. Ignore if the loader start fails; we will retry later.
-                        msg::dbg(4, "mem: approx start loading");
+                        MSG_DBG(4, "mem: approx start loading");
                         (void)mem_cache_loaders.locked_start_load(key, dd.db, disk_cache.quad_filename(dd.url, approx_quad));
                         break;
                     case quad_disk::cached_empty:
                         // We can handle this case immediately.
-                        msg::dbg(4, "disk: approx hit (empty)");
+                        MSG_DBG(4, "disk: approx hit (empty)");
                         qgpu = new quad_gpu(&tex_pool, 0, 0, ecmdb::metadata());
                         gpu_cache.locked_put(key, qgpu, 0);
                         *data_tex = qgpu->data_tex;
@@ -1085,7 +1915,7 @@ void depth_pass_renderer::get_quad_with_caching(
                 } else {
                     // We do not have a disk status yet; start getting one now.
                     // Ignore if the checker start fails; we will retry later.
-                    msg::dbg(4, "disk: approx start checking");
+                    MSG_DBG(4, "disk: approx start checking");
                     (void)disk_cache_checkers.locked_start_check(key, disk_cache.quad_filename(dd.url, quad));
                 }
             }
@@ -1097,32 +1927,32 @@ void depth_pass_renderer::get_quad_with_caching(
 
     /* Last resort: Load the root quad from disk. This will block. */
 
-    msg::dbg(4, "approx from root quad - ugh!");
+    MSG_DBG(4, "approx from root quad - ugh!");
     approx_quad = ivec4(quad[0], 0, 0, 0);
     quad_key key(dd.uuid, approx_quad, approx_quad[1]);
     // Check root quad
     std::string quad_filename = disk_cache.quad_filename(dd.url, approx_quad);
     quad_disk_cache_checker disk_cache_checker(key, quad_filename);
-    msg::dbg(4, "disk: checking root quad");
+    MSG_DBG(4, "disk: checking root quad");
     disk_cache_checker.start();
     disk_cache_checker.finish();
     if (disk_cache_checker.result == quad_disk::uncached) {
-        msg::dbg(4, "disk: fetching root quad");
+        MSG_DBG(4, "disk: fetching root quad");
         quad_disk_cache_fetcher disk_cache_fetcher(&disk_cache, key, dd.db, dd.url, dd.username, dd.password);
         disk_cache_fetcher.start();
         disk_cache_fetcher.finish();
-        msg::dbg(4, "disk: checking root quad");
+        MSG_DBG(4, "disk: checking root quad");
         disk_cache_checker.start();
         disk_cache_checker.finish();
     }
     assert(disk_cache_checker.result == quad_disk::cached
             || disk_cache_checker.result == quad_disk::cached_empty);
-    msg::dbg(4, "disk: caching check result");
+    MSG_DBG(4, "disk: caching check result");
     disk_cache.locked_put(key, new quad_disk(disk_cache_checker.result));
     // Transfer root quad to mem
     size_t s;
     if (disk_cache_checker.result == quad_disk::cached) {
-        msg::dbg(4, "mem: loading root quad");
+        MSG_DBG(4, "mem: loading root quad");
         quad_mem_cache_loader mem_cache_loader(key, dd.db, disk_cache.quad_filename(dd.url, approx_quad));
         mem_cache_loader.start();
         mem_cache_loader.finish();
@@ -1132,7 +1962,7 @@ void depth_pass_renderer::get_quad_with_caching(
         qmem = new quad_mem();
         s = 0;
     }
-    msg::dbg(4, "mem: caching root quad");
+    MSG_DBG(4, "mem: caching root quad");
     mem_cache.locked_put(key, qmem, s);
     // Transfer root quad to GPU
     if (qmem->data.ptr()) {
@@ -1141,7 +1971,7 @@ void depth_pass_renderer::get_quad_with_caching(
         s = 0;
         qgpu = new quad_gpu(&tex_pool, 0, 0, ecmdb::metadata());
     }
-    msg::dbg(4, "gpu: caching root quad");
+    MSG_DBG(4, "gpu: caching root quad");
     gpu_cache.locked_put(key, qgpu, s);
     // Compute approximation
     if (qgpu->data_tex == 0) {
@@ -1150,7 +1980,7 @@ void depth_pass_renderer::get_quad_with_caching(
     } else {
         qgpu = create_approximation(context, dd, quad, approx_quad[1], qgpu, &s);
     }
-    msg::dbg(4, "gpu: caching approximation");
+    MSG_DBG(4, "gpu: caching approximation");
     gpu_cache.locked_put(quad_key(dd.uuid, quad, 0), qgpu, s);
     *data_tex = qgpu->data_tex;
     *mask_tex = qgpu->mask_tex;
@@ -1158,6 +1988,124 @@ void depth_pass_renderer::get_quad_with_caching(
     *level_difference = quad[1] - 0;
 }
 
+/* Get the CPU processing result for a quad and upload it into the destination
+ * textures. This works only for exact quads, not for approximations. If the
+ * result is not in the memory cache yet, start a loader that processes the
+ * quad, and return false so that the caller processes it on the GPU this time. */
+bool depth_pass_renderer::get_cpu_processed_quad(
+        renderer_context& context,
+        class processor& processor,
+        const database_description& dd, bool lens,
+        const glvm::ivec4& quad,
+        int total_dst_quad_size,
+        GLuint dst_data_tex, GLuint dst_mask_tex,
+        bool* full_validity, ecmdb::metadata* meta)
+{
+    if (!processor.use_cpu(dd, lens) || quad[1] >= dd.db.levels())
+        return false;
+
+    quad_disk_cache& disk_cache = *(context.quad_disk_cache());
+    quad_mem_cache& mem_cache = *(context.quad_mem_cache());
+    quad_mem_cache_loaders& mem_cache_loaders = *(context.quad_mem_cache_loaders());
+
+    quad_key key(dd.uuid, quad, quad[1], processor.cpu_processing_generation(dd, lens));
+    const quad_mem* qmem = mem_cache.locked_get(key);
+    if (!qmem) {
+        const quad_disk* qdisk = disk_cache.locked_get(quad_key(dd.uuid, quad, quad[1]));
+        if (qdisk && qdisk->status == quad_disk::cached) {
+            // Ignore if the loader start fails; we will retry later.
+            MSG_DBG(4, "mem: start loading with cpu processing");
+            (void)mem_cache_loaders.locked_start_load(key, dd.db, disk_cache.quad_filename(dd.url, quad),
+                    processor.cpu_quad_processing(dd, lens));
+        }
+        return false;
+    } else if (!qmem->data.ptr()) {
+        return false;
+    }
+
+    TRC_SCOPE("upload cpu processed quad");
+    MSG_DBG(4, "mem: cpu processed hit");
+    int tqs = total_dst_quad_size;
+    if (dd.db.category() == ecmdb::category_elevation) {
+        assert(qmem->data.size() == static_cast<size_t>(tqs) * tqs * sizeof(float));
+        xgl::WriteTex2D(dst_data_tex, 0, 0, tqs, tqs, GL_RED, GL_FLOAT, tqs * sizeof(float), qmem->data.ptr(), _pbo[1]);
+    } else {
+        assert(qmem->data.size() == static_cast<size_t>(tqs) * tqs * 3);
+        xgl::WriteTex2D(dst_data_tex, 0, 0, tqs, tqs, GL_RGB, GL_UNSIGNED_BYTE, tqs * 3, qmem->data.ptr(), _pbo[1]);
+    }
+    if (qmem->mask.ptr()) {
+        xgl::WriteTex2D(dst_mask_tex, 0, 0, tqs, tqs, GL_RED, GL_UNSIGNED_BYTE, tqs, qmem->mask.ptr(), _pbo[0]);
+        *full_validity = false;
+    } else {
+        *full_validity = true;
+    }
+    *meta = qmem->meta;
+    return true;
+}
+
+/* Refine the lens status of a quad that was found to intersect the lens by the
+ * LOD thread. If the quad still intersects the lens, compute a rectangle in
+ * quad coordinates (x0, y0, x1, y1 in [0,1]; y pointing up) that contains all
+ * quad points that may lie inside the lens.
+ * The combine_lens shader computes the surface point of a quad point as the
+ * bilinear patch of the quad corners plus the base data offset. The surface
+ * lies within max_dist_to_quad_plane of the quad plane, and the patch lies
+ * within its own deviation from that plane, so the sum of both bounds the
+ * length of the offset. The patch is sampled on a grid; between samples, it
+ * stays within the span of a grid cell. If no bound is known yet (the base
+ * data is not available), the full rectangle is returned with status 2. */
+static int get_lens_rect(const ecm_side_quadtree* quad, const vec3 quad_corner_rel_pos[4],
+        const vec3& lens_rel_pos, float lens_radius, vec4* rect)
+{
+    *rect = vec4(0.0f, 0.0f, 1.0f, 1.0f);
+    if (!quad->max_dist_to_quad_plane_is_valid())
+        return 2;
+    const int n = 16;
+    const vec3& bl = quad_corner_rel_pos[ecm::corner_bl];
+    const vec3& br = quad_corner_rel_pos[ecm::corner_br];
+    const vec3& tl = quad_corner_rel_pos[ecm::corner_tl];
+    const vec3& tr = quad_corner_rel_pos[ecm::corner_tr];
+    // The distance of the patch to the quad plane is bilinear in the quad
+    // coordinates, so its maximum is reached at one of the corners.
+    double patch_dev = 0.0;
+    for (int i = 0; i < 4; i++)
+        patch_dev = max(patch_dev, abs(dot(quad->plane_normal(), quad->corner(i)) - quad->plane_distance()));
+    float surface_margin = quad->max_dist_to_quad_plane() + patch_dev;
+    // The patch derivatives are bounded by the longest edges in x and y
+    // direction, which bounds the distance between two points of a grid cell.
+    float cell_span = (max(length(br - bl), length(tr - tl)) + max(length(tl - bl), length(tr - br))) / n;
+    vec2 inside_min(1.0f), inside_max(0.0f);
+    bool all_inside = true;
+    for (int j = 0; j <= n; j++) {
+        float qy = static_cast<float>(j) / n;
+        for (int i = 0; i <= n; i++) {
+            float qx = static_cast<float>(i) / n;
+            vec3 p = bl * (1.0f - qx) * (1.0f - qy)
+                + br * qx * (1.0f - qy)
+                + tr * qx * qy
+                + tl * (1.0f - qx) * qy;
+            float dist = length(p - lens_rel_pos);
+            // If a cell point may lie inside the lens, all corners of its
+            // cell pass this test, so the rectangle contains the whole cell.
+            if (dist <= lens_radius + surface_margin + cell_span) {
+                inside_min = min(inside_min, vec2(qx, qy));
+                inside_max = max(inside_max, vec2(qx, qy));
+            }
+            // The patch cells lie within the convex hull of their corners,
+            // so no cell span is needed here.
+            if (dist > lens_radius - surface_margin) {
+                all_inside = false;
+            }
+        }
+    }
+    if (all_inside)
+        return 1;
+    if (inside_min.x > inside_max.x)
+        return 0;
+    *rect = vec4(inside_min.x, inside_min.y, inside_max.x, inside_max.y);
+    return 2;
+}
+
 void depth_pass_renderer::process_and_combine(
         renderer_context& context,
         unsigned int frame,
@@ -1178,13 +2126,18 @@ void depth_pass_renderer::process_and_combine(
         std::vector<bool>& return_data_texs_to_pool,
         std::vector<bool>& return_mask_texs_to_pool,
         std::vector<ecmdb::metadata>& metas,
-        int* approximated_quads)
+        int* approximated_quads,
+        int* lens_texels,
+        std::vector<deferred_processing_job>* deferred_jobs)
 {
+    TRC_SCOPE("process and combine");
+    TRC_GPU_SCOPE(_gpu_tracer, "process and combine");
     int relevant_quads = 0;
     int relevant_dds[processor::max_combinable_quads];
     GLuint relevant_data_texs[processor::max_combinable_quads];
     GLuint relevant_mask_texs[processor::max_combinable_quads];
     ecmdb::metadata relevant_metas[processor::max_combinable_quads];
+    int relevant_level_differences[processor::max_combinable_quads];
 
     class quad_tex_pool& quad_tex_pool = *(context.quad_tex_pool());
 
@@ -1195,6 +2148,25 @@ void depth_pass_renderer::process_and_combine(
 
     assert(xgl::CheckError(HERE));
 
+    /* For quads that intersect the lens, restrict processing with lens
+     * parameters to the region that may lie inside the lens. Quads that
+     * turn out to be completely inside or outside are processed only once. */
+    ivec4 lens_scissor(0, 0, 0, 0);
+    if (quad_lens_status == 2 && ndds > 0) {
+        vec4 rect;
+        quad_lens_status = get_lens_rect(quad, quad_corner_rel_pos, lens_rel_pos, lens_radius, &rect);
+        if (quad_lens_status == 2) {
+            // Texel x (or y) covers quad coordinate (x + 0.5 - overlap) / quad_size (or 1 minus that).
+            int overlap = (dds[0]->db.category() == ecmdb::category_elevation ? 2 : 1);
+            int total_quad_size = quad_size + 2 * overlap;
+            int x0 = max(0, static_cast<int>(std::floor(overlap + rect[0] * quad_size - 0.5f)) - 1);
+            int x1 = min(total_quad_size - 1, static_cast<int>(std::ceil(overlap + rect[2] * quad_size - 0.5f)) + 1);
+            int y0 = max(0, static_cast<int>(std::floor(overlap + (1.0f - rect[3]) * quad_size - 0.5f)) - 1);
+            int y1 = min(total_quad_size - 1, static_cast<int>(std::ceil(overlap + (1.0f - rect[1]) * quad_size - 0.5f)) + 1);
+            lens_scissor = ivec4(x0, y0, x1 - x0 + 1, y1 - y0 + 1);
+        }
+    }
+
     bool lens = (quad_lens_status == 0 ? false : true);
     int lens_index = (lens ? 1 : 0);
 
@@ -1236,12 +2208,14 @@ void depth_pass_renderer::process_and_combine(
                         relevant_data_texs[j] = relevant_data_texs[j - 1];
                         relevant_mask_texs[j] = relevant_mask_texs[j - 1];
                         relevant_metas[j] = relevant_metas[j - 1];
+                        relevant_level_differences[j] = relevant_level_differences[j - 1];
                     }
                 }
                 relevant_dds[slot] = i;
                 relevant_data_texs[slot] = data_tex;
                 relevant_mask_texs[slot] = mask_tex;
                 relevant_metas[slot] = meta;
+                relevant_level_differences[slot] = level_difference;
                 relevant_quads++;
                 if (level_difference > 0) {
                     quad_is_approximated = true;
@@ -1261,6 +2235,7 @@ void depth_pass_renderer::process_and_combine(
                             relevant_data_texs[j - overridden_quads] = relevant_data_texs[j];
                             relevant_mask_texs[j - overridden_quads] = relevant_mask_texs[j];
                             relevant_metas[j - overridden_quads] = relevant_metas[j];
+                            relevant_level_differences[j - overridden_quads] = relevant_level_differences[j];
                         }
                         relevant_quads -= overridden_quads;
                     }
@@ -1270,7 +2245,16 @@ void depth_pass_renderer::process_and_combine(
     }
     int dst_overlap = (relevant_quads > 0 ? dds[0]->db.category() == ecmdb::category_elevation ? 2 : 1 : 0);
     GLint data_internal_format = (relevant_quads > 0 ? dds[0]->db.category() == ecmdb::category_elevation ? GL_R32F : GL_SRGB : 0);
-    msg::dbg("%d relevant data quads for quad %s", relevant_quads, str::from(quad->quad()).c_str());
+    MSG_DBG("%d relevant data quads for quad %s", relevant_quads, str::from(quad->quad()).c_str());
+    if (lens && relevant_quads > 0) {
+        if (quad_lens_status == 2) {
+            glScissor(lens_scissor[0], lens_scissor[1], lens_scissor[2], lens_scissor[3]);
+            glEnable(GL_SCISSOR_TEST);
+            *lens_texels += lens_scissor[2] * lens_scissor[3];
+        } else {
+            *lens_texels += (quad_size + 2 * dst_overlap) * (quad_size + 2 * dst_overlap);
+        }
+    }
     if (relevant_quads == 0) {
         // nothing here...
         data_texs[quad_index] = 0;
@@ -1293,23 +2277,55 @@ void depth_pass_renderer::process_and_combine(
         mask_texs[quad_index] = quad_tex_pool.get(GL_R8, quad_size + 2 * dst_overlap);
         return_data_texs_to_pool[quad_index] = true;
         return_mask_texs_to_pool[quad_index] = true;
-        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, data_texs[quad_index], 0);
-        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, mask_texs[quad_index], 0);
-        assert(xgl::CheckFBO(GL_DRAW_FRAMEBUFFER, HERE));
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, relevant_data_texs[0]);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, relevant_mask_texs[0] == 0 ? _valid_mask_tex : relevant_mask_texs[0]);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-        bool full_validity = (relevant_mask_texs[0] == 0);
-        processor.process(frame, *(dds[relevant_dds[0]]), lens, quad->quad(), relevant_metas[0], &full_validity, &(metas[quad_index]));
-        if (full_validity) {
-            quad_tex_pool.put(mask_texs[quad_index]);
-            mask_texs[quad_index] = 0;
-            return_mask_texs_to_pool[quad_index] = false;
+        bool full_validity;
+        if (relevant_level_differences[0] == 0
+                && get_cpu_processed_quad(context, processor, *(dds[relevant_dds[0]]), lens, quad->quad(),
+                    quad_size + 2 * dst_overlap, data_texs[quad_index], mask_texs[quad_index],
+                    &full_validity, &(metas[quad_index]))) {
+            if (full_validity) {
+                quad_tex_pool.put(mask_texs[quad_index]);
+                mask_texs[quad_index] = 0;
+                return_mask_texs_to_pool[quad_index] = false;
+            }
+        } else if (deferred_jobs
+                && quad_lens_status != 2
+                && !dds[relevant_dds[0]]->processing_parameters[0].category_e2c) {
+            // Defer processing so that it can be batched with other quads
+            // from the same database; see process_deferred_jobs().
+            // Quads processed with a lens scissor rectangle and e2c quads
+            // (whose input is only valid for the current quad) are excluded.
+            deferred_processing_job dj;
+            dj.dd = dds[relevant_dds[0]];
+            dj.lens = lens;
+            dj.quad_index = quad_index;
+            dj.job.quad = quad->quad();
+            dj.job.quad_meta = relevant_metas[0];
+            dj.job.src_data_tex = relevant_data_texs[0];
+            dj.job.src_mask_tex = (relevant_mask_texs[0] == 0 ? _valid_mask_tex : relevant_mask_texs[0]);
+            dj.job.dst_data_tex = data_texs[quad_index];
+            dj.job.dst_mask_tex = mask_texs[quad_index];
+            dj.job.full_validity = (relevant_mask_texs[0] == 0);
+            deferred_jobs->push_back(dj);
+            metas[quad_index] = relevant_metas[0];
+        } else {
+            glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, data_texs[quad_index], 0);
+            glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, mask_texs[quad_index], 0);
+            assert(xgl::CheckFBO(GL_DRAW_FRAMEBUFFER, HERE));
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, relevant_data_texs[0]);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glActiveTexture(GL_TEXTURE1);
+            glBindTexture(GL_TEXTURE_2D, relevant_mask_texs[0] == 0 ? _valid_mask_tex : relevant_mask_texs[0]);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            full_validity = (relevant_mask_texs[0] == 0);
+            processor.process(frame, *(dds[relevant_dds[0]]), lens, quad->quad(), relevant_metas[0], &full_validity, &(metas[quad_index]));
+            if (full_validity) {
+                quad_tex_pool.put(mask_texs[quad_index]);
+                mask_texs[quad_index] = 0;
+                return_mask_texs_to_pool[quad_index] = false;
+            }
         }
     } else {
         // the general case: processing may be necessary, and combining is necessary
@@ -1325,6 +2341,18 @@ void depth_pass_renderer::process_and_combine(
                 processed_mask_texs[i] = quad_tex_pool.get(GL_R8, quad_size + 2 * dst_overlap);
                 return_processed_data_texs_to_pool[i] = true;
                 return_processed_mask_texs_to_pool[i] = true;
+                bool full_validity;
+                if (relevant_level_differences[i] == 0
+                        && get_cpu_processed_quad(context, processor, *(dds[relevant_dds[i]]), lens, quad->quad(),
+                            quad_size + 2 * dst_overlap, processed_data_texs[i], processed_mask_texs[i],
+                            &full_validity, &(processed_metas[i]))) {
+                    if (full_validity) {
+                        quad_tex_pool.put(processed_mask_texs[i]);
+                        processed_mask_texs[i] = 0;
+                        return_processed_mask_texs_to_pool[i] = false;
+                    }
+                    continue;
+                }
                 glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, processed_data_texs[i], 0);
                 glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, processed_mask_texs[i], 0);
                 assert(xgl::CheckFBO(GL_DRAW_FRAMEBUFFER, HERE));
@@ -1336,7 +2364,7 @@ void depth_pass_renderer::process_and_combine(
                 glBindTexture(GL_TEXTURE_2D, relevant_mask_texs[i] == 0 ? _valid_mask_tex : relevant_mask_texs[i]);
                 glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
                 glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-                bool full_validity = (relevant_mask_texs[i] == 0);
+                full_validity = (relevant_mask_texs[i] == 0);
                 processor.process(frame, *(dds[relevant_dds[i]]), lens, quad->quad(), relevant_metas[i], &full_validity, &(processed_metas[i]));
                 if (full_validity) {
                     quad_tex_pool.put(processed_mask_texs[i]);
@@ -1387,10 +2415,13 @@ void depth_pass_renderer::process_and_combine(
                 quad_tex_pool.put(processed_mask_texs[i]);
         }
     }
+    if (lens && quad_lens_status == 2) {
+        glDisable(GL_SCISSOR_TEST);
+    }
     assert(xgl::CheckError(HERE));
 
     if (quad_lens_status == 2) {
-        // We processed with lens == true.
+        // We processed with lens == true, restricted to the lens region.
         // Backup the results and process with lens == false.
         // Then combine both results into the final result.
         GLuint l1_data_tex = data_texs[quad_index];
@@ -1401,7 +2432,8 @@ void depth_pass_renderer::process_and_combine(
         process_and_combine(context, frame, processor, ndds, dds, quad_size, quad, quad_index, offsets_tex,
                 0, lens_rel_pos, lens_radius, quad_corner_rel_pos,
                 elevation_data_tex_for_e2c, elevation_mask_tex_for_e2c, elevation_meta_for_e2c,
-                data_texs, mask_texs, return_data_texs_to_pool, return_mask_texs_to_pool, metas, approximated_quads);
+                data_texs, mask_texs, return_data_texs_to_pool, return_mask_texs_to_pool, metas, approximated_quads,
+                lens_texels, NULL);
         GLuint l0_data_tex = data_texs[quad_index];
         GLuint l0_mask_tex = mask_texs[quad_index];
         bool l0_return_data_texs_to_pool = return_data_texs_to_pool[quad_index];
@@ -1446,7 +2478,7 @@ void depth_pass_renderer::process_and_combine(
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
             processor.combine_lens(frame, quad->quad(), quad_size, quad_size + 2 * dst_overlap,
-                    lens_rel_pos, lens_radius, quad_corner_rel_pos,
+                    lens_rel_pos, lens_radius, lens_scissor, quad_corner_rel_pos,
                     l0_meta, l1_meta, &(metas[quad_index]));
             bool full_validity = (l0_mask_tex == 0 && l1_mask_tex == 0);
             if (full_validity) {
@@ -1469,6 +2501,52 @@ void depth_pass_renderer::process_and_combine(
     }
 }
 
+static bool deferred_processing_job_less(const deferred_processing_job& j0, const deferred_processing_job& j1)
+{
+    return (j0.dd < j1.dd || (j0.dd == j1.dd && j0.lens < j1.lens));
+}
+
+void depth_pass_renderer::process_deferred_jobs(
+        renderer_context& context,
+        unsigned int frame,
+        class processor& processor)
+{
+    class quad_tex_pool& quad_tex_pool = *(context.quad_tex_pool());
+
+    assert(xgl::CheckError(HERE));
+    // Group the jobs by database and lens flag, so that each group
+    // shares the same processor and processing parameters.
+    std::stable_sort(_deferred_jobs.begin(), _deferred_jobs.end(), deferred_processing_job_less);
+    size_t group_start = 0;
+    while (group_start < _deferred_jobs.size()) {
+        size_t group_end = group_start + 1;
+        while (group_end < _deferred_jobs.size()
+                && !deferred_processing_job_less(_deferred_jobs[group_start], _deferred_jobs[group_end])) {
+            group_end++;
+        }
+        _batch_jobs.resize(group_end - group_start);
+        for (size_t i = group_start; i < group_end; i++)
+            _batch_jobs[i - group_start] = _deferred_jobs[i].job;
+        MSG_DBG("Processing a batch of %d texture quads", static_cast<int>(_batch_jobs.size()));
+        processor.process_batch(frame, *(_deferred_jobs[group_start].dd), _deferred_jobs[group_start].lens,
+                _batch_jobs.size(), &(_batch_jobs[0]));
+        for (size_t i = group_start; i < group_end; i++) {
+            const processing_job& job = _batch_jobs[i - group_start];
+            unsigned int quad_index = _deferred_jobs[i].quad_index;
+            _texture_metas[quad_index] = job.meta;
+            if (job.full_validity) {
+                assert(_texture_mask_texs[quad_index] == job.dst_mask_tex);
+                quad_tex_pool.put(_texture_mask_texs[quad_index]);
+                _texture_mask_texs[quad_index] = 0;
+                _texture_mask_texs_return_to_pool[quad_index] = false;
+            }
+        }
+        group_start = group_end;
+    }
+    _deferred_jobs.clear();
+    assert(xgl::CheckError(HERE));
+}
+
 static void set_subquad(std::vector<float>& subquads, size_t i, float bl_x, float bl_y, float size)
 {
     assert(i < subquads.size() * 4 * 2);
@@ -1566,6 +2644,165 @@ static void draw_bounding_box(const ecm_side_quadtree* quad, const dvec3& viewer
     }
 }
 
+static void draw_bounding_box_faces(const ecm_side_quadtree* quad, const dvec3& viewer_pos)
+{
+    const dvec3* bb[2] = { quad->bounding_box_inner(), quad->bounding_box_outer() };
+    const int corners[4] = { ecm::corner_tl, ecm::corner_tr, ecm::corner_br, ecm::corner_bl };
+
+    glBegin(GL_QUADS);
+    for (int i = 0; i < 2; i++) {
+        for (int j = 0; j < 4; j++) {
+            glvmVertex(bb[i][corners[j]] - viewer_pos);
+        }
+    }
+    for (int j = 0; j < 4; j++) {
+        glvmVertex(bb[0][corners[j]] - viewer_pos);
+        glvmVertex(bb[0][corners[(j + 1) % 4]] - viewer_pos);
+        glvmVertex(bb[1][corners[(j + 1) % 4]] - viewer_pos);
+        glvmVertex(bb[1][corners[j]] - viewer_pos);
+    }
+    glEnd();
+}
+
+void depth_pass_renderer::issue_occlusion_queries(int depth_pass,
+        const class state* state,
+        const lod_thread* lod_thread)
+{
+    TRC_SCOPE("occlusion queries");
+    occlusion_readback& o = _occlusion[depth_pass];
+    const unsigned int render_quads = lod_thread->n_render_quads();
+    const unsigned int query_quads = lod_thread->n_query_quads();
+    if (o.queries.size() < query_quads) {
+        size_t old_size = o.queries.size();
+        o.queries.resize(query_quads);
+        o.query_quads.resize(query_quads);
+        glGenQueries(query_quads - old_size, &(o.queries[old_size]));
+    }
+
+    GLint prg_bak;
+    glGetIntegerv(GL_CURRENT_PROGRAM, &prg_bak);
+    glPushAttrib(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_ENABLE_BIT | GL_POLYGON_BIT);
+    glUseProgram(0);
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glDepthMask(GL_FALSE);
+    glDepthFunc(GL_LEQUAL);
+    glDisable(GL_CULL_FACE);
+    glDisable(GL_TEXTURE_2D);
+    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    for (unsigned int i = 0; i < query_quads; i++) {
+        const ecm_side_quadtree* quad = lod_thread->render_quad(render_quads - query_quads + i);
+        o.query_quads[i] = quad->quad();
+        glBeginQuery(GL_ANY_SAMPLES_PASSED, o.queries[i]);
+        draw_bounding_box_faces(quad, state->viewer_pos);
+        glEndQuery(GL_ANY_SAMPLES_PASSED);
+    }
+    o.n_queries = query_quads;
+    glPopAttrib();
+    glUseProgram(prg_bak);
+    assert(xgl::CheckError(HERE));
+}
+
+void depth_pass_renderer::read_back_depth(int depth_pass,
+        const class state* state,
+        const lod_thread* lod_thread,
+        GLint framebuffer)
+{
+    TRC_SCOPE("depth readback");
+    TRC_GPU_SCOPE(_gpu_tracer, "depth readback");
+    occlusion_readback& o = _occlusion[depth_pass];
+    const ivec4& VP = lod_thread->VP();
+
+    /* Multisampled depth buffers cannot be copied into a texture */
+    GLint sample_buffers;
+    glGetIntegerv(GL_SAMPLE_BUFFERS, &sample_buffers);
+    if (sample_buffers > 0) {
+        MSG_DBG("Depth pass %d: cannot read back multisampled depth buffer", depth_pass);
+        return;
+    }
+
+    /* Two reductions of 4x4 texels give one texel per tile */
+    ivec2 hiz_size[2];
+    hiz_size[0] = ivec2((VP[2] + 3) / 4, (VP[3] + 3) / 4);
+    hiz_size[1] = ivec2((hiz_size[0].x + 3) / 4, (hiz_size[0].y + 3) / 4);
+    if (o.size.x != VP[2] || o.size.y != VP[3]) {
+        if (o.depth_tex != 0) {
+            glDeleteTextures(1, &o.depth_tex);
+            glDeleteTextures(2, o.hiz_texs);
+        }
+        if (o.pbo == 0)
+            glGenBuffers(1, &o.pbo);
+        glGenTextures(1, &o.depth_tex);
+        glBindTexture(GL_TEXTURE_2D, o.depth_tex);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, VP[2], VP[3], 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+        for (int i = 0; i < 2; i++)
+            o.hiz_texs[i] = xgl::CreateTex2D(GL_RG32F, hiz_size[i].x, hiz_size[i].y, GL_NEAREST);
+        o.size = ivec2(VP[2], VP[3]);
+        assert(xgl::CheckError(HERE));
+    }
+    if (_hiz_prg == 0) {
+        _hiz_prg = xgl::CreateProgram("hiz", "", "", HIZ_FS_GLSL_STR);
+        xgl::LinkProgram("hiz", _hiz_prg);
+        glUseProgram(_hiz_prg);
+        glvmUniform(xgl::GetUniformLocation(_hiz_prg, "tex"), 0);
+        _hiz_prg_depth_input_loc = xgl::GetUniformLocation(_hiz_prg, "depth_input");
+        _hiz_prg_in_size_loc = xgl::GetUniformLocation(_hiz_prg, "in_size");
+        _hiz_prg_out_size_loc = xgl::GetUniformLocation(_hiz_prg, "out_size");
+        assert(xgl::CheckError(HERE));
+    }
+
+    /* Copy the depth buffer and reduce it */
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, o.depth_tex);
+    glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, VP[0], VP[1], VP[2], VP[3]);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, _fbo);
+    glDrawBuffer(GL_COLOR_ATTACHMENT0);
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_CULL_FACE);
+    glUseProgram(_hiz_prg);
+    xgl::PushViewport(_xgl_stack);
+    xgl::PushModelViewMatrix(_xgl_stack);
+    xgl::PushProjectionMatrix(_xgl_stack);
+    glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
+    glMatrixMode(GL_MODELVIEW);
+    glLoadIdentity();
+    for (int i = 0; i < 2; i++) {
+        ivec2 in_size = (i == 0 ? o.size : hiz_size[0]);
+        glViewport(0, 0, hiz_size[i].x, hiz_size[i].y);
+        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, o.hiz_texs[i], 0);
+        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, 0, 0);
+        assert(xgl::CheckFBO(GL_DRAW_FRAMEBUFFER, HERE));
+        glBindTexture(GL_TEXTURE_2D, i == 0 ? o.depth_tex : o.hiz_texs[0]);
+        glvmUniform(_hiz_prg_depth_input_loc, i == 0);
+        glvmUniform(_hiz_prg_in_size_loc, vec2(in_size.x, in_size.y));
+        glvmUniform(_hiz_prg_out_size_loc, vec2(hiz_size[i].x, hiz_size[i].y));
+        xgl::DrawQuad();
+        assert(xgl::CheckError(HERE));
+    }
+    xgl::PopProjectionMatrix(_xgl_stack);
+    xgl::PopModelViewMatrix(_xgl_stack);
+    xgl::PopViewport(_xgl_stack);
+    glEnable(GL_DEPTH_TEST);
+
+    /* Start the transfer; the data is used in the next frame */
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, _read_fbo);
+    xgl::ReadTex2DStart(o.hiz_texs[1], 0, 0, hiz_size[1].x, hiz_size[1].y,
+            GL_RG, GL_FLOAT, hiz_size[1].x * 2 * sizeof(float), o.pbo);
+    o.pending = true;
+    o.pending_depth.width = hiz_size[1].x;
+    o.pending_depth.height = hiz_size[1].y;
+    o.pending_depth.viewer_pos = state->viewer_pos;
+    o.pending_depth.rel_MV = lod_thread->rel_MV();
+    o.pending_depth.P = lod_thread->P();
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer);
+    assert(xgl::CheckError(HERE));
+}
+
 void depth_pass_renderer::render(renderer_context* context, unsigned int frame,
         const class state* state,
         class processor* processor,
@@ -1576,9 +2813,12 @@ void depth_pass_renderer::render(renderer_context* context, unsigned int frame,
     assert(_initialized_gl);
 
     if (lod_thread->n_render_quads() == 0) {
-        msg::dbg("Depth pass %d: no quads to render; terminating early", depth_pass);
+        MSG_DBG("Depth pass %d: no quads to render; terminating early", depth_pass);
         return;
     }
+    TRC_GPU_COLLECT(_gpu_tracer);
+    TRC_SCOPE("depth pass");
+    TRC_GPU_SCOPE(_gpu_tracer, "depth pass");
 
     /* Initialize global information */
     const int quad_size = lod_thread->quad_size();
@@ -1589,6 +2829,7 @@ void depth_pass_renderer::render(renderer_context* context, unsigned int frame,
     class quad_tex_pool& quad_tex_pool = *(context->quad_tex_pool());
     processor->set_elevation_bounds(lod_thread->elevation_min(), lod_thread->elevation_max());
     processor->set_e2c_info(quad_size, lod_thread->e2c_elevation_min(), lod_thread->e2c_elevation_max());
+    processor->set_cpu_processing(state->renderer.cpu_processing, state->database_descriptions);
 
     /* Initialize GL context */
     xgl::PushEverything(_xgl_stack);
@@ -1691,9 +2932,11 @@ void depth_pass_renderer::render(renderer_context* context, unsigned int frame,
     if (_cart_coord_texs.size() < render_quads)
         _cart_coord_texs.resize(render_quads);
     info->quads_approximated[depth_pass] = 0;
+    info->lens_texels_processed[depth_pass] = 0;
     info->quads_rendered[depth_pass] = 0;
     info->lowest_quad_level[depth_pass] = ecmdb::max_levels;
     info->highest_quad_level[depth_pass] = 0;
+    _deferred_jobs.clear();
     for (unsigned int quad_index = 0; quad_index < render_quads; quad_index++) {
         const ecm_side_quadtree* quad = lod_thread->render_quad(quad_index);
         _render_flags[quad_index] = true;
@@ -1746,14 +2989,16 @@ void depth_pass_renderer::render(renderer_context* context, unsigned int frame,
                 _elevation_data_texs_return_to_pool,
                 _elevation_mask_texs_return_to_pool,
                 _elevation_metas,
-                &info->quads_approximated[depth_pass]);
+                &info->quads_approximated[depth_pass],
+                &info->lens_texels_processed[depth_pass],
+                NULL);
         assert(xgl::CheckError(HERE));
         if (_elevation_data_texs[0] == 0
                 && lod_thread->n_texture_dds() == 1
                 && lod_thread->texture_dds()[0]->processing_parameters[0].category_e2c) {
             assert(!_elevation_data_texs_return_to_pool[0]);
             assert(!_elevation_mask_texs_return_to_pool[0]);
-            msg::dbg("No valid elevation data and no texture except e2c: not rendering quad");
+            MSG_DBG("No valid elevation data and no texture except e2c: not rendering quad");
             _render_flags[quad_index] = false;
             continue;
         }
@@ -1770,7 +3015,13 @@ void depth_pass_renderer::render(renderer_context* context, unsigned int frame,
                 _texture_data_texs_return_to_pool,
                 _texture_mask_texs_return_to_pool,
                 _texture_metas,
-                &info->quads_approximated[depth_pass]);
+                &info->quads_approximated[depth_pass],
+                &info->lens_texels_processed[depth_pass],
+                // the debug quad is saved before deferred jobs are processed
+                (state->debug_quad_save
+                 && state->debug_quad_depth_pass == depth_pass
+                 && state->debug_quad_index == static_cast<int>(quad_index)
+                 ? NULL : &_deferred_jobs));
         assert(xgl::CheckError(HERE));
         if (_texture_data_texs[quad_index] == 0) {
             assert(!_texture_data_texs_return_to_pool[quad_index]);
@@ -1779,67 +3030,71 @@ void depth_pass_renderer::render(renderer_context* context, unsigned int frame,
                 quad_tex_pool.put(_elevation_data_texs[0]);
             if (_elevation_mask_texs_return_to_pool[0])
                 quad_tex_pool.put(_elevation_mask_texs[0]);
-            msg::dbg("No valid texture data: not rendering quad");
+            MSG_DBG("No valid texture data: not rendering quad");
             _render_flags[quad_index] = false;
             continue;
         }
         /* Compute the cartesian coordinates from base data + elevation. */
-        glViewport(0, 0, quad_size + 6, quad_size + 6);
-        glDrawBuffer(GL_COLOR_ATTACHMENT0);
-        _cart_coord_texs[quad_index] = quad_tex_pool.get(GL_RGB32F, quad_size + 6);
-        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, _cart_coord_texs[quad_index], 0);
-        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, 0, 0);
-        assert(xgl::CheckFBO(GL_DRAW_FRAMEBUFFER, HERE));
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, offsets_tex == 0 ? _invalid_data_tex : offsets_tex);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);   // has to be linear to get
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);   // the skirt coordinates correct
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, normals_tex == 0 ? _invalid_data_tex : normals_tex);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);   // has to be linear to get
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);   // the skirt coordinates correct
-        glActiveTexture(GL_TEXTURE2);
-        glBindTexture(GL_TEXTURE_2D, _elevation_data_texs[0] == 0 ? _invalid_data_tex : _elevation_data_texs[0]);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-        GLint elevation_total_quad_size;
-        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &elevation_total_quad_size);
-        int elevation_overlap = max(0, (elevation_total_quad_size - quad_size) / 2);
-        glActiveTexture(GL_TEXTURE3);
-        glBindTexture(GL_TEXTURE_2D, _elevation_mask_texs[0] == 0 ? _valid_mask_tex : _elevation_mask_texs[0]);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-        assert(xgl::CheckError(HERE));
-        glUseProgram(_cart_coord_prg);
-        glvmUniform(_cart_coord_prg_quad_tl_loc, vec3(quad->corner(ecm::corner_tl) - state->viewer_pos));
-        glvmUniform(_cart_coord_prg_quad_tr_loc, vec3(quad->corner(ecm::corner_tr) - state->viewer_pos));
-        glvmUniform(_cart_coord_prg_quad_bl_loc, vec3(quad->corner(ecm::corner_bl) - state->viewer_pos));
-        glvmUniform(_cart_coord_prg_quad_br_loc, vec3(quad->corner(ecm::corner_br) - state->viewer_pos));
-        glvmUniform(_cart_coord_prg_have_base_data_loc, (offsets_tex != 0));
-        glvmUniform(_cart_coord_prg_fallback_normal_loc, vec3(quad->plane_normal()));
-        bool base_data_mirror_x, base_data_mirror_y;
-        mat3 base_data_matrix;
-        int devnull;
-        ecm::symmetry_quad(quad->quad()[0], quad->quad()[1], quad->quad()[2], quad->quad()[3],
-                &devnull, &devnull, &devnull, &devnull,
-                &base_data_mirror_x, &base_data_mirror_y, base_data_matrix.vl);
-        glvmUniform(_cart_coord_prg_base_data_mirror_x_loc, base_data_mirror_x ? 1.0f : 0.0f);
-        glvmUniform(_cart_coord_prg_base_data_mirror_y_loc, base_data_mirror_y ? 1.0f : 0.0f);
-        glvmUniform(_cart_coord_prg_base_data_matrix_loc, base_data_matrix);
-        //glvmUniform(_cart_coord_prg_skirt_elevation_loc, quad->min_elev() - static_cast<float>(quad->max_dist_to_quad_plane()));
-        glvmUniform(_cart_coord_prg_skirt_elevation_loc,
-                min(static_cast<float>(state->inner_bounding_sphere_radius - state->semi_major_axis()),
-                    -static_cast<float>(quad->max_dist_to_quad_plane())));
-        glvmUniform(_cart_coord_prg_have_elevation_loc, (_elevation_data_texs[0] != 0));
-        glvmUniform(_cart_coord_prg_fallback_elevation_loc, quad->min_elev());
-        glvmUniform(_cart_coord_prg_elevation_texcoord_offset_loc, static_cast<float>(elevation_overlap) / elevation_total_quad_size);
-        glvmUniform(_cart_coord_prg_elevation_texcoord_factor_loc, static_cast<float>(quad_size) / elevation_total_quad_size);
-        assert(xgl::CheckError(HERE));
-        msg::dbg("Cartesian coordinates: base data %d, elevation %d",
-                offsets_tex == 0 ? 0 : 1,
-                _elevation_data_texs[0] == 0 ? 0 : 1);
-        xgl::DrawQuad();
-        assert(xgl::CheckError(HERE));
+        {
+            TRC_SCOPE("cart coords");
+            TRC_GPU_SCOPE(_gpu_tracer, "cart coords");
+            glViewport(0, 0, quad_size + 6, quad_size + 6);
+            glDrawBuffer(GL_COLOR_ATTACHMENT0);
+            _cart_coord_texs[quad_index] = quad_tex_pool.get(GL_RGB32F, quad_size + 6);
+            glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, _cart_coord_texs[quad_index], 0);
+            glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, 0, 0);
+            assert(xgl::CheckFBO(GL_DRAW_FRAMEBUFFER, HERE));
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, offsets_tex == 0 ? _invalid_data_tex : offsets_tex);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);   // has to be linear to get
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);   // the skirt coordinates correct
+            glActiveTexture(GL_TEXTURE1);
+            glBindTexture(GL_TEXTURE_2D, normals_tex == 0 ? _invalid_data_tex : normals_tex);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);   // has to be linear to get
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);   // the skirt coordinates correct
+            glActiveTexture(GL_TEXTURE2);
+            glBindTexture(GL_TEXTURE_2D, _elevation_data_texs[0] == 0 ? _invalid_data_tex : _elevation_data_texs[0]);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            GLint elevation_total_quad_size;
+            glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &elevation_total_quad_size);
+            int elevation_overlap = max(0, (elevation_total_quad_size - quad_size) / 2);
+            glActiveTexture(GL_TEXTURE3);
+            glBindTexture(GL_TEXTURE_2D, _elevation_mask_texs[0] == 0 ? _valid_mask_tex : _elevation_mask_texs[0]);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            assert(xgl::CheckError(HERE));
+            glUseProgram(_cart_coord_prg);
+            glvmUniform(_cart_coord_prg_quad_tl_loc, vec3(quad->corner(ecm::corner_tl) - state->viewer_pos));
+            glvmUniform(_cart_coord_prg_quad_tr_loc, vec3(quad->corner(ecm::corner_tr) - state->viewer_pos));
+            glvmUniform(_cart_coord_prg_quad_bl_loc, vec3(quad->corner(ecm::corner_bl) - state->viewer_pos));
+            glvmUniform(_cart_coord_prg_quad_br_loc, vec3(quad->corner(ecm::corner_br) - state->viewer_pos));
+            glvmUniform(_cart_coord_prg_have_base_data_loc, (offsets_tex != 0));
+            glvmUniform(_cart_coord_prg_fallback_normal_loc, vec3(quad->plane_normal()));
+            bool base_data_mirror_x, base_data_mirror_y;
+            mat3 base_data_matrix;
+            int devnull;
+            ecm::symmetry_quad(quad->quad()[0], quad->quad()[1], quad->quad()[2], quad->quad()[3],
+                    &devnull, &devnull, &devnull, &devnull,
+                    &base_data_mirror_x, &base_data_mirror_y, base_data_matrix.vl);
+            glvmUniform(_cart_coord_prg_base_data_mirror_x_loc, base_data_mirror_x ? 1.0f : 0.0f);
+            glvmUniform(_cart_coord_prg_base_data_mirror_y_loc, base_data_mirror_y ? 1.0f : 0.0f);
+            glvmUniform(_cart_coord_prg_base_data_matrix_loc, base_data_matrix);
+            //glvmUniform(_cart_coord_prg_skirt_elevation_loc, quad->min_elev() - static_cast<float>(quad->max_dist_to_quad_plane()));
+            glvmUniform(_cart_coord_prg_skirt_elevation_loc,
+                    min(static_cast<float>(state->inner_bounding_sphere_radius - state->semi_major_axis()),
+                        -static_cast<float>(quad->max_dist_to_quad_plane())));
+            glvmUniform(_cart_coord_prg_have_elevation_loc, (_elevation_data_texs[0] != 0));
+            glvmUniform(_cart_coord_prg_fallback_elevation_loc, quad->min_elev());
+            glvmUniform(_cart_coord_prg_elevation_texcoord_offset_loc, static_cast<float>(elevation_overlap) / elevation_total_quad_size);
+            glvmUniform(_cart_coord_prg_elevation_texcoord_factor_loc, static_cast<float>(quad_size) / elevation_total_quad_size);
+            assert(xgl::CheckError(HERE));
+            MSG_DBG("Cartesian coordinates: base data %d, elevation %d",
+                    offsets_tex == 0 ? 0 : 1,
+                    _elevation_data_texs[0] == 0 ? 0 : 1);
+            xgl::DrawQuad();
+            assert(xgl::CheckError(HERE));
+        }
         glDrawBuffers(2, draw_buffers);
         glViewport(0, 0, quad_size + 4, quad_size + 4);
         if (state->debug_quad_depth_pass == depth_pass
@@ -1882,6 +3137,14 @@ void depth_pass_renderer::render(renderer_context* context, unsigned int frame,
         info->lowest_quad_level[depth_pass] = -1;
         info->highest_quad_level[depth_pass] = -1;
     }
+    /* Process the texture quads that were deferred. */
+    if (_deferred_jobs.size() > 0) {
+        TRC_SCOPE("deferred processing");
+        TRC_GPU_SCOPE(_gpu_tracer, "deferred processing");
+        glViewport(0, 0, quad_size + 2, quad_size + 2);
+        glDrawBuffers(2, draw_buffers);
+        process_deferred_jobs(*context, frame, *processor);
+    }
 
     xgl::PopProjectionMatrix(_xgl_stack);
     xgl::PopModelViewMatrix(_xgl_stack);
@@ -1901,73 +3164,82 @@ void depth_pass_renderer::render(renderer_context* context, unsigned int frame,
     }
 
     /* Re-create the quad VBO. */
-    if (_quad_vbo_subdivision != state->renderer.quad_subdivision) {
+    const int quad_subdivision = state->quad_subdivision();
+    if (_quad_vbo_subdivision != quad_subdivision) {
         glBindBuffer(GL_ARRAY_BUFFER, _quad_vbo);
         std::vector<float> vbo_data;
-        unsigned int quad_subquads = 1 << (2 * state->renderer.quad_subdivision);
-        unsigned int skirt_subquads = 4 * (1 << state->renderer.quad_subdivision);
+        unsigned int quad_subquads = 1 << (2 * quad_subdivision);
+        unsigned int skirt_subquads = 4 * (1 << quad_subdivision);
         unsigned int subquads = quad_subquads + skirt_subquads;
         vbo_data.resize(subquads * 4 * 2);
-        float subquad_size = 1.0f / (1 << state->renderer.quad_subdivision);
+        float subquad_size = 1.0f / (1 << quad_subdivision);
 #if 0
         // quad subquads using z-order curve
         // this turned out to be ca. 0.5% SLOWER than the naive order!
         for (unsigned int z = 0; z < quad_subquads; z++) {
             unsigned int x, y;
             inv_morton(z, &x, &y);
-            float subquad_bl_x = static_cast<float>(x) / (1 << state->renderer.quad_subdivision);
-            float subquad_bl_y = static_cast<float>(y) / (1 << state->renderer.quad_subdivision);
+            float subquad_bl_x = static_cast<float>(x) / (1 << quad_subdivision);
+            float subquad_bl_y = static_cast<float>(y) / (1 << quad_subdivision);
             set_subquad(vbo_data, z, subquad_bl_x, subquad_bl_y, subquad_size);
         }
 #else
-        for (int y = 0; y < (1 << state->renderer.quad_subdivision); y++) {
-            for (int x = 0; x < (1 << state->renderer.quad_subdivision); x++) {
-                float subquad_bl_x = static_cast<float>(x) / (1 << state->renderer.quad_subdivision);
-                float subquad_bl_y = static_cast<float>(y) / (1 << state->renderer.quad_subdivision);
-                unsigned int z = y * (1 << state->renderer.quad_subdivision) + x;
+        for (int y = 0; y < (1 << quad_subdivision); y++) {
+            for (int x = 0; x < (1 << quad_subdivision); x++) {
+                float subquad_bl_x = static_cast<float>(x) / (1 << quad_subdivision);
+                float subquad_bl_y = static_cast<float>(y) / (1 << quad_subdivision);
+                unsigned int z = y * (1 << quad_subdivision) + x;
                 set_subquad(vbo_data, z, subquad_bl_x, subquad_bl_y, subquad_size);
             }
         }
 #endif
         // skirt subquads
         unsigned int skirt_subquad_index = 0;
-        for (int y = 0; y < (1 << state->renderer.quad_subdivision); y++) {
-            float subquad_bl_y = static_cast<float>(y) / (1 << state->renderer.quad_subdivision);
+        for (int y = 0; y < (1 << quad_subdivision); y++) {
+            float subquad_bl_y = static_cast<float>(y) / (1 << quad_subdivision);
             set_subquad(vbo_data, quad_subquads + skirt_subquad_index, -subquad_size, subquad_bl_y, subquad_size);
             skirt_subquad_index++;
         }
-        for (int y = 0; y < (1 << state->renderer.quad_subdivision); y++) {
-            float subquad_bl_y = static_cast<float>(y) / (1 << state->renderer.quad_subdivision);
+        for (int y = 0; y < (1 << quad_subdivision); y++) {
+            float subquad_bl_y = static_cast<float>(y) / (1 << quad_subdivision);
             set_subquad(vbo_data, quad_subquads + skirt_subquad_index, 1.0f, subquad_bl_y, subquad_size);
             skirt_subquad_index++;
         }
-        for (int x = 0; x < (1 << state->renderer.quad_subdivision); x++) {
-            float subquad_bl_x = static_cast<float>(x) / (1 << state->renderer.quad_subdivision);
+        for (int x = 0; x < (1 << quad_subdivision); x++) {
+            float subquad_bl_x = static_cast<float>(x) / (1 << quad_subdivision);
             set_subquad(vbo_data, quad_subquads + skirt_subquad_index, subquad_bl_x, -subquad_size, subquad_size);
             skirt_subquad_index++;
         }
-        for (int x = 0; x < (1 << state->renderer.quad_subdivision); x++) {
-            float subquad_bl_x = static_cast<float>(x) / (1 << state->renderer.quad_subdivision);
+        for (int x = 0; x < (1 << quad_subdivision); x++) {
+            float subquad_bl_x = static_cast<float>(x) / (1 << quad_subdivision);
             set_subquad(vbo_data, quad_subquads + skirt_subquad_index, subquad_bl_x, 1.0f, subquad_size);
             skirt_subquad_index++;
         }
         glBufferData(GL_ARRAY_BUFFER, vbo_data.size() * sizeof(float), &(vbo_data[0]), GL_STATIC_DRAW);
-        _quad_vbo_subdivision = state->renderer.quad_subdivision;
+        _quad_vbo_subdivision = quad_subdivision;
         _quad_vbo_mode = GL_QUADS;
         _quad_vbo_vertices = 4 * subquads;
     }
     /* Re-create the render program. */
+    // The depth pre-pass fills the depth buffer only where the texture mask is set.
+    // The shading pass then uses GL_EQUAL depth testing and does not need to
+    // discard fragments, which keeps early depth testing enabled on the GPU.
+    // Wireframe rendering does not work with a depth pre-pass.
+    const bool depth_prepass = state->renderer.depth_prepass && !state->renderer.wireframe;
     if (_render_prg == 0
             || _render_prg_lighting != state->light.active
-            || _render_prg_quad_borders != state->renderer.quad_borders) {
+            || _render_prg_quad_borders != state->renderer.quad_borders
+            || _render_prg_mask_discard != !depth_prepass) {
         _render_prg_lighting = state->light.active;
         _render_prg_quad_borders = state->renderer.quad_borders;
+        _render_prg_mask_discard = !depth_prepass;
         xgl::DeleteProgram(_render_prg);
         std::string render_vs_src(RENDER_VS_GLSL_STR);
         std::string render_fs_src(RENDER_FS_GLSL_STR);
         render_vs_src = str::replace(render_vs_src, "$lighting", state->light.active ? "LIGHTING" : "NO_LIGHTING");
         render_fs_src = str::replace(render_fs_src, "$lighting", state->light.active ? "LIGHTING" : "NO_LIGHTING");
         render_fs_src = str::replace(render_fs_src, "$quad_borders", state->renderer.quad_borders ? "QUAD_BORDERS" : "NO_QUAD_BORDERS");
+        render_fs_src = str::replace(render_fs_src, "$mask_discard", depth_prepass ? "NO_MASK_DISCARD" : "MASK_DISCARD");
         _render_prg = xgl::CreateProgram("render", render_vs_src, "", render_fs_src);
         assert(xgl::CheckError(HERE));
         xgl::LinkProgram("render", _render_prg);
@@ -1975,7 +3247,9 @@ void depth_pass_renderer::render(renderer_context* context, unsigned int frame,
         glUseProgram(_render_prg);
         glvmUniform(xgl::GetUniformLocation(_render_prg, "cart_coords"), 0);
         glvmUniform(xgl::GetUniformLocation(_render_prg, "texture_data"), 1);
-        glvmUniform(xgl::GetUniformLocation(_render_prg, "texture_mask"), 2);
+        if (!depth_prepass) {
+            glvmUniform(xgl::GetUniformLocation(_render_prg, "texture_mask"), 2);
+        }
         _render_prg_cart_coords_texcoord_factor_loc = xgl::GetUniformLocation(_render_prg, "cart_coords_texcoord_factor");
         _render_prg_cart_coords_texcoord_offset_loc = xgl::GetUniformLocation(_render_prg, "cart_coords_texcoord_offset");
         _render_prg_cart_coords_halfstep_loc = xgl::GetUniformLocation(_render_prg, "cart_coords_halfstep");
@@ -1990,8 +3264,126 @@ void depth_pass_renderer::render(renderer_context* context, unsigned int frame,
         }
         assert(xgl::CheckError(HERE));
     }
+    /* Create the depth pre-pass program. */
+    if (_depth_prg == 0) {
+        std::string depth_vs_src(RENDER_VS_GLSL_STR);
+        std::string depth_fs_src(DEPTH_FS_GLSL_STR);
+        depth_vs_src = str::replace(depth_vs_src, "$lighting", "NO_LIGHTING");
+        _depth_prg = xgl::CreateProgram("depth", depth_vs_src, "", depth_fs_src);
+        assert(xgl::CheckError(HERE));
+        xgl::LinkProgram("depth", _depth_prg);
+        assert(xgl::CheckError(HERE));
+        glUseProgram(_depth_prg);
+        glvmUniform(xgl::GetUniformLocation(_depth_prg, "cart_coords"), 0);
+        glvmUniform(xgl::GetUniformLocation(_depth_prg, "texture_mask"), 2);
+        _depth_prg_cart_coords_texcoord_factor_loc = xgl::GetUniformLocation(_depth_prg, "cart_coords_texcoord_factor");
+        _depth_prg_cart_coords_texcoord_offset_loc = xgl::GetUniformLocation(_depth_prg, "cart_coords_texcoord_offset");
+        _depth_prg_cart_coords_halfstep_loc = xgl::GetUniformLocation(_depth_prg, "cart_coords_halfstep");
+        _depth_prg_texture_texcoord_factor_loc = xgl::GetUniformLocation(_depth_prg, "texture_texcoord_factor");
+        _depth_prg_texture_texcoord_offset_loc = xgl::GetUniformLocation(_depth_prg, "texture_texcoord_offset");
+        assert(xgl::CheckError(HERE));
+    }
+
+    /* Get the fragment counts of the last frame for this depth pass, and
+     * prepare the occlusion queries for this frame. Reading the results of
+     * the current frame would stall the pipeline. The third query continues
+     * the count of the first loop over the quads after the per-quad occlusion
+     * queries, since only one occlusion query can be active at a time.
+     * The fourth query is the overdraw counter. */
+    if (_fragment_queries.size() < static_cast<size_t>(8 * (depth_pass + 1))) {
+        size_t old_size = _fragment_queries.size();
+        _fragment_queries.resize(8 * (depth_pass + 1));
+        _fragment_queries_issued.resize(8 * (depth_pass + 1), false);
+        _fragment_queries_split.resize(2 * (depth_pass + 1), 0);
+        glGenQueries(_fragment_queries.size() - old_size, &(_fragment_queries[old_size]));
+    }
+    const int last_queries = 8 * depth_pass + 4 * ((frame + 1) % 2);
+    const int this_queries = 8 * depth_pass + 4 * (frame % 2);
+    int* fragment_counts[2] = { &(info->fragments_prepass[depth_pass]), &(info->fragments_shaded[depth_pass]) };
+    for (int i = 0; i < 4; i++) {
+        if (_fragment_queries_issued[last_queries + i]) {
+            GLuint available;
+            glGetQueryObjectuiv(_fragment_queries[last_queries + i], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (available) {
+                GLuint count;
+                glGetQueryObjectuiv(_fragment_queries[last_queries + i], GL_QUERY_RESULT, &count);
+                if (i < 2)
+                    *(fragment_counts[i]) = count;
+                else if (i == 2)
+                    *(fragment_counts[_fragment_queries_split[last_queries / 4]]) += count;
+                else
+                    info->pixels_covered[depth_pass] = count;
+            }
+            _fragment_queries_issued[last_queries + i] = false;
+        }
+    }
+
+    /* The quads that are probably occluded come last. When the first loop
+     * over the quads reaches them, the depth buffer contains all other quads,
+     * and we can test their bounding boxes against it. Each test result
+     * decides whether the quad is rendered in this frame, and is remembered
+     * for the LOD of the next frames. */
+    if (_occlusion.size() < static_cast<size_t>(depth_pass + 1))
+        _occlusion.resize(depth_pass + 1);
+    const bool occlusion_queries = (lod_thread->n_query_quads() > 0
+            && (GLEW_VERSION_3_3 || (GLEW_VERSION_3_0 && GLEW_ARB_occlusion_query2)));
+    const unsigned int first_query_quad = render_quads - (occlusion_queries ? lod_thread->n_query_quads() : 0);
+    _fragment_queries_split[this_queries / 4] = (depth_prepass ? 0 : 1);
+
+    /* Fill the depth buffer in a depth-only pre-pass. */
+    if (depth_prepass) {
+        TRC_SCOPE("depth prepass");
+        TRC_GPU_SCOPE(_gpu_tracer, "depth prepass");
+        glUseProgram(_depth_prg);
+        glvmUniform(_depth_prg_cart_coords_texcoord_offset_loc, 3.0f / (quad_size + 6));
+        glvmUniform(_depth_prg_cart_coords_texcoord_factor_loc, static_cast<float>(quad_size) / (quad_size + 6));
+        glvmUniform(_depth_prg_cart_coords_halfstep_loc, 0.5f / (quad_size + 6));
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        glBeginQuery(GL_SAMPLES_PASSED, _fragment_queries[this_queries + 0]);
+        glBindBuffer(GL_ARRAY_BUFFER, _quad_vbo);
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glVertexPointer(2, GL_FLOAT, 0, 0);
+        for (unsigned int quad_index = 0; quad_index < render_quads; quad_index++) {
+            if (quad_index == first_query_quad) {
+                glEndQuery(GL_SAMPLES_PASSED);
+                issue_occlusion_queries(depth_pass, state, lod_thread);
+                glBeginQuery(GL_SAMPLES_PASSED, _fragment_queries[this_queries + 2]);
+                _fragment_queries_issued[this_queries + 2] = true;
+            }
+            if (!_render_flags[quad_index])
+                continue;
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, _cart_coord_texs[quad_index]);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glActiveTexture(GL_TEXTURE2);
+            glBindTexture(GL_TEXTURE_2D, _texture_mask_texs[quad_index] == 0 ? _valid_mask_tex : _texture_mask_texs[quad_index]);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            assert(_texture_data_texs[quad_index] != 0);
+            GLint texture_total_quad_size = xgl::GetTex2DParameter(_texture_data_texs[quad_index], GL_TEXTURE_WIDTH);
+            int texture_overlap = max(0, (texture_total_quad_size - quad_size) / 2);
+            glvmUniform(_depth_prg_texture_texcoord_offset_loc, static_cast<float>(texture_overlap) / texture_total_quad_size);
+            glvmUniform(_depth_prg_texture_texcoord_factor_loc, static_cast<float>(quad_size) / texture_total_quad_size);
+            if (quad_index >= first_query_quad)
+                glBeginConditionalRender(_occlusion[depth_pass].queries[quad_index - first_query_quad], GL_QUERY_WAIT);
+            glDrawArrays(_quad_vbo_mode, 0, _quad_vbo_vertices);
+            if (quad_index >= first_query_quad)
+                glEndConditionalRender();
+        }
+        glDisableClientState(GL_VERTEX_ARRAY);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glEndQuery(GL_SAMPLES_PASSED);
+        _fragment_queries_issued[this_queries + 0] = true;
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        glDepthFunc(GL_EQUAL);
+        glDepthMask(GL_FALSE);
+        assert(xgl::CheckError(HERE));
+    }
 
     /* Render the quads. Do not integrate this into the previous loop to avoid FBO switches. */
+    TRC_SCOPE("draw");
+    TRC_GPU_SCOPE(_gpu_tracer, "draw");
     if (state->renderer.wireframe) {
         glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
     }
@@ -2006,7 +3398,14 @@ void depth_pass_renderer::render(renderer_context* context, unsigned int frame,
         glvmUniform(_render_prg_light_color_loc, vec4(state->light.color, 1.0f));
         glvmUniform(_render_prg_shininess_loc, 1.0f / state->light.shininess);
     }
+    glBeginQuery(GL_SAMPLES_PASSED, _fragment_queries[this_queries + 1]);
     for (unsigned int quad_index = 0; quad_index < render_quads; quad_index++) {
+        if (!depth_prepass && quad_index == first_query_quad) {
+            glEndQuery(GL_SAMPLES_PASSED);
+            issue_occlusion_queries(depth_pass, state, lod_thread);
+            glBeginQuery(GL_SAMPLES_PASSED, _fragment_queries[this_queries + 2]);
+            _fragment_queries_issued[this_queries + 2] = true;
+        }
         if (!_render_flags[quad_index])
             continue;
         const ecm_side_quadtree* quad = lod_thread->render_quad(quad_index);
@@ -2028,10 +3427,12 @@ void depth_pass_renderer::render(renderer_context* context, unsigned int frame,
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
         }
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glActiveTexture(GL_TEXTURE2);
-        glBindTexture(GL_TEXTURE_2D, _texture_mask_texs[quad_index] == 0 ? _valid_mask_tex : _texture_mask_texs[quad_index]);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        if (!depth_prepass) {
+            glActiveTexture(GL_TEXTURE2);
+            glBindTexture(GL_TEXTURE_2D, _texture_mask_texs[quad_index] == 0 ? _valid_mask_tex : _texture_mask_texs[quad_index]);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        }
         // Set per-quad uniforms
         glvmUniform(_render_prg_texture_texcoord_offset_loc, static_cast<float>(texture_overlap) / texture_total_quad_size);
         glvmUniform(_render_prg_texture_texcoord_factor_loc, static_cast<float>(quad_size) / texture_total_quad_size);
@@ -2048,16 +3449,31 @@ void depth_pass_renderer::render(renderer_context* context, unsigned int frame,
         glBindBuffer(GL_ARRAY_BUFFER, _quad_vbo);
         glEnableClientState(GL_VERTEX_ARRAY);
         glVertexPointer(2, GL_FLOAT, 0, 0);
+        if (quad_index >= first_query_quad)
+            glBeginConditionalRender(_occlusion[depth_pass].queries[quad_index - first_query_quad], GL_QUERY_WAIT);
         glDrawArrays(_quad_vbo_mode, 0, _quad_vbo_vertices);
+        if (quad_index >= first_query_quad)
+            glEndConditionalRender();
         glDisableClientState(GL_VERTEX_ARRAY);
         glBindBuffer(GL_ARRAY_BUFFER, 0);
         /* glBegin(GL_QUADS); glVertex2f(1.0f, 1.0f); glVertex2f(0.0f, 1.0f); glVertex2f(0.0f, 0.0f); glVertex2f(1.0f, 0.0f); glEnd(); */
-        if (state->debug_quad_depth_pass == depth_pass
-                && state->debug_quad_index == static_cast<int>(quad_index)) {
+        // In LOD metric comparison mode, highlight the quads that the other metric would treat differently
+        bool lod_metric_highlight = (state->renderer.lod_metric_comparison && quad->lod_metric_disagreement());
+        if (depth_prepass && (state->renderer.bounding_boxes || lod_metric_highlight
+                    || (state->debug_quad_depth_pass == depth_pass
+                        && state->debug_quad_index == static_cast<int>(quad_index)))) {
+            glDepthFunc(GL_LEQUAL);
+        }
+        if (lod_metric_highlight
+                || (state->debug_quad_depth_pass == depth_pass
+                    && state->debug_quad_index == static_cast<int>(quad_index))) {
             draw_bounding_box(quad, state->viewer_pos, true);
         } else if (state->renderer.bounding_boxes) {
             draw_bounding_box(quad, state->viewer_pos);
         }
+        if (depth_prepass) {
+            glDepthFunc(GL_EQUAL);
+        }
         // Give unused textures back
         quad_tex_pool.put(_cart_coord_texs[quad_index]);
         if (_texture_data_texs_return_to_pool[quad_index])
@@ -2066,6 +3482,52 @@ void depth_pass_renderer::render(renderer_context* context, unsigned int frame,
             quad_tex_pool.put(_texture_mask_texs[quad_index]);
         assert(xgl::CheckError(HERE));
     }
+    glEndQuery(GL_SAMPLES_PASSED);
+    _fragment_queries_issued[this_queries + 1] = true;
+    if (depth_prepass) {
+        glDepthFunc(GL_LESS);
+        glDepthMask(GL_TRUE);
+    }
+    if (state->renderer.wireframe) {
+        glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    }
+
+    /* Count the pixels covered by terrain: a full-screen quad on the far
+     * plane passes the depth test only where something nearer was drawn. */
+    if (state->renderer.overdraw_counter) {
+        TRC_SCOPE("overdraw counter");
+        glPushAttrib(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_ENABLE_BIT);
+        glUseProgram(0);
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        glDepthMask(GL_FALSE);
+        glDepthFunc(GL_GREATER);
+        glMatrixMode(GL_PROJECTION);
+        glPushMatrix();
+        glLoadIdentity();
+        glMatrixMode(GL_MODELVIEW);
+        glPushMatrix();
+        glLoadIdentity();
+        glBeginQuery(GL_SAMPLES_PASSED, _fragment_queries[this_queries + 3]);
+        glBegin(GL_QUADS);
+        glVertex3f(-1.0f, -1.0f, 1.0f);
+        glVertex3f(+1.0f, -1.0f, 1.0f);
+        glVertex3f(+1.0f, +1.0f, 1.0f);
+        glVertex3f(-1.0f, +1.0f, 1.0f);
+        glEnd();
+        glEndQuery(GL_SAMPLES_PASSED);
+        _fragment_queries_issued[this_queries + 3] = true;
+        glMatrixMode(GL_PROJECTION);
+        glPopMatrix();
+        glMatrixMode(GL_MODELVIEW);
+        glPopMatrix();
+        glPopAttrib();
+        assert(xgl::CheckError(HERE));
+    }
+
+    /* Read back the depth buffer for occlusion culling in the next frames. */
+    if (state->renderer.occlusion_culling) {
+        read_back_depth(depth_pass, state, lod_thread, draw_framebuffer_bak);
+    }
 
 #if 0
     glActiveTexture(GL_TEXTURE0);       // XXX should not be necessary, but removing it gives wrong line colors!?
@@ -2179,6 +3641,55 @@ void depth_pass_renderer::render(renderer_context* context, unsigned int frame,
     }
 }
 
+// Quads that an occlusion query found to be occluded are culled without
+// further queries for this number of frames.
+static const unsigned int occlusion_confirmation_frames = 30;
+
+const occlusion_feedback& depth_pass_renderer::update_occlusion_feedback(int depth_pass, unsigned int frame)
+{
+    if (_occlusion.size() < static_cast<size_t>(depth_pass + 1))
+        _occlusion.resize(depth_pass + 1);
+    occlusion_readback& o = _occlusion[depth_pass];
+
+    /* The depth map is only valid if it belongs to the last rendered frame */
+    if (o.pending) {
+        TRC_SCOPE("depth readback");
+        const float* buffer = static_cast<const float*>(xgl::ReadTex2DGetData(o.pbo));
+        o.feedback.depth = o.pending_depth;
+        o.feedback.depth.depth.assign(buffer, buffer + 2 * o.pending_depth.width * o.pending_depth.height);
+        xgl::ReadTex2DFinish(o.pbo);
+        o.pending = false;
+    } else {
+        o.feedback.depth = depth_map();
+    }
+
+    /* Get the results of the occlusion queries. Results that are not
+     * available yet are ignored. */
+    for (unsigned int i = 0; i < o.n_queries; i++) {
+        GLuint available;
+        glGetQueryObjectuiv(o.queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available) {
+            GLuint any_samples_passed;
+            glGetQueryObjectuiv(o.queries[i], GL_QUERY_RESULT, &any_samples_passed);
+            if (any_samples_passed)
+                o.confirmed_occluded.erase(o.query_quads[i]);
+            else
+                o.confirmed_occluded[o.query_quads[i]] = frame;
+        }
+    }
+    o.n_queries = 0;
+    o.feedback.occluded_quads.clear();
+    for (auto it = o.confirmed_occluded.begin(); it != o.confirmed_occluded.end(); ) {
+        if (frame - it->second > occlusion_confirmation_frames) {
+            o.confirmed_occluded.erase(it++);
+        } else {
+            o.feedback.occluded_quads.push_back(it->first);
+            it++;
+        }
+    }
+    return o.feedback;
+}
+
 terrain::terrain()
 {
     _info[0] = new renderpass_info();
@@ -2244,7 +3755,9 @@ void terrain::render(renderer_context& context, unsigned int frame,
         _info[_current_lod]->clear_depth_pass(i);
         _lod_threads[_current_lod][i]->init(&context, frame,
                 &(_state[_current_lod]), &_processor,
-                VP, MV, i, P[i], _info[_current_lod]);
+                VP, MV, i, P[i],
+                _depth_pass_renderer.update_occlusion_feedback(i, frame),
+                _info[_current_lod]);
         _lod_threads[_current_lod][i]->start();
     }
     int render_lod = _state[_current_lod].renderer.force_lod_sync ? _current_lod : old_lod;
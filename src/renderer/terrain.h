@@ -22,13 +22,16 @@
 #define TERRAIN_H
 
 #include <vector>
+#include <map>
 
 #include <GL/glew.h>
 
 #include "glvm.h"
 #include "xgl.h"
+#include "xgl-trc.h"
 
 #include "culler.h"
+#include "occlusion.h"
 #include "processor.h"
 #include "renderer-context.h"
 #include "lod.h"
@@ -44,7 +47,72 @@ private:
     culler _culler;
     std::vector<glvm::vec2> _bbs;
     ecm_quadtree* _quadtree;
-    std::vector<ecm_side_quadtree*> _lod_quads;
+    class lod_quad
+    {
+    public:
+        ecm_side_quadtree* quad;
+        unsigned int parent_plane_mask; // frustum planes that the parent is not completely inside of
+        int cull;                       // 0 = no, 1 = yes, 2 = not tested in advance
+        unsigned int plane_mask;        // plane mask after the test in advance
+    };
+    std::vector<lod_quad> _lod_quads;
+    occlusion_culler _occlusion_culler;
+    std::vector<const ecm_side_quadtree*> _query_quads;
+    // Front-to-back ordering of the rendered quads
+    class distance_quad
+    {
+    public:
+        double distance;                // distance from the viewer to the bounding sphere
+        const ecm_side_quadtree* quad;
+
+        bool operator<(const distance_quad& dq) const
+        {
+            return distance < dq.distance;
+        }
+    };
+    std::vector<distance_quad> _distance_quads;
+    // Incremental LOD: the leaves of the quadtree from the previous run, the
+    // split decisions that become due when the viewer has traveled a given
+    // distance, the split and merge operations for the next run, and the
+    // parameters that the split decisions depend on
+    class lod_event
+    {
+    public:
+        double due;                     // viewer travel
+        glvm::ivec4 quad;
+
+        // Make std::push_heap() and friends return the earliest event first
+        bool operator<(const lod_event& e) const
+        {
+            return due > e.due;
+        }
+    };
+    class lod_operation
+    {
+    public:
+        glvm::ivec4 quad;
+        bool split;                     // true = split, false = merge
+        float priority;                 // higher is more urgent
+
+        // Sort more urgent operations first
+        bool operator<(const lod_operation& op) const
+        {
+            return priority > op.priority;
+        }
+    };
+    bool _lod_incremental_valid;        // false if the data below must be rebuilt
+    std::vector<ecm_side_quadtree*> _lod_cut;
+    std::vector<lod_event> _lod_events;
+    std::vector<ecm_side_quadtree*> _lod_candidates;
+    std::vector<lod_operation> _lod_operations;
+    unsigned int _n_lod_operations;
+    double _lod_travel;                 // distance the viewer traveled in incremental mode
+    glvm::dvec3 _lod_viewer_pos;        // viewer position of the previous run
+    double _lod_pixels_per_tan;
+    float _lod_split_area;              // decisions are valid for split areas within a band around this value
+    float _lod_hysteresis;
+    std::vector<float> _lod_parameters; // lens and elevation processing parameters
+    std::vector<uuid> _lod_databases;   // databases that the elevation bounds and quad levels come from
     // Input
     renderer_context* _context;
     unsigned int _frame;
@@ -52,6 +120,7 @@ private:
     const processor* _processor;
     glvm::dmat4 _MV;
     int _depth_pass;
+    occlusion_feedback _occlusion_feedback;
     // Input/Output
     glvm::dmat4 _P;
     glvm::ivec4 _VP;
@@ -65,21 +134,42 @@ private:
     float _e2c_elevation_max;
     unsigned int _n_elevation_dds;
     std::vector<const database_description*> _elevation_dds;
+    std::vector<quad_metadata_pyramid*> _elevation_pyramids;
     unsigned int _n_texture_dds;
     std::vector<const database_description*> _texture_dds;
     unsigned int _n_render_quads;
     std::vector<const ecm_side_quadtree*> _render_quads;
+    unsigned int _n_query_quads;
 
     // Helpers
     ecmdb::metadata get_metadata_with_caching(
             const database_description& dd,
+            quad_metadata_pyramid* pyramid,
             const glvm::ivec4& quad,
             int* level_difference);
+    void sort_front_to_back(const ecm_side_quadtree** quads, unsigned int n);
     void get_quad_elevation_bounds(
             const glvm::ivec4& quad,
-            bool quad_intersects_lens,
+            int quad_lens_status,
             unsigned int ndds, const database_description** dds,
-            float* min_elev, float* max_elev, bool* valid);
+            quad_metadata_pyramid* const* pyramids,
+            float* min_elev, float* max_elev, bool* valid, bool* pending);
+    // Update the lens status, elevation bounds, and bounding box of a quad.
+    // Returns true if the bounding box changed. Sets *need_base_data if the
+    // quad base data should be computed once the quad is known to be visible.
+    bool update_quad_bounds(const class ecm& ecm, const glvm::dvec3& lens_pos,
+            ecm_side_quadtree* quad, bool* minmax_elev_pending, bool* need_base_data);
+    void start_quad_base_data(const class ecm& ecm, int quad_size, const ecm_side_quadtree* quad);
+    bool is_at_highest_level(const ecm_side_quadtree* quad) const;
+    // Incremental LOD
+    void schedule_lod_decision(ecm_side_quadtree* quad, double slack);
+    void push_lod_event(ecm_side_quadtree* quad, double due);
+    void add_to_lod_cut(ecm_side_quadtree* quad);
+    void remove_from_lod_cut(ecm_side_quadtree* quad);  // removes the leaves below quad
+    void reset_lod_decisions(ecm_side_quadtree* quad);  // schedules all quads below quad
+    void run_incremental(const class ecm& ecm, int quad_size, const glvm::dvec3& lens_pos,
+            int max_level, double pixels_per_tan, float split_area_base, bool horizon_conservative,
+            unsigned int* query_quads);
 
 public:
     lod_thread();
@@ -92,6 +182,7 @@ public:
             const glvm::dmat4& MV,
             int depth_pass,
             const glvm::dmat4& P,
+            const occlusion_feedback& occlusion,
             renderpass_info* info);
 
     virtual void run();
@@ -180,6 +271,49 @@ public:
     {
         return _render_quads[i];
     }
+
+    /* The last n_query_quads() render quads are probably occluded. Their
+     * occlusion should be verified with occlusion queries. */
+    unsigned int n_query_quads() const
+    {
+        return _n_query_quads;
+    }
+};
+
+/* A texture processing job that was deferred until all quads of a depth pass
+ * are known, so that jobs for the same database can be processed in one batch. */
+class deferred_processing_job
+{
+public:
+    const database_description* dd;
+    bool lens;
+    unsigned int quad_index;
+    processing_job job;
+};
+
+/* The depth buffer readback and the occlusion queries of one depth pass.
+ * They become the occlusion feedback for the LOD of the next frame. */
+class occlusion_readback
+{
+public:
+    glvm::ivec2 size;
+    GLuint depth_tex;
+    GLuint hiz_texs[2];
+    GLuint pbo;
+    bool pending;
+    depth_map pending_depth;
+    std::vector<GLuint> queries;
+    std::vector<glvm::ivec4> query_quads;
+    unsigned int n_queries;
+    std::map<glvm::ivec4, unsigned int, quad_less> confirmed_occluded; // frame of the last confirmation
+    occlusion_feedback feedback;
+
+    occlusion_readback() :
+        size(0, 0), depth_tex(0), pbo(0), pending(false), n_queries(0)
+    {
+        hiz_texs[0] = 0;
+        hiz_texs[1] = 0;
+    }
 };
 
 class depth_pass_renderer
@@ -233,6 +367,21 @@ private:
     GLint _render_prg_ambient_color_loc;
     GLint _render_prg_light_color_loc;
     GLint _render_prg_shininess_loc;
+    bool _render_prg_mask_discard;
+    GLuint _depth_prg;
+    GLint _depth_prg_cart_coords_texcoord_offset_loc;
+    GLint _depth_prg_cart_coords_texcoord_factor_loc;
+    GLint _depth_prg_cart_coords_halfstep_loc;
+    GLint _depth_prg_texture_texcoord_offset_loc;
+    GLint _depth_prg_texture_texcoord_factor_loc;
+    std::vector<GLuint> _fragment_queries;      // 4 (pre-pass, shading, continued, covered) per frame parity per depth pass
+    std::vector<bool> _fragment_queries_issued;
+    std::vector<int> _fragment_queries_split;   // which count the third query per frame parity continues
+    GLuint _hiz_prg;
+    GLint _hiz_prg_depth_input_loc;
+    GLint _hiz_prg_in_size_loc;
+    GLint _hiz_prg_out_size_loc;
+    std::vector<occlusion_readback> _occlusion;
     GLuint _quad_vbo;
     int _quad_vbo_subdivision;
     GLenum _quad_vbo_mode;
@@ -249,6 +398,10 @@ private:
     std::vector<bool> _texture_mask_texs_return_to_pool;
     std::vector<ecmdb::metadata> _texture_metas;
     std::vector<GLuint> _cart_coord_texs;
+    std::vector<deferred_processing_job> _deferred_jobs;
+    std::vector<processing_job> _batch_jobs;
+    // GPU spans for tracing
+    xgl::gpu_tracer _gpu_tracer;
 
     quad_gpu* create_approximation(
             renderer_context& context,
@@ -261,6 +414,15 @@ private:
             GLuint* data_tex, GLuint* mask_tex, ecmdb::metadata* meta,
             int* level_difference);
 
+    bool get_cpu_processed_quad(
+            renderer_context& context,
+            class processor& processor,
+            const database_description& dd, bool lens,
+            const glvm::ivec4& quad,
+            int total_dst_quad_size,
+            GLuint dst_data_tex, GLuint dst_mask_tex,
+            bool* full_validity, ecmdb::metadata* meta);
+
     void process_and_combine(
             renderer_context& context,
             unsigned int frame,
@@ -281,7 +443,23 @@ private:
             std::vector<bool>& return_data_texs_to_pool,
             std::vector<bool>& return_mask_texs_to_pool,
             std::vector<ecmdb::metadata>& metas,
-            int* approximated_quads);
+            int* approximated_quads,
+            int* lens_texels,
+            std::vector<deferred_processing_job>* deferred_jobs);
+
+    void process_deferred_jobs(
+            renderer_context& context,
+            unsigned int frame,
+            class processor& processor);
+
+    void issue_occlusion_queries(int depth_pass,
+            const class state* state,
+            const lod_thread* lod_thread);
+
+    void read_back_depth(int depth_pass,
+            const class state* state,
+            const lod_thread* lod_thread,
+            GLint framebuffer);
 
 public:
     depth_pass_renderer();
@@ -296,6 +474,10 @@ public:
             int depth_pass,
             const lod_thread* lod_thread,
             renderpass_info* info);
+
+    /* Get the results of the depth readback and the occlusion queries of the
+     * last frame that rendered the given depth pass. */
+    const occlusion_feedback& update_occlusion_feedback(int depth_pass, unsigned int frame);
 };
 
 class terrain
@@ -322,6 +504,11 @@ public:
             unsigned int depth_passes,
             const glvm::dmat4* P,
             renderpass_info* info);
+
+    unsigned long long gradient_uploads() const
+    {
+        return _processor.gradient_uploads();
+    }
 };
 
 #endif
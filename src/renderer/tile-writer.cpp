@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2013
+ * Computer Graphics Group, University of Siegen, Germany.
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>.
+ * See http://www.cg.informatik.uni-siegen.de/ for contact information.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <cstring>
+
+#include <gta/gta.hpp>
+
+#include "exc.h"
+#include "fio.h"
+#include "str.h"
+
+#include "tile-writer.h"
+
+
+buffer_tile_writer::buffer_tile_writer(void* buffer, int width) :
+    _buffer(static_cast<unsigned char*>(buffer)), _width(width)
+{
+}
+
+void buffer_tile_writer::write_tile(int x, int y, int w, int h, const void* data)
+{
+    for (int r = 0; r < h; r++) {
+        // Avoid integer overflow for the buffer index
+        size_t index = (static_cast<size_t>(y + r) * _width + x) * 4;
+        std::memcpy(_buffer + index, static_cast<const unsigned char*>(data) + static_cast<size_t>(r) * w * 4, w * 4);
+    }
+}
+
+gta_tile_writer::gta_tile_writer(const std::string& filename, int width, int height) :
+    _filename(filename), _f(NULL), _hdr(new gta::header), _data_offset(0), _width(width), _height(height)
+{
+    try {
+        _hdr->set_dimensions(width, height);
+        gta::type types[3] = { gta::uint8, gta::uint8, gta::uint8 };
+        _hdr->set_components(3, types);
+        _hdr->component_taglist(0).set("INTERPRETATION", "SRGB/RED");
+        _hdr->component_taglist(1).set("INTERPRETATION", "SRGB/GREEN");
+        _hdr->component_taglist(2).set("INTERPRETATION", "SRGB/BLUE");
+        _f = fio::open(filename, "w");
+        _hdr->write_to(_f);
+        _data_offset = fio::tell(_f, filename);
+        // Allocate the complete data so that tiles can be written in any order
+        fio::seek(_f, _data_offset + _hdr->data_size() - 1, SEEK_SET, filename);
+        unsigned char zero = 0;
+        fio::write(&zero, 1, 1, _f, filename);
+    }
+    catch (std::exception& e) {
+        if (_f)
+            std::fclose(_f);
+        delete _hdr;
+        throw exc(e);
+    }
+}
+
+gta_tile_writer::~gta_tile_writer()
+{
+    if (_f)
+        std::fclose(_f);
+    delete _hdr;
+}
+
+void gta_tile_writer::write_tile(int x, int y, int w, int h, const void* data)
+{
+    // Convert to RGB and turn the tile upside down
+    _tile.resize(w, h, 3);
+    for (int r = 0; r < h; r++) {
+        const unsigned char* src = static_cast<const unsigned char*>(data) + static_cast<size_t>(r) * w * 4;
+        unsigned char* dst = _tile.ptr<unsigned char>() + static_cast<size_t>(h - 1 - r) * w * 3;
+        for (int c = 0; c < w; c++) {
+            dst[3 * c + 0] = src[4 * c + 2];
+            dst[3 * c + 1] = src[4 * c + 1];
+            dst[3 * c + 2] = src[4 * c + 0];
+        }
+    }
+    uintmax_t lower[2] = { static_cast<uintmax_t>(x), static_cast<uintmax_t>(_height - y - h) };
+    uintmax_t higher[2] = { static_cast<uintmax_t>(x + w - 1), static_cast<uintmax_t>(_height - y - 1) };
+    try {
+        _hdr->write_block(_f, _data_offset, lower, higher, _tile.ptr());
+    }
+    catch (std::exception& e) {
+        throw exc(_filename + ": " + e.what());
+    }
+}
+
+void gta_tile_writer::close()
+{
+    if (_f) {
+        FILE* f = _f;
+        _f = NULL;
+        fio::close(f, _filename);
+    }
+}
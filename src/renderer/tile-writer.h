@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2013
+ * Computer Graphics Group, University of Siegen, Germany.
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>.
+ * See http://www.cg.informatik.uni-siegen.de/ for contact information.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TILE_WRITER_H
+#define TILE_WRITER_H
+
+#include <cstdio>
+#include <string>
+
+#include "blb.h"
+
+namespace gta
+{
+    class header;
+}
+
+
+/* Receives the tiles of an image rendered with renderer::render_tiles().
+ * Tile positions are relative to the lower left corner of the image. The tile
+ * data consists of h rows of w pixels in the format 0xffRRGGBB, starting with
+ * the lowest row. */
+
+class tile_writer
+{
+public:
+    virtual ~tile_writer()
+    {
+    }
+
+    virtual void write_tile(int x, int y, int w, int h, const void* data) = 0;
+};
+
+/* Copy tiles into one image buffer in the format 0xffRRGGBB, starting with
+ * the lowest row. */
+
+class buffer_tile_writer : public tile_writer
+{
+private:
+    unsigned char* _buffer;
+    int _width;
+
+public:
+    buffer_tile_writer(void* buffer, int width);
+
+    void write_tile(int x, int y, int w, int h, const void* data);
+};
+
+/* Write tiles into an uncompressed GTA file with three uint8 sRGB components
+ * and the upper left corner first. Only the current tile is kept in memory.
+ * The file is created with its full size, so tiles can be written in any
+ * order. */
+
+class gta_tile_writer : public tile_writer
+{
+private:
+    std::string _filename;
+    FILE* _f;
+    gta::header* _hdr;
+    long long _data_offset;
+    int _width;
+    int _height;
+    blob _tile;
+
+public:
+    gta_tile_writer(const std::string& filename, int width, int height);
+    ~gta_tile_writer();
+
+    void write_tile(int x, int y, int w, int h, const void* data);
+
+    // Close the file. Call this to get errors reported; the destructor
+    // ignores them.
+    void close();
+};
+
+#endif
@@ -40,12 +40,27 @@ void renderer_parameters::reset()
     background_color[2] = 0;
     quad_screen_size_ratio = 2.0f;
     fixed_quadtree_depth = 0;
+    lod_metric = 0;
+    lod_metric_comparison = false;
+    lod_hysteresis = 0.1f;
+    lod_min_residence = 10;
+    lod_hold_pending = true;
+    lod_incremental = false;
+    lod_max_operations = 64;
     quad_subdivision = 6;
+    adaptive_quality = false;
+    target_frame_time = 1000.0f / 60.0f;
+    adaptive_subdivision = false;
     wireframe = false;
     bounding_boxes = false;
     quad_borders = false;
     mipmapping = false;
     force_lod_sync = false;
+    depth_prepass = true;
+    front_to_back = true;
+    overdraw_counter = false;
+    occlusion_culling = true;
+    cpu_processing = false;
     statistics_overlay = false;
     gpu_cache_size = 256UL * 1024UL * 1024UL;
     mem_cache_size = 2048UL * 1024UL * 1024UL;
@@ -58,12 +73,27 @@ void renderer_parameters::save(std::ostream& os) const
     s11n::save(os, background_color[2]);
     s11n::save(os, quad_screen_size_ratio);
     s11n::save(os, fixed_quadtree_depth);
+    s11n::save(os, lod_metric);
+    s11n::save(os, lod_metric_comparison);
+    s11n::save(os, lod_hysteresis);
+    s11n::save(os, lod_min_residence);
+    s11n::save(os, lod_hold_pending);
+    s11n::save(os, lod_incremental);
+    s11n::save(os, lod_max_operations);
     s11n::save(os, quad_subdivision);
+    s11n::save(os, adaptive_quality);
+    s11n::save(os, target_frame_time);
+    s11n::save(os, adaptive_subdivision);
     s11n::save(os, wireframe);
     s11n::save(os, bounding_boxes);
     s11n::save(os, quad_borders);
     s11n::save(os, mipmapping);
     s11n::save(os, force_lod_sync);
+    s11n::save(os, depth_prepass);
+    s11n::save(os, front_to_back);
+    s11n::save(os, overdraw_counter);
+    s11n::save(os, occlusion_culling);
+    s11n::save(os, cpu_processing);
     s11n::save(os, statistics_overlay);
     s11n::save(os, gpu_cache_size);
     s11n::save(os, mem_cache_size);
@@ -76,12 +106,27 @@ void renderer_parameters::load(std::istream& is)
     s11n::load(is, background_color[2]);
     s11n::load(is, quad_screen_size_ratio);
     s11n::load(is, fixed_quadtree_depth);
+    s11n::load(is, lod_metric);
+    s11n::load(is, lod_metric_comparison);
+    s11n::load(is, lod_hysteresis);
+    s11n::load(is, lod_min_residence);
+    s11n::load(is, lod_hold_pending);
+    s11n::load(is, lod_incremental);
+    s11n::load(is, lod_max_operations);
     s11n::load(is, quad_subdivision);
+    s11n::load(is, adaptive_quality);
+    s11n::load(is, target_frame_time);
+    s11n::load(is, adaptive_subdivision);
     s11n::load(is, wireframe);
     s11n::load(is, bounding_boxes);
     s11n::load(is, quad_borders);
     s11n::load(is, mipmapping);
     s11n::load(is, force_lod_sync);
+    s11n::load(is, depth_prepass);
+    s11n::load(is, front_to_back);
+    s11n::load(is, overdraw_counter);
+    s11n::load(is, occlusion_culling);
+    s11n::load(is, cpu_processing);
     s11n::load(is, statistics_overlay);
     s11n::load(is, gpu_cache_size);
     s11n::load(is, mem_cache_size);
@@ -94,12 +139,27 @@ void renderer_parameters::save(std::ostream& os, const char* name) const
     s11n::save(os, "background-color", bc);
     s11n::save(os, "quad-screen-size-ratio", quad_screen_size_ratio);
     s11n::save(os, "fixed-quadtree-depth", fixed_quadtree_depth);
+    s11n::save(os, "lod-metric", lod_metric);
+    s11n::save(os, "lod-metric-comparison", lod_metric_comparison);
+    s11n::save(os, "lod-hysteresis", lod_hysteresis);
+    s11n::save(os, "lod-min-residence", lod_min_residence);
+    s11n::save(os, "lod-hold-pending", lod_hold_pending);
+    s11n::save(os, "lod-incremental", lod_incremental);
+    s11n::save(os, "lod-max-operations", lod_max_operations);
     s11n::save(os, "quad-subdivision", quad_subdivision);
+    s11n::save(os, "adaptive-quality", adaptive_quality);
+    s11n::save(os, "target-frame-time", target_frame_time);
+    s11n::save(os, "adaptive-subdivision", adaptive_subdivision);
     s11n::save(os, "wireframe", wireframe);
     s11n::save(os, "bounding-boxes", bounding_boxes);
     s11n::save(os, "quad-borders", quad_borders);
     s11n::save(os, "mipmapping", mipmapping);
     s11n::save(os, "force-lod-sync", force_lod_sync);
+    s11n::save(os, "depth-prepass", depth_prepass);
+    s11n::save(os, "front-to-back", front_to_back);
+    s11n::save(os, "overdraw-counter", overdraw_counter);
+    s11n::save(os, "occlusion-culling", occlusion_culling);
+    s11n::save(os, "cpu-processing", cpu_processing);
     s11n::save(os, "statistics-overlay", statistics_overlay);
     s11n::save(os, "gpu-cache-size", gpu_cache_size);
     s11n::save(os, "mem-cache-size", mem_cache_size);
@@ -123,8 +183,28 @@ void renderer_parameters::load(const std::string& s)
             s11n::load(value, quad_screen_size_ratio);
         } else if (name == "fixed-quadtree-depth") {
             s11n::load(value, fixed_quadtree_depth);
+        } else if (name == "lod-metric") {
+            s11n::load(value, lod_metric);
+        } else if (name == "lod-metric-comparison") {
+            s11n::load(value, lod_metric_comparison);
+        } else if (name == "lod-hysteresis") {
+            s11n::load(value, lod_hysteresis);
+        } else if (name == "lod-min-residence") {
+            s11n::load(value, lod_min_residence);
+        } else if (name == "lod-hold-pending") {
+            s11n::load(value, lod_hold_pending);
+        } else if (name == "lod-incremental") {
+            s11n::load(value, lod_incremental);
+        } else if (name == "lod-max-operations") {
+            s11n::load(value, lod_max_operations);
         } else if (name == "quad-subdivision") {
             s11n::load(value, quad_subdivision);
+        } else if (name == "adaptive-quality") {
+            s11n::load(value, adaptive_quality);
+        } else if (name == "target-frame-time") {
+            s11n::load(value, target_frame_time);
+        } else if (name == "adaptive-subdivision") {
+            s11n::load(value, adaptive_subdivision);
         } else if (name == "wireframe") {
             s11n::load(value, wireframe);
         } else if (name == "bounding-boxes") {
@@ -135,6 +215,16 @@ void renderer_parameters::load(const std::string& s)
             s11n::load(value, mipmapping);
         } else if (name == "force-lod-sync") {
             s11n::load(value, force_lod_sync);
+        } else if (name == "depth-prepass") {
+            s11n::load(value, depth_prepass);
+        } else if (name == "front-to-back") {
+            s11n::load(value, front_to_back);
+        } else if (name == "overdraw-counter") {
+            s11n::load(value, overdraw_counter);
+        } else if (name == "occlusion-culling") {
+            s11n::load(value, occlusion_culling);
+        } else if (name == "cpu-processing") {
+            s11n::load(value, cpu_processing);
         } else if (name == "statistics-overlay") {
             s11n::load(value, statistics_overlay);
         } else if (name == "gpu-cache-size") {
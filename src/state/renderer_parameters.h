@@ -30,12 +30,27 @@ public:
     uint8_t background_color[3];    // used for glClearColor()
     float quad_screen_size_ratio;   // max allowed ratio between screen size of quad and quad size
     int fixed_quadtree_depth;       // 0 = off, > 0 = fixed level
+    int lod_metric;                 // 0 = bounding box area, 1 = bounding sphere
+    bool lod_metric_comparison;     // evaluate both LOD metrics and highlight quads where they disagree
+    float lod_hysteresis;           // relative width of the band around the split threshold in which quads keep their level
+    int lod_min_residence;          // minimum number of frames before a split quad may merge again
+    bool lod_hold_pending;          // keep quads at their level while their elevation data is not yet available
+    bool lod_incremental;           // update the LOD of the previous frame instead of deciding from scratch (bounding sphere metric only)
+    int lod_max_operations;         // maximum number of split/merge operations per frame in incremental mode
     int quad_subdivision;           // >= 0
+    bool adaptive_quality;          // adapt the quad screen size ratio to reach the target frame time
+    float target_frame_time;        // in milliseconds
+    bool adaptive_subdivision;      // let the adaptive quality also reduce the quad subdivision level
     bool wireframe;
     bool bounding_boxes;
     bool quad_borders;
     bool mipmapping;
     bool force_lod_sync;
+    bool depth_prepass;             // fill depth buffer first, then shade only visible fragments
+    bool front_to_back;             // render quads in front-to-back order for early depth rejection
+    bool overdraw_counter;          // count the covered pixels of each depth pass to report the overdraw
+    bool occlusion_culling;         // cull quads that were occluded in the previous frame
+    bool cpu_processing;            // process quads on the CPU where supported, on the loader threads
     bool statistics_overlay;
     size_t gpu_cache_size;          // in bytes
     size_t mem_cache_size;          // in bytes
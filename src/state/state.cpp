@@ -49,7 +49,8 @@ state::state(msg::level_t msg_level,
     viewer_pos(0.0, 0.0, 0.0), viewer_rot(0.0, 0.0, 0.0, 0.0),
     tracker_pos(0.0f, 0.0f, 0.0f), tracker_rot(toQuat(0.0f, vec3(1.0f, 0.0f, 0.0f))),
     pointer_pos(-1, -1),
-    debug_quad_depth_pass(-1), debug_quad_index(-1), debug_quad_save(false)
+    debug_quad_depth_pass(-1), debug_quad_index(-1), debug_quad_save(false),
+    quality_ratio_factor(1.0f), quality_subdivision_reduction(0)
 {
     create_e2c_database(database_descriptions);
 }
@@ -107,6 +108,16 @@ int state::quad_size() const
             : -1);
 }
 
+float state::quad_screen_size_ratio() const
+{
+    return renderer.quad_screen_size_ratio * quality_ratio_factor;
+}
+
+int state::quad_subdivision() const
+{
+    return max(renderer.quad_subdivision - quality_subdivision_reduction, 0);
+}
+
 void state::save(std::ostream& os) const
 {
     s11n::save(os, static_cast<int>(msg_level));
@@ -132,6 +143,8 @@ void state::save(std::ostream& os) const
     s11n::save(os, debug_quad_depth_pass);
     s11n::save(os, debug_quad_index);
     s11n::save(os, debug_quad_save);
+    s11n::save(os, quality_ratio_factor);
+    s11n::save(os, quality_subdivision_reduction);
 }
 
 void state::load(std::istream& is)
@@ -161,6 +174,8 @@ void state::load(std::istream& is)
     s11n::load(is, debug_quad_depth_pass);
     s11n::load(is, debug_quad_index);
     s11n::load(is, debug_quad_save);
+    s11n::load(is, quality_ratio_factor);
+    s11n::load(is, quality_subdivision_reduction);
 }
 
 void state::save_statefile(const std::string& filename) const
@@ -70,6 +70,8 @@ public:
     int debug_quad_depth_pass;
     int debug_quad_index;
     bool debug_quad_save;
+    float quality_ratio_factor;         // set by the quality controller; scales renderer.quad_screen_size_ratio
+    int quality_subdivision_reduction;  // set by the quality controller; reduces renderer.quad_subdivision
 
 public:
     // This constructor builds a master state:
@@ -88,6 +90,9 @@ public:
     double semi_major_axis() const;
     double semi_minor_axis() const;
     int quad_size() const;
+    // The effective LOD parameters, including the adaptations of the quality controller
+    float quad_screen_size_ratio() const;
+    int quad_subdivision() const;
     
     // Serialization
     void save(std::ostream& os) const;
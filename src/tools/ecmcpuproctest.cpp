@@ -0,0 +1,335 @@
+/*
+ * Copyright (C) 2013
+ * Computer Graphics Group, University of Siegen, Germany.
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>.
+ * See http://www.cg.informatik.uni-siegen.de/ for contact information.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * ecmcpuproctest checks the CPU quad processing that the memory cache loaders
+ * apply, without OpenGL. It processes generated raw quads and compares the
+ * results with straightforward reference computations: unprocessed textures,
+ * scaled and clamped elevations with their metadata, the cropping of masks
+ * to the destination overlap, and linear SAR amplitude dynamic range
+ * reduction. It also checks the generations of the processing parameters.
+ *
+ * ecmproctest compares the CPU implementation with the shaders.
+ */
+
+#include "config.h"
+
+#include <cstring>
+#include <cmath>
+#include <memory>
+#include <vector>
+
+#include <ecmdb/ecmdb.h>
+
+#include "dbg.h"
+#include "exc.h"
+#include "msg.h"
+#include "str.h"
+
+#include "glvm.h"
+
+#include "database_description.h"
+#include "quad-cache.h"
+#include "processor.h"
+
+using namespace glvm;
+
+
+static const int quad_size = 32;
+
+static const float elevation_tolerance = 1e-5f;
+
+static int failures = 0;
+static int checks = 0;
+
+static void check(const std::string& name, bool ok)
+{
+    checks++;
+    msg::inf("%s: %s", name.c_str(), ok ? "ok" : "FAILED");
+    if (!ok)
+        failures++;
+}
+
+static database_description make_database(ecmdb::category_t category, ecmdb::type_t type, int channels,
+        int overlap, float data_offset, float data_factor)
+{
+    database_description dd;
+    dd.db.create(1.0, 1.0, quad_size, 1, category, type, channels, overlap, data_offset, data_factor,
+            "Test", std::vector<std::string>(1, "Test database"));
+    dd.meta = ecmdb::metadata(category);
+    dd.processing_parameters[0] = processing_parameters(category);
+    dd.processing_parameters[1] = processing_parameters(category);
+    return dd;
+}
+
+/* A raw quad as the memory cache loaders load it. Element i has the value
+ * value(i), and every seventh element is invalid if a mask is requested. */
+
+static int value(size_t i)
+{
+    return static_cast<int>((i * 37) % 251);
+}
+
+static void make_quad(const database_description& dd, bool full_validity, quad_mem* qmem)
+{
+    size_t n = static_cast<size_t>(dd.db.total_quad_size()) * dd.db.total_quad_size();
+    qmem->data.resize(n * dd.db.element_size());
+    for (size_t i = 0; i < n * dd.db.channels(); i++) {
+        if (dd.db.type() == ecmdb::type_uint8) {
+            qmem->data.ptr<uint8_t>()[i] = value(i);
+        } else if (dd.db.type() == ecmdb::type_int16) {
+            qmem->data.ptr<int16_t>()[i] = 100 * (value(i) - 125);
+        } else {
+            qmem->data.ptr<float>()[i] = 4.0f * value(i);
+        }
+    }
+    if (full_validity) {
+        qmem->mask.free();
+    } else {
+        qmem->mask.resize(n);
+        for (size_t i = 0; i < n; i++)
+            qmem->mask.ptr<uint8_t>()[i] = (i % 7 == 0 ? 0x00 : 0xff);
+    }
+    qmem->meta = ecmdb::metadata(dd.db.category());
+}
+
+/* The source element that the CPU processing reads for a destination texel */
+static size_t src_index(const database_description& dd, int dst_overlap, int x, int y)
+{
+    int offset = dd.db.overlap() - dst_overlap;
+    return static_cast<size_t>(y + offset) * dd.db.total_quad_size() + (x + offset);
+}
+
+static uint8_t linear_to_srgb8(float x)
+{
+    x = clamp(x, 0.0f, 1.0f);
+    float s = (x <= 0.0031308f ? x * 12.92f : 1.055f * std::pow(x, 1.0f / 2.4f) - 0.055f);
+    return static_cast<uint8_t>(s * 255.0f + 0.5f);
+}
+
+/* Process one quad as the memory cache loaders do it */
+static void process(class processor& processor, const database_description& dd, bool lens, quad_mem* qmem)
+{
+    processor.set_cpu_processing(true, std::vector<database_description>(1, dd));
+    if (!processor.use_cpu(dd, lens))
+        throw exc("CPU processing is not supported for this database");
+    std::unique_ptr<const quad_mem_processing> processing(processor.cpu_quad_processing(dd, lens));
+    processing->process(qmem);
+}
+
+static bool check_mask(const database_description& dd, const quad_mem& src, const quad_mem& dst, int dst_overlap)
+{
+    int ds = quad_size + 2 * dst_overlap;
+    if (!src.mask.ptr())
+        return !dst.mask.ptr();
+    if (!dst.mask.ptr() || dst.mask.size() != static_cast<size_t>(ds) * ds)
+        return false;
+    for (int y = 0; y < ds; y++)
+        for (int x = 0; x < ds; x++)
+            if (dst.mask.ptr<uint8_t>()[y * ds + x] != src.mask.ptr<uint8_t>()[src_index(dd, dst_overlap, x, y)])
+                return false;
+    return true;
+}
+
+/* Without color correction, texture processing must reproduce the source
+ * colors exactly, with luminance expanded to RGB. */
+static void test_texture(class processor& processor, int channels, bool full_validity)
+{
+    database_description dd = make_database(ecmdb::category_texture, ecmdb::type_uint8, channels, 2, 0.0f, 1.0f);
+    quad_mem src, dst;
+    make_quad(dd, full_validity, &src);
+    dst = src;
+    process(processor, dd, false, &dst);
+    int ds = quad_size + 2;
+    bool ok = (dst.data.size() == static_cast<size_t>(ds) * ds * 3);
+    for (int y = 0; ok && y < ds; y++) {
+        for (int x = 0; ok && x < ds; x++) {
+            size_t s = src_index(dd, 1, x, y);
+            for (int c = 0; c < 3; c++) {
+                uint8_t expected = src.data.ptr<uint8_t>()[s * channels + (channels == 1 ? 0 : c)];
+                if (dst.data.ptr<uint8_t>()[(y * ds + x) * 3 + c] != expected)
+                    ok = false;
+            }
+        }
+    }
+    std::string name = str::asprintf("texture %s, %s", channels == 1 ? "luminance" : "rgb",
+            full_validity ? "valid" : "masked");
+    check(name + ", data", ok);
+    check(name + ", mask", check_mask(dd, src, dst, 1));
+}
+
+/* Elevations are converted with the data offset and factor, scaled around
+ * the scale center, and clamped to the scene bounds; likewise the metadata. */
+static void test_elevation(class processor& processor, ecmdb::type_t type, bool full_validity)
+{
+    const float min_elev = -8000.0f;
+    const float max_elev = +9000.0f;
+    const float data_offset = 100.0f;
+    const float data_factor = 0.5f;
+    database_description dd = make_database(ecmdb::category_elevation, type, 1, 3, data_offset, data_factor);
+    dd.processing_parameters[1].elevation.scale_factor = 3.0f;
+    dd.processing_parameters[1].elevation.scale_center = 250.0f;
+    processor.set_elevation_bounds(min_elev, max_elev);
+    quad_mem src, dst;
+    make_quad(dd, full_validity, &src);
+    src.meta.elevation.min = 1000.0f;
+    src.meta.elevation.max = 5000.0f;
+    for (int lens = 0; lens < 2; lens++) {
+        const processing_parameters& pp = dd.processing_parameters[lens];
+        float sf = pp.elevation.scale_factor;
+        float sc = pp.elevation.scale_center;
+        dst = src;
+        process(processor, dd, lens, &dst);
+        int ds = quad_size + 4;
+        bool ok = (dst.data.size() == static_cast<size_t>(ds) * ds * sizeof(float));
+        for (int y = 0; ok && y < ds; y++) {
+            for (int x = 0; ok && x < ds; x++) {
+                size_t s = src_index(dd, 2, x, y);
+                float raw = (type == ecmdb::type_int16 ? src.data.ptr<int16_t>()[s] : src.data.ptr<float>()[s]);
+                float expected = clamp((data_offset + data_factor * raw - sc) * sf + sc, min_elev, max_elev);
+                float processed = dst.data.ptr<float>()[y * ds + x];
+                if (!(std::fabs(processed - expected) <= elevation_tolerance * max(1.0f, std::fabs(expected))))
+                    ok = false;
+            }
+        }
+        std::string name = str::asprintf("elevation %s, %s, %s", type == ecmdb::type_int16 ? "int16" : "float32",
+                full_validity ? "valid" : "masked", lens ? "scaled" : "unscaled");
+        check(name + ", data", ok);
+        check(name + ", mask", check_mask(dd, src, dst, 2));
+        check(name + ", metadata",
+                std::fabs(dst.meta.elevation.min - clamp((1000.0f - sc) * sf + sc, min_elev, max_elev)) <= 1e-2f
+                && std::fabs(dst.meta.elevation.max - clamp((5000.0f - sc) * sf + sc, min_elev, max_elev)) <= 1e-2f);
+    }
+}
+
+/* Linear dynamic range reduction with a white gradient and brightness
+ * adaption yields the reduced amplitude as linear gray. */
+static void test_sar_amplitude_linear(class processor& processor)
+{
+    database_description dd = make_database(ecmdb::category_sar_amplitude, ecmdb::type_float32, 1, 2, 0.0f, 1.0f);
+    dd.meta.sar_amplitude.min = 0.0f;
+    dd.meta.sar_amplitude.max = 1000.0f;
+    dd.meta.sar_amplitude.sum = 500.0f * 1000.0f;
+    dd.meta.sar_amplitude.valid = 1000;
+    processing_parameters& pp = dd.processing_parameters[0];
+    pp.sar_amplitude.despeckling_method = processing_parameters::sar_amplitude_despeckling_none;
+    pp.sar_amplitude.drr_method = processing_parameters::sar_amplitude_drr_linear;
+    pp.sar_amplitude.drr.linear.min_amp = 0.1f;
+    pp.sar_amplitude.drr.linear.max_amp = 0.8f;
+    pp.sar_amplitude.gradient_length = 2;
+    std::memset(pp.sar_amplitude.gradient, 0xff, 2 * 3);
+    pp.sar_amplitude.adapt_brightness = true;
+    quad_mem src, dst;
+    make_quad(dd, false, &src);
+    dst = src;
+    process(processor, dd, false, &dst);
+    int ds = quad_size + 2;
+    bool ok = (dst.data.size() == static_cast<size_t>(ds) * ds * 3);
+    for (int y = 0; ok && y < ds; y++) {
+        for (int x = 0; ok && x < ds; x++) {
+            float amp = src.data.ptr<float>()[src_index(dd, 1, x, y)] / 1000.0f;
+            float reduced = (clamp(amp, 0.1f, 0.8f) - 0.1f) / (0.8f - 0.1f);
+            int expected = linear_to_srgb8(reduced);
+            for (int c = 0; c < 3; c++)
+                if (std::abs(dst.data.ptr<uint8_t>()[(y * ds + x) * 3 + c] - expected) > 1)
+                    ok = false;
+        }
+    }
+    check("sar amplitude linear, data", ok);
+    check("sar amplitude linear, mask", check_mask(dd, src, dst, 1));
+}
+
+/* The generation of the processing parameters of a database changes only
+ * when its parameters change, and e2c is never processed on the CPU. */
+static void test_generations(class processor& processor)
+{
+    std::vector<database_description> dds(2);
+    dds[0] = make_database(ecmdb::category_elevation, ecmdb::type_float32, 1, 2, 0.0f, 1.0f);
+    dds[1] = make_database(ecmdb::category_texture, ecmdb::type_uint8, 3, 2, 0.0f, 1.0f);
+    dds[0].uuid.generate();
+    dds[1].uuid.generate();
+    processor.set_elevation_bounds(-1000.0f, 1000.0f);
+    processor.set_cpu_processing(true, dds);
+    unsigned int g00 = processor.cpu_processing_generation(dds[0], false);
+    unsigned int g01 = processor.cpu_processing_generation(dds[0], true);
+    unsigned int g10 = processor.cpu_processing_generation(dds[1], false);
+    processor.set_cpu_processing(true, dds);
+    check("generations, unchanged parameters",
+            processor.cpu_processing_generation(dds[0], false) == g00
+            && processor.cpu_processing_generation(dds[0], true) == g01
+            && processor.cpu_processing_generation(dds[1], false) == g10);
+    dds[1].processing_parameters[0].texture.contrast = 0.5f;
+    processor.set_cpu_processing(true, dds);
+    check("generations, changed texture parameters",
+            processor.cpu_processing_generation(dds[0], false) == g00
+            && processor.cpu_processing_generation(dds[1], false) != g10);
+    processor.set_elevation_bounds(-2000.0f, 1000.0f);
+    processor.set_cpu_processing(true, dds);
+    check("generations, changed elevation bounds",
+            processor.cpu_processing_generation(dds[0], false) != g00
+            && processor.cpu_processing_generation(dds[0], true) != g01);
+    processor.set_cpu_processing(false, dds);
+    check("generations, disabled", !processor.use_cpu(dds[0], false) && !processor.use_cpu(dds[1], false));
+
+    database_description e2c_dd;
+    e2c_dd.db.create(1.0, 1.0, 4, 1, ecmdb::category_texture, ecmdb::type_uint8, 3, 1, 0.0f, 1.0f,
+            "Texture from elevation", std::vector<std::string>(1, "Test"));
+    e2c_dd.processing_parameters[0] = processing_parameters(true);
+    e2c_dd.processing_parameters[1] = processing_parameters(true);
+    processor.set_cpu_processing(true, std::vector<database_description>(1, e2c_dd));
+    check("e2c not supported", !processor.use_cpu(e2c_dd, false) && !processor.use_cpu(e2c_dd, true));
+}
+
+int main(int argc, char *argv[])
+{
+    /* Initialization: messages */
+    char *program_name = strrchr(argv[0], '/');
+    program_name = program_name ? program_name + 1 : argv[0];
+    msg::set_level(msg::INF);
+    msg::set_program_name(program_name);
+    msg::set_columns_from_env();
+    dbg::init_crashhandler();
+
+    if (argc > 1) {
+        msg::req_txt("Usage: %s\n"
+                "Check the CPU quad processing against reference computations.\n"
+                "Report bugs to <%s>.",
+                program_name, PACKAGE_BUGREPORT);
+        return (std::strcmp(argv[1], "--help") == 0 ? 0 : 1);
+    }
+
+    try {
+        class processor processor;
+        for (int full_validity = 0; full_validity < 2; full_validity++) {
+            test_texture(processor, 3, full_validity);
+            test_texture(processor, 1, full_validity);
+            test_elevation(processor, ecmdb::type_float32, full_validity);
+            test_elevation(processor, ecmdb::type_int16, full_validity);
+        }
+        test_sar_amplitude_linear(processor);
+        test_generations(processor);
+    }
+    catch (std::exception &e) {
+        msg::err("%s", e.what());
+        return 1;
+    }
+    msg::inf("%d of %d checks failed", failures, checks);
+    return (failures == 0 ? 0 : 1);
+}
@@ -0,0 +1,505 @@
+/*
+ * Copyright (C) 2013
+ * Computer Graphics Group, University of Siegen, Germany.
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>.
+ * See http://www.cg.informatik.uni-siegen.de/ for contact information.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * ecmdbgen generates a synthetic ecmdb database with procedural content.
+ *
+ * All content is a deterministic function of the options (in particular the
+ * seed) and of the 3D position of a sample on the planet surface. Neighboring
+ * quads, overlap areas and quads on different levels therefore agree with each
+ * other, and two runs with the same options produce identical databases. This
+ * makes the result usable for reproducible load tests, scale tests, and pixel
+ * exact regression images without any network access.
+ */
+
+#include "config.h"
+
+#include <cstring>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include <ecmdb/ecm.h>
+#include <ecmdb/ecmdb.h>
+
+#include "dbg.h"
+#include "exc.h"
+#include "fio.h"
+#include "msg.h"
+#include "opt.h"
+#include "str.h"
+#include "blb.h"
+
+
+/* Deterministic noise functions */
+
+static uint32_t hash(uint32_t a, uint32_t b, uint32_t c, uint32_t d, uint32_t seed)
+{
+    uint32_t h = seed ^ 0x9e3779b9u;
+    uint32_t v[4] = { a, b, c, d };
+    for (int i = 0; i < 4; i++) {
+        h ^= v[i] * 0xcc9e2d51u;
+        h = (h << 13) | (h >> 19);
+        h = h * 5u + 0xe6546b64u;
+    }
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+}
+
+// Uniformly distributed value in [0,1)
+static double hash01(uint32_t a, uint32_t b, uint32_t c, uint32_t d, uint32_t seed)
+{
+    return hash(a, b, c, d, seed) / 4294967296.0;
+}
+
+// Value noise in [0,1) at position p
+static double value_noise(const double p[3], uint32_t seed)
+{
+    double fl[3], f[3];
+    for (int i = 0; i < 3; i++) {
+        fl[i] = std::floor(p[i]);
+        f[i] = p[i] - fl[i];
+        f[i] = f[i] * f[i] * (3.0 - 2.0 * f[i]);
+    }
+    int32_t ix = fl[0], iy = fl[1], iz = fl[2];
+    double c[2][2][2];
+    for (int k = 0; k < 2; k++)
+        for (int j = 0; j < 2; j++)
+            for (int i = 0; i < 2; i++)
+                c[k][j][i] = hash01(ix + i, iy + j, iz + k, 0, seed);
+    double x00 = c[0][0][0] + f[0] * (c[0][0][1] - c[0][0][0]);
+    double x01 = c[0][1][0] + f[0] * (c[0][1][1] - c[0][1][0]);
+    double x10 = c[1][0][0] + f[0] * (c[1][0][1] - c[1][0][0]);
+    double x11 = c[1][1][0] + f[0] * (c[1][1][1] - c[1][1][0]);
+    double y0 = x00 + f[1] * (x01 - x00);
+    double y1 = x10 + f[1] * (x11 - x10);
+    return y0 + f[2] * (y1 - y0);
+}
+
+// Fractal noise in [0,1) at position p on the unit sphere
+static double fbm(const double p[3], double frequency, int octaves, uint32_t seed)
+{
+    double sum = 0.0;
+    double amplitude = 0.5;
+    double amplitude_sum = 0.0;
+    for (int o = 0; o < octaves; o++) {
+        double q[3] = { p[0] * frequency, p[1] * frequency, p[2] * frequency };
+        sum += amplitude * value_noise(q, seed + o);
+        amplitude_sum += amplitude;
+        amplitude *= 0.5;
+        frequency *= 2.0;
+    }
+    return sum / amplitude_sum;
+}
+
+
+/* The generator */
+
+class generator
+{
+public:
+    // Parameters
+    class ecm ecm;
+    ecmdb::category_t category;
+    ecmdb::type_t type;
+    int channels;
+    int quad_size;
+    int levels;
+    int overlap;
+    float value_min, value_max;
+    float data_offset, data_factor;
+    double mask_density;
+    std::vector<double> coverage;
+    uint32_t seed;
+    int octaves;
+
+    // Global metadata, accumulated while writing quads
+    ecmdb::metadata meta;
+
+    generator() : meta()
+    {
+    }
+
+    // Is the given quad present? This decides per level, based on the coverage of that level.
+    bool quad_is_covered(int side, int level, int x, int y) const
+    {
+        return hash01(side, level, x, y, seed + 1) < coverage[level];
+    }
+
+    // Recursively add all present quads on the deepest level
+    void add_quads(class ecmdb& db, int side, int level, int x, int y) const
+    {
+        if (!quad_is_covered(side, level, x, y))
+            return;
+        if (level == levels - 1) {
+            db.add_quad(side, x, y);
+        } else {
+            for (int i = 0; i < 4; i++)
+                add_quads(db, side, level + 1, 2 * x + i % 2, 2 * y + i / 2);
+        }
+    }
+
+    // Physical value of the given channel at the given unit sphere position
+    float value(const double p[3], int channel) const
+    {
+        double v;
+        if (category == ecmdb::category_elevation) {
+            v = fbm(p, 2.0, octaves, seed);
+        } else if (category == ecmdb::category_texture) {
+            double h = fbm(p, 2.0, octaves, seed);
+            // A simple colormap: water, vegetation, rock, snow
+            static const float colormap[5][4] = {
+                { 0.05f, 0.15f, 0.45f, 1.0f },
+                { 0.20f, 0.45f, 0.70f, 1.0f },
+                { 0.25f, 0.50f, 0.20f, 1.0f },
+                { 0.50f, 0.40f, 0.30f, 1.0f },
+                { 0.95f, 0.95f, 0.95f, 1.0f }
+            };
+            double t = std::max(0.0, std::min(3.999, (h - 0.3) / 0.4 * 4.0));
+            int i = t;
+            t -= i;
+            if (channels <= 2) {
+                // Luminance (and alpha)
+                double l0 = (colormap[i][0] + colormap[i][1] + colormap[i][2]) / 3.0;
+                double l1 = (colormap[i + 1][0] + colormap[i + 1][1] + colormap[i + 1][2]) / 3.0;
+                v = (channel == 0 ? l0 + t * (l1 - l0) : 1.0);
+            } else {
+                v = colormap[i][channel] + t * (colormap[i + 1][channel] - colormap[i][channel]);
+            }
+        } else if (category == ecmdb::category_sar_amplitude) {
+            // Speckle-like high frequency noise on a smooth background
+            double b = fbm(p, 2.0, octaves / 2 + 1, seed);
+            double s = fbm(p, 64.0, octaves, seed + channel + 3);
+            // The product can exceed 1; clamp it so that the values stay
+            // within [value_min, value_max] as stated by the metadata.
+            v = std::min(b * b * (0.5 + s), 1.0);
+        } else {
+            v = fbm(p, 2.0, octaves, seed + 17 * channel);
+        }
+        return value_min + v * (value_max - value_min);
+    }
+
+    // Store a physical value in the quad data
+    void store(float v, void* data, size_t i) const
+    {
+        float raw = (v - data_offset) / data_factor;
+        if (type == ecmdb::type_uint8) {
+            static_cast<uint8_t*>(data)[i] = std::max(0.0f, std::min(255.0f, raw + 0.5f));
+        } else if (type == ecmdb::type_int16) {
+            static_cast<int16_t*>(data)[i] = std::floor(std::max(-32767.0f, std::min(32767.0f, raw)) + 0.5f);
+        } else {
+            static_cast<float*>(data)[i] = raw;
+        }
+    }
+
+    // Generate and save one quad
+    void write_quad(const class ecmdb& db, const std::string& dir, int side, int level, int x, int y)
+    {
+        const int tqs = db.total_quad_size();
+        blob data(db.data_size());
+        blob mask(db.mask_size());
+        ecmdb::metadata quad_meta(category);
+        if (category == ecmdb::category_elevation) {
+            quad_meta.elevation.min = std::numeric_limits<float>::max();
+            quad_meta.elevation.max = -std::numeric_limits<float>::max();
+        } else if (category == ecmdb::category_sar_amplitude) {
+            quad_meta.sar_amplitude.min = std::numeric_limits<float>::max();
+            quad_meta.sar_amplitude.max = -std::numeric_limits<float>::max();
+            quad_meta.sar_amplitude.sum = 0.0f;
+            quad_meta.sar_amplitude.valid = 0;
+        }
+
+        double corners[4][2];
+        ecm::quad_to_ecm(side, level, x, y, ecm::corner_tl, &corners[0][0], &corners[0][1]);
+        ecm::quad_to_ecm(side, level, x, y, ecm::corner_tr, &corners[1][0], &corners[1][1]);
+        ecm::quad_to_ecm(side, level, x, y, ecm::corner_bl, &corners[2][0], &corners[2][1]);
+        ecm::quad_to_ecm(side, level, x, y, ecm::corner_br, &corners[3][0], &corners[3][1]);
+        // Overlap samples are extrapolated from the quad, but they must not leave the cube side.
+        const double quads_per_side = std::ldexp(1.0, level);
+        bool all_valid = true;
+        for (int j = 0; j < tqs; j++) {
+            double t = (j - overlap + 0.5) / quad_size;
+            t = std::max(-static_cast<double>(y), std::min(quads_per_side - y, t));
+            for (int i = 0; i < tqs; i++) {
+                double s = (i - overlap + 0.5) / quad_size;
+                s = std::max(-static_cast<double>(x), std::min(quads_per_side - x, s));
+                double ecmx = (1.0 - t) * ((1.0 - s) * corners[0][0] + s * corners[1][0])
+                    + t * ((1.0 - s) * corners[2][0] + s * corners[3][0]);
+                double ecmy = (1.0 - t) * ((1.0 - s) * corners[0][1] + s * corners[1][1])
+                    + t * ((1.0 - s) * corners[2][1] + s * corners[3][1]);
+                double p[3];
+                ecm.ecm_to_cartesian(ecmx, ecmy, p);
+                double l = std::sqrt(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]);
+                p[0] /= l;
+                p[1] /= l;
+                p[2] /= l;
+                size_t e = j * tqs + i;
+                bool valid = (mask_density >= 1.0 || fbm(p, 16.0, 3, seed + 4) < mask_density);
+                mask.ptr<uint8_t>()[e] = (valid ? 0xff : 0x00);
+                all_valid = all_valid && valid;
+                for (int c = 0; c < channels; c++) {
+                    float v = valid ? value(p, c) : value_min;
+                    store(v, data.ptr(), e * channels + c);
+                    if (!valid)
+                        continue;
+                    if (category == ecmdb::category_elevation) {
+                        quad_meta.elevation.min = std::min(quad_meta.elevation.min, v);
+                        quad_meta.elevation.max = std::max(quad_meta.elevation.max, v);
+                    } else if (category == ecmdb::category_sar_amplitude) {
+                        quad_meta.sar_amplitude.min = std::min(quad_meta.sar_amplitude.min, v);
+                        quad_meta.sar_amplitude.max = std::max(quad_meta.sar_amplitude.max, v);
+                        if (i >= overlap && i < tqs - overlap && j >= overlap && j < tqs - overlap) {
+                            quad_meta.sar_amplitude.sum += v;
+                            quad_meta.sar_amplitude.valid++;
+                        }
+                    }
+                }
+            }
+        }
+
+        std::string filename = ecmdb::quad_filename(side, level, x, y);
+        fio::mkdir_p(dir, fio::dirname(filename));
+        db.save_quad(dir + '/' + filename, data.ptr(), mask.ptr<uint8_t>(), all_valid, quad_meta);
+
+        // Accumulate global metadata. Sums are taken from level 0 only
+        // so that each area of the planet counts exactly once.
+        if (category == ecmdb::category_elevation) {
+            meta.elevation.min = std::min(meta.elevation.min, quad_meta.elevation.min);
+            meta.elevation.max = std::max(meta.elevation.max, quad_meta.elevation.max);
+        } else if (category == ecmdb::category_sar_amplitude) {
+            meta.sar_amplitude.min = std::min(meta.sar_amplitude.min, quad_meta.sar_amplitude.min);
+            meta.sar_amplitude.max = std::max(meta.sar_amplitude.max, quad_meta.sar_amplitude.max);
+            if (level == 0) {
+                meta.sar_amplitude.sum += quad_meta.sar_amplitude.sum;
+                meta.sar_amplitude.valid += quad_meta.sar_amplitude.valid;
+            }
+        }
+    }
+
+    // Recursively write all quads that the database contains
+    void write_quads(const class ecmdb& db, const std::string& dir, int side, int level, int x, int y,
+            std::vector<unsigned long>& quads_per_level)
+    {
+        if (!db.has_quad(side, level, x, y))
+            return;
+        write_quad(db, dir, side, level, x, y);
+        quads_per_level[level]++;
+        if (level < levels - 1) {
+            for (int i = 0; i < 4; i++)
+                write_quads(db, dir, side, level + 1, 2 * x + i % 2, 2 * y + i / 2, quads_per_level);
+        }
+    }
+};
+
+
+int main(int argc, char *argv[])
+{
+    /* Initialization: messages */
+    char *program_name = strrchr(argv[0], '/');
+    program_name = program_name ? program_name + 1 : argv[0];
+    msg::set_level(msg::INF);
+    msg::set_program_name(program_name);
+    msg::set_columns_from_env();
+    dbg::init_crashhandler();
+
+    /* Command line handling */
+    std::vector<opt::option *> options;
+    opt::info help("help", '\0', opt::optional);
+    options.push_back(&help);
+    std::vector<std::string> planet_values;
+    planet_values.push_back("earth");
+    planet_values.push_back("mars");
+    planet_values.push_back("moon");
+    opt::val<std::string> planet("planet", 'p', opt::optional, planet_values, "earth");
+    options.push_back(&planet);
+    std::vector<std::string> category_values;
+    category_values.push_back("elevation");
+    category_values.push_back("texture");
+    category_values.push_back("sar-amplitude");
+    category_values.push_back("data");
+    opt::val<std::string> category("category", 'c', opt::optional, category_values, "elevation");
+    options.push_back(&category);
+    std::vector<std::string> type_values;
+    type_values.push_back("uint8");
+    type_values.push_back("int16");
+    type_values.push_back("float32");
+    opt::val<std::string> type("type", 't', opt::optional, type_values, "");
+    options.push_back(&type);
+    opt::val<int> channels("channels", '\0', opt::optional, 1, 4, 1);
+    options.push_back(&channels);
+    opt::val<int> quad_size("quad-size", 'q', opt::optional, 2, 4096, 512);
+    options.push_back(&quad_size);
+    opt::val<int> levels("levels", 'l', opt::optional, 1, ecmdb::max_levels, 4);
+    options.push_back(&levels);
+    opt::val<int> overlap("overlap", '\0', opt::optional, 0, ecmdb::max_overlap, 2);
+    options.push_back(&overlap);
+    opt::val<double> mask_density("mask-density", 'm', opt::optional, 0.0, 1.0, 1.0);
+    options.push_back(&mask_density);
+    opt::tuple<double> coverage("coverage", '\0', opt::optional, 0.0, 1.0, std::vector<double>());
+    options.push_back(&coverage);
+    opt::val<unsigned int> seed("seed", 's', opt::optional, 0u);
+    options.push_back(&seed);
+
+    std::vector<std::string> arguments;
+    if (!opt::parse(argc, argv, options, 1, 1, arguments)) {
+        return 1;
+    }
+    if (help.value()) {
+        msg::req_txt("Usage: %s [option...] <output-dir>\n"
+                "Generate a synthetic ecmdb database with deterministic procedural content.\n"
+                "    [--help]               Print help and exit\n"
+                "    [-p|--planet=<p>]      earth, mars, or moon. Default is earth.\n"
+                "    [-c|--category=<c>]    elevation, texture, sar-amplitude, or data.\n"
+                "                           Default is elevation.\n"
+                "    [-t|--type=<t>]        uint8, int16, or float32. Texture requires uint8.\n"
+                "                           Default is uint8 for texture and float32 otherwise.\n"
+                "    [--channels=<n>]       Number of channels (1-4). Texture defaults to 3,\n"
+                "                           other categories require 1 except for data.\n"
+                "    [-q|--quad-size=<n>]   Quad size in samples. Default is 512.\n"
+                "    [-l|--levels=<n>]      Number of quad tree levels. Default is 4.\n"
+                "    [--overlap=<n>]        Quad overlap in samples. Default is 2.\n"
+                "    [-m|--mask-density=<d>]\n"
+                "                           Approximate fraction of valid samples. Default is 1.\n"
+                "    [--coverage=<c0>,<c1>,...]\n"
+                "                           Fraction of quads present on each level, relative\n"
+                "                           to the level above. Missing entries are 1.\n"
+                "    [-s|--seed=<n>]        Seed for the procedural content. Default is 0.\n"
+                "Report bugs to <%s>.",
+                program_name, PACKAGE_BUGREPORT);
+        return 0;
+    }
+
+    class generator gen;
+    try {
+        const std::string& dir = arguments[0];
+
+        if (planet.value() == "earth")
+            gen.ecm = ecm(ecm::semi_major_axis_earth_wgs84, ecm::semi_minor_axis_earth_wgs84);
+        else if (planet.value() == "mars")
+            gen.ecm = ecm(ecm::semi_major_axis_mars_nasa, ecm::semi_minor_axis_mars_nasa);
+        else
+            gen.ecm = ecm(ecm::radius_moon_nasa, ecm::radius_moon_nasa);
+        gen.category = (category.value() == "elevation" ? ecmdb::category_elevation
+                : category.value() == "texture" ? ecmdb::category_texture
+                : category.value() == "sar-amplitude" ? ecmdb::category_sar_amplitude
+                : ecmdb::category_data);
+        std::string type_name = type.value();
+        if (type_name.empty())
+            type_name = (gen.category == ecmdb::category_texture ? "uint8" : "float32");
+        gen.type = (type_name == "uint8" ? ecmdb::type_uint8
+                : type_name == "int16" ? ecmdb::type_int16
+                : ecmdb::type_float32);
+        gen.channels = channels.value();
+        if (gen.category == ecmdb::category_texture) {
+            if (gen.type != ecmdb::type_uint8)
+                throw exc("texture databases require type uint8");
+            if (!channels.values().size())
+                gen.channels = 3;
+        } else if (gen.category != ecmdb::category_data && gen.channels != 1) {
+            throw exc(category.value() + " databases require exactly one channel");
+        }
+        gen.quad_size = quad_size.value();
+        gen.levels = levels.value();
+        gen.overlap = overlap.value();
+        gen.mask_density = mask_density.value();
+        gen.coverage = coverage.value();
+        gen.coverage.resize(gen.levels, 1.0);
+        gen.seed = seed.value();
+        // Enough octaves to have detail down to the sample spacing of the deepest level
+        gen.octaves = gen.levels + std::log(static_cast<double>(gen.quad_size)) / std::log(2.0);
+
+        // Physical value range, and the mapping from stored to physical values
+        if (gen.category == ecmdb::category_elevation) {
+            gen.value_min = -8000.0f;
+            gen.value_max = +8000.0f;
+        } else if (gen.category == ecmdb::category_sar_amplitude) {
+            gen.value_min = 0.0f;
+            gen.value_max = 1000.0f;
+        } else {
+            gen.value_min = 0.0f;
+            gen.value_max = 1.0f;
+        }
+        if (gen.category == ecmdb::category_texture) {
+            // Texture colors are stored as normalized uint8 values
+            gen.data_offset = 0.0f;
+            gen.data_factor = 1.0f / 255.0f;
+        } else if (gen.type == ecmdb::type_float32) {
+            gen.data_offset = 0.0f;
+            gen.data_factor = 1.0f;
+        } else if (gen.type == ecmdb::type_int16) {
+            gen.data_offset = 0.5f * (gen.value_min + gen.value_max);
+            gen.data_factor = (gen.value_max - gen.value_min) / 65534.0f;
+        } else {
+            gen.data_offset = gen.value_min;
+            gen.data_factor = (gen.value_max - gen.value_min) / 255.0f;
+        }
+
+        std::vector<std::string> description;
+        description.push_back(str::asprintf("Synthetic %s database generated by %s.",
+                    category.value().c_str(), program_name));
+        description.push_back(str::asprintf("Planet %s, type %s, %d channel(s), quad size %d, %d level(s), overlap %d.",
+                    planet.value().c_str(), type_name.c_str(), gen.channels, gen.quad_size, gen.levels, gen.overlap));
+        description.push_back(str::asprintf("Mask density %g, seed %u.", gen.mask_density, gen.seed));
+        class ecmdb db;
+        db.create(gen.ecm.semi_major_axis(), gen.ecm.semi_minor_axis(),
+                gen.quad_size, gen.levels, gen.category, gen.type, gen.channels, gen.overlap,
+                gen.category == ecmdb::category_texture ? 0.0f : gen.data_offset,
+                gen.category == ecmdb::category_texture ? 1.0f : gen.data_factor,
+                std::string("Synthetic ") + category.value(), description);
+
+        for (int s = 0; s < 6; s++)
+            gen.add_quads(db, s, 0, 0, 0);
+
+        gen.meta = ecmdb::metadata(gen.category);
+        if (gen.category == ecmdb::category_elevation) {
+            gen.meta.elevation.min = std::numeric_limits<float>::max();
+            gen.meta.elevation.max = -std::numeric_limits<float>::max();
+        } else if (gen.category == ecmdb::category_sar_amplitude) {
+            gen.meta.sar_amplitude.min = std::numeric_limits<float>::max();
+            gen.meta.sar_amplitude.max = -std::numeric_limits<float>::max();
+            gen.meta.sar_amplitude.sum = 0.0f;
+            gen.meta.sar_amplitude.valid = 0;
+        }
+
+        fio::mkdir_p(dir);
+        std::vector<unsigned long> quads_per_level(gen.levels, 0);
+        for (int s = 0; s < 6; s++)
+            gen.write_quads(db, dir, s, 0, 0, 0, quads_per_level);
+        db.write(dir + '/');
+        gen.meta.write(dir + '/');
+
+        unsigned long quads = 0;
+        for (int l = 0; l < gen.levels; l++) {
+            msg::inf("Level %d: %lu quads", l, quads_per_level[l]);
+            quads += quads_per_level[l];
+        }
+        msg::inf("Wrote %lu quads to %s", quads, dir.c_str());
+    }
+    catch (std::exception &e) {
+        msg::err("%s", e.what());
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,502 @@
+/*
+ * Copyright (C) 2013
+ * Computer Graphics Group, University of Siegen, Germany.
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>.
+ * See http://www.cg.informatik.uni-siegen.de/ for contact information.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * ecmdbserve serves a local directory (typically an ecmdb database) over HTTP
+ * on the loopback interface, and optionally misbehaves like a slow, overloaded
+ * or broken remote server. This allows to test how the disk cache fetchers
+ * deal with latency, limited bandwidth, errors, resets and stalls, without
+ * depending on real remote servers.
+ *
+ * The number of concurrent connections is limited by the number of worker
+ * threads; additional connections wait in the listen backlog, as they would
+ * with an overloaded server.
+ */
+
+#include "config.h"
+
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+#include <unistd.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "dbg.h"
+#include "exc.h"
+#include "fio.h"
+#include "msg.h"
+#include "opt.h"
+#include "str.h"
+#include "pth.h"
+#include "sys.h"
+#include "tmr.h"
+
+
+static volatile sig_atomic_t quit = 0;
+
+static void signal_handler(int)
+{
+    quit = 1;
+}
+
+// Server configuration
+class server_config
+{
+public:
+    std::string root;
+    int latency;                // milliseconds
+    int latency_jitter;         // milliseconds
+    long bandwidth;             // bytes per second per connection, 0 = unlimited
+    double p_404;
+    double p_500;
+    double p_reset;
+    double p_stall;
+    int stall_time;             // milliseconds, 0 = until the client gives up
+    unsigned int seed;
+};
+
+// Server statistics
+class server_stats
+{
+private:
+    mutex _mutex;
+
+public:
+    enum outcome {
+        ok = 0, not_found, error_404, error_500, reset, stall, bad_request, outcomes
+    };
+    unsigned long count[outcomes];
+    unsigned long long bytes;
+    std::vector<long long> latencies;   // microseconds, successful requests only
+
+    server_stats() : bytes(0)
+    {
+        std::memset(count, 0, sizeof(count));
+    }
+
+    void add(enum outcome o, unsigned long long b, long long latency)
+    {
+        _mutex.lock();
+        count[o]++;
+        bytes += b;
+        if (o == ok)
+            latencies.push_back(latency);
+        _mutex.unlock();
+    }
+
+    static const char* outcome_name(enum outcome o)
+    {
+        static const char* names[] = { "ok", "not found", "injected 404", "injected 500",
+            "injected reset", "injected stall", "bad request" };
+        return names[o];
+    }
+};
+
+class worker : public thread
+{
+private:
+    int _listen_fd;
+    const server_config& _conf;
+    server_stats& _stats;
+    uint32_t _rng;
+
+    // Deterministic per-worker random numbers in [0,1)
+    double random()
+    {
+        _rng ^= _rng << 13;
+        _rng ^= _rng >> 17;
+        _rng ^= _rng << 5;
+        return _rng / 4294967296.0;
+    }
+
+    // Sleep for the given time, but wake up early if the server quits or
+    // the client closes the connection. Returns false in the latter cases.
+    bool delay(int fd, long long msecs)
+    {
+        int64_t end = timer::get(timer::monotonic) + msecs * 1000;
+        for (;;) {
+            int64_t now = timer::get(timer::monotonic);
+            if (quit)
+                return false;
+            if (msecs >= 0 && now >= end)
+                return true;
+            struct pollfd pfd;
+            pfd.fd = fd;
+            pfd.events = POLLIN;
+            pfd.revents = 0;
+            int timeout = (msecs < 0 ? 100 : std::min(static_cast<int64_t>(100), (end - now) / 1000 + 1));
+            int r = ::poll(&pfd, 1, timeout);
+            if (r > 0) {
+                char c;
+                if (pfd.revents & (POLLHUP | POLLERR))
+                    return false;
+                if ((pfd.revents & POLLIN) && ::recv(fd, &c, 1, MSG_PEEK) <= 0)
+                    return false;
+                // Pipelined data from the client; we ignore it.
+                sys::msleep(std::max(1, timeout));
+            }
+        }
+    }
+
+    bool send_all(int fd, const char* buf, size_t len)
+    {
+        while (len > 0) {
+            ssize_t r = ::send(fd, buf, len, MSG_NOSIGNAL);
+            if (r < 0 && errno == EINTR)
+                continue;
+            if (r <= 0)
+                return false;
+            buf += r;
+            len -= r;
+        }
+        return true;
+    }
+
+    void send_status(int fd, int status, const char* reason)
+    {
+        std::string s = str::asprintf("HTTP/1.1 %d %s\r\nContent-Length: 0\r\nConnection: close\r\n\r\n", status, reason);
+        send_all(fd, s.data(), s.length());
+    }
+
+    // Read the request header and return the requested path (empty on failure)
+    std::string read_request(int fd, bool* head)
+    {
+        std::string req;
+        char buf[1024];
+        while (req.find("\r\n\r\n") == std::string::npos) {
+            if (req.length() > 16384 || quit)
+                return std::string();
+            ssize_t r = ::recv(fd, buf, sizeof(buf), 0);
+            if (r < 0 && errno == EINTR)
+                continue;
+            if (r <= 0)
+                return std::string();
+            req.append(buf, r);
+        }
+        size_t sp1 = req.find(' ');
+        size_t sp2 = (sp1 == std::string::npos ? sp1 : req.find(' ', sp1 + 1));
+        if (sp2 == std::string::npos)
+            return std::string();
+        std::string method = req.substr(0, sp1);
+        std::string path = req.substr(sp1 + 1, sp2 - sp1 - 1);
+        if ((method != "GET" && method != "HEAD") || path.empty() || path[0] != '/')
+            return std::string();
+        *head = (method == "HEAD");
+        size_t q = path.find_first_of("?#");
+        if (q != std::string::npos)
+            path.erase(q);
+        return path;
+    }
+
+    void handle(int fd)
+    {
+        int64_t t0 = timer::get(timer::monotonic);
+        bool head = false;
+        std::string path = read_request(fd, &head);
+        if (path.empty()) {
+            send_status(fd, 400, "Bad Request");
+            _stats.add(server_stats::bad_request, 0, 0);
+            return;
+        }
+
+        double r = random();
+        if (r < _conf.p_reset) {
+            // Abort the connection: SO_LINGER with zero timeout sends a RST on close
+            struct linger l;
+            l.l_onoff = 1;
+            l.l_linger = 0;
+            ::setsockopt(fd, SOL_SOCKET, SO_LINGER, &l, sizeof(l));
+            _stats.add(server_stats::reset, 0, 0);
+            msg::dbg("%s: reset", path.c_str());
+            return;
+        }
+        r -= _conf.p_reset;
+        if (r < _conf.p_stall) {
+            msg::dbg("%s: stall", path.c_str());
+            delay(fd, _conf.stall_time > 0 ? _conf.stall_time : -1);
+            _stats.add(server_stats::stall, 0, 0);
+            return;
+        }
+        r -= _conf.p_stall;
+
+        long long latency = _conf.latency;
+        if (_conf.latency_jitter > 0)
+            latency += static_cast<long long>(random() * (2 * _conf.latency_jitter + 1)) - _conf.latency_jitter;
+        if (latency > 0 && !delay(fd, latency))
+            return;
+
+        if (r < _conf.p_500) {
+            send_status(fd, 500, "Internal Server Error");
+            _stats.add(server_stats::error_500, 0, 0);
+            msg::dbg("%s: 500", path.c_str());
+            return;
+        }
+        r -= _conf.p_500;
+        std::string filename = _conf.root + path;
+        struct stat st;
+        if (r < _conf.p_404 || path.find("/../") != std::string::npos
+                || path.compare(path.length() >= 3 ? path.length() - 3 : 0, 3, "/..") == 0
+                || !fio::stat(filename, &st) || !S_ISREG(st.st_mode)) {
+            send_status(fd, 404, "Not Found");
+            _stats.add(r < _conf.p_404 ? server_stats::error_404 : server_stats::not_found, 0, 0);
+            msg::dbg("%s: 404", path.c_str());
+            return;
+        }
+
+        std::string header = str::asprintf("HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\n"
+                "Content-Length: %s\r\nConnection: close\r\n\r\n", str::from(st.st_size).c_str());
+        if (!send_all(fd, header.data(), header.length()))
+            return;
+        unsigned long long sent = 0;
+        if (!head) {
+            FILE* f = fio::open(filename, "r");
+            // Send in chunks of 1/10 of the bandwidth per 100 ms
+            std::vector<char> buf(_conf.bandwidth > 0 ? std::max(1L, _conf.bandwidth / 10) : 65536);
+            int64_t start = timer::get(timer::monotonic);
+            size_t n;
+            try {
+                while ((n = std::fread(&buf[0], 1, buf.size(), f)) > 0) {
+                    if (_conf.bandwidth > 0) {
+                        long long due = (sent + n) * 1000000 / _conf.bandwidth;
+                        long long elapsed = timer::get(timer::monotonic) - start;
+                        if (due > elapsed && !delay(fd, (due - elapsed) / 1000))
+                            break;
+                    }
+                    if (!send_all(fd, &buf[0], n))
+                        break;
+                    sent += n;
+                }
+            }
+            catch (...) {
+                fio::close(f, filename);
+                throw;
+            }
+            fio::close(f, filename);
+        }
+        _stats.add(server_stats::ok, sent, timer::get(timer::monotonic) - t0);
+        msg::dbg("%s: 200, %s bytes", path.c_str(), str::from(sent).c_str());
+    }
+
+public:
+    worker(int listen_fd, const server_config& conf, server_stats& stats, int index) :
+        _listen_fd(listen_fd), _conf(conf), _stats(stats), _rng(conf.seed * 2654435761u + index + 1)
+    {
+        if (_rng == 0)
+            _rng = 1;
+    }
+
+    void run()
+    {
+        while (!quit) {
+            int fd = ::accept(_listen_fd, NULL, NULL);
+            if (fd < 0) {
+                if (errno == EINTR || errno == ECONNABORTED)
+                    continue;
+                break;  // the listening socket was shut down
+            }
+            try {
+                handle(fd);
+            }
+            catch (std::exception& e) {
+                msg::wrn("%s", e.what());
+            }
+            ::close(fd);
+        }
+    }
+};
+
+
+int main(int argc, char *argv[])
+{
+    /* Initialization: messages */
+    char *program_name = strrchr(argv[0], '/');
+    program_name = program_name ? program_name + 1 : argv[0];
+    msg::set_level(msg::INF);
+    msg::set_program_name(program_name);
+    msg::set_columns_from_env();
+    dbg::init_crashhandler();
+
+    /* Command line handling */
+    std::vector<opt::option *> options;
+    opt::info help("help", '\0', opt::optional);
+    options.push_back(&help);
+    opt::flag verbose("verbose", 'v', opt::optional);
+    options.push_back(&verbose);
+    opt::val<int> port("port", 'p', opt::optional, 0, 65535, 8080);
+    options.push_back(&port);
+    opt::val<std::string> port_file("port-file", '\0', opt::optional);
+    options.push_back(&port_file);
+    opt::val<int> max_connections("max-connections", 'c', opt::optional, 1, 1024, 8);
+    options.push_back(&max_connections);
+    opt::val<int> latency("latency", 'l', opt::optional, 0, 600000, 0);
+    options.push_back(&latency);
+    opt::val<int> latency_jitter("latency-jitter", '\0', opt::optional, 0, 600000, 0);
+    options.push_back(&latency_jitter);
+    opt::val<long> bandwidth("bandwidth", 'b', opt::optional, 0, std::numeric_limits<long>::max(), 0);
+    options.push_back(&bandwidth);
+    opt::val<double> p_404("error-404", '\0', opt::optional, 0.0, 1.0, 0.0);
+    options.push_back(&p_404);
+    opt::val<double> p_500("error-500", '\0', opt::optional, 0.0, 1.0, 0.0);
+    options.push_back(&p_500);
+    opt::val<double> p_reset("reset", '\0', opt::optional, 0.0, 1.0, 0.0);
+    options.push_back(&p_reset);
+    opt::val<double> p_stall("stall", '\0', opt::optional, 0.0, 1.0, 0.0);
+    options.push_back(&p_stall);
+    opt::val<int> stall_time("stall-time", '\0', opt::optional, 0, 3600000, 0);
+    options.push_back(&stall_time);
+    opt::val<unsigned int> seed("seed", 's', opt::optional, 0u);
+    options.push_back(&seed);
+
+    std::vector<std::string> arguments;
+    if (!opt::parse(argc, argv, options, 1, 1, arguments)) {
+        return 1;
+    }
+    if (help.value()) {
+        msg::req_txt("Usage: %s [option...] <dir>\n"
+                "Serve a directory over HTTP on the loopback interface, with fault injection.\n"
+                "    [--help]               Print help and exit\n"
+                "    [-v|--verbose]         Log every request\n"
+                "    [-p|--port=<n>]        Port to listen on. Default is 8080.\n"
+                "                           Use 0 to let the system choose a free port.\n"
+                "    [--port-file=<file>]   Write the port to this file once the server\n"
+                "                           accepts connections.\n"
+                "    [-c|--max-connections=<n>]\n"
+                "                           Maximum number of concurrent connections. Default is 8.\n"
+                "    [-l|--latency=<ms>]    Delay before each response. Default is 0.\n"
+                "    [--latency-jitter=<ms>]\n"
+                "                           Uniform random variation of the latency. Default is 0.\n"
+                "    [-b|--bandwidth=<bytes/s>]\n"
+                "                           Bandwidth limit per connection. Default is unlimited.\n"
+                "    [--error-404=<p>]      Probability of a 404 response.\n"
+                "    [--error-500=<p>]      Probability of a 500 response.\n"
+                "    [--reset=<p>]          Probability of a connection reset.\n"
+                "    [--stall=<p>]          Probability of a stalled connection.\n"
+                "    [--stall-time=<ms>]    Stall duration. Default is until the client gives up.\n"
+                "    [-s|--seed=<n>]        Seed for the fault injection. Default is 0.\n"
+                "Report bugs to <%s>.",
+                program_name, PACKAGE_BUGREPORT);
+        return 0;
+    }
+    if (verbose.value())
+        msg::set_level(msg::DBG);
+    if (p_404.value() + p_500.value() + p_reset.value() + p_stall.value() > 1.0) {
+        msg::err("The sum of all fault probabilities must not exceed 1");
+        return 1;
+    }
+
+    server_config conf;
+    conf.root = arguments[0];
+    conf.latency = latency.value();
+    conf.latency_jitter = std::min(latency_jitter.value(), latency.value());
+    conf.bandwidth = bandwidth.value();
+    conf.p_404 = p_404.value();
+    conf.p_500 = p_500.value();
+    conf.p_reset = p_reset.value();
+    conf.p_stall = p_stall.value();
+    conf.stall_time = stall_time.value();
+    conf.seed = seed.value();
+    server_stats stats;
+
+    int listen_fd = -1;
+    std::vector<worker*> workers;
+    int retval = 0;
+    try {
+        if (!fio::test_d(conf.root))
+            throw exc(conf.root + ": not a directory");
+        listen_fd = ::socket(AF_INET, SOCK_STREAM, 0);
+        if (listen_fd < 0)
+            throw exc("cannot create socket", errno);
+        int one = 1;
+        ::setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        struct sockaddr_in addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(port.value());
+        if (::bind(listen_fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0)
+            throw exc(str::asprintf("cannot bind to port %d", port.value()), errno);
+        if (::listen(listen_fd, 128) != 0)
+            throw exc("cannot listen", errno);
+        socklen_t addr_len = sizeof(addr);
+        if (::getsockname(listen_fd, reinterpret_cast<struct sockaddr*>(&addr), &addr_len) != 0)
+            throw exc("cannot get socket address", errno);
+        int bound_port = ntohs(addr.sin_port);
+
+        std::signal(SIGINT, signal_handler);
+        std::signal(SIGTERM, signal_handler);
+        std::signal(SIGPIPE, SIG_IGN);
+        for (int i = 0; i < max_connections.value(); i++) {
+            workers.push_back(new worker(listen_fd, conf, stats, i));
+            workers.back()->start();
+        }
+        msg::inf("Serving %s at http://127.0.0.1:%d/", conf.root.c_str(), bound_port);
+        if (!port_file.value().empty()) {
+            // Write to a temporary file and rename it, so that a reader
+            // never sees an incomplete port number.
+            std::string tmp = port_file.value() + ".tmp";
+            FILE* f = fio::open(tmp, "w");
+            std::string s = str::from(bound_port) + '\n';
+            fio::write(s.c_str(), s.length(), 1, f, tmp);
+            fio::close(f, tmp);
+            fio::rename(tmp, port_file.value());
+        }
+        while (!quit)
+            sys::msleep(100);
+    }
+    catch (std::exception& e) {
+        msg::err("%s", e.what());
+        retval = 1;
+    }
+
+    quit = 1;
+    if (listen_fd >= 0)
+        ::shutdown(listen_fd, SHUT_RDWR);
+    for (size_t i = 0; i < workers.size(); i++) {
+        workers[i]->wait();
+        delete workers[i];
+    }
+    if (listen_fd >= 0)
+        ::close(listen_fd);
+
+    unsigned long requests = 0;
+    for (int o = 0; o < server_stats::outcomes; o++)
+        requests += stats.count[o];
+    msg::inf("%lu requests, %s bytes sent", requests, str::from(stats.bytes).c_str());
+    for (int o = 0; o < server_stats::outcomes; o++)
+        if (stats.count[o] > 0)
+            msg::inf(4, "%s: %lu", server_stats::outcome_name(static_cast<enum server_stats::outcome>(o)), stats.count[o]);
+    if (!stats.latencies.empty()) {
+        std::sort(stats.latencies.begin(), stats.latencies.end());
+        size_t n = stats.latencies.size();
+        msg::inf("Response time of successful requests: p50 %.1f ms, p95 %.1f ms, p99 %.1f ms, max %.1f ms",
+                stats.latencies[n / 2] / 1e3f, stats.latencies[n * 95 / 100] / 1e3f,
+                stats.latencies[n * 99 / 100] / 1e3f, stats.latencies[n - 1] / 1e3f);
+    }
+    return retval;
+}
@@ -0,0 +1,283 @@
+/*
+ * Copyright (C) 2013
+ * Computer Graphics Group, University of Siegen, Germany.
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>.
+ * See http://www.cg.informatik.uni-siegen.de/ for contact information.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * ecmfetchtest fetches all quads of a database from a server into a fresh disk
+ * cache, using the disk cache fetchers of the renderer, and checks the result.
+ * It is meant to be run against ecmdbserve with fault injection; see
+ * fetch-test.sh.
+ *
+ * Fetches that fail are retried in the next round, as the renderer would
+ * retry them in a later frame. At the end, every quad of the database must be
+ * cached, every cached file must be identical to the original, and there must
+ * be no leftover partial files. Optionally, a minimum throughput and a maximum
+ * tail latency are enforced.
+ */
+
+#include "config.h"
+
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include <ecmdb/ecmdb.h>
+
+#include "dbg.h"
+#include "exc.h"
+#include "fio.h"
+#include "msg.h"
+#include "opt.h"
+#include "str.h"
+#include "pth.h"
+#include "tmr.h"
+
+#include "uuid.h"
+
+#include "quad-cache.h"
+
+
+static std::string read_file(const std::string& filename)
+{
+    struct stat buf;
+    if (!fio::stat(filename, &buf))
+        throw exc(filename + ": does not exist");
+    std::string s(buf.st_size, '\0');
+    FILE* f = fio::open(filename, "r");
+    if (s.length() > 0)
+        fio::read(&(s[0]), s.length(), 1, f, filename);
+    fio::close(f, filename);
+    return s;
+}
+
+// Return all regular files below dir, relative to dir.
+static void find_files(const std::string& dir, const std::string& prefix, std::vector<std::string>& files)
+{
+    std::vector<std::string> names = fio::readdir(dir + '/' + prefix);
+    for (size_t i = 0; i < names.size(); i++) {
+        std::string name = prefix.empty() ? names[i] : prefix + '/' + names[i];
+        if (fio::test_d(dir + '/' + name))
+            find_files(dir, name, files);
+        else
+            files.push_back(name);
+    }
+}
+
+static void collect_quads(const class ecmdb& db, int side, int level, int x, int y,
+        std::vector<glvm::ivec4>& quads)
+{
+    if (!db.has_quad(side, level, x, y))
+        return;
+    quads.push_back(glvm::ivec4(side, level, x, y));
+    if (level < db.levels() - 1) {
+        for (int i = 0; i < 4; i++)
+            collect_quads(db, side, level + 1, 2 * x + i % 2, 2 * y + i / 2, quads);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    /* Initialization: messages */
+    char *program_name = strrchr(argv[0], '/');
+    program_name = program_name ? program_name + 1 : argv[0];
+    msg::set_level(msg::INF);
+    msg::set_program_name(program_name);
+    msg::set_columns_from_env();
+    dbg::init_crashhandler();
+
+    /* Command line handling */
+    std::vector<opt::option *> options;
+    opt::info help("help", '\0', opt::optional);
+    options.push_back(&help);
+    opt::val<int> threads("threads", 't', opt::optional, 1, 255, 8);
+    options.push_back(&threads);
+    opt::val<int> max_rounds("max-rounds", 'r', opt::optional, 1, 1000, 20);
+    options.push_back(&max_rounds);
+    opt::string cache_dir("cache-dir", 'c', opt::optional);
+    options.push_back(&cache_dir);
+    opt::val<double> min_tiles_per_second("min-tiles-per-second", '\0', opt::optional, 0.0, 1e9, 0.0);
+    options.push_back(&min_tiles_per_second);
+    opt::val<double> max_p99_latency("max-p99-latency", '\0', opt::optional, 0.0, 1e9, 0.0);
+    options.push_back(&max_p99_latency);
+
+    std::vector<std::string> arguments;
+    if (!opt::parse(argc, argv, options, 2, 2, arguments)) {
+        return 1;
+    }
+    if (help.value()) {
+        msg::req_txt("Usage: %s [option...] <db-url> <db-dir>\n"
+                "Fetch all quads of the database at <db-url> into a fresh disk cache and\n"
+                "compare the cached files with the original database in <db-dir>.\n"
+                "    [--help]               Print help and exit\n"
+                "    [-t|--threads=<n>]     Number of fetcher threads. Default is 8.\n"
+                "    [-r|--max-rounds=<n>]  Maximum number of rounds; quads whose fetch\n"
+                "                           failed are retried in the next round.\n"
+                "                           Default is 20.\n"
+                "    [-c|--cache-dir=<d>]   Cache directory. It must not exist yet.\n"
+                "                           Default is a temporary directory that is removed.\n"
+                "    [--min-tiles-per-second=<x>]\n"
+                "                           Fail if fewer quads per second were cached.\n"
+                "    [--max-p99-latency=<ms>]\n"
+                "                           Fail if the 99th percentile of the fetch latency\n"
+                "                           exceeds this limit. The percentile is measured\n"
+                "                           in power-of-two buckets, so use a power of two.\n"
+                "Report bugs to <%s>.",
+                program_name, PACKAGE_BUGREPORT);
+        return 0;
+    }
+
+    bool ok = true;
+    std::string dir;
+    try {
+        std::string db_url = arguments[0];
+        if (db_url.length() > 0 && db_url[db_url.length() - 1] != '/')
+            db_url.push_back('/');
+        const std::string db_dir = arguments[1];
+        class ecmdb db;
+        db.open(db_dir + '/', db_url);
+        uuid db_id;
+        db_id.generate();
+        uuid app_id;
+        app_id.generate();
+
+        std::vector<glvm::ivec4> quads;
+        for (int s = 0; s < 6; s++)
+            collect_quads(db, s, 0, 0, 0, quads);
+
+        if (cache_dir.value().empty()) {
+            dir = fio::mktempdir();
+        } else {
+            dir = cache_dir.value();
+            fio::mkdir_p(dir);
+        }
+        quad_disk_cache disk_cache(app_id.to_string(), dir);
+        quad_disk_cache_fetchers fetchers(threads.value(), &disk_cache);
+
+        /* Fetch */
+        long long start_time = timer::get(timer::monotonic);
+        std::vector<glvm::ivec4> pending = quads;
+        int round;
+        for (round = 0; round < max_rounds.value() && pending.size() > 0; round++) {
+            for (size_t i = 0; i < pending.size(); i++) {
+                quad_key key(db_id, pending[i]);
+                for (;;) {
+                    unsigned long long completions = thread_group::completions().count();
+                    if (fetchers.start_fetch(key, db, db_url, "", ""))
+                        break;
+                    thread_group::completions().wait(completions, 100000);
+                    fetchers.get_results();
+                }
+            }
+            while (fetchers.stats().in_flight > 0) {
+                unsigned long long completions = thread_group::completions().count();
+                fetchers.get_results();
+                if (fetchers.stats().in_flight > 0)
+                    thread_group::completions().wait(completions, 100000);
+            }
+            fetchers.get_results();
+            std::vector<glvm::ivec4> failed;
+            for (size_t i = 0; i < pending.size(); i++) {
+                const quad_disk* qd = disk_cache.get(quad_key(db_id, pending[i]));
+                if (!qd || (qd->status != quad_disk::cached && qd->status != quad_disk::cached_empty))
+                    failed.push_back(pending[i]);
+            }
+            msg::inf("Round %d: %lu of %lu fetches failed", round + 1,
+                    static_cast<unsigned long>(failed.size()), static_cast<unsigned long>(pending.size()));
+            pending.swap(failed);
+        }
+        float seconds = timer::to_seconds(timer::get(timer::monotonic) - start_time);
+        float tiles_per_second = (quads.size() - pending.size()) / std::max(seconds, 1e-6f);
+        float p99_latency = fetchers.stats().latency_percentile(0.99f);
+        msg::inf("Cached %lu quads in %g seconds (%g quads per second), p99 latency %g ms",
+                static_cast<unsigned long>(quads.size() - pending.size()), seconds, tiles_per_second, p99_latency);
+        if (pending.size() > 0) {
+            msg::err("%lu quads could not be cached in %d rounds", static_cast<unsigned long>(pending.size()), round);
+            ok = false;
+        }
+        if (min_tiles_per_second.value() > 0.0 && tiles_per_second < min_tiles_per_second.value()) {
+            msg::err("Throughput %g quads per second is below %g", tiles_per_second, min_tiles_per_second.value());
+            ok = false;
+        }
+        if (max_p99_latency.value() > 0.0 && p99_latency > max_p99_latency.value()) {
+            msg::err("p99 latency %g ms is above %g ms", p99_latency, max_p99_latency.value());
+            ok = false;
+        }
+
+        /* Check the cache contents */
+        unsigned long mismatches = 0;
+        for (size_t i = 0; i < quads.size(); i++) {
+            const glvm::ivec4& q = quads[i];
+            std::string original = db_dir + '/' + ecmdb::quad_filename(q[0], q[1], q[2], q[3]);
+            std::string cached = disk_cache.quad_filename(db_url, q);
+            if (!fio::test_f(cached)) {
+                msg::err("%s: missing", cached.c_str());
+                mismatches++;
+            } else if (fio::test_f(original)) {
+                if (read_file(cached) != read_file(original)) {
+                    msg::err("%s: differs from %s", cached.c_str(), original.c_str());
+                    mismatches++;
+                }
+            } else {
+                // A quad that the server does not have must be cached as empty
+                if (read_file(cached).length() > 0) {
+                    msg::err("%s: not empty although %s does not exist", cached.c_str(), original.c_str());
+                    mismatches++;
+                }
+            }
+        }
+        // Temporary files are kept as hard links of finished quads; any other
+        // temporary file is a leftover from a failed fetch.
+        std::string base_dir = dir + '/' + quad_disk_cache::db_dir(db_url);
+        std::vector<std::string> files;
+        find_files(base_dir, "", files);
+        const std::string tmp_suffix = '.' + app_id.to_string() + ".hardlink";
+        unsigned long tmp_files = 0;
+        for (size_t i = 0; i < files.size(); i++) {
+            const std::string& f = files[i];
+            if (f.length() > tmp_suffix.length()
+                    && f.compare(f.length() - tmp_suffix.length(), tmp_suffix.length(), tmp_suffix) == 0) {
+                tmp_files++;
+                if (!fio::test_f(base_dir + '/' + f.substr(0, f.length() - tmp_suffix.length()))) {
+                    msg::err("%s: leftover partial file", (base_dir + '/' + f).c_str());
+                    mismatches++;
+                }
+            }
+        }
+        if (files.size() - tmp_files != quads.size()) {
+            msg::err("Cache contains %lu quad files instead of %lu",
+                    static_cast<unsigned long>(files.size() - tmp_files), static_cast<unsigned long>(quads.size()));
+            mismatches++;
+        }
+        if (mismatches > 0) {
+            msg::err("%lu errors in cache directory %s", mismatches, dir.c_str());
+            ok = false;
+        }
+        if (cache_dir.value().empty())
+            fio::rm_r(dir);
+    }
+    catch (std::exception &e) {
+        msg::err("%s", e.what());
+        return 1;
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,549 @@
+/*
+ * Copyright (C) 2013
+ * Computer Graphics Group, University of Siegen, Germany.
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>.
+ * See http://www.cg.informatik.uni-siegen.de/ for contact information.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * ecmproctest checks the CPU implementation of the quad processors against
+ * the shaders. It processes generated quads of each supported category with
+ * the shaders, single and batched, and with the CPU processing that the
+ * memory cache loaders apply to the raw quad data, and compares the results
+ * with a pixel tolerance.
+ *
+ * It needs an OpenGL context. Without one, it reports that it was skipped.
+ * ecmcpuproctest checks the CPU implementation without OpenGL.
+ */
+
+#include "config.h"
+
+#include <cstdio>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <memory>
+#include <vector>
+
+#include <QApplication>
+#include <QGLFormat>
+#include <QGLPixelBuffer>
+
+#include <GL/glew.h>
+
+#include <ecmdb/ecmdb.h>
+
+#include "dbg.h"
+#include "exc.h"
+#include "msg.h"
+#include "str.h"
+
+#include "glvm.h"
+#include "xgl.h"
+
+#include "database_description.h"
+#include "quad-cache.h"
+#include "processor.h"
+
+using namespace glvm;
+
+
+/* Exit status that tells 'make check' that a test was skipped */
+static const int exit_skip = 77;
+
+static const int quad_size = 64;
+
+/* Tolerances: processed elevations are relative, colors are in sRGB8 steps.
+ * A few colors may differ more where the shaders use less accurate math. */
+static const float elevation_tolerance = 1e-5f;
+static const int color_tolerance = 3;
+static const float color_outlier_fraction = 0.01f;
+
+/* Deterministic pseudo random numbers in [0,1] */
+static unsigned int rnd_state;
+
+static float rnd()
+{
+    rnd_state = rnd_state * 1103515245u + 12345u;
+    return ((rnd_state >> 8) & 0xffff) / 65535.0f;
+}
+
+/* A generated source quad, uploaded as the renderer does it, and as
+ * the memory cache loaders load it */
+
+class source_quad
+{
+public:
+    GLuint data_tex;
+    GLuint mask_tex;            // 0 for full validity
+    ecmdb::metadata meta;
+    quad_mem qmem;
+
+    source_quad() : data_tex(0), mask_tex(0) {}
+};
+
+static source_quad make_source_quad(const database_description& dd, GLuint pbo, unsigned int seed, bool full_validity)
+{
+    const class ecmdb& db = dd.db;
+    int tqs = db.total_quad_size();
+    int channels = db.channels();
+    size_t n = static_cast<size_t>(tqs) * tqs;
+    std::vector<uint8_t> data(n * db.element_size());
+    std::vector<uint8_t> mask(n);
+    source_quad q;
+    q.meta = ecmdb::metadata(db.category());
+    q.meta.elevation.min = +1e30f;
+    q.meta.elevation.max = -1e30f;
+    rnd_state = seed;
+    for (int y = 0; y < tqs; y++) {
+        for (int x = 0; x < tqs; x++) {
+            size_t e = static_cast<size_t>(y) * tqs + x;
+            // Smooth structure plus noise, in [0,1]
+            float v = 0.5f + 0.35f * std::sin(0.11f * x + seed) * std::cos(0.07f * y) + 0.15f * (rnd() - 0.5f);
+            mask[e] = (full_validity || rnd() > 0.1f ? 0xff : 0x00);
+            for (int c = 0; c < channels; c++) {
+                float w = (c == 0 ? v : c == 1 ? 1.0f - v : 0.5f * v + 0.25f);
+                if (db.type() == ecmdb::type_uint8) {
+                    data[e * channels + c] = static_cast<uint8_t>(w * 255.0f + 0.5f);
+                } else if (db.type() == ecmdb::type_int16) {
+                    int16_t s = static_cast<int16_t>((w - 0.5f) * 60000.0f);
+                    std::memcpy(&(data[(e * channels + c) * sizeof(int16_t)]), &s, sizeof(int16_t));
+                } else {
+                    float f = (db.category() == ecmdb::category_elevation ? (w - 0.5f) * 16000.0f : w * 1000.0f);
+                    std::memcpy(&(data[(e * channels + c) * sizeof(float)]), &f, sizeof(float));
+                }
+            }
+            if (db.category() == ecmdb::category_elevation && mask[e]) {
+                float elev = db.data_offset() + db.data_factor() * (db.type() == ecmdb::type_int16
+                        ? (v - 0.5f) * 60000.0f : (v - 0.5f) * 16000.0f);
+                q.meta.elevation.min = min(q.meta.elevation.min, elev);
+                q.meta.elevation.max = max(q.meta.elevation.max, elev);
+            }
+        }
+    }
+
+    // See mem_quad_to_gpu() in the renderer
+    GLint internal_format = (db.category() == ecmdb::category_texture ? (channels == 1 ? GL_SLUMINANCE : GL_SRGB) : GL_R32F);
+    GLenum format = (db.category() == ecmdb::category_texture && channels == 1 ? GL_LUMINANCE : channels == 1 ? GL_RED : GL_RGB);
+    GLenum type = (db.type() == ecmdb::type_uint8 ? GL_UNSIGNED_BYTE
+            : db.type() == ecmdb::type_int16 ? GL_SHORT : GL_FLOAT);
+    q.data_tex = xgl::CreateTex2D(internal_format, tqs, tqs, GL_NEAREST);
+    if (type == GL_SHORT) {
+        glPixelTransferf(GL_RED_BIAS, -0.5f);
+        glPixelTransferf(GL_RED_SCALE, 65535.0f / 2.0f);
+    }
+    xgl::WriteTex2D(q.data_tex, 0, 0, tqs, tqs, format, type, tqs * db.element_size(), &(data[0]), pbo);
+    if (type == GL_SHORT) {
+        glPixelTransferf(GL_RED_BIAS, 0.0f);
+        glPixelTransferf(GL_RED_SCALE, 1.0f);
+    }
+    if (!full_validity) {
+        q.mask_tex = xgl::CreateTex2D(GL_R8, tqs, tqs, GL_NEAREST);
+        xgl::WriteTex2D(q.mask_tex, 0, 0, tqs, tqs, GL_RED, GL_UNSIGNED_BYTE, tqs, &(mask[0]), pbo);
+    }
+    assert(xgl::CheckError(HERE));
+
+    // See quad_mem_cache_loader::run()
+    q.qmem.data.resize(data.size());
+    std::memcpy(q.qmem.data.ptr(), &(data[0]), data.size());
+    if (!full_validity) {
+        q.qmem.mask.resize(mask.size());
+        std::memcpy(q.qmem.mask.ptr(), &(mask[0]), mask.size());
+    }
+    q.qmem.meta = q.meta;
+    return q;
+}
+
+static void delete_source_quad(source_quad& q)
+{
+    glDeleteTextures(1, &q.data_tex);
+    if (q.mask_tex != 0)
+        glDeleteTextures(1, &q.mask_tex);
+}
+
+/* The result of processing one quad, read back from the textures */
+
+class result
+{
+public:
+    std::vector<float> elevation;
+    std::vector<uint8_t> srgb;
+    std::vector<uint8_t> mask;  // empty for full validity
+    ecmdb::metadata meta;
+};
+
+class test_context
+{
+public:
+    class processor processor;
+    GLuint fbo;
+    GLuint pbo;
+    GLuint valid_mask_tex;
+    int failures;
+    int checks;
+
+    test_context() : fbo(0), pbo(0), valid_mask_tex(0), failures(0), checks(0)
+    {
+    }
+
+    static bool is_elevation(const database_description& dd)
+    {
+        return (dd.db.category() == ecmdb::category_elevation);
+    }
+
+    static int dst_size(const database_description& dd)
+    {
+        return quad_size + (is_elevation(dd) ? 4 : 2);
+    }
+
+    // Process the given quads with the shaders, single or batched
+    void process_on_gpu(const database_description& dd, bool lens, bool batch,
+            const std::vector<source_quad>& quads, std::vector<result>& results)
+    {
+        int ds = dst_size(dd);
+        GLint data_format = (is_elevation(dd) ? GL_R32F : GL_SRGB);
+        std::vector<processing_job> jobs(quads.size());
+        for (size_t i = 0; i < quads.size(); i++) {
+            jobs[i].quad = ivec4(0, 0, 0, 0);
+            jobs[i].quad_meta = quads[i].meta;
+            jobs[i].src_data_tex = quads[i].data_tex;
+            jobs[i].src_mask_tex = (quads[i].mask_tex == 0 ? valid_mask_tex : quads[i].mask_tex);
+            jobs[i].dst_data_tex = xgl::CreateTex2D(data_format, ds, ds, GL_NEAREST);
+            jobs[i].dst_mask_tex = xgl::CreateTex2D(GL_R8, ds, ds, GL_NEAREST);
+            jobs[i].full_validity = (quads[i].mask_tex == 0);
+        }
+        glViewport(0, 0, ds, ds);
+        if (batch) {
+            processor.process_batch(0, dd, lens, jobs.size(), &(jobs[0]));
+        } else {
+            for (size_t i = 0; i < jobs.size(); i++) {
+                glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, jobs[i].dst_data_tex, 0);
+                glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, jobs[i].dst_mask_tex, 0);
+                glActiveTexture(GL_TEXTURE0);
+                glBindTexture(GL_TEXTURE_2D, jobs[i].src_data_tex);
+                glActiveTexture(GL_TEXTURE1);
+                glBindTexture(GL_TEXTURE_2D, jobs[i].src_mask_tex);
+                processor.process(0, dd, lens, jobs[i].quad, jobs[i].quad_meta, &(jobs[i].full_validity), &(jobs[i].meta));
+            }
+        }
+        assert(xgl::CheckError(HERE));
+
+        results.resize(jobs.size());
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glActiveTexture(GL_TEXTURE0);
+        for (size_t i = 0; i < jobs.size(); i++) {
+            result& r = results[i];
+            glBindTexture(GL_TEXTURE_2D, jobs[i].dst_data_tex);
+            if (is_elevation(dd)) {
+                r.elevation.resize(ds * ds);
+                glGetTexImage(GL_TEXTURE_2D, 0, GL_RED, GL_FLOAT, &(r.elevation[0]));
+            } else {
+                r.srgb.resize(ds * ds * 3);
+                glGetTexImage(GL_TEXTURE_2D, 0, GL_RGB, GL_UNSIGNED_BYTE, &(r.srgb[0]));
+            }
+            r.mask.clear();
+            if (!jobs[i].full_validity) {
+                r.mask.resize(ds * ds);
+                glBindTexture(GL_TEXTURE_2D, jobs[i].dst_mask_tex);
+                glGetTexImage(GL_TEXTURE_2D, 0, GL_RED, GL_UNSIGNED_BYTE, &(r.mask[0]));
+            }
+            r.meta = jobs[i].meta;
+            glDeleteTextures(1, &(jobs[i].dst_data_tex));
+            glDeleteTextures(1, &(jobs[i].dst_mask_tex));
+        }
+        glPixelStorei(GL_PACK_ALIGNMENT, 4);
+        assert(xgl::CheckError(HERE));
+    }
+
+    // Process the given quads as the memory cache loaders do it
+    void process_on_cpu(const database_description& dd, bool lens,
+            const std::vector<source_quad>& quads, std::vector<result>& results)
+    {
+        int ds = dst_size(dd);
+        processor.set_cpu_processing(true, std::vector<database_description>(1, dd));
+        if (!processor.use_cpu(dd, lens))
+            throw exc("CPU processing is not supported for this database");
+        std::unique_ptr<const quad_mem_processing> processing(processor.cpu_quad_processing(dd, lens));
+        results.resize(quads.size());
+        for (size_t i = 0; i < quads.size(); i++) {
+            quad_mem qmem(quads[i].qmem);
+            processing->process(&qmem);
+            result& r = results[i];
+            if (is_elevation(dd)) {
+                r.elevation.resize(ds * ds);
+                assert(qmem.data.size() == r.elevation.size() * sizeof(float));
+                std::memcpy(&(r.elevation[0]), qmem.data.ptr(), qmem.data.size());
+            } else {
+                r.srgb.resize(ds * ds * 3);
+                assert(qmem.data.size() == r.srgb.size());
+                std::memcpy(&(r.srgb[0]), qmem.data.ptr(), qmem.data.size());
+            }
+            r.mask.clear();
+            if (qmem.mask.ptr()) {
+                r.mask.resize(ds * ds);
+                assert(qmem.mask.size() == r.mask.size());
+                std::memcpy(&(r.mask[0]), qmem.mask.ptr(), qmem.mask.size());
+            }
+            r.meta = qmem.meta;
+        }
+    }
+
+    void compare(const std::string& name, const result& gpu, const result& cpu)
+    {
+        checks++;
+        size_t texels = 0, outliers = 0;
+        float max_diff = 0.0f;
+        bool ok = true;
+        if (gpu.elevation.size() > 0) {
+            texels = gpu.elevation.size();
+            for (size_t i = 0; i < texels; i++) {
+                float d = std::fabs(gpu.elevation[i] - cpu.elevation[i]);
+                max_diff = max(max_diff, d);
+                if (!(d <= elevation_tolerance * max(1.0f, std::fabs(gpu.elevation[i]))))
+                    outliers++;
+            }
+            ok = (outliers == 0);
+            if (std::fabs(gpu.meta.elevation.min - cpu.meta.elevation.min) > elevation_tolerance * 1e4f
+                    || std::fabs(gpu.meta.elevation.max - cpu.meta.elevation.max) > elevation_tolerance * 1e4f) {
+                msg::err("%s: metadata differs: GPU [%g,%g], CPU [%g,%g]", name.c_str(),
+                        gpu.meta.elevation.min, gpu.meta.elevation.max,
+                        cpu.meta.elevation.min, cpu.meta.elevation.max);
+                ok = false;
+            }
+        } else {
+            texels = gpu.srgb.size() / 3;
+            for (size_t i = 0; i < texels; i++) {
+                int d = 0;
+                for (int c = 0; c < 3; c++)
+                    d = max(d, std::abs(static_cast<int>(gpu.srgb[3 * i + c]) - static_cast<int>(cpu.srgb[3 * i + c])));
+                max_diff = max(max_diff, static_cast<float>(d));
+                if (d > color_tolerance)
+                    outliers++;
+            }
+            ok = (outliers <= color_outlier_fraction * texels);
+        }
+        if (gpu.mask != cpu.mask) {
+            msg::err("%s: masks differ", name.c_str());
+            ok = false;
+        }
+        msg::inf("%s: max difference %g, %lu of %lu texels outside tolerance: %s", name.c_str(),
+                max_diff, static_cast<unsigned long>(outliers), static_cast<unsigned long>(texels),
+                ok ? "ok" : "FAILED");
+        if (!ok)
+            failures++;
+    }
+
+    // Process the quads with both paths and compare the results
+    void check(const std::string& name, const database_description& dd, bool lens,
+            const std::vector<source_quad>& quads)
+    {
+        std::vector<result> gpu, cpu;
+        process_on_cpu(dd, lens, quads, cpu);
+        for (int variant = 0; variant < 2; variant++) {
+            bool batch = (variant == 1);
+            process_on_gpu(dd, lens, batch, quads, gpu);
+            for (size_t i = 0; i < quads.size(); i++) {
+                compare(str::asprintf("%s, %s, quad %d", name.c_str(),
+                            batch ? "batch" : "single", static_cast<int>(i)), gpu[i], cpu[i]);
+            }
+        }
+    }
+};
+
+static database_description make_database(ecmdb::category_t category, ecmdb::type_t type, int channels,
+        int overlap, float data_offset, float data_factor)
+{
+    database_description dd;
+    dd.db.create(1.0, 1.0, quad_size, 1, category, type, channels, overlap, data_offset, data_factor,
+            "Test", std::vector<std::string>(1, "Test database"));
+    dd.meta = ecmdb::metadata(category);
+    dd.processing_parameters[0] = processing_parameters(category);
+    dd.processing_parameters[1] = processing_parameters(category);
+    return dd;
+}
+
+static void set_gradient(int* length, uint8_t* gradient)
+{
+    const uint8_t g[] = { 0x10, 0x20, 0x80, 0x30, 0xa0, 0x40, 0xf0, 0xe0, 0x20, 0xff, 0xff, 0xff };
+    *length = 4;
+    std::memcpy(gradient, g, sizeof(g));
+}
+
+static int run_tests()
+{
+    test_context t;
+    t.processor.init_gl();
+    glGenFramebuffers(1, &t.fbo);
+    glGenBuffers(1, &t.pbo);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, t.fbo);
+    GLenum draw_buffers[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+    glDrawBuffers(2, draw_buffers);
+    // The GL state of the renderer's depth pass
+    glEnable(GL_FRAMEBUFFER_SRGB);
+    glDisable(GL_BLEND);
+    glDisable(GL_DITHER);
+    glClampColor(GL_CLAMP_READ_COLOR, GL_FALSE);
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    const float elevation_min = -3000.0f;
+    const float elevation_max = +3000.0f;
+    t.processor.set_elevation_bounds(elevation_min, elevation_max);
+
+    /* Elevation, float and int16 */
+    for (int type = 0; type < 2; type++) {
+        database_description dd = (type == 0
+                ? make_database(ecmdb::category_elevation, ecmdb::type_float32, 1, 2, 0.0f, 1.0f)
+                : make_database(ecmdb::category_elevation, ecmdb::type_int16, 1, 3, 100.0f, 0.25f));
+        std::vector<uint8_t> valid(dd.db.total_quad_size() * dd.db.total_quad_size(), 0xff);
+        t.valid_mask_tex = xgl::CreateTex2D(GL_R8, dd.db.total_quad_size(), dd.db.total_quad_size(), GL_NEAREST);
+        xgl::WriteTex2D(t.valid_mask_tex, 0, 0, dd.db.total_quad_size(), dd.db.total_quad_size(),
+                GL_RED, GL_UNSIGNED_BYTE, dd.db.total_quad_size(), &(valid[0]), t.pbo);
+        dd.processing_parameters[1].elevation.scale_factor = 2.5f;
+        dd.processing_parameters[1].elevation.scale_center = 300.0f;
+        std::vector<source_quad> quads;
+        for (int i = 0; i < 3; i++)
+            quads.push_back(make_source_quad(dd, t.pbo, i + 1, i == 2));
+        std::string name = (type == 0 ? "elevation float32" : "elevation int16");
+        t.check(name, dd, false, quads);
+        t.check(name + " scaled", dd, true, quads);
+
+        for (size_t i = 0; i < quads.size(); i++)
+            delete_source_quad(quads[i]);
+        glDeleteTextures(1, &t.valid_mask_tex);
+    }
+
+    /* Texture, RGB and luminance */
+    for (int channels = 3; channels >= 1; channels -= 2) {
+        database_description dd = make_database(ecmdb::category_texture, ecmdb::type_uint8, channels, 2, 0.0f, 1.0f);
+        std::vector<uint8_t> valid(dd.db.total_quad_size() * dd.db.total_quad_size(), 0xff);
+        t.valid_mask_tex = xgl::CreateTex2D(GL_R8, dd.db.total_quad_size(), dd.db.total_quad_size(), GL_NEAREST);
+        xgl::WriteTex2D(t.valid_mask_tex, 0, 0, dd.db.total_quad_size(), dd.db.total_quad_size(),
+                GL_RED, GL_UNSIGNED_BYTE, dd.db.total_quad_size(), &(valid[0]), t.pbo);
+        for (int l = 0; l < 2; l++) {
+            dd.processing_parameters[l].texture.contrast = (l == 0 ? 0.3f : -0.2f);
+            dd.processing_parameters[l].texture.brightness = (l == 0 ? -0.1f : 0.15f);
+            dd.processing_parameters[l].texture.saturation = (l == 0 ? 0.5f : -0.4f);
+            dd.processing_parameters[l].texture.hue = (l == 0 ? 0.2f : -0.6f);
+        }
+        std::vector<source_quad> quads;
+        for (int i = 0; i < 3; i++)
+            quads.push_back(make_source_quad(dd, t.pbo, i + 10, i == 2));
+        std::string name = (channels == 3 ? "texture rgb" : "texture luminance");
+        t.check(name, dd, false, quads);
+        t.check(name + " lens", dd, true, quads);
+        for (size_t i = 0; i < quads.size(); i++)
+            delete_source_quad(quads[i]);
+        glDeleteTextures(1, &t.valid_mask_tex);
+    }
+
+    /* SAR amplitude, with all global dynamic range reduction methods */
+    {
+        database_description dd = make_database(ecmdb::category_sar_amplitude, ecmdb::type_float32, 1, 2, 0.0f, 1.0f);
+        dd.meta.sar_amplitude.min = 0.0f;
+        dd.meta.sar_amplitude.max = 1000.0f;
+        dd.meta.sar_amplitude.sum = 450.0f * 1000.0f;
+        dd.meta.sar_amplitude.valid = 1000;
+        std::vector<uint8_t> valid(dd.db.total_quad_size() * dd.db.total_quad_size(), 0xff);
+        t.valid_mask_tex = xgl::CreateTex2D(GL_R8, dd.db.total_quad_size(), dd.db.total_quad_size(), GL_NEAREST);
+        xgl::WriteTex2D(t.valid_mask_tex, 0, 0, dd.db.total_quad_size(), dd.db.total_quad_size(),
+                GL_RED, GL_UNSIGNED_BYTE, dd.db.total_quad_size(), &(valid[0]), t.pbo);
+        std::vector<source_quad> quads;
+        for (int i = 0; i < 3; i++)
+            quads.push_back(make_source_quad(dd, t.pbo, i + 20, i == 2));
+        const char* drr_names[] = { "linear", "log", "gamma", "schlick", "reinhard" };
+        for (int drr = processing_parameters::sar_amplitude_drr_linear;
+                drr <= processing_parameters::sar_amplitude_drr_reinhard; drr++) {
+            processing_parameters& pp = dd.processing_parameters[0];
+            pp.sar_amplitude.drr_method = drr;
+            pp.sar_amplitude.drr.linear.min_amp = 0.1f;
+            pp.sar_amplitude.drr.linear.max_amp = 0.8f;
+            pp.sar_amplitude.drr.log.min_amp = 0.1f;
+            pp.sar_amplitude.drr.log.max_amp = 0.8f;
+            pp.sar_amplitude.drr.log.prescale = 50.0f;
+            pp.sar_amplitude.drr.gamma.min_amp = 0.1f;
+            pp.sar_amplitude.drr.gamma.max_amp = 0.8f;
+            pp.sar_amplitude.drr.gamma.gamma = 2.2f;
+            pp.sar_amplitude.drr.schlick.brightness = 20.0f;
+            pp.sar_amplitude.drr.reinhard.brightness = 0.5f;
+            pp.sar_amplitude.drr.reinhard.contrast = 0.3f;
+            set_gradient(&pp.sar_amplitude.gradient_length, pp.sar_amplitude.gradient);
+            pp.sar_amplitude.adapt_brightness = (drr % 2 == 1);
+            t.check(std::string("sar amplitude ") + drr_names[drr], dd, false, quads);
+        }
+        for (size_t i = 0; i < quads.size(); i++)
+            delete_source_quad(quads[i]);
+        glDeleteTextures(1, &t.valid_mask_tex);
+    }
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &t.fbo);
+    glDeleteBuffers(1, &t.pbo);
+    t.processor.exit_gl();
+    if (!xgl::CheckError(HERE))
+        t.failures++;
+    msg::inf("%d of %d comparisons failed", t.failures, t.checks);
+    return (t.failures == 0 ? 0 : 1);
+}
+
+int main(int argc, char *argv[])
+{
+    /* Initialization: messages */
+    char *program_name = strrchr(argv[0], '/');
+    program_name = program_name ? program_name + 1 : argv[0];
+    msg::set_level(msg::INF);
+    msg::set_program_name(program_name);
+    msg::set_columns_from_env();
+    dbg::init_crashhandler();
+
+    if (argc > 1) {
+        msg::req_txt("Usage: %s\n"
+                "Compare the CPU and GPU implementations of the quad processors.\n"
+                "Report bugs to <%s>.",
+                program_name, PACKAGE_BUGREPORT);
+        return (std::strcmp(argv[1], "--help") == 0 ? 0 : 1);
+    }
+
+    /* Get an OpenGL context, or skip the test */
+    if (!std::getenv("DISPLAY")) {
+        msg::inf("No display available; skipping the test");
+        return exit_skip;
+    }
+    QApplication app(argc, argv);
+    QGLFormat fmt(QGL::Rgba | QGL::NoAlphaChannel | QGL::NoAccumBuffer
+            | QGL::NoStencilBuffer | QGL::NoStereoBuffers | QGL::NoOverlay | QGL::NoSampleBuffers);
+    if (!QGLPixelBuffer::hasOpenGLPbuffers()) {
+        msg::inf("No offscreen OpenGL rendering available; skipping the test");
+        return exit_skip;
+    }
+    QGLPixelBuffer pbuffer(16, 16, fmt);
+    if (!pbuffer.isValid() || !pbuffer.makeCurrent()) {
+        msg::inf("Cannot create an offscreen OpenGL context; skipping the test");
+        return exit_skip;
+    }
+    if (glewInit() != GLEW_OK || !glewIsSupported("GL_VERSION_2_1 GL_ARB_texture_rg GL_ARB_framebuffer_object "
+                "GL_ARB_color_buffer_float GL_ARB_texture_float GL_EXT_framebuffer_sRGB")) {
+        msg::inf("The OpenGL implementation lacks required features; skipping the test");
+        return exit_skip;
+    }
+
+    try {
+        return run_tests();
+    }
+    catch (std::exception &e) {
+        msg::err("%s", e.what());
+        return 1;
+    }
+}
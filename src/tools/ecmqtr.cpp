@@ -0,0 +1,388 @@
+/*
+ * Copyright (C) 2013
+ * Computer Graphics Group, University of Siegen, Germany.
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>.
+ * See http://www.cg.informatik.uni-siegen.de/ for contact information.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * ecmqtr replays a quad cache trace recorded with ecmview --quad-trace
+ * against different cache policies and sizes, and prints hit ratio and
+ * byte hit ratio curves. This allows to tune cache sizes offline.
+ *
+ * The replay is open-loop: puts happen as recorded, regardless of whether the
+ * simulated cache would have caused the renderer to request other quads.
+ */
+
+#include "config.h"
+
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <algorithm>
+#include <list>
+#include <map>
+#include <set>
+#include <vector>
+
+#include "dbg.h"
+#include "exc.h"
+#include "msg.h"
+#include "opt.h"
+#include "str.h"
+#include "lru.h"
+
+#include "quad-trace.h"
+
+
+/* Key of a quad in the simulated caches */
+
+class sim_key
+{
+public:
+    uint8_t db, side, level;
+    int8_t approx_level;
+    int32_t x, y;
+
+    sim_key(const quad_trace::event& e) :
+        db(e.db), side(e.side), level(e.level), approx_level(e.approx_level), x(e.x), y(e.y)
+    {
+    }
+
+    bool operator<(const sim_key& k) const
+    {
+        return (db < k.db || (db == k.db && (side < k.side || (side == k.side
+                            && (level < k.level || (level == k.level
+                                    && (approx_level < k.approx_level || (approx_level == k.approx_level
+                                            && (x < k.x || (x == k.x && y < k.y))))))))));
+    }
+};
+
+/* Simulated caches */
+
+class sim_cache
+{
+public:
+    virtual ~sim_cache() {}
+    // Look up a quad; return whether it is cached. next_use is the index of the
+    // next get of the same quad, or max if there is none.
+    virtual bool get(const sim_key& key, size_t next_use) = 0;
+    // Insert a quad with the given size in cache units.
+    virtual void put(const sim_key& key, size_t size, size_t next_use) = 0;
+};
+
+// Least recently used, using the cache implementation of the renderer
+class sim_lru : public sim_cache
+{
+private:
+    class element {};
+    lru_cache<element, sim_key, true> _cache;
+
+public:
+    sim_lru(size_t max_size) : _cache(max_size) {}
+
+    bool get(const sim_key& key, size_t)
+    {
+        return _cache.get(key);
+    }
+
+    void put(const sim_key& key, size_t size, size_t)
+    {
+        if (!_cache.get(key))
+            _cache.put(key, new element, size);
+    }
+};
+
+// First in, first out
+class sim_fifo : public sim_cache
+{
+private:
+    size_t _max_size, _size;
+    std::list<std::pair<sim_key, size_t> > _queue;
+    std::set<sim_key> _elements;
+
+public:
+    sim_fifo(size_t max_size) : _max_size(max_size), _size(0) {}
+
+    bool get(const sim_key& key, size_t)
+    {
+        return _elements.find(key) != _elements.end();
+    }
+
+    void put(const sim_key& key, size_t size, size_t)
+    {
+        if (_elements.find(key) != _elements.end())
+            return;
+        size = (size == 0 ? 1 : size);
+        _queue.push_back(std::pair<sim_key, size_t>(key, size));
+        _elements.insert(key);
+        _size += size;
+        while (_size > _max_size) {
+            _size -= _queue.front().second;
+            _elements.erase(_queue.front().first);
+            _queue.pop_front();
+        }
+    }
+};
+
+// Belady's optimal policy: evict the quad that is needed again furthest in the future.
+// This is an upper bound for what any policy can achieve.
+class sim_opt : public sim_cache
+{
+private:
+    size_t _max_size, _size;
+    std::map<sim_key, std::pair<size_t, size_t> > _elements;    // next use, size
+    std::set<std::pair<size_t, sim_key> > _next_uses;
+
+    void set_next_use(std::map<sim_key, std::pair<size_t, size_t> >::iterator it, size_t next_use)
+    {
+        _next_uses.erase(std::pair<size_t, sim_key>(it->second.first, it->first));
+        it->second.first = next_use;
+        _next_uses.insert(std::pair<size_t, sim_key>(next_use, it->first));
+    }
+
+public:
+    sim_opt(size_t max_size) : _max_size(max_size), _size(0) {}
+
+    bool get(const sim_key& key, size_t next_use)
+    {
+        std::map<sim_key, std::pair<size_t, size_t> >::iterator it = _elements.find(key);
+        if (it == _elements.end())
+            return false;
+        set_next_use(it, next_use);
+        return true;
+    }
+
+    void put(const sim_key& key, size_t size, size_t next_use)
+    {
+        std::map<sim_key, std::pair<size_t, size_t> >::iterator it = _elements.find(key);
+        if (it != _elements.end()) {
+            set_next_use(it, next_use);
+            return;
+        }
+        size = (size == 0 ? 1 : size);
+        _elements.insert(std::pair<sim_key, std::pair<size_t, size_t> >(key, std::pair<size_t, size_t>(next_use, size)));
+        _next_uses.insert(std::pair<size_t, sim_key>(next_use, key));
+        _size += size;
+        while (_size > _max_size) {
+            std::set<std::pair<size_t, sim_key> >::iterator victim = --_next_uses.end();
+            it = _elements.find(victim->second);
+            _size -= it->second.second;
+            _elements.erase(it);
+            _next_uses.erase(victim);
+        }
+    }
+};
+
+static sim_cache* create_sim_cache(const std::string& policy, size_t max_size)
+{
+    if (policy == "lru")
+        return new sim_lru(max_size);
+    else if (policy == "fifo")
+        return new sim_fifo(max_size);
+    else
+        return new sim_opt(max_size);
+}
+
+/* Replay of one tier */
+
+class replay_result
+{
+public:
+    unsigned long long requests, hits;
+    unsigned long long requested_bytes, hit_bytes;
+
+    replay_result() : requests(0), hits(0), requested_bytes(0), hit_bytes(0) {}
+};
+
+static replay_result replay(const std::vector<quad_trace::event>& events,
+        const std::vector<size_t>& next_uses, sim_cache* cache)
+{
+    replay_result r;
+    std::map<sim_key, size_t> sizes;
+    for (size_t i = 0; i < events.size(); i++) {
+        const quad_trace::event& e = events[i];
+        sim_key key(e);
+        if (e.op == quad_trace::op_put) {
+            sizes[key] = e.size;
+            cache->put(key, e.size, next_uses[i]);
+        } else {
+            std::map<sim_key, size_t>::const_iterator it = sizes.find(key);
+            size_t size = (it == sizes.end() ? 0 : it->second);
+            bool hit = cache->get(key, next_uses[i]);
+            r.requests++;
+            r.requested_bytes += size;
+            if (hit) {
+                r.hits++;
+                r.hit_bytes += size;
+            }
+        }
+    }
+    return r;
+}
+
+static double ratio(unsigned long long a, unsigned long long b)
+{
+    return (b > 0 ? 100.0 * a / b : 0.0);
+}
+
+
+int main(int argc, char *argv[])
+{
+    /* Initialization: messages */
+    char *program_name = strrchr(argv[0], '/');
+    program_name = program_name ? program_name + 1 : argv[0];
+    msg::set_level(msg::INF);
+    msg::set_program_name(program_name);
+    msg::set_columns_from_env();
+    dbg::init_crashhandler();
+
+    /* Command line handling */
+    std::vector<opt::option *> options;
+    opt::info help("help", '\0', opt::optional);
+    options.push_back(&help);
+    std::vector<std::string> tier_values;
+    tier_values.push_back("all");
+    for (int t = 0; t < quad_trace::tiers; t++)
+        tier_values.push_back(quad_trace::tier_name(static_cast<enum quad_trace::tier>(t)));
+    opt::val<std::string> tier("tier", 't', opt::optional, tier_values, "all");
+    options.push_back(&tier);
+    opt::string policies_list("policies", 'p', opt::optional);
+    options.push_back(&policies_list);
+    opt::tuple<double> sizes("sizes", 's', opt::optional, 0.0, false, 1e15, true, std::vector<double>());
+    options.push_back(&sizes);
+
+    std::vector<std::string> arguments;
+    if (!opt::parse(argc, argv, options, 1, 1, arguments)) {
+        return 1;
+    }
+    if (help.value()) {
+        msg::req_txt("Usage: %s [option...] <trace-file>\n"
+                "Replay a quad cache trace recorded with ecmview --quad-trace.\n"
+                "    [--help]               Print help and exit\n"
+                "    [-t|--tier=<t>]        all, metadata, gpu, mem, or disk. Default is all.\n"
+                "    [-p|--policies=<p>,...]\n"
+                "                           Cache policies to simulate: lru, fifo, opt.\n"
+                "                           Default is all.\n"
+                "    [-s|--sizes=<s>,...]   Cache sizes to simulate, in MiB for the gpu and mem\n"
+                "                           tiers and in quads for the metadata and disk tiers.\n"
+                "                           Default is 1/16 to 1/1 of the working set.\n"
+                "Report bugs to <%s>.",
+                program_name, PACKAGE_BUGREPORT);
+        return 0;
+    }
+
+    try {
+        std::vector<std::string> policies = str::tokens(policies_list.value().empty()
+                ? std::string("lru,fifo,opt") : policies_list.value(), ",");
+        for (size_t p = 0; p < policies.size(); p++)
+            if (policies[p] != "lru" && policies[p] != "fifo" && policies[p] != "opt")
+                throw exc("unknown cache policy " + policies[p]);
+
+        std::vector<quad_trace::event> events;
+        quad_trace::read(arguments[0], events);
+        if (events.empty())
+            throw exc(arguments[0] + ": trace contains no events");
+
+        unsigned long op_counts[quad_trace::ops];
+        std::memset(op_counts, 0, sizeof(op_counts));
+        std::set<uint8_t> dbs;
+        for (size_t i = 0; i < events.size(); i++) {
+            op_counts[events[i].op]++;
+            dbs.insert(events[i].db);
+        }
+        std::printf("Trace %s: %lu events, frames %u to %u, %lu databases\n",
+                arguments[0].c_str(), static_cast<unsigned long>(events.size()),
+                events.front().frame, events.back().frame, static_cast<unsigned long>(dbs.size()));
+        for (int o = 0; o < quad_trace::ops; o++)
+            std::printf("  %-12s %lu\n", quad_trace::op_name(static_cast<enum quad_trace::op>(o)), op_counts[o]);
+
+        for (int t = 0; t < quad_trace::tiers; t++) {
+            if (tier.value() != "all" && tier.value() != quad_trace::tier_name(static_cast<enum quad_trace::tier>(t)))
+                continue;
+            const bool bytes = (t == quad_trace::tier_gpu || t == quad_trace::tier_mem);
+            const double unit = (bytes ? 1024.0 * 1024.0 : 1.0);
+
+            // Extract the gets and puts of this tier, and find each quad's next use
+            std::vector<quad_trace::event> tier_events;
+            for (size_t i = 0; i < events.size(); i++)
+                if (events[i].tier == t && events[i].op <= quad_trace::op_put)
+                    tier_events.push_back(events[i]);
+            if (tier_events.empty())
+                continue;
+            std::vector<size_t> next_uses(tier_events.size());
+            std::map<sim_key, size_t> next_get;
+            for (size_t i = tier_events.size(); i > 0; i--) {
+                sim_key key(tier_events[i - 1]);
+                std::map<sim_key, size_t>::iterator it = next_get.find(key);
+                next_uses[i - 1] = (it == next_get.end() ? std::numeric_limits<size_t>::max() : it->second);
+                if (tier_events[i - 1].op != quad_trace::op_put)
+                    next_get[key] = i - 1;
+            }
+
+            // Working set: all quads that were ever put, and the recorded hit ratio
+            std::map<sim_key, size_t> working_set;
+            unsigned long long recorded_hits = 0, recorded_requests = 0;
+            for (size_t i = 0; i < tier_events.size(); i++) {
+                if (tier_events[i].op == quad_trace::op_put) {
+                    working_set[sim_key(tier_events[i])] = (tier_events[i].size == 0 ? 1 : tier_events[i].size);
+                } else {
+                    recorded_requests++;
+                    if (tier_events[i].op == quad_trace::op_hit)
+                        recorded_hits++;
+                }
+            }
+            unsigned long long working_set_size = 0;
+            for (std::map<sim_key, size_t>::const_iterator it = working_set.begin(); it != working_set.end(); it++)
+                working_set_size += it->second;
+            if (working_set_size == 0)
+                continue;
+
+            std::vector<double> sim_sizes = sizes.value();
+            if (sim_sizes.empty()) {
+                for (int i = 4; i >= 0; i--)
+                    sim_sizes.push_back(working_set_size / unit / (1 << i));
+            }
+
+            std::printf("\nTier %s: %lu requests, recorded hit ratio %.1f%%, working set %lu quads, %.1f %s\n",
+                    quad_trace::tier_name(static_cast<enum quad_trace::tier>(t)),
+                    static_cast<unsigned long>(recorded_requests), ratio(recorded_hits, recorded_requests),
+                    static_cast<unsigned long>(working_set.size()), working_set_size / unit,
+                    bytes ? "MiB" : "quads");
+            std::printf("  %12s", bytes ? "size [MiB]" : "size [quads]");
+            for (size_t p = 0; p < policies.size(); p++)
+                std::printf("  %6s hit%% %6s byte%%", policies[p].c_str(), policies[p].c_str());
+            std::printf("\n");
+            for (size_t s = 0; s < sim_sizes.size(); s++) {
+                size_t max_size = sim_sizes[s] * unit;
+                std::printf("  %12.1f", sim_sizes[s]);
+                for (size_t p = 0; p < policies.size(); p++) {
+                    sim_cache* cache = create_sim_cache(policies[p], std::max(max_size, static_cast<size_t>(1)));
+                    replay_result r = replay(tier_events, next_uses, cache);
+                    delete cache;
+                    std::printf("  %11.1f %11.1f", ratio(r.hits, r.requests), ratio(r.hit_bytes, r.requested_bytes));
+                }
+                std::printf("\n");
+            }
+        }
+    }
+    catch (std::exception& e) {
+        msg::err("%s", e.what());
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,45 @@
+#!/bin/sh
+
+# Copyright (C) 2013
+# Martin Lambers <marlam@marlam.de>
+#
+# Copying and distribution of this file, with or without modification, are
+# permitted in any medium without royalty provided the copyright notice and this
+# notice are preserved. This file is offered as-is, without any warranty.
+
+# Fetch a generated database from ecmdbserve with injected latency, bandwidth
+# limits, server errors, connection resets and stalls, and check throughput,
+# tail latency, and the contents of the disk cache. Run by 'make check'.
+
+set -e
+
+dir="`mktemp -d`"
+server=""
+trap 'test -n "$server" && kill $server 2>/dev/null; rm -rf "$dir"' 0
+
+./ecmdbgen -q 64 -l 4 -s 1 "$dir/db" > /dev/null
+
+# Remove some quads so that the server answers with 404 for them;
+# they must be cached as empty.
+find "$dir/db" -type f ! -name '*.txt' | sort | awk 'NR % 37 == 1' | xargs rm -f
+
+# Let the server choose a free port, and wait until it accepts connections.
+./ecmdbserve -p 0 --port-file="$dir/port" -c 8 -l 5 --latency-jitter=5 -b 4000000 \
+    --error-500=0.05 --reset=0.05 --stall=0.02 --stall-time=250 -s 1 \
+    "$dir/db" &
+server=$!
+tries=0
+while ! test -f "$dir/port"; do
+    if ! kill -0 $server 2>/dev/null || test $tries -ge 300; then
+        echo "ecmdbserve did not start" >&2
+        exit 1
+    fi
+    sleep 0.1 2>/dev/null || sleep 1
+    tries=`expr $tries + 1`
+done
+port=`cat "$dir/port"`
+
+# The p99 latency is an upper bucket bound (a power of two in ms).
+./ecmfetchtest -t 8 -r 20 -c "$dir/cache" \
+    --min-tiles-per-second=20 --max-p99-latency=2048 \
+    "http://127.0.0.1:$port/" "$dir/db"
@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2013
+ * Computer Graphics Group, University of Siegen, Germany.
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>.
+ * See http://www.cg.informatik.uni-siegen.de/ for contact information.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "dbg.h"
+
+#include "xgl.h"
+#include "xgl-trc.h"
+
+
+xgl::gpu_tracer::gpu_tracer(size_t size) :
+    _size(size), _head(0), _count(0), _calibrated(false), _offset(0)
+{
+}
+
+xgl::gpu_tracer::~gpu_tracer()
+{
+}
+
+void xgl::gpu_tracer::exit_gl()
+{
+    if (_queries.size() > 0) {
+        glDeleteQueries(_queries.size(), &(_queries[0]));
+        _queries.clear();
+    }
+    _head = 0;
+    _count = 0;
+    _open.clear();
+    _calibrated = false;
+}
+
+void xgl::gpu_tracer::begin(const char* name)
+{
+    if (!trc::active() || !GLEW_ARB_timer_query || _count == _size) {
+        _open.push_back(_size);
+        return;
+    }
+    if (_queries.size() == 0) {
+        _queries.resize(2 * _size);
+        _names.resize(_size);
+        _ended.resize(_size);
+        glGenQueries(_queries.size(), &(_queries[0]));
+        assert(xgl::CheckError(HERE));
+    }
+    if (!_calibrated) {
+        GLint64 gpu_now;
+        glGetInteger64v(GL_TIMESTAMP, &gpu_now);
+        _offset = trc::now() - gpu_now / 1000;
+        _calibrated = true;
+    }
+    size_t slot = (_head + _count) % _size;
+    _count++;
+    _names[slot] = name;
+    _ended[slot] = false;
+    glQueryCounter(_queries[2 * slot + 0], GL_TIMESTAMP);
+    assert(xgl::CheckError(HERE));
+    _open.push_back(slot);
+}
+
+void xgl::gpu_tracer::end()
+{
+    assert(_open.size() > 0);
+    size_t slot = _open.back();
+    _open.pop_back();
+    if (slot < _size) {
+        glQueryCounter(_queries[2 * slot + 1], GL_TIMESTAMP);
+        assert(xgl::CheckError(HERE));
+        _ended[slot] = true;
+    }
+}
+
+void xgl::gpu_tracer::collect()
+{
+    while (_count > 0 && _ended[_head]) {
+        GLint available;
+        glGetQueryObjectiv(_queries[2 * _head + 1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            break;
+        GLuint64 gpu_begin, gpu_end;
+        glGetQueryObjectui64v(_queries[2 * _head + 0], GL_QUERY_RESULT, &gpu_begin);
+        glGetQueryObjectui64v(_queries[2 * _head + 1], GL_QUERY_RESULT, &gpu_end);
+        assert(xgl::CheckError(HERE));
+        trc::record(_names[_head], trc::gpu_track,
+                static_cast<long long>(gpu_begin / 1000) + _offset,
+                static_cast<long long>(gpu_end / 1000) + _offset);
+        _head = (_head + 1) % _size;
+        _count--;
+    }
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2013
+ * Computer Graphics Group, University of Siegen, Germany.
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>.
+ * See http://www.cg.informatik.uni-siegen.de/ for contact information.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * GPU spans for tracing (see trc.h).
+ *
+ * A gpu_tracer issues timestamp queries at the beginning and end of each span
+ * and collects the results a few frames later, so that it never waits for
+ * the GPU. Timestamp queries are used instead of GL_TIME_ELAPSED queries
+ * because the latter cannot be nested. Query objects are organized as a ring
+ * of fixed size; spans that do not fit into the ring are dropped.
+ *
+ * A gpu_tracer belongs to one GL context and does nothing while tracing is
+ * not active.
+ */
+
+#ifndef XGL_TRC_H
+#define XGL_TRC_H
+
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "trc.h"
+
+
+namespace xgl
+{
+    class gpu_tracer
+    {
+    private:
+        size_t _size;
+        std::vector<GLuint> _queries;   // two per span
+        std::vector<const char*> _names;
+        std::vector<bool> _ended;
+        size_t _head;                   // oldest span in the ring
+        size_t _count;                  // number of spans in the ring
+        std::vector<size_t> _open;      // stack of unfinished spans
+        bool _calibrated;
+        long long _offset;              // GPU time to trace time, in microseconds
+
+    public:
+        gpu_tracer(size_t size = 4096);
+        ~gpu_tracer();
+
+        // Free GL resources. Must be called while the context is current.
+        void exit_gl();
+
+        void begin(const char* name);
+        void end();
+        // Record all finished spans whose results are available. Call once per frame.
+        void collect();
+    };
+
+    class gpu_trace_scope
+    {
+    private:
+        gpu_tracer& _tracer;
+
+    public:
+        gpu_trace_scope(gpu_tracer& tracer, const char* name) : _tracer(tracer)
+        {
+            _tracer.begin(name);
+        }
+        ~gpu_trace_scope()
+        {
+            _tracer.end();
+        }
+    };
+}
+
+#if ENABLE_TRACING
+# define TRC_GPU_SCOPE(tracer, name) xgl::gpu_trace_scope TRC_CONCAT(_trc_gpu_scope_, __LINE__)(tracer, name)
+# define TRC_GPU_COLLECT(tracer) (tracer).collect()
+#else
+# define TRC_GPU_SCOPE(tracer, name)
+# define TRC_GPU_COLLECT(tracer)
+#endif
+
+#endif